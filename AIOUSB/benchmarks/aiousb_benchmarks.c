@@ -0,0 +1,596 @@
+/**
+ * @file   aiousb_benchmarks.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Throughput of the acquisition hot paths, for tracking from commit to commit
+ *
+ * No hardware is needed. The continuous acquisition runs against a mock
+ * USB-AI16-16A whose bulk reads return at once, and DIO streaming against
+ * a mock USB-DIO-16H, so what is measured is the library itself. Every
+ * benchmark runs batches until --min-time has passed, --repetitions
+ * times over, and reports the median and fastest repetition.
+ *
+ * @verbatim
+shell> ./aiousb_benchmarks [--format json|csv] [--min-time seconds] [--repetitions N] [--filter substring] [--out file] [--list]
+ @endverbatim
+ *
+ * The JSON form carries the library version, so results from different
+ * commits can be kept side by side; "make run_benchmarks" writes it to
+ * benchmark_results.json in the build directory.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <aiousb.h>
+#include "AIOContinuousBuffer.h"
+#include "AIOConversionPlan.h"
+#include "AIOCountsConverter.h"
+#include "AIODeviceTable.h"
+#include "AIOFifo.h"
+#include "USBDevice.h"
+
+#define AI_DEVICE_INDEX         0
+#define DIO_DEVICE_INDEX        1
+#define NUM_CHANNELS            16
+#define BLOCK_COUNTS            ( 64 * 1024 )
+#define ACQUIRE_SCANS           20000
+#define FRAME_POINTS            ( 64 * 1024 )
+#define MAX_REPETITIONS         100
+
+typedef struct benchmark {
+    const char *name;
+    const char *params;
+    const char *unit;                           /**< What the items of items_per_sec are */
+    unsigned arg;
+    AIOCountsConverterKernel kernel;
+    void *(*setup)( const struct benchmark *b );
+    uint64_t (*run)( void *ctx );               /**< One batch, returns the items it processed or 0 on failure */
+    void (*teardown)( void *ctx );
+} Benchmark;
+
+typedef struct benchmark_result {
+    uint64_t iterations;
+    double median_ns;                           /**< Per batch */
+    double min_ns;
+    double items_per_sec;                       /**< At the median */
+} BenchmarkResult;
+
+static double now_seconds( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles( const void *a, const void *b )
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return ( x > y ) - ( x < y );
+}
+
+static unsigned short *synthetic_counts( unsigned n )
+{
+    unsigned short *counts = (unsigned short *)malloc( n * sizeof(unsigned short) );
+    for ( unsigned i = 0; counts && i < n; i ++ )
+        counts[i] = (unsigned short)( i * 2654435761u >> 16 );
+    return counts;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Mock devices                                                               */
+/*----------------------------------------------------------------------------*/
+
+static unsigned char mock_registers[AD_MAX_CONFIG_REGISTERS];
+static unsigned short *mock_counts;
+static USBDevice mock_ai, mock_dio;
+
+/* Keeps the A/D configuration so it reads back as written, and accepts everything else */
+static int mock_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                  uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_ADC_SET_CONFIG || bRequest == AUR_ADC_GET_CONFIG ) {
+        wLength = MIN( wLength, (uint16_t)AD_MAX_CONFIG_REGISTERS );
+        if ( request_type & LIBUSB_ENDPOINT_IN )
+            memcpy( data, mock_registers, wLength );
+        else
+            memcpy( mock_registers, data, wLength );
+    } else if ( request_type & LIBUSB_ENDPOINT_IN ) {
+        memset( data, 0, wLength );
+    }
+    return wLength;
+}
+
+/* A bus that is never the bottleneck: reads are filled from a fixed block of counts */
+static int mock_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                               int *actual_length, unsigned int timeout )
+{
+    if ( endpoint & LIBUSB_ENDPOINT_IN ) {
+        for ( int done = 0; done < length; ) {
+            int n = MIN( length - done, (int)( BLOCK_COUNTS * sizeof(unsigned short) ) );
+            memcpy( data + done, mock_counts, n );
+            done += n;
+        }
+    }
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+static void add_mock_devices( void )
+{
+    int numDevices = 0;
+    USBDevice *mocks[] = { &mock_ai, &mock_dio };
+
+    for ( int i = 0; i < 2; i ++ ) {
+        memset( mocks[i], 0, sizeof(USBDevice) );
+        mocks[i]->usb_control_transfer = mock_control_transfer;
+        mocks[i]->usb_bulk_transfer    = mock_bulk_transfer;
+        mocks[i]->usb_request          = usb_request;
+        mocks[i]->usb_put_config       = USBDevicePutADCConfigBlock;
+        mocks[i]->usb_get_config       = USBDeviceFetchADCConfigBlock;
+    }
+    mock_ai.deviceDesc.idProduct  = USB_AI16_16A;
+    mock_dio.deviceDesc.idProduct = USB_DIO_16H;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16A, &mock_ai );
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_16H, &mock_dio );
+}
+
+static void remove_mock_devices( void )
+{
+    /* The mocks are static, the device table must not free them */
+    deviceTable[AI_DEVICE_INDEX].usb_device = NULL;
+    deviceTable[DIO_DEVICE_INDEX].usb_device = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/* AIOFifo                                                                    */
+/*----------------------------------------------------------------------------*/
+
+typedef struct {
+    unsigned n;
+    AIOFifoCounts *fifo;
+    unsigned short *in, *out;
+} FifoContext;
+
+static void *fifo_setup( const Benchmark *b )
+{
+    FifoContext *ctx = (FifoContext *)calloc( 1, sizeof(FifoContext) );
+    ctx->n    = b->arg;
+    ctx->fifo = NewAIOFifoCounts( BLOCK_COUNTS );
+    ctx->in   = synthetic_counts( b->arg );
+    ctx->out  = (unsigned short *)malloc( b->arg * sizeof(unsigned short) );
+    return ctx;
+}
+
+static uint64_t fifo_run( void *object )
+{
+    FifoContext *ctx = (FifoContext *)object;
+    if ( ctx->fifo->PushN( ctx->fifo, ctx->in, ctx->n ) < 0 )
+        return 0;
+    if ( ctx->fifo->PopN( ctx->fifo, ctx->out, ctx->n ) != (AIORET_TYPE)( ctx->n * sizeof(unsigned short) ) )
+        return 0;
+    return ctx->n;
+}
+
+static void fifo_teardown( void *object )
+{
+    FifoContext *ctx = (FifoContext *)object;
+    DeleteAIOFifoCounts( ctx->fifo );
+    free( ctx->in );
+    free( ctx->out );
+    free( ctx );
+}
+
+/*----------------------------------------------------------------------------*/
+/* AIOCountsConverter                                                         */
+/*----------------------------------------------------------------------------*/
+
+typedef struct {
+    unsigned oversample;
+    AIOCountsConverter *cc;
+    AIOFifoCounts *infifo;
+    AIOFifoVolts *outfifo;
+    unsigned short *counts;
+    double *volts;
+} ConverterContext;
+
+static void *converter_setup( const Benchmark *b )
+{
+    AIOGainRange ranges[NUM_CHANNELS];
+    ConverterContext *ctx = (ConverterContext *)calloc( 1, sizeof(ConverterContext) );
+
+    for ( int i = 0; i < NUM_CHANNELS; i ++ ) {
+        ranges[i].min = -10.0;
+        ranges[i].max = 10.0;
+    }
+    ctx->oversample = b->arg;
+    ctx->cc      = NewAIOCountsConverter( NUM_CHANNELS, ranges, b->arg, sizeof(unsigned short) );
+    ctx->infifo  = NewAIOFifoCounts( BLOCK_COUNTS );
+    ctx->outfifo = NewAIOFifoVolts( BLOCK_COUNTS );
+    ctx->counts  = synthetic_counts( BLOCK_COUNTS );
+    ctx->volts   = (double *)malloc( BLOCK_COUNTS * sizeof(double) );
+    if ( !ctx->cc || AIOCountsConverterSetKernel( ctx->cc, b->kernel ) != AIOUSB_SUCCESS ) {
+        if ( ctx->cc )
+            DeleteAIOCountsConverter( ctx->cc );
+        DeleteAIOFifoCounts( ctx->infifo );
+        DeleteAIOFifoVolts( ctx->outfifo );
+        free( ctx->counts );
+        free( ctx->volts );
+        free( ctx );
+        return NULL;
+    }
+    return ctx;
+}
+
+/* Convert() averages in place on a plain buffer, a block of whole scans at a time */
+static uint64_t converter_convert_run( void *object )
+{
+    ConverterContext *ctx = (ConverterContext *)object;
+    unsigned scan_counts = NUM_CHANNELS * ( ctx->oversample + 1 );
+    unsigned n = ( BLOCK_COUNTS / scan_counts ) * scan_counts;
+
+    if ( AIOCountsConverterConvert( ctx->cc, ctx->volts, ctx->counts, n * sizeof(unsigned short) ) < 0 )
+        return 0;
+    return n;
+}
+
+/* ConvertFifo() the way the continuous worker calls it */
+static uint64_t converter_fifo_run( void *object )
+{
+    ConverterContext *ctx = (ConverterContext *)object;
+    AIORET_TYPE nvolts;
+
+    ctx->infifo->PushN( ctx->infifo, ctx->counts, BLOCK_COUNTS );
+    nvolts = ctx->cc->ConvertFifo( ctx->cc, ctx->outfifo, ctx->infifo, BLOCK_COUNTS );
+    if ( nvolts < 0 )
+        return 0;
+    ctx->outfifo->PopN( ctx->outfifo, ctx->volts, (unsigned)nvolts );
+    return BLOCK_COUNTS;
+}
+
+static void converter_teardown( void *object )
+{
+    ConverterContext *ctx = (ConverterContext *)object;
+    DeleteAIOCountsConverter( ctx->cc );
+    DeleteAIOFifoCounts( ctx->infifo );
+    DeleteAIOFifoVolts( ctx->outfifo );
+    free( ctx->counts );
+    free( ctx->volts );
+    free( ctx );
+}
+
+/*----------------------------------------------------------------------------*/
+/* Counts to volts through the device's conversion plan                      */
+/*----------------------------------------------------------------------------*/
+
+typedef struct {
+    AIOConversionPlan *plan;
+    unsigned short *counts;
+    double *volts;
+} PlanContext;
+
+static void *plan_setup( const Benchmark *b )
+{
+    PlanContext *ctx = (PlanContext *)calloc( 1, sizeof(PlanContext) );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AI_DEVICE_INDEX, NULL );
+    AIORET_TYPE result;
+
+    ADCConfigBlockSetAllGainCodeAndDiffMode( AIOUSBDeviceGetADCConfigBlock( dev ), AD_GAIN_CODE_10V, AIOUSB_FALSE );
+    AIOUSBDeviceSetConversionLUT( dev, b->arg ? AIOUSB_TRUE : AIOUSB_FALSE );
+    ctx->plan   = AIOUSBDeviceGetConversionPlan( dev, &result );
+    ctx->counts = synthetic_counts( BLOCK_COUNTS );
+    ctx->volts  = (double *)malloc( BLOCK_COUNTS * sizeof(double) );
+    if ( !ctx->plan ) {
+        free( ctx->counts );
+        free( ctx->volts );
+        free( ctx );
+        return NULL;
+    }
+    return ctx;
+}
+
+static uint64_t plan_run( void *object )
+{
+    PlanContext *ctx = (PlanContext *)object;
+    for ( unsigned i = 0; i < BLOCK_COUNTS; i += NUM_CHANNELS ) {
+        if ( AIOConversionPlanCountsToVolts( ctx->plan, 0, NUM_CHANNELS, &ctx->counts[i], &ctx->volts[i] ) != AIOUSB_SUCCESS )
+            return 0;
+    }
+    return BLOCK_COUNTS;
+}
+
+static void plan_teardown( void *object )
+{
+    PlanContext *ctx = (PlanContext *)object;
+    AIOUSBDeviceReleaseConversionPlan( AIODeviceTableGetDeviceAtIndex( AI_DEVICE_INDEX, NULL ), ctx->plan );
+    free( ctx->counts );
+    free( ctx->volts );
+    free( ctx );
+}
+
+/*----------------------------------------------------------------------------*/
+/* AIOContinuousBuf end to end                                                */
+/*----------------------------------------------------------------------------*/
+
+typedef struct {
+    unsigned num_scans;
+    unsigned short *counts;
+} ContinuousContext;
+
+static void *continuous_setup( const Benchmark *b )
+{
+    ContinuousContext *ctx = (ContinuousContext *)calloc( 1, sizeof(ContinuousContext) );
+    ctx->num_scans = b->arg;
+    ctx->counts = (unsigned short *)malloc( b->arg * NUM_CHANNELS * sizeof(unsigned short) );
+    return ctx;
+}
+
+/* Configures, starts, drains and ends a whole acquisition of num_scans */
+static uint64_t continuous_run( void *object )
+{
+    ContinuousContext *ctx = (ContinuousContext *)object;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( AI_DEVICE_INDEX, ctx->num_scans, NUM_CHANNELS );
+    uint64_t read = 0;
+
+    if ( !buf )
+        return 0;
+
+    AIOContinuousBufInitConfiguration( buf );
+    AIOContinuousBufSetOversample( buf, 0 );
+    AIOContinuousBufSetStartAndEndChannel( buf, 0, NUM_CHANNELS - 1 );
+    AIOContinuousBufSetAllGainCodeAndDiffMode( buf, AD_GAIN_CODE_0_10V, AIOUSB_FALSE );
+    AIOContinuousBufSaveConfig( buf );
+    AIOContinuousBufSetClock( buf, 100000 );
+    AIOContinuousBufInitiateCallbackAcquisition( buf );
+
+    while ( read < ctx->num_scans ) {
+        AIORET_TYPE available = AIOContinuousBufCountScansAvailable( buf );
+        if ( available <= 0 ) {
+            if ( !( AIOContinuousBufGetRunStatus( buf ) & RUNNING ) )
+                break;
+            AIOContinuousBufWaitForSamples( buf, NUM_CHANNELS, 100 );
+            continue;
+        }
+        AIORET_TYPE scans = AIOContinuousBufReadIntegerScanCounts( buf, ctx->counts, ctx->num_scans * NUM_CHANNELS,
+                                                                   MIN( available, (AIORET_TYPE)( ctx->num_scans - read ) ) * NUM_CHANNELS );
+        if ( scans < 0 )
+            break;
+        read += scans;
+    }
+
+    AIOContinuousBufEnd( buf );
+    DeleteAIOContinuousBuf( buf );
+    return ( read >= ctx->num_scans ? read : 0 );
+}
+
+static void continuous_teardown( void *object )
+{
+    ContinuousContext *ctx = (ContinuousContext *)object;
+    free( ctx->counts );
+    free( ctx );
+}
+
+/*----------------------------------------------------------------------------*/
+/* DIO_StreamFrame                                                            */
+/*----------------------------------------------------------------------------*/
+
+typedef struct {
+    unsigned short *frame;
+} StreamContext;
+
+static void *stream_setup( const Benchmark *b )
+{
+    StreamContext *ctx = (StreamContext *)calloc( 1, sizeof(StreamContext) );
+    ctx->frame = synthetic_counts( FRAME_POINTS );
+    if ( DIO_StreamOpen( DIO_DEVICE_INDEX, b->arg ) != AIOUSB_SUCCESS ) {
+        free( ctx->frame );
+        free( ctx );
+        return NULL;
+    }
+    return ctx;
+}
+
+static uint64_t stream_run( void *object )
+{
+    StreamContext *ctx = (StreamContext *)object;
+    unsigned long bytes = 0;
+
+    if ( DIO_StreamFrame( DIO_DEVICE_INDEX, FRAME_POINTS, ctx->frame, &bytes ) != AIOUSB_SUCCESS )
+        return 0;
+    return bytes;
+}
+
+static void stream_teardown( void *object )
+{
+    StreamContext *ctx = (StreamContext *)object;
+    DIO_StreamClose( DIO_DEVICE_INDEX );
+    free( ctx->frame );
+    free( ctx );
+}
+
+/*----------------------------------------------------------------------------*/
+
+static const Benchmark benchmarks[] = {
+    { "fifo_pushn_popn", "counts=256", "samples", 256, AIO_CC_KERNEL_AUTO, fifo_setup, fifo_run, fifo_teardown },
+    { "fifo_pushn_popn", "counts=4096", "samples", 4096, AIO_CC_KERNEL_AUTO, fifo_setup, fifo_run, fifo_teardown },
+    { "counts_converter_convert", "channels=16,oversample=3", "samples", 3, AIO_CC_KERNEL_AUTO, converter_setup, converter_convert_run, converter_teardown },
+    { "counts_converter_convert_fifo", "channels=16,oversample=0,kernel=per_sample", "samples", 0, AIO_CC_KERNEL_PER_SAMPLE, converter_setup, converter_fifo_run, converter_teardown },
+    { "counts_converter_convert_fifo", "channels=16,oversample=0,kernel=auto", "samples", 0, AIO_CC_KERNEL_AUTO, converter_setup, converter_fifo_run, converter_teardown },
+    { "counts_converter_convert_fifo", "channels=16,oversample=3,kernel=auto", "samples", 3, AIO_CC_KERNEL_AUTO, converter_setup, converter_fifo_run, converter_teardown },
+    { "counts_to_volts", "plan=formula", "samples", 0, AIO_CC_KERNEL_AUTO, plan_setup, plan_run, plan_teardown },
+    { "counts_to_volts", "plan=lut", "samples", 1, AIO_CC_KERNEL_AUTO, plan_setup, plan_run, plan_teardown },
+    { "continuous_buf_acquire", "channels=16,scans=20000", "scans", ACQUIRE_SCANS, AIO_CC_KERNEL_AUTO, continuous_setup, continuous_run, continuous_teardown },
+    { "dio_stream_frame", "direction=read,points=65536", "bytes", 1, AIO_CC_KERNEL_AUTO, stream_setup, stream_run, stream_teardown },
+    { "dio_stream_frame", "direction=write,points=65536", "bytes", 0, AIO_CC_KERNEL_AUTO, stream_setup, stream_run, stream_teardown },
+};
+
+/**
+ * @return 0 on success, -1 if the benchmark could not be set up or a batch failed
+ */
+static int run_benchmark( const Benchmark *b, double min_time, int repetitions, BenchmarkResult *result )
+{
+    double per_batch[MAX_REPETITIONS], items_per_batch[MAX_REPETITIONS];
+    void *ctx = b->setup( b );
+    uint64_t batches = 1;
+
+    if ( !ctx )
+        return -1;
+    memset( result, 0, sizeof(*result) );
+
+    /* Warm up, and size a repetition to take about min_time */
+    double start = now_seconds();
+    if ( !b->run( ctx ) ) {
+        b->teardown( ctx );
+        return -1;
+    }
+    double once = now_seconds() - start;
+    if ( once > 0 && once < min_time )
+        batches = (uint64_t)( min_time / once ) + 1;
+
+    for ( int r = 0; r < repetitions; r ++ ) {
+        uint64_t items = 0;
+        start = now_seconds();
+        for ( uint64_t i = 0; i < batches; i ++ ) {
+            uint64_t n = b->run( ctx );
+            if ( !n ) {
+                b->teardown( ctx );
+                return -1;
+            }
+            items += n;
+        }
+        double elapsed = now_seconds() - start;
+        per_batch[r] = elapsed * 1e9 / batches;
+        items_per_batch[r] = (double)items / batches;
+        result->iterations += batches;
+    }
+    b->teardown( ctx );
+
+    double items = items_per_batch[0];
+    qsort( per_batch, repetitions, sizeof(double), compare_doubles );
+    result->median_ns = per_batch[repetitions / 2];
+    result->min_ns = per_batch[0];
+    result->items_per_sec = ( result->median_ns > 0 ? items * 1e9 / result->median_ns : 0 );
+    return 0;
+}
+
+static void usage( const char *prog )
+{
+    fprintf(stderr,"Usage: %s [--format json|csv] [--min-time seconds] [--repetitions N] [--filter substring] [--out file] [--list]\n", prog );
+}
+
+int main( int argc, char *argv[] )
+{
+    static struct option options[] = {
+        { "format",      required_argument, 0, 'f' },
+        { "min-time",    required_argument, 0, 't' },
+        { "repetitions", required_argument, 0, 'r' },
+        { "filter",      required_argument, 0, 'F' },
+        { "out",         required_argument, 0, 'o' },
+        { "list",        no_argument,       0, 'l' },
+        { "help",        no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    const char *filter = NULL, *outname = NULL;
+    double min_time = 0.5;
+    int repetitions = 5, json = 1, list = 0, failed = 0, first = 1, c;
+    FILE *out = stdout;
+    char host[256] = "";
+
+    while ( ( c = getopt_long( argc, argv, "f:t:r:F:o:lh", options, NULL ) ) != -1 ) {
+        switch ( c ) {
+        case 'f':
+            if ( strcmp( optarg, "json" ) && strcmp( optarg, "csv" ) ) {
+                usage( argv[0] );
+                return 1;
+            }
+            json = ( strcmp( optarg, "json" ) == 0 );
+            break;
+        case 't':
+            min_time = atof( optarg );
+            break;
+        case 'r':
+            repetitions = atoi( optarg );
+            break;
+        case 'F':
+            filter = optarg;
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'l':
+            list = 1;
+            break;
+        default:
+            usage( argv[0] );
+            return ( c == 'h' ? 0 : 1 );
+        }
+    }
+    if ( repetitions < 1 || repetitions > MAX_REPETITIONS || min_time < 0 ) {
+        fprintf(stderr,"repetitions must be between 1 and %d and min-time positive\n", MAX_REPETITIONS );
+        return 1;
+    }
+    if ( list ) {
+        for ( size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i ++ )
+            printf("%s/%s\n", benchmarks[i].name, benchmarks[i].params );
+        return 0;
+    }
+    if ( outname && !( out = fopen( outname, "w" ) ) ) {
+        perror( outname );
+        return 1;
+    }
+
+    mock_counts = synthetic_counts( BLOCK_COUNTS );
+    add_mock_devices();
+    gethostname( host, sizeof(host) - 1 );
+
+    if ( json ) {
+        fprintf(out,"{\n  \"library_version\": \"%s\",\n  \"library_date\": \"%s\",\n  \"host\": \"%s\",\n"
+                "  \"timestamp\": %ld,\n  \"min_time\": %g,\n  \"repetitions\": %d,\n  \"benchmarks\": [",
+                AIOUSB_GetVersion(), AIOUSB_GetVersionDate(), host, (long)time( NULL ), min_time, repetitions );
+    } else {
+        fprintf(out,"name,params,unit,iterations,median_ns,min_ns,items_per_sec\n");
+    }
+
+    for ( size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i ++ ) {
+        const Benchmark *b = &benchmarks[i];
+        BenchmarkResult result;
+        char full_name[128];
+
+        snprintf( full_name, sizeof(full_name), "%s/%s", b->name, b->params );
+        if ( filter && !strstr( full_name, filter ) )
+            continue;
+        if ( run_benchmark( b, min_time, repetitions, &result ) < 0 ) {
+            fprintf(stderr,"%s failed\n", full_name );
+            failed ++;
+            continue;
+        }
+
+        if ( json ) {
+            fprintf(out,"%s\n    { \"name\": \"%s\", \"params\": \"%s\", \"unit\": \"%s\", \"iterations\": %llu, "
+                    "\"median_ns\": %.1f, \"min_ns\": %.1f, \"items_per_sec\": %.0f }",
+                    ( first ? "" : "," ), b->name, b->params, b->unit, (unsigned long long)result.iterations,
+                    result.median_ns, result.min_ns, result.items_per_sec );
+        } else {
+            fprintf(out,"%s,\"%s\",%s,%llu,%.1f,%.1f,%.0f\n", b->name, b->params, b->unit,
+                    (unsigned long long)result.iterations, result.median_ns, result.min_ns, result.items_per_sec );
+        }
+        first = 0;
+        fflush( out );
+    }
+
+    if ( json )
+        fprintf(out,"\n  ]\n}\n");
+    if ( out != stdout )
+        fclose( out );
+
+    remove_mock_devices();
+    free( mock_counts );
+    return ( failed ? 1 : 0 );
+}
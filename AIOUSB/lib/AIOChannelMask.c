@@ -7,6 +7,44 @@
 namespace AIOUSB {
 #endif
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ * @brief Number of 64 bit words needed for number_channels
+ */
+static unsigned _aiochannelmask_words( unsigned number_channels )
+{
+    return ( number_channels + 63 ) / 64;
+}
+
+/**
+ * @brief Byte index of the mask, byte 0 holding channels 0-7
+ */
+static unsigned char _aiochannelmask_byte( AIOChannelMask *obj, unsigned index )
+{
+    return (unsigned char)( obj->bits[index/8] >> ( ( index % 8 )*BITS_PER_BYTE ) );
+}
+
+static int _aiochannelmask_bit( AIOChannelMask *obj, unsigned channel )
+{
+    return (int)( ( obj->bits[channel/64] >> ( channel % 64 ) ) & 1 );
+}
+
+/**
+ * @brief Clears the bits past number_signals and recounts the mask. Every
+ * setter ends here, so the count never goes stale.
+ */
+static void _aiochannelmask_sync( AIOChannelMask *obj )
+{
+    unsigned words = _aiochannelmask_words( obj->number_signals );
+    unsigned active = 0;
+    if ( obj->number_signals % 64 )
+        obj->bits[words-1] &= ( (uint64_t)1 << ( obj->number_signals % 64 ) ) - 1;
+    for ( unsigned w = 0; w < words; w ++ )
+        active += __builtin_popcountll( obj->bits[w] );
+    obj->active_signals = active;
+} /** @endcond */
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Constructor AIOChannelMask bit mask object
@@ -14,25 +52,18 @@ namespace AIOUSB {
  */
 AIOChannelMask * NewAIOChannelMask( unsigned number_channels ) {
     AIOChannelMask *tmp = (AIOChannelMask *)malloc(sizeof(AIOChannelMask ));
-    unsigned i;
     if( !tmp ) {
         goto out_NewAIOChannelMask;
     }
     tmp->size = ((number_channels+BITS_PER_BYTE-1)/BITS_PER_BYTE); /* Ceil function */
 
-    tmp->signals = (aio_channel_obj *)calloc(sizeof(aio_channel_obj), ( tmp->size + 1) );
-    if( !tmp->signals ) 
+    tmp->bits = (uint64_t *)calloc( sizeof(uint64_t), _aiochannelmask_words( number_channels ) + 1 );
+    if( !tmp->bits ) 
         goto out_cleansignals;
     tmp->strrep          = 0;
     tmp->strrepsmall     = 0;
     tmp->number_signals  = number_channels;
     tmp->active_signals  = 0;
-
-    tmp->signal_indices = (int*)malloc(sizeof(int)*(number_channels+1) );
-    tmp->signal_index = 0;
-    for ( i = 0; i < number_channels + 1 ; i ++ ) {
-        tmp->signal_indices[i] = -1;
-    }
  out_NewAIOChannelMask:
     return tmp;
  out_cleansignals:
@@ -50,22 +81,20 @@ void DeleteAIOChannelMask( AIOChannelMask *mask ) {
         free(mask->strrep);
     if( mask->strrepsmall )
         free( mask->strrepsmall );
-    free(mask->signal_indices );
-    free(mask->signals);
+    free(mask->bits);
     free(mask);
 }
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Returns an interator to the indices that are valid high ( 1).
+ * pos holds the last channel returned, so the iteration always follows
+ * the current mask.
  */
 AIORET_TYPE AIOChannelMaskIndices( AIOChannelMask *mask , int *pos ) {
-    AIORET_TYPE retval;
     if ( !mask || !pos )
         return -AIOUSB_ERROR_INVALID_DATA;
-    *pos = 0;
-    retval = mask->signal_indices[*pos];
-    *pos +=1;
-    return retval;
+    *pos = (int)AIOChannelMaskNextActive( mask, -1 );
+    return *pos;
 }
 /*----------------------------------------------------------------------------*/
 /**
@@ -73,14 +102,54 @@ AIORET_TYPE AIOChannelMaskIndices( AIOChannelMask *mask , int *pos ) {
  * the mask has a 1. 
  */
 AIORET_TYPE AIOChannelMaskNextIndex( AIOChannelMask *mask , int *pos ) {
-    int retval;
-    if ( *pos >= (int)mask->number_signals ) {
-        retval = *pos = -1;
-    } else {
-        retval = mask->signal_indices[*pos];
-        *pos +=1 ;
+    if ( !mask || !pos )
+        return -AIOUSB_ERROR_INVALID_DATA;
+    if ( *pos >= 0 )
+        *pos = (int)AIOChannelMaskNextActive( mask, *pos );
+    return *pos;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Finds the first channel after channel that is set, a word of the
+ *        mask at a time. Start with -1 to get the lowest one, so
+ *        for ( ch = AIOChannelMaskNextActive( mask, -1 ); ch >= 0; ch = AIOChannelMaskNextActive( mask, ch ) )
+ *        visits only the active channels whatever the width of the mask.
+ * @param obj 
+ * @param channel Last channel visited
+ * @return Next active channel, or -1 when there are no more
+ */
+AIORET_TYPE AIOChannelMaskNextActive( AIOChannelMask *obj, int channel ) {
+    if ( !obj )
+        return -AIOUSB_ERROR_INVALID_DATA;
+    unsigned ch = ( channel < 0 ? 0 : (unsigned)channel + 1 );
+
+    for ( ; ch < obj->number_signals; ch = ( ch | 63 ) + 1 ) {
+        uint64_t word = obj->bits[ch/64] >> ( ch % 64 );
+        if ( word )
+            return ch + __builtin_ctzll( word );
     }
-    return retval;
+    return -1;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Writes the active channels, lowest first, into indices. The table
+ *        lets a caller pick channels out of every scan without testing the
+ *        mask for each sample.
+ * @param obj 
+ * @param indices Table to fill
+ * @param maxindices Room in indices
+ * @return Number of channels written
+ */
+AIORET_TYPE AIOChannelMaskActiveIndices( AIOChannelMask *obj, int *indices, unsigned maxindices ) {
+    unsigned n = 0;
+    if ( !obj || !indices )
+        return -AIOUSB_ERROR_INVALID_DATA;
+
+    for ( unsigned w = 0; w < _aiochannelmask_words( obj->number_signals ); w ++ ) {
+        for ( uint64_t word = obj->bits[w]; word && n < maxindices; word &= word - 1 )
+            indices[n++] = w*64 + __builtin_ctzll( word );
+    }
+    return n;
 }
 /*----------------------------------------------------------------------------*/
 /**
@@ -88,36 +157,29 @@ AIORET_TYPE AIOChannelMaskNextIndex( AIOChannelMask *mask , int *pos ) {
  * 
  */
 AIORET_TYPE AIOChannelMaskSetMaskFromInt( AIOChannelMask *obj, unsigned field ) {
-    int i;
     AIORET_TYPE ret = AIOUSB_SUCCESS;  
     if ( obj->size <  (int)( sizeof(field) / sizeof(aio_channel_obj )) ) {
         return -AIOUSB_ERROR_INVALID_PARAMETER;
     }
-    obj->signal_index = 0;
-    for ( i = 0; i < obj->size ; i ++ ) {
-      char curfield = *(((char *)&field)+i);
-      obj->signals[(obj->size-1-i)] = curfield;
-      for( int j = 0; j < BITS_PER_BYTE; j ++ ) {
-         if( ( 1 << j ) & curfield ? 1 : 0 ) { 
-           obj->active_signals ++;
-           obj->signal_indices[obj->signal_index++] = (i*BITS_PER_BYTE) + j;
-         }
-      }
-    }
+    memset( obj->bits, 0, sizeof(uint64_t)*_aiochannelmask_words( obj->number_signals ) );
+    obj->bits[0] = field;
+    _aiochannelmask_sync( obj );
     return ret;
 }
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Sets the Bit Mask at specified index to the values contained in 
- * field
+ * field. Index 0 is channels 0-7.
  */
 AIORET_TYPE AIOChannelMaskSetMaskAtIndex( AIOChannelMask *obj, char field, unsigned index  )
 {
     if ( index >= (unsigned)obj->size )
         return -AIOUSB_ERROR_INVALID_INDEX;
     
-
-    obj->signals[obj->size-index-1] = field;
+    unsigned shift = ( index % 8 )*BITS_PER_BYTE;
+    obj->bits[index/8] &= ~( (uint64_t)0xff << shift );
+    obj->bits[index/8] |= (uint64_t)(unsigned char)field << shift;
+    _aiochannelmask_sync( obj );
     return AIOUSB_SUCCESS;
 }
 /*----------------------------------------------------------------------------*/
@@ -131,7 +193,7 @@ AIORET_TYPE AIOChannelMaskGetMaskAtIndex( AIOChannelMask *obj , char *tmp , unsi
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     if( index >= (unsigned)obj->size )
         return -AIOUSB_ERROR_INVALID_INDEX;
-    *tmp = obj->signals[obj->size-1-index];
+    *tmp = (char)_aiochannelmask_byte( obj, index );
     return retval;
 }
 /*----------------------------------------------------------------------------*/
@@ -163,32 +225,23 @@ AIORET_TYPE AIOChannelMaskNumberSignals( AIOChannelMask *obj ) {
  */
 
 AIORET_TYPE AIOChannelMaskSetMaskFromStr( AIOChannelMask *obj, const char *bitfields ) {
-    AIORET_TYPE ret = AIOUSB_SUCCESS;
-    unsigned j;
-    aio_channel_obj tmpval = 0;
-    int number_channels = strlen(bitfields);
-    obj->signal_index = 0;
+    unsigned number_channels = strlen(bitfields);
+    unsigned words = _aiochannelmask_words( number_channels ) + 1;
+    uint64_t *bits = (uint64_t *)realloc( obj->bits, sizeof(uint64_t)*words );
+    if ( !bits )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    obj->bits = bits;
     obj->number_signals  = number_channels;
-    obj->signals = (char*)realloc( obj->signals, strlen(bitfields)*sizeof(char));
-    obj->signal_indices = (int*)realloc( obj->signal_indices, sizeof(int)*(strlen(bitfields)) );
-    obj->size = (strlen(bitfields) + BITS_PER_BYTE-1 ) / BITS_PER_BYTE ;
-    memset(obj->signals,0,obj->size);
-    int index = obj->size-1;
-    for( int i = strlen(bitfields) , shiftval = 0; i > 0 ; i -- , shiftval = (shiftval + 1)%BITS_PER_BYTE ) {
-        j = strlen(bitfields)-i;
-        if( bitfields[i-1] == '1' ) {
-            tmpval |= 1 << shiftval;
-            obj->active_signals ++;
-            obj->signal_indices[obj->signal_index++] = j;
-        }
-        if ( j > 0 && (( (j+1) % BITS_PER_BYTE) == 0)  ) {
-            obj->signals[index--] = tmpval;
-            tmpval = 0;
-        }
+    obj->size = ( number_channels + BITS_PER_BYTE-1 ) / BITS_PER_BYTE ;
+    memset( obj->bits, 0, sizeof(uint64_t)*words );
+    for ( unsigned ch = 0; ch < number_channels; ch ++ ) {
+        if ( bitfields[number_channels-1-ch] == '1' )
+            obj->bits[ch/64] |= (uint64_t)1 << ( ch % 64 );
     }
-    obj->signals[index] = tmpval;
+    _aiochannelmask_sync( obj );
 
-    return ret;
+    return AIOUSB_SUCCESS;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -219,32 +272,18 @@ AIOChannelMask *NewAIOChannelMaskFromChr( const char bits )
 
 /*----------------------------------------------------------------------------*/
 /**
- * @brief Returns a string representation for the AIOChannel Bit mask in question
+ * @brief Returns a string representation for the AIOChannel Bit mask in question,
+ * highest channel first
  * @param obj AIOChannelMask to convert to string form
  */
 char *AIOChannelMaskToString( AIOChannelMask *obj ) {
-     if( obj->strrep ) {
-         free(obj->strrep);
-     }
-     obj->strrep = (char *)malloc( obj->number_signals+1*sizeof(char) );
-     memset(obj->strrep,0,obj->number_signals+1);
-     char *retval = obj->strrep;
-     int i, j, pos, startpos;
-     pos = 0;
-     for ( i = 0;  i < obj->size; i ++ ) {
-         /** @todo Check for the case where we have say 17 signals( non-integer multiple of 
-          * BITS_PER_BYTE 
-          */
-         if ( i == 0 && (obj->number_signals % BITS_PER_BYTE != 0) ) {
-             startpos = (( obj->number_signals % BITS_PER_BYTE ) - 1);
-         } else {
-             startpos = BITS_PER_BYTE-1;
-         }
-         for ( j = startpos ; j >= 0 && pos < (int)obj->number_signals ; j -- ) { 
-             retval[pos] = ((( 1 << j ) & ( obj->signals[i] )) ? '1' : '0');
-             pos ++;
-         }
-     }
+     char *retval = (char *)realloc( obj->strrep, obj->number_signals+1 );
+     if ( !retval )
+         return NULL;
+     obj->strrep = retval;
+     for ( unsigned pos = 0; pos < obj->number_signals; pos ++ )
+         retval[pos] = ( _aiochannelmask_bit( obj, obj->number_signals-1-pos ) ? '1' : '0' );
+     retval[obj->number_signals] = '\0';
 
      return retval;
  }
@@ -259,37 +298,40 @@ char *AIOChannelMaskToStringAtIndex( AIOChannelMask *obj, unsigned index ) {
     if ( index >= (unsigned)obj->size ) {
         return NULL;
     }
-    obj->strrepsmall = (char *)realloc( obj->strrepsmall, obj->number_signals+1 );
-    memset(obj->strrepsmall,0,obj->number_signals+1);
-    char *retval = obj->strrepsmall;
-    int i, j, pos, startpos;
+    char *retval = (char *)realloc( obj->strrepsmall, BITS_PER_BYTE+1 );
+    if ( !retval )
+        return NULL;
+    obj->strrepsmall = retval;
+    unsigned char byte = _aiochannelmask_byte( obj, index );
+    int j, pos, startpos;
     pos = 0;
 
-    i = ( obj->size - index - 1 );
-        /**
-         * @note Check for the case where we have say 17 signals( non-integer multiple of 
-         * BITS_PER_BYTE 
-         */
-    if ( i == 0 && (obj->number_signals % BITS_PER_BYTE != 0) ) {
+    /**
+     * @note The top byte only shows the channels that exist, say 1 for 17 signals
+     */
+    if ( index == (unsigned)obj->size-1 && (obj->number_signals % BITS_PER_BYTE != 0) ) {
         startpos = (( obj->number_signals % BITS_PER_BYTE ) - 1);
     } else {
         startpos = BITS_PER_BYTE-1;
     }
     for ( j = startpos ; j >= 0 ; j -- ) { 
-        retval[pos] = ((( 1 << j ) & ( obj->signals[i] )) ? '1' : '0');
+        retval[pos] = ((( 1 << j ) & byte ) ? '1' : '0');
         pos ++;
     }
+    retval[pos] = '\0';
     return retval;
 }
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Returns the mask as bytes, highest channels first. The caller frees it.
+ */
 char *AIOChannelMaskGetMask( AIOChannelMask *obj ) {
     char *tmp = (char *)malloc(obj->size+1);
     if ( tmp ) {
-        memset(tmp,0,obj->size+1);
-        /* memcpy(tmp,obj->signals,obj->size); */
         for ( int i = 0; i < obj->size ; i ++ ) 
-            tmp[i] = obj->signals[i];
+            tmp[i] = (char)_aiochannelmask_byte( obj, obj->size-1-i );
+        tmp[obj->size] = '\0';
     }
     return tmp;
 }
@@ -311,7 +353,7 @@ using namespace AIOUSB;
 
 TEST(AIOChannelMask, Channel_Mask_from_int ) {
     int expected[] = {0,1,3,7,30};
-    int received[4] = {0};
+    int received[5] = {0};
     int i,j,pos;
     AIOChannelMask *mask = NewAIOChannelMask( 32 );
     AIOChannelMaskSetMaskFromInt( mask , 1 | 2 | 1 << 3 | 1 << 7 | 1 << 30 );
@@ -325,13 +367,14 @@ TEST(AIOChannelMask, Channel_Mask_from_int ) {
         EXPECT_EQ( expected[pos], received[pos] );
         pos ++;
     }
+    EXPECT_EQ( 5, pos );
     DeleteAIOChannelMask( mask );
 }
 
 TEST(AIOChannelMask, Channel_Mask_From_String ) {
     int expected[] = {0,1,3,7,30};
-    int expected_long[] = {0,1,3,7,30,32,33,35,39,62};
-    int received[4] = {0};
+    int expected_long[] = {0,1,3,7,20,21,22,23,30,32,33,35,39,62};
+    int received[14] = {0};
     int i,j,pos;
     char tmpmask;
     AIOChannelMask *mask = NewAIOChannelMaskFromStr( "0100000000000000000000001000101101000000000000000000000010001011" );
@@ -346,7 +389,9 @@ TEST(AIOChannelMask, Channel_Mask_From_String ) {
     EXPECT_EQ( 0xff, (unsigned char)tmpmask );
     AIOChannelMaskSetMaskAtIndex( mask, 0xf0, 2 );
     EXPECT_STREQ( "11110000" , AIOChannelMaskToStringAtIndex(mask, 2 ));
+    EXPECT_EQ( 14, AIOChannelMaskNumberChannels( mask ) );
 
+    /* The indices follow the byte that was just set */
     pos = 0;
     j = 0;
     for ( i = AIOChannelMaskIndices( mask, &j ); i >= 0 ; i = AIOChannelMaskNextIndex( mask, &j )) { 
@@ -354,6 +399,7 @@ TEST(AIOChannelMask, Channel_Mask_From_String ) {
         EXPECT_EQ( expected_long[pos], received[pos] );
         pos ++;
     }
+    EXPECT_EQ( 14, pos );
     DeleteAIOChannelMask( mask );
 
 }
@@ -429,6 +475,52 @@ TEST(AIOChannelMask, NewChannelMaskFromChar ) {
     DeleteAIOChannelMask( mask );
 }
 
+TEST(AIOChannelMask, ActiveChannelsComeFromTheBits ) {
+    char signals[137];
+    int expected[] = {0,5,63,64,99};
+    int indices[8];
+    int i, ch;
+    memset( signals, '0', 100 );
+    signals[100] = '\0';
+    for ( i = 0; i < 5; i ++ )
+        signals[99-expected[i]] = '1';
+    AIOChannelMask *mask = NewAIOChannelMaskFromStr( signals );
+    EXPECT_EQ( 5, AIOChannelMaskNumberChannels( mask ));
+
+    i = 0;
+    for ( ch = AIOChannelMaskNextActive( mask, -1 ); ch >= 0; ch = AIOChannelMaskNextActive( mask, ch ) )
+        EXPECT_EQ( expected[i++], ch );
+    EXPECT_EQ( 5, i );
+
+    ASSERT_EQ( 3, AIOChannelMaskActiveIndices( mask, indices, 3 ));
+    EXPECT_EQ( 63, indices[2] );
+
+    AIOChannelMaskSetMaskAtIndex( mask, 0x01, 1 );
+    EXPECT_EQ( 6, AIOChannelMaskNumberChannels( mask ));
+    EXPECT_EQ( 8, AIOChannelMaskNextActive( mask, 5 ));
+    DeleteAIOChannelMask( mask );
+
+    /* Masks wider than two words */
+    memset( signals, '0', 136 );
+    signals[136] = '\0';
+    signals[135-3] = '1';
+    signals[135-130] = '1';
+    mask = NewAIOChannelMaskFromStr( signals );
+    EXPECT_EQ( 2, AIOChannelMaskNumberChannels( mask ));
+    EXPECT_EQ( 130, AIOChannelMaskNextActive( mask, 3 ));
+    EXPECT_EQ( -1, AIOChannelMaskNextActive( mask, 130 ));
+    ASSERT_EQ( 2, AIOChannelMaskActiveIndices( mask, indices, 8 ));
+    EXPECT_EQ( 130, indices[1] );
+    DeleteAIOChannelMask( mask );
+
+    /* Setting the whole mask again replaces the count */
+    mask = NewAIOChannelMask( 32 );
+    AIOChannelMaskSetMaskFromInt( mask, 0xf );
+    AIOChannelMaskSetMaskFromInt( mask, 0x3 );
+    EXPECT_EQ( 2, AIOChannelMaskNumberChannels( mask ));
+    DeleteAIOChannelMask( mask );
+}
+
 
 int main(int argc, char *argv[] )
 {
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include <stdint.h>
 
 #ifdef __aiousb_cplusplus
 namespace AIOUSB
@@ -17,13 +18,10 @@ namespace AIOUSB
 
 typedef char aio_channel_obj;
 typedef struct {
-    int *signal_indices;
-    int signal_index;
-    unsigned active_signals;
-    aio_channel_obj *signals;
+    uint64_t *bits;                     /**< Bit n is channel n, the only copy of the mask */
+    unsigned active_signals;            /**< Population count of bits */
     unsigned number_signals;
-    unsigned pos;
-    int size;
+    int size;                           /**< Bytes needed for number_signals */
     char *strrep;
     char *strrepsmall;
 } AIOChannelMask;
@@ -45,6 +43,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskNumberSignals( AIOChannelMask *mask );
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskGetSize( AIOChannelMask *mask );
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskIndices( AIOChannelMask *mask , int *pos);
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskNextIndex( AIOChannelMask *mask , int *pos );
+PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskNextActive( AIOChannelMask *mask, int channel );
+PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskActiveIndices( AIOChannelMask *mask, int *indices, unsigned maxindices );
 
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskSetMaskFromInt( AIOChannelMask *mask, unsigned field );
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskSetMaskAtIndex( AIOChannelMask *mask, char field, unsigned index  );
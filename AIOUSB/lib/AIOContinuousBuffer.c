@@ -25,9 +25,16 @@
 #include "AIODeviceTable.h"
 #include "AIOFifo.h"
 #include "AIOCountsConverter.h"
+#include "AIOConversionPlan.h"
+#include "AIOHistogram.h"
 #include "AIOCmd.h"
 #include "cJSON.h"
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -35,9 +42,11 @@ namespace AIOUSB {
 
 void *ConvertCountsToVoltsFunction( void *object );
 void *RawCountsWorkFunction( void *object );
+void *AIOContinuousBufAsyncWorkFunction( void *object );
 AIORET_TYPE _AIOContinuousBufResizeFifo( AIOContinuousBuf *buf );
 AIORET_TYPE  AIOContinuousBufForceTerminateAcqusitionOverrun( AIOContinuousBuf *buf );
 AIORET_TYPE  AIOContinuousBufForceTerminateAcqusition( AIOContinuousBuf *buf );
+static AIORET_TYPE _AIOContinuousBufUpdateActiveChannels( AIOContinuousBuf *buf );
 
 /*-------------------------------  Constructors  -----------------------------*/
 AIOContinuousBuf *NewAIOContinuousBufForCounts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels )
@@ -46,7 +55,9 @@ AIOContinuousBuf *NewAIOContinuousBufForCounts( unsigned long DeviceIndex, unsig
     AIOContinuousBuf *tmp = NewAIOContinuousBuf(DeviceIndex, num_channels, 0, scancounts );
     AIO_ERROR_VALID_DATA( NULL, tmp );
 
+    DeleteAIOFifoCounts( (AIOFifoCounts *)tmp->fifo );
     tmp->fifo  = (AIOFifoTYPE *)NewAIOFifoCounts( num_channels * scancounts );
+    AIOFifoSetSPSC( tmp->fifo, AIOUSB_TRUE ); /* one USB worker writes, one user thread reads */
     AIOContinuousBufSetDeviceIndex( tmp, DeviceIndex );
 
     AIOContinuousBufSetCallback( tmp, RawCountsWorkFunction );
@@ -82,8 +93,16 @@ AIOContinuousBuf *NewAIOContinuousBuf( unsigned long deviceIndex, unsigned num_c
         tmp->unit_size        = sizeof(uint16_t);
 #ifdef HAS_PTHREAD
         tmp->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+        pthread_condattr_t condattr;
+        pthread_condattr_init( &condattr );
+        pthread_condattr_setclock( &condattr, CLOCK_MONOTONIC );
+        pthread_cond_init( &tmp->data_ready, &condattr );
+        pthread_condattr_destroy( &condattr );
 #endif
+        tmp->wakeup_threshold = 1;
+        tmp->wakeup_fd        = -1;
         tmp->fifo = (AIOFifoTYPE *)NewAIOFifoCounts( tmp->num_channels *(tmp->num_oversamples+1)*tmp->base_size  );
+        AIOFifoSetSPSC( tmp->fifo, AIOUSB_TRUE ); /* one USB worker writes, one user thread reads */
 
         tmp->PushN = AIOContinuousBufPushN;
         tmp->PopN  = AIOContinuousBufPopN;
@@ -103,6 +122,7 @@ AIOContinuousBuf *NewAIOContinuousBuf( unsigned long deviceIndex, unsigned num_c
 #else
     tmp->mask = NewAIOChannelMask( num_channels );
 #endif
+    _AIOContinuousBufUpdateActiveChannels( tmp );
 
 
     }
@@ -128,7 +148,8 @@ AIORET_TYPE AIOContinuousBufGetNumberChannels( AIOContinuousBuf * buf)
     
     AIO_ASSERT_AIOCONTBUF( buf );
     buf->num_channels = num_channels;
-    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIORET_TYPE retval = _AIOContinuousBufUpdateActiveChannels( buf );
+    AIO_ERROR_VALID_DATA( retval, retval == AIOUSB_SUCCESS );
     if ( (AIOFifoGetSizeNumElements( buf->fifo ) % num_channels) != 0 ) { 
         retval = _AIOContinuousBufResizeFifo( buf );
     }
@@ -185,6 +206,142 @@ AIORET_TYPE AIOContinuousBuf_InitConfiguration(  AIOContinuousBuf *buf )
     return AIOContinuousBufInitConfiguration( buf );
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Called by the producer after it adds samples or stops. Wakes the
+ *        threads in AIOContinuousBufWaitForSamples() once enough samples are
+ *        in the fifo, and bumps the wakeup eventfd once wakeup_threshold
+ *        samples are. Either kind of waiter is always woken when the
+ *        acquisition is no longer running.
+ * @note Must not be called with buf->lock held
+ */
+static void _AIOContinuousBufNotify( AIOContinuousBuf *buf )
+{
+    unsigned long available;
+    AIOUSB_BOOL stopped;
+
+#ifdef HAS_PTHREAD
+    /* Pairs with the fence in AIOContinuousBufWaitForSamples(): either the
+     * waiter sees what was just pushed, or we see the waiter. The lock is
+     * only taken when someone is actually blocked */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &buf->waiters, __ATOMIC_RELAXED ) != 0 ) {
+        AIOContinuousBufLock( buf );
+        available = AIOFifoReadSizeNumElements( buf->fifo );
+        stopped = ( buf->status & RUNNING ? AIOUSB_FALSE : AIOUSB_TRUE );
+        if ( buf->waiters && ( stopped || available >= buf->wait_threshold ) )
+            pthread_cond_broadcast( &buf->data_ready );
+        AIOContinuousBufUnlock( buf );
+    }
+#endif
+
+    if ( buf->wakeup_fd < 0 )
+        return;
+    available = AIOFifoReadSizeNumElements( buf->fifo );
+    stopped = ( buf->status & RUNNING ? AIOUSB_FALSE : AIOUSB_TRUE );
+    if ( stopped || available >= buf->wakeup_threshold ) {
+        uint64_t one = 1;
+        if ( write( buf->wakeup_fd, &one, sizeof(one) ) != sizeof(one) )
+            AIOUSB_DEVEL("Wakeup fd not written, errno=%d\n", errno ); /* Counter is full, so it is readable anyway */
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/** @cond INTERNAL_DOCUMENTATION */
+#define AIOCONTBUF_MAX_STARTED ( 4 * MAX_USB_DEVICES )
+#define AIOCONTBUF_MAX_USB_FAILURES 5
+
+/* Buffers between AIOContinuousBufStart() and AIOContinuousBufEnd(), so a
+ * board that is unplugged can stop the acquisitions running on it */
+static pthread_mutex_t started_lock = PTHREAD_MUTEX_INITIALIZER;
+static AIOContinuousBuf *started_bufs[ AIOCONTBUF_MAX_STARTED ];
+
+static void _AIOContinuousBufSetStarted( AIOContinuousBuf *buf, AIOUSB_BOOL started )
+{
+    int free_slot = -1;
+    pthread_mutex_lock( &started_lock );
+    for ( int i = 0; i < AIOCONTBUF_MAX_STARTED; i ++ ) {
+        if ( started_bufs[i] == buf ) {
+            if ( !started )
+                started_bufs[i] = NULL;
+            free_slot = -2;
+            break;
+        } else if ( !started_bufs[i] && free_slot == -1 ) {
+            free_slot = i;
+        }
+    }
+    if ( started && free_slot >= 0 )
+        started_bufs[free_slot] = buf;
+    pthread_mutex_unlock( &started_lock );
+}
+
+/* Keeps the first error, so workers failing on a vanished board don't hide why it stopped */
+static void _AIOContinuousBufSetExitCode( AIOContinuousBuf *buf, AIORET_TYPE exitcode )
+{
+    __sync_bool_compare_and_swap( &buf->exitcode, AIOUSB_SUCCESS, exitcode );
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops every running acquisition on DeviceIndex after the board
+ *        has been unplugged. Their exit code becomes
+ *        -AIOUSB_ERROR_DEVICE_REMOVED and any threads waiting for samples
+ *        are woken. Called by the device table when it sees the board leave.
+ * @param DeviceIndex
+ * @return Number of acquisitions that were stopped
+ */
+AIORET_TYPE AIOContinuousBufDeviceRemoved( unsigned long DeviceIndex )
+{
+    AIORET_TYPE retval = 0;
+
+    pthread_mutex_lock( &started_lock );
+    for ( int i = 0; i < AIOCONTBUF_MAX_STARTED; i ++ ) {
+        AIOContinuousBuf *buf = started_bufs[i];
+        if ( !buf || buf->DeviceIndex != (int)DeviceIndex )
+            continue;
+
+        AIOContinuousBufLock( buf );
+        AIOUSB_BOOL running = ( buf->status & RUNNING ? AIOUSB_TRUE : AIOUSB_FALSE );
+        if ( running ) {
+            _AIOContinuousBufSetExitCode( buf, -AIOUSB_ERROR_DEVICE_REMOVED );
+            buf->status = TERMINATED;
+        }
+        AIOContinuousBufUnlock( buf );
+
+        if ( running ) {
+            AIOUSB_WARN("Device %lu removed, stopping its acquisition\n", DeviceIndex );
+            _AIOContinuousBufNotify( buf );
+            retval ++;
+        }
+    }
+    pthread_mutex_unlock( &started_lock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Counts the acquisitions on DeviceIndex between
+ * AIOContinuousBufStart() and AIOContinuousBufEnd(), whose workers may
+ * still hold the USBDevice of the board they were started on.
+ * @param DeviceIndex
+ * @return Number of started acquisitions
+ */
+AIORET_TYPE AIOContinuousBufDeviceInUse( unsigned long DeviceIndex )
+{
+    AIORET_TYPE retval = 0;
+
+    pthread_mutex_lock( &started_lock );
+    for ( int i = 0; i < AIOCONTBUF_MAX_STARTED; i ++ ) {
+        if ( started_bufs[i] && started_bufs[i]->DeviceIndex == (int)DeviceIndex )
+            retval ++;
+    }
+    pthread_mutex_unlock( &started_lock );
+
+    return retval;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBufPushN(AIOContinuousBuf *buf , void *frombuf, unsigned int N )
 {
@@ -192,9 +349,14 @@ AIORET_TYPE AIOContinuousBufPushN(AIOContinuousBuf *buf , void *frombuf, unsigne
     AIO_ASSERT( frombuf );
     
     AIORET_TYPE retval = AIOUSB_SUCCESS;
-    retval = AIOContinuousBufLock(buf);
-    retval = buf->fifo->PushN( buf->fifo, frombuf, N );
-    AIOContinuousBufUnlock(buf);
+    if ( buf->fifo->spsc ) {
+        retval = buf->fifo->PushN( buf->fifo, frombuf, N );
+    } else {
+        retval = AIOContinuousBufLock(buf);
+        retval = buf->fifo->PushN( buf->fifo, frombuf, N );
+        AIOContinuousBufUnlock(buf);
+    }
+    _AIOContinuousBufNotify( buf );
     return retval;
 }
 
@@ -204,6 +366,9 @@ AIORET_TYPE AIOContinuousBufPopN(AIOContinuousBuf *buf , void *frombuf, unsigned
     AIO_ASSERT_AIOCONTBUF( buf );
     AIO_ASSERT( frombuf );
     AIORET_TYPE retval = AIOUSB_SUCCESS;
+    if ( buf->fifo->spsc )
+        return buf->fifo->PopN( buf->fifo, frombuf, N );
+
     retval = AIOContinuousBufLock(buf);
 
     retval = buf->fifo->PopN( buf->fifo, frombuf, N );
@@ -314,10 +479,18 @@ AIORET_TYPE DeleteAIOContinuousBuf( AIOContinuousBuf *buf )
     AIO_ASSERT_AIOCONTBUF( buf );
     if ( buf->mask )
         DeleteAIOChannelMask( buf->mask );
+    free( buf->active_channels );
     if ( buf->buffer )
         free( buf->buffer );
     if ( buf->fifo  )
         DeleteAIOFifoCounts( (AIOFifoCounts *)buf->fifo );
+    if ( buf->wakeup_fd >= 0 )
+        close( buf->wakeup_fd );
+    DeleteAIOThreadPolicy( buf->thread_policy );
+    _AIOContinuousBufSetStarted( buf, AIOUSB_FALSE );
+#ifdef HAS_PTHREAD
+    pthread_cond_destroy( &buf->data_ready );
+#endif
     free( buf );
     return AIOUSB_SUCCESS;
 }
@@ -358,6 +531,47 @@ AIORET_TYPE AIOContinuousBufGetStreamingBlockSize( AIOContinuousBuf *buf )
     return buf->block_size;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Configures the number of bulk transfers that are kept in flight
+ *        while acquiring. With a depth of 0 the worker thread falls back to
+ *        issuing one synchronous bulk read at a time.
+ * @param buf 
+ * @param depth Number of outstanding transfers ( max AIOCONTBUF_MAX_ASYNC_DEPTH )
+ * @param transfer_size Bytes per transfer, rounded down to a multiple of 512.
+ *        0 means use the streaming block size.
+ * @return AIOUSB_SUCCESS on success
+ */
+AIORET_TYPE AIOContinuousBufSetAsyncTransfers( AIOContinuousBuf *buf, unsigned depth, unsigned transfer_size )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, depth <= AIOCONTBUF_MAX_ASYNC_DEPTH );
+
+    buf->async_depth = depth;
+    if ( transfer_size == 0 ) {
+        buf->async_transfer_size = 0;
+    } else if ( transfer_size < 512 ) {
+        buf->async_transfer_size = 512;
+    } else {
+        buf->async_transfer_size = ( transfer_size / 512 ) * 512;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetAsyncDepth( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    return buf->async_depth;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetAsyncTransferSize( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    return ( buf->async_transfer_size ? buf->async_transfer_size : buf->block_size );
+}
+
 /*----------------------------------------------------------------------------*/
 ADCConfigBlock *AIOContinuousBufGetADCConfigBlock( AIOContinuousBuf *buf )
 {
@@ -452,14 +666,14 @@ AIORET_TYPE AIOContinuousBufReset( AIOContinuousBuf *buf )
 AIORET_TYPE AIOContinuousBufGetReadPosition( AIOContinuousBuf *buf )
 {
     AIO_ASSERT_AIOCONTBUF( buf );
-    return buf->fifo->read_pos;
+    return AIOFifoReadPosition( buf->fifo );
 }
 
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBufGetWritePosition( AIOContinuousBuf *buf )
 {
     AIO_ASSERT_AIOCONTBUF( buf );
-    return buf->fifo->write_pos;
+    return AIOFifoWritePosition( buf->fifo );
 }
 
 /*----------------------------------------------------------------------------*/
@@ -588,6 +802,132 @@ AIORET_TYPE AIOContinuousBufReadIntegerScanCounts( AIOContinuousBuf *buf,
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Gives direct access to the whole scans waiting in the buffer
+ *        without copying them out. The data remains valid, and in the
+ *        buffer, until AIOContinuousBufConsume() is called.
+ * @param buf 
+ * @param region Filled in with one or two pieces of the buffer's storage;
+ *        a scan may be split between the two pieces
+ * @return Number of bytes in region
+ */
+AIORET_TYPE AIOContinuousBufPeek( AIOContinuousBuf *buf, AIOFifoRegion *region )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ASSERT( region );
+    unsigned scan_size = buf->fifo->refsize * AIOContinuousBufNumberChannels(buf);
+    AIORET_TYPE available = buf->fifo->rdelta( (AIOFifo*)buf->fifo );
+
+    return AIOFifoReadPeek( buf->fifo, ( available / scan_size ) * scan_size, region );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Releases size bytes returned by AIOContinuousBufPeek()
+ * @return Number of scans consumed
+ */
+AIORET_TYPE AIOContinuousBufConsume( AIOContinuousBuf *buf, unsigned size )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIORET_TYPE retval;
+
+    if ( !buf->fifo->spsc )
+        AIOContinuousBufLock( buf );
+    retval = AIOFifoReadConsume( buf->fifo, size );
+    if ( retval > 0 ) {
+        retval /= AIOContinuousBufNumberChannels(buf);
+        retval /= buf->fifo->refsize;
+        buf->scans_read += retval;
+    }
+    if ( !buf->fifo->spsc )
+        AIOContinuousBufUnlock( buf );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ * @brief Copies the channels listed in table out of one scan
+ */
+static void _AIOContinuousBufPickChannels( void *to, const void *scan, const int *table, unsigned n, unsigned refsize )
+{
+    if ( refsize == sizeof(uint16_t) ) {
+        for ( unsigned k = 0; k < n; k ++ )
+            ((uint16_t *)to)[k] = ((const uint16_t *)scan)[table[k]];
+    } else if ( refsize == sizeof(uint64_t) ) {
+        for ( unsigned k = 0; k < n; k ++ )
+            ((uint64_t *)to)[k] = ((const uint64_t *)scan)[table[k]];
+    } else {
+        for ( unsigned k = 0; k < n; k ++ )
+            memcpy( (char *)to + k*refsize, (const char *)scan + table[k]*refsize, refsize );
+    }
+} /** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads whole scans like AIOContinuousBufReadIntegerScanCounts(), but
+ *        keeps only the channels set in the mask given to
+ *        AIOContinuousBufSetChannelMask(). The channels are picked through
+ *        a table built when the mask changes, so nothing is tested per sample.
+ * @param buf 
+ * @param tobuf Receives the kept channels of each scan back to back, as
+ *        counts or volts depending on the buffer
+ * @param tobufsize Size of tobuf in bytes
+ * @return Number of scans read
+ */
+AIORET_TYPE AIOContinuousBufReadActiveScans( AIOContinuousBuf *buf, void *tobuf, unsigned tobufsize )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ASSERT( tobuf );
+    AIOFifoRegion region;
+    unsigned char *scratch = NULL;
+
+    AIOContinuousBufLock( buf );
+    unsigned refsize   = buf->fifo->refsize;
+    unsigned scan_size = refsize * buf->num_channels;
+    unsigned out_size  = refsize * buf->num_active_channels;
+    if ( scan_size == 0 || out_size == 0 ) {
+        AIOContinuousBufUnlock( buf );
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    }
+    unsigned available = buf->fifo->rdelta( (AIOFifo*)buf->fifo ) / scan_size;
+    unsigned room      = tobufsize / out_size;
+    unsigned num_scans = MIN( available, room );
+    if ( num_scans > 0 && AIOFifoReadPeek( buf->fifo, num_scans*scan_size, &region ) <= 0 )
+        num_scans = 0;
+
+    for ( unsigned s = 0; s < num_scans; s ++ ) {
+        unsigned offset = s * scan_size;
+        const unsigned char *scan;
+        if ( offset + scan_size <= region.size[0] ) {
+            scan = (unsigned char *)region.ptr[0] + offset;
+        } else if ( offset >= region.size[0] ) {
+            scan = (unsigned char *)region.ptr[1] + ( offset - region.size[0] );
+        } else {                /* the one scan that wraps around the storage */
+            unsigned head = region.size[0] - offset;
+            if ( !scratch && !(scratch = (unsigned char *)malloc( scan_size )) ) {
+                num_scans = s;
+                break;
+            }
+            memcpy( scratch, (unsigned char *)region.ptr[0] + offset, head );
+            memcpy( scratch + head, region.ptr[1], scan_size - head );
+            scan = scratch;
+        }
+        _AIOContinuousBufPickChannels( (unsigned char *)tobuf + s*out_size, scan, buf->active_channels, buf->num_active_channels, refsize );
+    }
+
+    if ( num_scans > 0 ) {
+        AIOFifoReadConsume( buf->fifo, num_scans*scan_size );
+        buf->scans_read += num_scans;
+    }
+    AIOContinuousBufUnlock( buf );
+    free( scratch );
+
+    return num_scans;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBufGetNumberOfScansToRead( AIOContinuousBuf *buf )
 {
@@ -697,7 +1037,11 @@ AIORET_TYPE  AIOContinuousBufForceTerminateAcqusition( AIOContinuousBuf *buf )
 AIORET_TYPE  AIOContinuousBufForceTerminateAcqusitionOverrun( AIOContinuousBuf *buf )
 {
     AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIORESULT result = AIOUSB_SUCCESS;
     AIO_ASSERT_AIOCONTBUF( buf );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), &result );
+    if ( dev && dev->usb_device )
+        USB_DEVICE_COUNT( dev->usb_device, overruns, 1 );
     buf->status = TERMINATED_OVERRUN;
     buf->start_scanning = 0;
     return retval;
@@ -705,6 +1049,56 @@ AIORET_TYPE  AIOContinuousBufForceTerminateAcqusitionOverrun( AIOContinuousBuf *
 
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ * @brief Thread entry used when a thread policy is attached: the worker
+ *        applies the policy to itself and then runs the real work function
+ *        kept in buf->work
+ */
+static void *_AIOContinuousBufPolicyWorker( void *object )
+{
+    AIOContinuousBuf *buf = (AIOContinuousBuf *)object;
+    AIOThreadPolicyApply( buf->thread_policy );
+    return buf->work( object );
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Has the acquisition worker apply a copy of policy to itself when
+ *        it starts; replaces any policy set before
+ * @param buf 
+ * @param policy Policy to copy, or NULL to run the worker as created
+ * @return AIOUSB_SUCCESS or negative error
+ */
+AIORET_TYPE AIOContinuousBufSetThreadPolicy( AIOContinuousBuf *buf, const AIOThreadPolicy *policy )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIOThreadPolicy *tmp = NULL;
+    if ( policy ) {
+        tmp = NewAIOThreadPolicyCopy( policy );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, tmp );
+    }
+    DeleteAIOThreadPolicy( buf->thread_policy );
+    buf->thread_policy = tmp;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief What the worker actually got from the thread policy
+ * @return AIOUSB_SUCCESS, -AIOUSB_ERROR_INVALID_PARAMETER if no policy is
+ *         attached or -AIOUSB_ERROR_INVALID_THREAD if the worker hasn't
+ *         applied it yet
+ */
+AIORET_TYPE AIOContinuousBufGetThreadPolicyReport( AIOContinuousBuf *buf, AIOThreadPolicyReport *report )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->thread_policy );
+    return AIOThreadPolicyGetReport( buf->thread_policy, report );
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Starts the thread that acquires data from USB bus.   * 
@@ -716,7 +1110,20 @@ AIORET_TYPE AIOContinuousBufStart( AIOContinuousBuf *buf )
     AIO_ASSERT_AIOCONTBUF( buf );
     AIORET_TYPE retval = AIOUSB_SUCCESS;
 #ifdef HAS_PTHREAD
+    AIOUSB_WorkFn work = buf->callback;
+    /* Only the built in workers know how to run with transfers in flight */
+    if ( buf->async_depth > 0 && ( work == RawCountsWorkFunction || work == ConvertCountsToVoltsFunction ) )
+        work = AIOContinuousBufAsyncWorkFunction;
+
+    if ( buf->thread_policy ) {
+        memset( &buf->thread_policy->report, 0, sizeof(buf->thread_policy->report) );
+        buf->work = work;
+        work = _AIOContinuousBufPolicyWorker;
+    }
+
+    buf->exitcode = AIOUSB_SUCCESS;
     buf->status = RUNNING_OR_WITH_DATA;
+    _AIOContinuousBufSetStarted( buf, AIOUSB_TRUE );
 #ifdef HIGH_PRIORITY            /* Must run as root if you use this */
     int fifo_max_prio;
     struct sched_param fifo_param;
@@ -727,9 +1134,9 @@ AIORET_TYPE AIOContinuousBufStart( AIOContinuousBuf *buf )
     fifo_max_prio = sched_get_priority_max(SCHED_RR);
     fifo_param.sched_priority = fifo_max_prio;
     pthread_attr_setschedparam( &custom_sched_attr, &fifo_param);
-    retval = pthread_create( &(buf->worker), &custom_sched_attr, buf->callback, (void *)buf );
+    retval = pthread_create( &(buf->worker), &custom_sched_attr, work, (void *)buf );
 #else
-    retval = pthread_create( &(buf->worker), NULL, buf->callback, (void *)buf );
+    retval = pthread_create( &(buf->worker), NULL, work, (void *)buf );
 #endif
     if (  retval != 0 ) {
         AIOContinuousBufForceTerminateAcqusition( buf );
@@ -755,6 +1162,7 @@ AIORET_TYPE AIOContinuousBufStopAcquisition( AIOContinuousBuf *buf )
     buf->bytes_processed = AIOContinuousBufGetTotalSamplesExpected(buf)*AIOContinuousBufGetUnitSize(buf);
 
     AIOContinuousBufUnlock( buf );    
+    _AIOContinuousBufNotify( buf );
     return retval;
 }
 
@@ -775,10 +1183,38 @@ AIORET_TYPE AIOContinuousBufSetChannelMask( AIOContinuousBuf *buf, AIOChannelMas
 {
     AIO_ASSERT_AIOCONTBUF( buf );
     AIO_ASSERT(mask);
+    AIOContinuousBufLock( buf );
     buf->mask   = mask;
-    return 0;
+    AIORET_TYPE retval = _AIOContinuousBufUpdateActiveChannels( buf );
+    AIOContinuousBufUnlock( buf );
+    return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ * @brief Rebuilds the table AIOContinuousBufReadActiveScans() demultiplexes
+ *        with from the mask and the number of channels. A mask with no
+ *        channel set keeps them all.
+ */
+static AIORET_TYPE _AIOContinuousBufUpdateActiveChannels( AIOContinuousBuf *buf )
+{
+    int *table = (int *)realloc( buf->active_channels, sizeof(int)*( buf->num_channels + 1 ) );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, table );
+    buf->active_channels = table;
+
+    AIORET_TYPE n = ( buf->mask ? AIOChannelMaskActiveIndices( buf->mask, table, buf->num_channels ) : 0 );
+    while ( n > 0 && table[n-1] >= (int)buf->num_channels )
+        n --;
+    if ( n <= 0 ) {
+        for ( n = 0; n < (AIORET_TYPE)buf->num_channels; n ++ )
+            table[n] = (int)n;
+    }
+    buf->num_active_channels = (unsigned)n;
+
+    return AIOUSB_SUCCESS;
+} /** @endcond */
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBuf_NumberSignals( AIOContinuousBuf *buf ) { return AIOContinuousBufNumberSignals( buf ); }
 
@@ -829,15 +1265,18 @@ AIORET_TYPE AIOContinuousBuf_SmartCountsToVolts( AIOContinuousBuf *buf,
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), (AIORESULT*)&retval );
     AIO_ERROR_VALID_AIORET_TYPE( retval, retval == AIOUSB_SUCCESS );
     int number_channels = AIOContinuousBufNumberChannels(buf);
-
+    AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( deviceDesc, NULL );
+    AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_GAINCODE, plan );
 
     for (unsigned ch = 0; ch < count;  ch ++ , *channel = ((*channel+1)% number_channels ) , *pos += 1 ) {
-        int gain = ADCConfigBlockGetGainCode( &deviceDesc->cachedConfigBlock, *channel );
-        AIO_ERROR_VALID_AIORET_TYPE( AIOUSB_ERROR_INVALID_GAINCODE, gain >= AIOUSB_SUCCESS );
-        struct ADRange *range = &adRanges[ gain ];
-        tobuf[ *pos ] = ( (( double )data[ ch ] / ( double )AI_16_MAX_COUNTS) * range->range ) + range->minVolts;
+        if ( *channel >= plan->num_channels ) {
+            retval = -AIOUSB_ERROR_INVALID_GAINCODE;
+            break;
+        }
+        tobuf[ *pos ] = data[ ch ] * plan->scale[ *channel ] + plan->offset[ *channel ];
         retval += 1;
     }
+    AIOUSBDeviceReleaseConversionPlan( deviceDesc, plan );
 
     return retval;
 } /** @endcond */
@@ -958,6 +1397,52 @@ AIORET_TYPE AIOContinuousBufGetTotalSamplesExpected(  AIOContinuousBuf *buf )
     return tmp;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Moves one block of raw counts read from the device into the
+ *        fifo, flagging an overrun or the end of the acquisition.
+ * @param buf 
+ * @param data Block read from the bulk endpoint, or NULL if the block was
+ *        read in place into space reserved with AIOFifoWriteReserve()
+ * @param bytes Number of valid bytes in data
+ * @param count Running number of counts that have been pushed
+ */
+static void _AIOContinuousBufConsumeCounts( AIOContinuousBuf *buf, unsigned char *data, int bytes, unsigned long *count )
+{
+    int64_t bytes_remaining = MIN( (int64_t)(AIOContinuousBufGetTotalSamplesExpected(buf)*AIOContinuousBufGetUnitSize(buf) - *count*2), (int64_t)bytes );
+
+    int tmp = ( data ? AIOContinuousBufPushN( buf, data, bytes_remaining / sizeof(unsigned short)) :
+                AIOFifoWriteCommit( buf->fifo, bytes_remaining ) );
+    if ( tmp <= 0 ) { 
+        AIOUSB_ERROR("Buffer overflow error: tried to add %ld with size=%ld available\n",
+                     (long)bytes_remaining / 2, (long)AIOFifoWriteSizeRemainingNumElements(buf->fifo ) );
+
+        *count += bytes_remaining / 2;
+        AIOContinuousBufForceTerminateAcqusitionOverrun(buf);
+    } else {
+        AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes_remaining / 2 , AIOFifoWriteSizeRemainingNumElements(buf->fifo ) );
+        if (  tmp >= 0 ) {
+            *count += bytes_remaining / 2;
+        }                
+    }
+    buf->bytes_processed += bytes_remaining;
+
+    AIOUSB_DEVEL("Tmpcount=%d,count=%d,Bytes=%lu, Write=%d,Read=%d,max=%d\n", tmp,(int)*count,bytes_remaining,AIOFifoWritePosition(buf->fifo) , AIOFifoReadPosition(buf->fifo), AIOFifoGetSize(buf->fifo));
+
+    /**
+     * Modification, allow the count to keep going... stop 
+     * if 
+     * 1. count >= number we are supposed to read
+     * 2. we don't have enough space
+     */
+    if ( buf->bytes_processed >= (int64_t)(AIOContinuousBufGetTotalSamplesExpected( buf )*AIOContinuousBufGetUnitSize(buf)) ) {
+        AIOContinuousBufLock(buf);
+        buf->status = TERMINATED;
+        AIOContinuousBufUnlock(buf);
+    }
+    _AIOContinuousBufNotify( buf );
+}
+
 /*----------------------------------------------------------------------------*/
 void *RawCountsWorkFunction( void *object )
 {
@@ -968,52 +1453,39 @@ void *RawCountsWorkFunction( void *object )
     unsigned long count = 0;
     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), (AIORESULT*)&retval );
     AIO_ERROR_VALID_DATA( &retval, retval == AIOUSB_SUCCESS );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), (AIORESULT*)&retval );
+    uint64_t started = 0, lastEnd = 0;
 
     unsigned char *data  = (unsigned char *)malloc( buf->block_size );
-    int64_t bytes_remaining = 0;
     buf->start_scanning = AIOUSB_TRUE;
 
     while ( buf->status & RUNNING  ) {
         int bytes;
-
+        AIOFifoRegion region;
+        unsigned char *target = data;
         int reqsize = buf->block_size;
-        int usbresult = aiocontbuf_get_bulk_data( buf, usb, 0x86, data, reqsize, &bytes, 3000 );
 
-        AIOUSB_DEVEL("Requested: %d libusb_bulk_transfer  %d as usbresult, bytes=%d\n", reqsize, usbresult , (int)bytes);
+        /* Read straight into the fifo when whole USB packets fit before it wraps */
+        if ( AIOFifoWriteReserve( buf->fifo, buf->block_size, &region ) > 0 && region.size[0] >= 512 ) {
+            target  = (unsigned char *)region.ptr[0];
+            reqsize = ( region.size[0] / 512 ) * 512;
+        }
 
-        if (  bytes ) {
-            bytes_remaining = MIN( (int64_t)(AIOContinuousBufGetTotalSamplesExpected(buf)*AIOContinuousBufGetUnitSize(buf) - count*2), (int64_t)bytes );
-
-            int tmp = AIOContinuousBufPushN( buf, data, bytes_remaining / sizeof(unsigned short));
-            if ( tmp <= 0 ) { 
-                AIOUSB_ERROR("Buffer overflow error: tried to add %ld with size=%ld available\n",
-                             (long)bytes_remaining / 2, (long)AIOFifoWriteSizeRemainingNumElements(buf->fifo ) );
-
-                count += bytes_remaining / 2;
-                AIOContinuousBufForceTerminateAcqusitionOverrun(buf);
-            } else {
-                AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes_remaining / 2 , AIOFifoWriteSizeRemainingNumElements(buf->fifo ) );
-                if (  tmp >= 0 ) {
-                    count += bytes_remaining / 2;
-                }                
-            }
-            buf->bytes_processed += bytes_remaining;
+        AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( dev, AIO_TRANSFER_CONTINUOUS );
+        if ( hists )
+            started = AIOTransferTimestamp();
+        bytes = 0;
+        int usbresult = aiocontbuf_get_bulk_data( buf, usb, 0x86, target, reqsize, &bytes, 3000 );
+        if ( hists )
+            AIOTransferHistogramsRecord( hists, started, AIOTransferTimestamp(), bytes, AIOFifoReadSize( buf->fifo ), &lastEnd );
 
-            AIOUSB_DEVEL("Tmpcount=%d,count=%d,Bytes=%lu, Write=%d,Read=%d,max=%d\n", tmp,count,bytes_remaining,AIOFifoWritePosition(buf->fifo) , AIOFifoReadPosition(buf->fifo), AIOFifoGetSize(buf->fifo));
+        AIOUSB_DEVEL("Requested: %d libusb_bulk_transfer  %d as usbresult, bytes=%d\n", reqsize, usbresult , (int)bytes);
 
-            /**
-             * Modification, allow the count to keep going... stop 
-             * if 
-             * 1. count >= number we are supposed to read
-             * 2. we don't have enough space
-             */
-            if ( buf->bytes_processed >= (int64_t)(AIOContinuousBufGetTotalSamplesExpected( buf )*AIOContinuousBufGetUnitSize(buf)) ) {
-                AIOContinuousBufLock(buf);
-                buf->status = TERMINATED;
-                AIOContinuousBufUnlock(buf);
-            }
+        if (  bytes ) {
+            _AIOContinuousBufConsumeCounts( buf, ( target == data ? data : NULL ), bytes, &count );
         } else if ( usbresult < 0  && usbfail < usbfail_count ) {
             AIOUSB_ERROR("Error with usb: %d\n", (int)usbresult );
+            USB_DEVICE_COUNT( usb, retries, 1 );
             usbfail ++;
         } else {
             if ( usbfail >= usbfail_count  ) {
@@ -1022,7 +1494,7 @@ void *RawCountsWorkFunction( void *object )
                 AIOContinuousBufLock(buf);
                 buf->status = TERMINATED;
                 AIOContinuousBufUnlock(buf);
-                buf->exitcode = -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbresult);
+                _AIOContinuousBufSetExitCode( buf, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbresult) );
             } 
         }
     }
@@ -1033,6 +1505,71 @@ void *RawCountsWorkFunction( void *object )
   
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Pushes one block of raw counts through the counts converter and
+ *        into the volts fifo, flagging an overrun or the end of the acquisition.
+ * @param buf 
+ * @param cc Converter created for this acquisition
+ * @param infifo Staging fifo holding counts that have not been converted
+ * @param data Block read from the bulk endpoint
+ * @param bytes Number of valid bytes in data
+ * @param num_scans Scan limit used when acquiring forever
+ * @param count Running number of converted samples
+ * @return Number of samples converted, < 0 if the acquisition overran
+ */
+static AIORET_TYPE _AIOContinuousBufConsumeVolts( AIOContinuousBuf *buf, 
+                                                  AIOCountsConverter *cc,
+                                                  AIOFifoCounts *infifo,
+                                                  unsigned char *data,
+                                                  int bytes,
+                                                  int num_scans,
+                                                  unsigned *count
+                                                  )
+{
+    AIORET_TYPE retval;
+    AIOFifoVolts *outfifo = (AIOFifoVolts*)buf->fifo;
+
+    if ( buf->infinite ) {
+        bytes = MIN( (int)(buf->num_channels * (buf->num_oversamples+1)*num_scans * sizeof(uint16_t) - *count*sizeof(uint16_t)), bytes );
+    } else {
+        bytes = MIN( (int)(buf->num_channels * (buf->num_oversamples+1)*buf->num_scans * sizeof(uint16_t) - *count*sizeof(uint16_t)), bytes );
+    }
+    if ( bytes <= 0 )
+        return 0;
+
+    infifo->PushN( infifo, (uint16_t*)data, bytes / 2 );
+
+    retval = cc->ConvertFifo( cc, outfifo, infifo , bytes / sizeof(uint16_t) );
+
+    if (  retval >= 0 ) {
+        *count += retval;
+    } else {
+        AIOContinuousBufForceTerminateAcqusitionOverrun(buf);
+        _AIOContinuousBufNotify( buf );
+        return retval;
+    }
+
+    AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes / 2 , buf->fifo->size );
+    AIOUSB_DEVEL("Tmpcount=%d,count=%d,Bytes=%d, Write=%d,Read=%d,max=%d\n", (int)retval,*count,bytes,AIOFifoWritePosition(buf->fifo) , AIOFifoReadPosition(buf->fifo), AIOFifoGetSize(buf->fifo));
+
+    /**
+     * Modification, allow the count to keep going... stop 
+     * if 
+     * 1. count >= number we are supposed to read
+     * 2. we don't have enough space
+     */
+    if ( !buf->infinite ) {
+        if ( *count >= buf->num_scans*buf->num_channels ) {
+            AIOContinuousBufLock(buf);
+            buf->status = TERMINATED;
+            AIOContinuousBufUnlock(buf);
+        }
+    }
+    _AIOContinuousBufNotify( buf );
+    return retval;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Main work function for collecting data. Also performs copies from 
@@ -1060,7 +1597,6 @@ void *ConvertCountsToVoltsFunction( void *object )
     infifo = NewAIOFifoCounts( (unsigned)num_channels*(num_oversamples+1)*num_scans );
 
     AIO_ERROR_VALID_DATA_W_CODE( &retval, retval = AIOUSB_ERROR_INVALID_AIOFIFO, infifo );
-    AIOFifoVolts *outfifo = (AIOFifoVolts*)buf->fifo;
 
     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), (AIORESULT*)&retval );
     AIO_ERROR_VALID_DATA( &retval, retval == AIOUSB_SUCCESS );
@@ -1070,7 +1606,9 @@ void *ConvertCountsToVoltsFunction( void *object )
     AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), (AIORESULT*)&retval );
     AIO_ERROR_VALID_DATA( &retval, retval == AIOUSB_SUCCESS );
 
-    ranges = NewAIOGainRangeFromADCConfigBlock( AIOUSBDeviceGetADCConfigBlock( dev ) );
+    AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( dev, NULL );
+    ranges = NewAIOGainRangeFromAIOConversionPlan( plan );
+    AIOUSBDeviceReleaseConversionPlan( dev, plan );
     AIO_ERROR_VALID_DATA_W_CODE( &retval, retval = AIOUSB_ERROR_INVALID_GAINCODE, ranges );
 
     unsigned char *data   = (unsigned char *)malloc( buf->block_size );
@@ -1084,49 +1622,26 @@ void *ConvertCountsToVoltsFunction( void *object )
      * @brief create temporary buffer and then Load the fifo with values
      */
    
+    uint64_t started = 0, lastEnd = 0;
     while ( buf->status & RUNNING  ) {
-        int bytes;
+        int bytes = 0;
+        AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( dev, AIO_TRANSFER_CONTINUOUS );
+        if ( hists )
+            started = AIOTransferTimestamp();
         int usbresult = aiocontbuf_get_bulk_data( buf, usb, 0x86, data, buf->block_size, &bytes, 3000 );
+        if ( hists )
+            AIOTransferHistogramsRecord( hists, started, AIOTransferTimestamp(), bytes, AIOFifoReadSize( buf->fifo ), &lastEnd );
         AIOUSB_DEVEL("libusb_bulk_transfer returned  %d as usbresult, bytes=%d\n", usbresult , (int)bytes);
 
         AIOUSB_DEVEL("Using counts=%d\n",bytes / 2 );
 
-        if ( buf->infinite ) {
-            bytes = MIN( (int)(buf->num_channels * (buf->num_oversamples+1)*num_scans * sizeof(uint16_t) - count*sizeof(uint16_t)), bytes );
-        } else {
-            bytes = MIN( (int)(buf->num_channels * (buf->num_oversamples+1)*buf->num_scans * sizeof(uint16_t) - count*sizeof(uint16_t)), bytes );
-        }
-        retval = infifo->PushN( infifo, (uint16_t*)data, bytes / 2 );
-
         if ( bytes ) {
-
-            retval = cc->ConvertFifo( cc, outfifo, infifo , bytes / sizeof(uint16_t) );
-
-            if (  retval >= 0 ) {
-                count += retval;
-            } else {
-                AIOContinuousBufForceTerminateAcqusitionOverrun(buf);
+            retval = _AIOContinuousBufConsumeVolts( buf, cc, infifo, data, bytes, num_scans, &count );
+            if ( retval < 0 )
                 break;
-            }
-
-            AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes / 2 , buf->fifo->size );
-            AIOUSB_DEVEL("Tmpcount=%d,count=%d,Bytes=%d, Write=%d,Read=%d,max=%d\n", retval,count,bytes,AIOFifoWritePosition(buf) , AIOFifoReadPosition(buf), AIOFifoGetSize(buf->fifo));
-
-            /**
-             * Modification, allow the count to keep going... stop 
-             * if 
-             * 1. count >= number we are supposed to read
-             * 2. we don't have enough space
-             */
-            if ( !buf->infinite ) {
-                if ( count >= buf->num_scans*buf->num_channels ) {
-                    AIOContinuousBufLock(buf);
-                    buf->status = TERMINATED;
-                    AIOContinuousBufUnlock(buf);
-                }
-            }
         } else if (  usbresult < 0  && usbfail < usbfail_count ) {
             AIOUSB_ERROR("Error with usb: %d\n", (int)usbresult );
+            USB_DEVICE_COUNT( usb, retries, 1 );
             usbfail ++;
         } else {
             if (  usbfail >= usbfail_count  ){
@@ -1135,7 +1650,7 @@ void *ConvertCountsToVoltsFunction( void *object )
                 AIOContinuousBufLock(buf);
                 buf->status = TERMINATED;
                 AIOContinuousBufUnlock(buf);
-                buf->exitcode = -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbresult);
+                _AIOContinuousBufSetExitCode( buf, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbresult) );
             } 
         }
     }
@@ -1154,6 +1669,287 @@ void *ConvertCountsToVoltsFunction( void *object )
     pthread_exit((void*)&retval);
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ * @brief Bookkeeping shared between the asynchronous worker and the libusb
+ *        completion callbacks. The callbacks run on whichever thread is
+ *        handling events on the default context, which may be the hotplug
+ *        thread rather than the worker, so they hold lock while they
+ *        touch the state and in_flight is only changed atomically.
+ */
+typedef struct aiocontbuf_async_state {
+    AIOContinuousBuf *buf;
+    struct libusb_transfer **transfers;
+    unsigned depth;
+    pthread_mutex_t lock;
+    unsigned in_flight;                 /**< The worker frees the state once this drops to 0 */
+    uint64_t *submitted;                /**< When each of transfers last went on the bus */
+    int usbfail;
+    unsigned long count;
+    /* Only used when converting to volts */
+    AIOCountsConverter *cc;
+    AIOFifoCounts *infifo;
+    AIOGainRange *ranges;
+    unsigned volts_count;
+    int num_scans;
+    USBDevice *usb;
+    AIOUSBDevice *dev;
+    uint64_t last_end;
+} AIOContinuousBufAsyncState;
+
+/*----------------------------------------------------------------------------*/
+/** @brief When xfer was submitted, 0 if it is not one of state's */
+static uint64_t _aiocontbuf_async_submitted( AIOContinuousBufAsyncState *state, struct libusb_transfer *xfer )
+{
+    for ( unsigned i = 0; state->submitted && i < state->depth; i ++ ) {
+        if ( state->transfers[i] == xfer )
+            return state->submitted[i];
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/** @brief Stamps xfer with the time it goes on the bus and submits it */
+static int _aiocontbuf_async_submit( AIOContinuousBufAsyncState *state, struct libusb_transfer *xfer )
+{
+    for ( unsigned i = 0; state->submitted && i < state->depth; i ++ ) {
+        if ( state->transfers[i] == xfer )
+            state->submitted[i] = AIOTransferTimestamp();
+    }
+    return libusb_submit_transfer( xfer );
+}
+
+/*----------------------------------------------------------------------------*/
+static int _aiocontbuf_transfer_status_to_libusb( enum libusb_transfer_status status )
+{
+    switch ( status ) {
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:
+        return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+        return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return LIBUSB_ERROR_INTERRUPTED;
+    default:
+        return LIBUSB_ERROR_IO;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aiocontbuf_async_fail( AIOContinuousBufAsyncState *state, int usbresult )
+{
+    AIOContinuousBuf *buf = state->buf;
+    AIOContinuousBufLock(buf);
+    buf->status = TERMINATED;
+    AIOContinuousBufUnlock(buf);
+    _AIOContinuousBufSetExitCode( buf, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbresult) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Accounts for one finished bulk transfer and consumes whatever data
+ *        arrived. Called with state->lock held.
+ * @return AIOUSB_TRUE if the transfer should go back on the bus
+ */
+static AIOUSB_BOOL _aiocontbuf_async_complete( AIOContinuousBufAsyncState *state, struct libusb_transfer *xfer )
+{
+    AIOContinuousBuf *buf = state->buf;
+    int usbresult;
+
+    AIOUSB_DEVEL("Async transfer status=%d, bytes=%d\n", (int)xfer->status, xfer->actual_length );
+    USB_DEVICE_COUNT( state->usb, bulk_transfers, 1 );
+    USB_DEVICE_COUNT( state->usb, bulk_bytes_in, xfer->actual_length );
+    AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( state->dev, AIO_TRANSFER_CONTINUOUS );
+    if ( hists )
+        AIOTransferHistogramsRecord( hists, _aiocontbuf_async_submitted( state, xfer ), AIOTransferTimestamp(), xfer->actual_length, AIOFifoReadSize( buf->fifo ), &state->last_end );
+
+    if ( xfer->actual_length > 0 && ( buf->status & RUNNING ) ) {
+        if ( state->cc ) {
+            _AIOContinuousBufConsumeVolts( buf, state->cc, state->infifo, xfer->buffer, xfer->actual_length, state->num_scans, &state->volts_count );
+        } else {
+            _AIOContinuousBufConsumeCounts( buf, xfer->buffer, xfer->actual_length, &state->count );
+        }
+    } else if ( xfer->status != LIBUSB_TRANSFER_COMPLETED && xfer->status != LIBUSB_TRANSFER_CANCELLED ) {
+        usbresult = _aiocontbuf_transfer_status_to_libusb( xfer->status );
+        if ( xfer->status == LIBUSB_TRANSFER_TIMED_OUT )
+            USB_DEVICE_COUNT( state->usb, timeouts, 1 );
+        else
+            USB_DEVICE_COUNT( state->usb, errors, 1 );
+        if ( xfer->status == LIBUSB_TRANSFER_NO_DEVICE || ++state->usbfail >= AIOCONTBUF_MAX_USB_FAILURES ) {
+            AIOUSB_ERROR("Erroring out. too many usb failures: %d\n", state->usbfail );
+            _aiocontbuf_async_fail( state, usbresult );
+        } else {
+            AIOUSB_ERROR("Error with usb: %d\n", usbresult );
+            USB_DEVICE_COUNT( state->usb, retries, 1 );
+        }
+    }
+
+    return ( buf->status & RUNNING ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Completion handler for one bulk transfer. Consumes whatever data
+ *        arrived and puts the transfer straight back on the bus while the
+ *        acquisition is still running so the device never waits on the host.
+ */
+static void LIBUSB_CALL aiocontbuf_async_transfer_cb( struct libusb_transfer *xfer )
+{
+    AIOContinuousBufAsyncState *state = (AIOContinuousBufAsyncState *)xfer->user_data;
+
+    pthread_mutex_lock( &state->lock );
+    if ( _aiocontbuf_async_complete( state, xfer ) ) {
+        int usbresult = _aiocontbuf_async_submit( state, xfer );
+        if ( usbresult == LIBUSB_SUCCESS ) {
+            pthread_mutex_unlock( &state->lock );
+            return;
+        }
+        AIOUSB_ERROR("Unable to resubmit transfer: %d\n", usbresult );
+        _aiocontbuf_async_fail( state, usbresult );
+    }
+    pthread_mutex_unlock( &state->lock );
+    /* Last touch of state, the worker may free it as soon as this hits 0 */
+    __atomic_sub_fetch( &state->in_flight, 1, __ATOMIC_RELEASE );
+}
+
+/*----------------------------------------------------------------------------*/
+static void _aiocontbuf_async_free( AIOContinuousBufAsyncState *state )
+{
+    for ( unsigned i = 0; state->transfers && i < state->depth; i ++ ) {
+        if ( state->transfers[i] ) {
+            free( state->transfers[i]->buffer );
+            libusb_free_transfer( state->transfers[i] );
+        }
+    }
+    free( state->transfers );
+    free( state->submitted );
+    pthread_mutex_destroy( &state->lock );
+    if ( state->infifo )
+        DeleteAIOFifoCounts( state->infifo );
+    if ( state->cc )
+        DeleteAIOCountsConverter( state->cc );
+    if ( state->ranges )
+        DeleteAIOGainRange( state->ranges );
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Work function used when AIOContinuousBufSetAsyncTransfers() has
+ *        requested a non zero depth. Keeps buf->async_depth bulk transfers
+ *        queued on the 0x86 endpoint and pushes each completed block into the
+ *        fifo from the completion callback. If the device has no real libusb
+ *        handle ( testing / mocks ) or the first submission fails, this falls
+ *        back to the synchronous work function set with
+ *        AIOContinuousBufSetCallback().
+ * @param object AIOContinuousBuf
+ * @return 
+ */
+void *AIOContinuousBufAsyncWorkFunction( void *object )
+{
+    static AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIO_ERROR_VALID_DATA_W_CODE( &retval, retval = AIOUSB_ERROR_INVALID_PARAMETER, object );
+
+    AIOContinuousBuf *buf = (AIOContinuousBuf*)object;
+    AIOContinuousBufAsyncState state;
+    AIOUSB_BOOL cancelled = AIOUSB_FALSE;
+    unsigned transfer_size = AIOContinuousBufGetAsyncTransferSize( buf );
+    memset( &state, 0, sizeof(state) );
+    state.buf = buf;
+    state.dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), (AIORESULT*)&retval );
+
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), (AIORESULT*)&retval );
+    AIO_ERROR_VALID_DATA( &retval, retval == AIOUSB_SUCCESS );
+
+    libusb_device_handle *handle = USBDeviceGetUSBDeviceHandle( usb );
+    if ( !handle )
+        return buf->callback( object );
+    state.usb = usb;
+    pthread_mutex_init( &state.lock, NULL );
+
+    if ( buf->callback == ConvertCountsToVoltsFunction ) {
+        AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), (AIORESULT*)&retval );
+        AIO_ERROR_VALID_DATA( &retval, retval == AIOUSB_SUCCESS );
+
+        state.num_scans = AIOContinuousBufGetNumberScans(buf);
+        if ( state.num_scans == LONG_MAX ) {
+            state.num_scans = 10000;
+        }
+        state.infifo = NewAIOFifoCounts( (unsigned)buf->num_channels*(buf->num_oversamples+1)*state.num_scans );
+        AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( dev, NULL );
+        state.ranges = NewAIOGainRangeFromAIOConversionPlan( plan );
+        AIOUSBDeviceReleaseConversionPlan( dev, plan );
+        if ( state.ranges ) 
+            state.cc = NewAIOCountsConverterWithScanLimiter( NULL, state.num_scans, buf->num_channels, state.ranges, buf->num_oversamples, sizeof(unsigned short) );
+        if ( !state.infifo || !state.cc ) {
+            _aiocontbuf_async_free( &state );
+            return buf->callback( object );
+        }
+    }
+
+    state.depth = buf->async_depth;
+    state.transfers = (struct libusb_transfer **)calloc( state.depth, sizeof(struct libusb_transfer *) );
+    state.submitted = (uint64_t *)calloc( state.depth, sizeof(uint64_t) );
+    AIO_ERROR_VALID_DATA_W_CODE( &retval, retval = AIOUSB_ERROR_NOT_ENOUGH_MEMORY; _aiocontbuf_async_free( &state ), state.transfers && state.submitted );
+
+    buf->start_scanning = AIOUSB_TRUE;
+
+    for ( unsigned i = 0; i < state.depth; i ++ ) {
+        unsigned char *block;
+        state.transfers[i] = libusb_alloc_transfer( 0 );
+        if ( !state.transfers[i] )
+            break;
+        block = (unsigned char *)malloc( transfer_size );
+        libusb_fill_bulk_transfer( state.transfers[i], handle, 0x86, block, transfer_size, aiocontbuf_async_transfer_cb, &state, 3000 );
+        if ( !block )
+            break;
+        /* Counted first, another thread may complete it straight away */
+        __atomic_add_fetch( &state.in_flight, 1, __ATOMIC_RELAXED );
+        if ( _aiocontbuf_async_submit( &state, state.transfers[i] ) != LIBUSB_SUCCESS ) {
+            __atomic_sub_fetch( &state.in_flight, 1, __ATOMIC_RELAXED );
+            break;
+        }
+    }
+
+    if ( __atomic_load_n( &state.in_flight, __ATOMIC_ACQUIRE ) == 0 ) {
+        AIOUSB_DEVEL("Unable to queue asynchronous transfers, using synchronous reads\n");
+        _aiocontbuf_async_free( &state );
+        return buf->callback( object );
+    }
+
+    while ( __atomic_load_n( &state.in_flight, __ATOMIC_ACQUIRE ) > 0 ) {
+        struct timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+        if ( !( buf->status & RUNNING ) && !cancelled ) {
+            for ( unsigned i = 0; i < state.depth; i ++ ) {
+                if ( state.transfers[i] )
+                    libusb_cancel_transfer( state.transfers[i] );
+            }
+            cancelled = AIOUSB_TRUE;
+        }
+    }
+
+    retval = ( buf->exitcode < 0 ? buf->exitcode : AIOUSB_SUCCESS );
+    _aiocontbuf_async_free( &state );
+
+    AIOUSB_DEVEL("Stopping\n");
+    if ( buf->callback == ConvertCountsToVoltsFunction ) {
+        AIOContinuousBufLock(buf);
+        buf->status = TERMINATED;
+        AIOContinuousBufUnlock(buf);
+        AIOContinuousBufCleanup( buf );
+        AIOUSB_ClearFIFO( AIOContinuousBufGetDeviceIndex(buf) ,   CLEAR_FIFO_METHOD_NOW );
+    } else {
+        AIOContinuousBufCleanup( buf );
+    }
+
+    pthread_exit((void*)&retval);
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE StartStreaming( AIOContinuousBuf *buf )
 {
@@ -1367,6 +2163,7 @@ AIORET_TYPE AIOContinuousBufCleanup( AIOContinuousBuf *buf )
     
     retval = (AIORET_TYPE)continuous_end( usb, data, 4 );
     ResetCounters( buf );
+    _AIOContinuousBufNotify( buf );
     return retval;
 }
 
@@ -1427,6 +2224,117 @@ AIORET_TYPE AIOContinuousBufNumberWriteSamplesRemaining( AIOContinuousBuf *buf )
     return AIOFifoWriteSizeRemainingNumElements( buf->fifo );
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Blocks until at least num_samples samples can be read, the
+ *        acquisition stops running or timeout_ms runs out. The producer
+ *        signals the wait, so no time is spent polling.
+ * @param buf 
+ * @param num_samples Samples wanted
+ * @param timeout_ms Milliseconds to wait, < 0 to wait until one of the other
+ *        two things happens
+ * @return Number of samples available, which is less than num_samples only
+ *         if the acquisition is not running, or -AIOUSB_ERROR_TIMEOUT
+ */
+AIORET_TYPE AIOContinuousBufWaitForSamples( AIOContinuousBuf *buf, unsigned long num_samples, int timeout_ms )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIORET_TYPE retval;
+#ifdef HAS_PTHREAD
+    struct timespec deadline;
+    int rc = 0;
+
+    if ( timeout_ms >= 0 ) {
+        clock_gettime( CLOCK_MONOTONIC, &deadline );
+        deadline.tv_sec  += timeout_ms / 1000;
+        deadline.tv_nsec += ( timeout_ms % 1000 ) * 1000000L;
+        if ( deadline.tv_nsec >= 1000000000L ) {
+            deadline.tv_sec  ++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    AIOContinuousBufLock( buf );
+    if ( __atomic_fetch_add( &buf->waiters, 1, __ATOMIC_SEQ_CST ) == 0 || num_samples < buf->wait_threshold )
+        buf->wait_threshold = num_samples;
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    while ( rc == 0 && (unsigned long)AIOFifoReadSizeNumElements( buf->fifo ) < num_samples && ( buf->status & RUNNING ) ) {
+        rc = ( timeout_ms < 0 ? pthread_cond_wait( &buf->data_ready, &buf->lock ) :
+               pthread_cond_timedwait( &buf->data_ready, &buf->lock, &deadline ) );
+    }
+
+    __atomic_sub_fetch( &buf->waiters, 1, __ATOMIC_SEQ_CST );
+    retval = AIOFifoReadSizeNumElements( buf->fifo );
+    AIOContinuousBufUnlock( buf );
+
+    if ( rc == ETIMEDOUT && (unsigned long)retval < num_samples )
+        retval = -AIOUSB_ERROR_TIMEOUT;
+#else
+    retval = AIOFifoReadSizeNumElements( buf->fifo );
+#endif
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Returns a file descriptor that becomes readable when at least
+ *        AIOContinuousBufGetWakeupThreshold() samples are available or the
+ *        acquisition stops, so that several buffers can be watched with
+ *        poll(), select() or epoll. Call AIOContinuousBufClearWakeup() once
+ *        it fires. The descriptor belongs to buf and is closed by
+ *        DeleteAIOContinuousBuf().
+ * @param buf 
+ * @return The descriptor, or < 0 if one can't be created
+ */
+AIORET_TYPE AIOContinuousBufGetWakeupFd( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+#ifdef __linux__
+    if ( buf->wakeup_fd < 0 ) {
+        buf->wakeup_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_FILE_NOT_FOUND, buf->wakeup_fd >= 0 );
+        /* Samples may already be waiting */
+        _AIOContinuousBufNotify( buf );
+    }
+    return buf->wakeup_fd;
+#else
+    return -AIOUSB_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufSetWakeupThreshold( AIOContinuousBuf *buf, unsigned long num_samples )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, num_samples > 0 );
+    buf->wakeup_threshold = num_samples;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetWakeupThreshold( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    return buf->wakeup_threshold;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Resets the wakeup descriptor so that it is readable again only
+ *        after the producer next finds the threshold met
+ * @return Number of wakeups since the last clear, 0 if there were none
+ */
+AIORET_TYPE AIOContinuousBufClearWakeup( AIOContinuousBuf *buf )
+{
+    AIO_ASSERT_AIOCONTBUF( buf );
+    uint64_t wakeups = 0;
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->wakeup_fd >= 0 );
+    if ( read( buf->wakeup_fd, &wakeups, sizeof(wakeups) ) != sizeof(wakeups) )
+        wakeups = 0;
+    return (AIORET_TYPE)wakeups;
+}
+
 
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBufReadNSamples( AIOContinuousBuf *buf, void *tobuf, size_t n_to_read )
@@ -1489,7 +2397,6 @@ AIORET_TYPE AIOContinuousBufCallbackStartCallbackWithAcquisitionFunction( AIOCon
     int data_read;
     AIORET_TYPE retval = 0;
     unsigned long tmp_remaining;
-    int sleep_value = 200;
 
     AIOUSB_DEVEL("Trying to consume %d bytes\n", (int)AIOContinuousBufGetTotalSamplesExpected(buf)*AIOContinuousBufGetUnitSize(buf) );
 
@@ -1497,9 +2404,13 @@ AIORET_TYPE AIOContinuousBufCallbackStartCallbackWithAcquisitionFunction( AIOCon
         if ( ( tmp_remaining = AIOContinuousBufNumberSamplesAvailable(buf) ) >= number_to_read(buf, cmd) ) {
             data_read = callback( buf );
             retval += data_read;
-        } else {
-            usleep(sleep_value);
+        } else if ( AIOContinuousBufWaitForSamples( buf, number_to_read(buf, cmd), (int)buf->timeout ) < 0 ) {
             AIOUSB_DEBUG("Buffer underflow error: %d samples available\n",AIOContinuousBufNumberSamplesAvailable(buf));
+        } else if ( !( buf->status & RUNNING ) && 
+                    (unsigned long)AIOContinuousBufNumberSamplesAvailable(buf) < number_to_read(buf, cmd) ) {
+            /* Nothing more is coming, so the remainder can never be handed out */
+            AIOUSB_DEBUG("Acquisition stopped with %d samples left over\n",(int)AIOContinuousBufNumberSamplesAvailable(buf));
+            break;
         }
     }
 
@@ -1679,6 +2590,7 @@ AIORET_TYPE AIOContinuousBufEnd( AIOContinuousBuf *buf )
     AIOUSB_DEVEL("\tWaiting for thread to terminate\n");
     AIOUSB_DEVEL("Set flag to FINISH\n");
     AIOContinuousBufUnlock( buf );
+    _AIOContinuousBufNotify( buf );
     AIOContinuousBufReset(buf);
 
 #ifdef HAS_PTHREAD
@@ -1687,6 +2599,8 @@ AIORET_TYPE AIOContinuousBufEnd( AIOContinuousBuf *buf )
     if ( ret != 0 ) {
         AIOUSB_ERROR("Error joining threads: %d\n", (int)ret );
     }
+    /* Only now, as the worker may have held the USBDevice of a replaced board */
+    _AIOContinuousBufSetStarted( buf, AIOUSB_FALSE );
     buf->status = JOINED;
     return ret;
 }
@@ -1813,6 +2727,7 @@ AIORET_TYPE AIOContinuousBufSetStartAndEndChannel( AIOContinuousBuf *buf, unsign
     retval= ADCConfigBlockSetScanRange( AIOUSBDeviceGetADCConfigBlock( deviceDesc ) , startChannel, endChannel );
     AIO_ERROR_VALID_DATA( retval, retval == AIOUSB_SUCCESS );
     buf->num_channels = ( endChannel - startChannel + 1 );
+    retval = _AIOContinuousBufUpdateActiveChannels( buf );
 
     return retval;
 }
@@ -2063,6 +2978,10 @@ AIOContinuousBuf *NewAIOContinuousBufFromJSON( const char *str )
         AIOContinuousBufSetTimeout( aiobuf, cJSON_AsInteger(tmp) );
     if ( ( tmp = cJSON_GetObjectItem(aiojson,"unit_size" )) )
         AIOContinuousBufSetUnitSize( aiobuf, cJSON_AsInteger(tmp) );
+    if ( ( tmp = cJSON_GetObjectItem(aiojson,"async_depth" )) )
+        AIOContinuousBufSetAsyncTransfers( aiobuf, cJSON_AsInteger(tmp), 
+                                           ( cJSON_GetObjectItem(aiojson,"async_transfer_size") ? 
+                                             cJSON_AsInteger(cJSON_GetObjectItem(aiojson,"async_transfer_size")) : 0 ));
 
     return aiobuf;
 }
@@ -2129,6 +3048,7 @@ char *AIOContinuousBufToJSON( AIOContinuousBuf *buf )
 
 #include "AIOUSBDevice.h"
 #include "gtest/gtest.h"
+#include <poll.h>
 
 #include <iostream>
 using namespace AIOUSB;
@@ -2337,6 +3257,156 @@ TEST_P(AIOContinuousBufThreeParamTest,BufferScanCounting )
     free(tobuf);
 }
 
+TEST(AIOContinuousBuf, PeekAndConsumeInPlace )
+{
+    int num_channels = 4;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 100, num_channels );
+    unsigned short data[10*4];
+    AIOFifoRegion region;
+    for ( int i = 0; i < 10*num_channels; i ++ ) 
+        data[i] = i;
+
+    ASSERT_EQ( sizeof(data), AIOContinuousBufPushN( buf, data, 10*num_channels ));
+    ASSERT_EQ( sizeof(data), AIOContinuousBufPeek( buf, &region ));
+    EXPECT_EQ( 0, ((unsigned short *)region.ptr[0])[0] );
+    EXPECT_EQ( 5, ((unsigned short *)region.ptr[0])[5] );
+
+    EXPECT_EQ( 3, AIOContinuousBufConsume( buf, 3*num_channels*sizeof(unsigned short) ));
+    EXPECT_EQ( 7, AIOContinuousBufCountScansAvailable( buf ));
+    ASSERT_EQ( 7*num_channels*sizeof(unsigned short), AIOContinuousBufPeek( buf, &region ));
+    EXPECT_EQ( 3*num_channels, ((unsigned short *)region.ptr[0])[0] );
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST(AIOContinuousBuf, ReadActiveScansFollowsTheMask )
+{
+    int num_channels = 8;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 100, num_channels );
+    unsigned short data[10*8], out[10*8];
+    for ( int i = 0; i < 10*num_channels; i ++ ) 
+        data[i] = i;
+
+    /* No channel set keeps every channel */
+    ASSERT_EQ( sizeof(data), AIOContinuousBufPushN( buf, data, 10*num_channels ));
+    ASSERT_EQ( 10, AIOContinuousBufReadActiveScans( buf, out, sizeof(out) ));
+    EXPECT_EQ( 0, memcmp( data, out, sizeof(data) ));
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetChannelMask( buf, NewAIOChannelMaskFromStr( "10100010" )));
+    ASSERT_EQ( sizeof(data), AIOContinuousBufPushN( buf, data, 10*num_channels ));
+    EXPECT_EQ( 4, AIOContinuousBufReadActiveScans( buf, out, 4*3*sizeof(unsigned short) ));
+    EXPECT_EQ( 6, AIOContinuousBufReadActiveScans( buf, out, sizeof(out) ));
+    EXPECT_EQ( 0, AIOContinuousBufCountScansAvailable( buf ));
+    for ( int s = 0; s < 6; s ++ ) {
+        EXPECT_EQ( (s+4)*8 + 1, out[s*3] );
+        EXPECT_EQ( (s+4)*8 + 5, out[s*3+1] );
+        EXPECT_EQ( (s+4)*8 + 7, out[s*3+2] );
+    }
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST(AIOContinuousBuf, ReadActiveScansAcrossTheWrap )
+{
+    int num_channels = 3;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 10, num_channels );
+    unsigned short data[4*3], out[4*2];
+    /* 30 counts are stored in 32, so rounds of four scans split one across the wrap */
+    AIOContinuousBufSetChannelMask( buf, NewAIOChannelMaskFromStr( "101" ));
+
+    for ( int round = 0; round < 8; round ++ ) {
+        for ( int i = 0; i < 4*num_channels; i ++ ) 
+            data[i] = round*100 + i;
+        ASSERT_EQ( sizeof(data), AIOContinuousBufPushN( buf, data, 4*num_channels ));
+        ASSERT_EQ( 4, AIOContinuousBufReadActiveScans( buf, out, sizeof(out) ));
+        for ( int s = 0; s < 4; s ++ ) {
+            EXPECT_EQ( round*100 + s*3, out[s*2] );
+            EXPECT_EQ( round*100 + s*3 + 2, out[s*2+1] );
+        }
+    }
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST(AIOContinuousBuf, AsyncTransfers )
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 1000, 16 );
+    ASSERT_TRUE( buf );
+
+    EXPECT_EQ( 0, AIOContinuousBufGetAsyncDepth(buf) ) << "Synchronous reads are the default\n";
+    EXPECT_EQ( AIOContinuousBufGetStreamingBlockSize(buf), AIOContinuousBufGetAsyncTransferSize(buf) ) << "Transfer size follows the block size by default\n";
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetAsyncTransfers( buf, 8, 16*1024 + 100 ) );
+    EXPECT_EQ( 8, AIOContinuousBufGetAsyncDepth(buf) );
+    EXPECT_EQ( 16*1024, AIOContinuousBufGetAsyncTransferSize(buf) ) << "Rounding of transfer size to multiple of 512\n";
+
+    AIOContinuousBufSetAsyncTransfers( buf, 4, 1 );
+    EXPECT_EQ( 512, AIOContinuousBufGetAsyncTransferSize(buf) ) << "Minimum size is 512\n";
+
+    EXPECT_LT( AIOContinuousBufSetAsyncTransfers( buf, AIOCONTBUF_MAX_ASYNC_DEPTH + 1, 0 ), 0 );
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST(AIOContinuousBuf, AsyncCompletions )
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 100, 4 );
+    AIOContinuousBufAsyncState state;
+    struct libusb_transfer xfer;
+    USBDevice usb;
+    unsigned short data[16];
+    for ( int i = 0; i < 16; i ++ )
+        data[i] = i;
+
+    AIOUSBDevice dev;
+    AIOTransferHistograms hists;
+    struct libusb_transfer *transfers[1] = { &xfer };
+    uint64_t submitted[1];
+
+    memset( &usb, 0, sizeof(usb) );
+    memset( &dev, 0, sizeof(dev) );
+    memset( &xfer, 0, sizeof(xfer) );
+    memset( &state, 0, sizeof(state) );
+    pthread_mutex_init( &state.lock, NULL );
+    state.buf = buf;
+    state.usb = &usb;
+    state.dev = &dev;
+    state.transfers = transfers;
+    state.submitted = submitted;
+    state.depth = 1;
+    xfer.user_data = &state;
+    xfer.buffer = (unsigned char *)data;
+    buf->status = RUNNING;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceEnableTransferHistograms( &dev, AIOUSB_TRUE ) );
+    submitted[0] = AIOTransferTimestamp();
+
+    xfer.status = LIBUSB_TRANSFER_COMPLETED;
+    xfer.actual_length = sizeof(data);
+    EXPECT_TRUE( _aiocontbuf_async_complete( &state, &xfer ) ) << "A running acquisition resubmits\n";
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceGetTransferHistograms( &dev, AIO_TRANSFER_CONTINUOUS, &hists ) );
+    EXPECT_EQ( 1u, hists.latency_ns.count ) << "Latency runs from the transfer's own submit time";
+    AIOUSBDeviceFreeTransferHistograms( &dev );
+    EXPECT_EQ( 4, AIOContinuousBufCountScansAvailable( buf ));
+    EXPECT_EQ( 16, state.count );
+    EXPECT_EQ( sizeof(data), usb.stats.bulk_bytes_in );
+
+    xfer.status = LIBUSB_TRANSFER_ERROR;
+    xfer.actual_length = 0;
+    for ( int i = 1; i < AIOCONTBUF_MAX_USB_FAILURES; i ++ )
+        EXPECT_TRUE( _aiocontbuf_async_complete( &state, &xfer ) );
+    EXPECT_EQ( AIOCONTBUF_MAX_USB_FAILURES - 1, usb.stats.retries );
+    EXPECT_FALSE( _aiocontbuf_async_complete( &state, &xfer ) ) << "The last failure stops the acquisition\n";
+    EXPECT_EQ( AIOCONTBUF_MAX_USB_FAILURES, usb.stats.errors );
+    EXPECT_LT( AIOContinuousBufGetExitCode( buf ), 0 );
+
+    /* A stopped acquisition retires the transfer instead of resubmitting it */
+    state.in_flight = 1;
+    aiocontbuf_async_transfer_cb( &xfer );
+    EXPECT_EQ( 0, state.in_flight );
+    EXPECT_EQ( AIOCONTBUF_MAX_USB_FAILURES + 2, usb.stats.bulk_transfers );
+
+    pthread_mutex_destroy( &state.lock );
+    DeleteAIOContinuousBuf( buf );
+}
+
 /**
  * @brief Test reading and writing from the AIOBuf
  *
@@ -2580,6 +3650,118 @@ TEST(AIOContinuousBuf,ReadingIntegerSamples)
 
 }
 
+static void *delayed_push( void *object )
+{
+    AIOContinuousBuf *buf = (AIOContinuousBuf *)object;
+    uint16_t counts[20] = {0};
+    usleep( 20000 );
+    AIOContinuousBufPushN( buf, counts, 20 );
+    usleep( 20000 );
+    AIOContinuousBufPushN( buf, counts, 20 );
+    return NULL;
+}
+
+TEST(AIOContinuousBuf,WaitForSamplesIsSignalled)
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBuf(0,16,0,1024);
+    pthread_t producer;
+    buf->status = RUNNING_OR_WITH_DATA;
+
+    EXPECT_EQ( -AIOUSB_ERROR_TIMEOUT, AIOContinuousBufWaitForSamples( buf, 40, 10 ) );
+
+    pthread_create( &producer, NULL, delayed_push, buf );
+    EXPECT_EQ( 40, AIOContinuousBufWaitForSamples( buf, 40, 5000 ) );
+    pthread_join( producer, NULL );
+
+    buf->status = TERMINATED;
+    EXPECT_EQ( 40, AIOContinuousBufWaitForSamples( buf, 100, -1 ) ) << "A stopped acquisition never blocks";
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+static int pushed;
+
+static void *push_once( void *object )
+{
+    AIOContinuousBuf *buf = (AIOContinuousBuf *)object;
+    uint16_t counts[20] = {0};
+    AIOContinuousBufPushN( buf, counts, 20 );
+    __atomic_store_n( &pushed, 1, __ATOMIC_SEQ_CST );
+    return NULL;
+}
+
+TEST(AIOContinuousBuf,PushWithoutWaitersSkipsTheLock)
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBuf(0,16,0,1024);
+    pthread_t producer;
+    int i;
+    buf->status = RUNNING_OR_WITH_DATA;
+    ASSERT_TRUE( buf->fifo->spsc );
+
+    pushed = 0;
+    AIOContinuousBufLock( buf );
+    pthread_create( &producer, NULL, push_once, buf );
+    for ( i = 0; i < 5000 && !__atomic_load_n( &pushed, __ATOMIC_SEQ_CST ); i ++ )
+        usleep( 1000 );
+    EXPECT_EQ( 1, __atomic_load_n( &pushed, __ATOMIC_SEQ_CST ) ) << "Nobody is waiting, so the push must not block on the lock";
+    AIOContinuousBufUnlock( buf );
+    pthread_join( producer, NULL );
+    EXPECT_EQ( 20, AIOContinuousBufNumberSamplesAvailable( buf ) );
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+static void *run_until_stopped( void *object )
+{
+    AIOContinuousBuf *buf = (AIOContinuousBuf *)object;
+    while ( buf->status & RUNNING )
+        usleep( 1000 );
+    return NULL;
+}
+
+TEST(AIOContinuousBuf,UnpluggedDeviceStopsAcquisition)
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBuf(3,16,0,1024);
+    AIOContinuousBufSetCallback( buf, run_until_stopped );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStart( buf ) );
+
+    EXPECT_EQ( 0, AIOContinuousBufDeviceRemoved( 2 ) ) << "Acquisitions on other devices keep going";
+    EXPECT_EQ( 1, AIOContinuousBufDeviceRemoved( 3 ) );
+    EXPECT_EQ( 0, AIOContinuousBufWaitForSamples( buf, 100, -1 ) ) << "Waiting readers are woken";
+
+    AIOContinuousBufEnd( buf );
+    EXPECT_EQ( -AIOUSB_ERROR_DEVICE_REMOVED, AIOContinuousBufGetExitCode( buf ) );
+    EXPECT_EQ( 0, AIOContinuousBufDeviceRemoved( 3 ) ) << "Ended acquisitions are forgotten";
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST(AIOContinuousBuf,WakeupFdFollowsThreshold)
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBuf(0,16,0,1024);
+    uint16_t counts[20] = {0};
+    struct pollfd pfd;
+    buf->status = RUNNING_OR_WITH_DATA;
+
+    AIOContinuousBufSetWakeupThreshold( buf, 20 );
+    pfd.fd     = (int)AIOContinuousBufGetWakeupFd( buf );
+    pfd.events = POLLIN;
+    ASSERT_GE( pfd.fd, 0 );
+
+    AIOContinuousBufPushN( buf, counts, 10 );
+    EXPECT_EQ( 0, poll( &pfd, 1, 0 ) );
+    AIOContinuousBufPushN( buf, counts, 10 );
+    EXPECT_EQ( 1, poll( &pfd, 1, 0 ) );
+    EXPECT_EQ( 1, AIOContinuousBufClearWakeup( buf ) );
+    EXPECT_EQ( 0, poll( &pfd, 1, 0 ) );
+
+    AIOContinuousBufPopN( buf, counts, 20 );
+    AIOContinuousBufStopAcquisition( buf );
+    EXPECT_EQ( 1, poll( &pfd, 1, 0 ) ) << "Stopping wakes the poller with the fifo empty";
+
+    DeleteAIOContinuousBuf( buf );
+}
+
 TEST(AIOContiuousBuf,JSONFunctions)
 {
     int numDevices = 0;
@@ -18,6 +18,7 @@
 #include "AIOUSB_Core.h"
 #include "AIOBuf.h"
 #include "AIOCmd.h"
+#include "AIOThreadPolicy.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -67,8 +68,13 @@ typedef struct AIOContinuousBuf {
 #ifdef HAS_PTHREAD
     pthread_t worker;
     pthread_mutex_t lock;
+    pthread_cond_t data_ready;          /**< Broadcast under lock when wait_threshold is met or the acquisition stops */
     pthread_attr_t tattr;
 #endif
+    unsigned waiters;                   /**< Threads blocked in AIOContinuousBufWaitForSamples, changed atomically under lock so producers can read it without the lock */
+    unsigned long wait_threshold;       /**< Samples the blocked threads are waiting for */
+    unsigned long wakeup_threshold;     /**< Samples that make wakeup_fd readable */
+    int wakeup_fd;                      /**< eventfd handed out by AIOContinuousBufGetWakeupFd, -1 until then */
     AIOUSB_WorkFn work;
     int DeviceIndex;
     AIOFifoTYPE *fifo;
@@ -84,6 +90,8 @@ typedef struct AIOContinuousBuf {
     int64_t scans_read;
     AIOUSB_BOOL start_scanning;
     unsigned block_size;
+    unsigned async_depth;               /**< Number of bulk transfers kept in flight, 0 uses synchronous reads */
+    unsigned async_transfer_size;       /**< Bytes per asynchronous bulk transfer, 0 uses block_size */
     int64_t bytes_processed;
     unsigned counter_control;
     unsigned timeout;
@@ -92,6 +100,9 @@ typedef struct AIOContinuousBuf {
     AIOUSB_BOOL testing;
     AIOUSB_BOOL debug;
     AIOChannelMask *mask;               /**< Used for keeping track of channels */
+    int *active_channels;               /**< Channels of the mask in ascending order, every channel when it has none */
+    unsigned num_active_channels;
+    AIOThreadPolicy *thread_policy;     /**< Applied by the worker thread when it starts, NULL to leave it alone */
 
     volatile THREAD_STATUS status; /* Are we running, paused ..etc; */
     AIO_CONT_BUF_TYPE type;
@@ -100,6 +111,7 @@ typedef struct AIOContinuousBuf {
 } AIOContinuousBuf;
 
 #define ROOTCLOCK 10000000
+#define AIOCONTBUF_MAX_ASYNC_DEPTH 64
 
 /* BEGIN AIOUSB_API */
 /*-----------------------------  Constructors  ------------------------------*/
@@ -126,6 +138,10 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetCallback(AIOContinuousBuf *buf , vo
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetStreamingBlockSize( AIOContinuousBuf *buf, unsigned sblksize);
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetStreamingBlockSize( AIOContinuousBuf *buf );
 
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetAsyncTransfers( AIOContinuousBuf *buf, unsigned depth, unsigned transfer_size );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetAsyncDepth( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetAsyncTransferSize( AIOContinuousBuf *buf );
+
 PUBLIC_EXTERN ADCConfigBlock *AIOContinuousBufGetADCConfigBlock( AIOContinuousBuf *buf );
 
 
@@ -175,6 +191,11 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetNumberScans( AIOContinuousBuf *buf
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufNumberWriteSamplesRemaining( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufNumberSamplesAvailable( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufWaitForSamples( AIOContinuousBuf *buf, unsigned long num_samples, int timeout_ms );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetWakeupFd( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetWakeupThreshold( AIOContinuousBuf *buf, unsigned long num_samples );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetWakeupThreshold( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufClearWakeup( AIOContinuousBuf *buf );
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetNumberSamplesPerScan( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetTotalSamplesExpected(  AIOContinuousBuf *buf );
@@ -183,6 +204,9 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReset( AIOContinuousBuf *buf );
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPushN(AIOContinuousBuf *buf ,void  *frombuf, unsigned int N );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPopN(AIOContinuousBuf *buf , void *tobuf, unsigned int N );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPeek( AIOContinuousBuf *buf, AIOFifoRegion *region );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufConsume( AIOContinuousBuf *buf, unsigned size );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadActiveScans( AIOContinuousBuf *buf, void *tobuf, unsigned tobufsize );
 
 
 /*-----------------------------  Deprecated / Refactored   -------------------------------*/
@@ -222,6 +246,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufUnlock( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCallbackStart( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCallbackStartCallbackWithAcquisitionFunction( AIOContinuousBuf *buf, AIOCmd *cmd, AIORET_TYPE (*callback)( AIOContinuousBuf *buf) );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufStopAcquisition( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetThreadPolicy( AIOContinuousBuf *buf, const AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetThreadPolicyReport( AIOContinuousBuf *buf, AIOThreadPolicyReport *report );
 
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufInitiateCallbackAcquisition( AIOContinuousBuf *buf );
@@ -233,6 +259,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetWritePosition( AIOContinuousBuf *bu
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetRemainingSize( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetStatus( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetExitCode( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufDeviceRemoved( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufDeviceInUse( unsigned long DeviceIndex );
 PUBLIC_EXTERN THREAD_STATUS AIOContinuousBufGetRunStatus( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPending( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetScansRead( AIOContinuousBuf *buf );
@@ -0,0 +1,529 @@
+/**
+ * @file   AIOConversionPlan.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Per channel counts to volts tables compiled from an ADCConfigBlock
+ *
+ */
+
+#include "AIOConversionPlan.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_Log.h"
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+AIOConversionPlan *NewAIOConversionPlan( void )
+{
+    return (AIOConversionPlan *)calloc( 1, sizeof(AIOConversionPlan) );
+}
+
+/*----------------------------------------------------------------------------*/
+static void _AIOConversionPlanFreeLUT( AIOConversionPlan *plan )
+{
+    for ( int i = 0; i < AD_NUM_GAIN_CODES; i ++ ) {
+        free( plan->lut[i] );
+        plan->lut[i] = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIOConversionPlan( AIOConversionPlan *plan )
+{
+    if ( !plan )
+        return;
+    _AIOConversionPlanFreeLUT( plan );
+    free( plan );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Builds the lookup table for every gain code that some channel uses
+ */
+static AIORET_TYPE _AIOConversionPlanBuildLUT( AIOConversionPlan *plan )
+{
+    for ( unsigned channel = 0; channel < plan->num_channels; channel ++ ) {
+        unsigned gain = plan->gain_code[channel];
+        if ( plan->lut[gain] )
+            continue;
+
+        plan->lut[gain] = (double *)malloc( (AI_16_MAX_COUNTS + 1)*sizeof(double) );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, plan->lut[gain] );
+
+        const struct ADRange *range = &adRanges[ gain ];
+        for ( unsigned counts = 0; counts <= AI_16_MAX_COUNTS; counts ++ )
+            plan->lut[gain][counts] = ( (( double )counts / ( double )AI_16_MAX_COUNTS) * range->range ) + range->minVolts;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Compiles the gain settings in config into plan
+ * @param plan Plan to fill in
+ * @param config Config block with valid mux settings
+ * @return AIOUSB_SUCCESS or negative error
+ */
+AIORET_TYPE AIOConversionPlanBuild( AIOConversionPlan *plan, const ADCConfigBlock *config )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, plan && config );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_ADCCONFIG_SETTING, config->size );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_CHANNELS_PER_GROUP_SETTING, config->mux_settings.ADCChannelsPerGroup );
+
+    unsigned num_channels = config->mux_settings.ADCMUXChannels;
+    if ( num_channels > AD_MAX_CHANNELS )
+        num_channels = AD_MAX_CHANNELS;
+
+    _AIOConversionPlanFreeLUT( plan );
+    plan->built = 0;
+
+    for ( unsigned channel = 0; channel < num_channels; channel ++ ) {
+        AIORET_TYPE gain = ADCConfigBlockGetGainCode( config, channel );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_GAINCODE, gain >= 0 && gain < AD_NUM_GAIN_CODES );
+
+        const struct ADRange *range = &adRanges[ gain ];
+        plan->gain_code[channel]  = (unsigned char)gain;
+        plan->scale[channel]      = range->range / ( double )AI_16_MAX_COUNTS;
+        plan->offset[channel]     = range->minVolts;
+        plan->ranges[channel].min = range->minVolts;
+        plan->ranges[channel].max = range->minVolts + range->range;
+    }
+
+    plan->num_channels       = num_channels;
+    plan->channels_per_group = config->mux_settings.ADCChannelsPerGroup;
+    memcpy( plan->gain_registers, &config->registers[AD_CONFIG_GAIN_CODE], AD_NUM_GAIN_CODE_REGISTERS );
+
+    if ( plan->use_lut ) {
+        AIORET_TYPE retval = _AIOConversionPlanBuildLUT( plan );
+        if ( retval != AIOUSB_SUCCESS )
+            return retval;
+    }
+
+    plan->built = 1;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @return AIOUSB_TRUE if plan was compiled from the same gain settings that
+ *         config holds now
+ */
+AIORET_TYPE AIOConversionPlanIsCurrent( const AIOConversionPlan *plan, const ADCConfigBlock *config )
+{
+    if ( !plan || !config || !plan->built )
+        return AIOUSB_FALSE;
+
+    return ( plan->channels_per_group == config->mux_settings.ADCChannelsPerGroup &&
+             plan->num_channels == ( config->mux_settings.ADCMUXChannels > AD_MAX_CHANNELS ?
+                                     (unsigned)AD_MAX_CHANNELS : config->mux_settings.ADCMUXChannels ) &&
+             memcmp( plan->gain_registers, &config->registers[AD_CONFIG_GAIN_CODE], AD_NUM_GAIN_CODE_REGISTERS ) == 0 ?
+             AIOUSB_TRUE : AIOUSB_FALSE );
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOConversionPlanInvalidate( AIOConversionPlan *plan )
+{
+    if ( plan )
+        plan->built = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Turns the 64K entry lookup tables on or off. The tables cost
+ * 512KB per gain code in use and replace the multiply/add with a load.
+ */
+AIORET_TYPE AIOConversionPlanSetLUT( AIOConversionPlan *plan, AIOUSB_BOOL use_lut )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, plan );
+
+    plan->use_lut = ( use_lut ? 1 : 0 );
+    if ( !plan->use_lut ) {
+        _AIOConversionPlanFreeLUT( plan );
+        return AIOUSB_SUCCESS;
+    }
+
+    return ( plan->built ? _AIOConversionPlanBuildLUT( plan ) : AIOUSB_SUCCESS );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Converts counts read from startChannel .. startChannel+numChannels-1
+ * @return AIOUSB_SUCCESS or negative error
+ */
+AIORET_TYPE AIOConversionPlanCountsToVolts( const AIOConversionPlan *plan,
+                                            unsigned startChannel,
+                                            unsigned numChannels,
+                                            const unsigned short *counts,
+                                            double *volts
+                                            )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, plan && counts && volts );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_ADCCONFIG_SETTING, plan->built );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, startChannel + numChannels <= plan->num_channels );
+
+    const double *scale  = plan->scale + startChannel;
+    const double *offset = plan->offset + startChannel;
+
+    if ( plan->use_lut ) {
+        const unsigned char *gain = plan->gain_code + startChannel;
+        for ( unsigned channel = 0; channel < numChannels; channel ++ )
+            volts[channel] = plan->lut[ gain[channel] ][ counts[channel] ];
+    } else {
+        for ( unsigned channel = 0; channel < numChannels; channel ++ )
+            volts[channel] = counts[channel] * scale[channel] + offset[channel];
+    }
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copy of the plan's ranges, AD_MAX_CHANNELS long, for handing to an
+ *        AIOCountsConverter. Free with DeleteAIOGainRange()
+ */
+AIOGainRange *NewAIOGainRangeFromAIOConversionPlan( const AIOConversionPlan *plan )
+{
+    if ( !plan || !plan->built )
+        return NULL;
+
+    AIOGainRange *tmp = (AIOGainRange *)calloc( AD_MAX_CHANNELS, sizeof(AIOGainRange) );
+    if ( !tmp )
+        return tmp;
+
+    memcpy( tmp, plan->ranges, plan->num_channels*sizeof(AIOGainRange) );
+    return tmp;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ * @brief A copy of the device's current plan, or an empty plan, without
+ *        its lookup tables and not yet published. Called with the device lock.
+ */
+static AIOConversionPlan *_AIOUSBDeviceNextConversionPlan( AIOUSBDevice *dev )
+{
+    AIOConversionPlan *plan = NewAIOConversionPlan();
+    if ( plan && dev->conversionPlan ) {
+        memcpy( plan, dev->conversionPlan, sizeof(*plan) );
+        memset( plan->lut, 0, sizeof(plan->lut) );
+    }
+    return plan;
+}
+
+/**
+ * @brief Frees the plans the current one retired if no reader holds a plan.
+ *        Readers count themselves before loading the current plan, so one
+ *        that counts itself after this looks only ever gets the current
+ *        plan. Called with the device lock.
+ */
+static void _AIOUSBDeviceReclaimConversionPlans( AIOUSBDevice *dev )
+{
+    AIOConversionPlan *plan = dev->conversionPlan;
+    if ( !plan || !plan->retired || __atomic_load_n( &dev->conversionPlanReaders, __ATOMIC_SEQ_CST ) != 0 )
+        return;
+
+    AIOConversionPlan *retired = plan->retired;
+    plan->retired = NULL;
+    for ( AIOConversionPlan *next; retired; retired = next ) {
+        next = retired->retired;
+        DeleteAIOConversionPlan( retired );
+    }
+}
+
+/**
+ * @brief Makes plan the device's current plan, retiring the one before it.
+ *        Called with the device lock.
+ */
+static void _AIOUSBDevicePublishConversionPlan( AIOUSBDevice *dev, AIOConversionPlan *plan )
+{
+    plan->retired = dev->conversionPlan;
+    __atomic_store_n( &dev->conversionPlan, plan, __ATOMIC_SEQ_CST );
+    _AIOUSBDeviceReclaimConversionPlans( dev );
+}
+
+/**
+ * @brief Drops a reader, reclaiming the retired plans if it was the last
+ */
+static void _AIOUSBDeviceLeaveConversionPlan( AIOUSBDevice *dev )
+{
+    if ( __atomic_sub_fetch( &dev->conversionPlanReaders, 1, __ATOMIC_SEQ_CST ) != 0 )
+        return;
+
+    AIOConversionPlan *current = __atomic_load_n( &dev->conversionPlan, __ATOMIC_ACQUIRE );
+    if ( current && current->retired && pthread_mutex_trylock( &dev->lock ) == 0 ) {
+        _AIOUSBDeviceReclaimConversionPlans( dev );
+        AIOUSBDeviceUnlock( dev );
+    }
+} /** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Returns the device's plan, recompiling it only when the cached
+ *        config block's gain settings differ from the ones it was built with.
+ *        A current plan is returned without locking; a rebuild takes the
+ *        device lock and publishes a new plan. The plan stays valid until
+ *        it is handed back with AIOUSBDeviceReleaseConversionPlan().
+ * @param dev Device whose cachedConfigBlock has been read
+ * @param result Set to AIOUSB_SUCCESS or a negative error
+ */
+AIOConversionPlan *AIOUSBDeviceGetConversionPlan( AIOUSBDevice *dev, AIORET_TYPE *result )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIOConversionPlan *plan = NULL;
+    ADCConfigBlock *config;
+
+    if ( !dev ) {
+        retval = -AIOUSB_ERROR_INVALID_DEVICE;
+        goto out_AIOUSBDeviceGetConversionPlan;
+    }
+    config = AIOUSBDeviceGetADCConfigBlock( dev );
+
+    __atomic_add_fetch( &dev->conversionPlanReaders, 1, __ATOMIC_SEQ_CST );
+    plan = __atomic_load_n( &dev->conversionPlan, __ATOMIC_SEQ_CST );
+    if ( AIOConversionPlanIsCurrent( plan, config ) )
+        goto out_AIOUSBDeviceGetConversionPlan;
+
+    AIOUSBDeviceLock( dev );
+    plan = dev->conversionPlan;
+    if ( !AIOConversionPlanIsCurrent( plan, config ) ) {
+        AIOUSB_DEVEL("Rebuilding conversion plan for device %d\n", dev->deviceIndex );
+        if ( !(plan = _AIOUSBDeviceNextConversionPlan( dev )) ) {
+            retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        } else if ( (retval = AIOConversionPlanBuild( plan, config )) != AIOUSB_SUCCESS ) {
+            DeleteAIOConversionPlan( plan );
+        } else {
+            _AIOUSBDevicePublishConversionPlan( dev, plan );
+        }
+    }
+    AIOUSBDeviceUnlock( dev );
+    if ( retval != AIOUSB_SUCCESS )
+        _AIOUSBDeviceLeaveConversionPlan( dev );
+
+ out_AIOUSBDeviceGetConversionPlan:
+    if ( result )
+        *result = retval;
+    return ( retval == AIOUSB_SUCCESS ? plan : NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands back a plan from AIOUSBDeviceGetConversionPlan(). The last
+ *        reader to leave frees the plans retired while it held one. If the
+ *        device lock is busy, the next publisher or last reader does.
+ * @param dev
+ * @param plan The plan, NULL if getting it failed
+ */
+void AIOUSBDeviceReleaseConversionPlan( AIOUSBDevice *dev, AIOConversionPlan *plan )
+{
+    if ( !dev || !plan )
+        return;
+    _AIOUSBDeviceLeaveConversionPlan( dev );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceSetConversionLUT( AIOUSBDevice *dev, AIOUSB_BOOL use_lut )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+    AIORET_TYPE retval;
+
+    AIOUSBDeviceLock( dev );
+    AIOConversionPlan *plan = _AIOUSBDeviceNextConversionPlan( dev );
+    if ( !plan ) {
+        retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    } else if ( (retval = AIOConversionPlanSetLUT( plan, use_lut )) != AIOUSB_SUCCESS ) {
+        DeleteAIOConversionPlan( plan );
+    } else {
+        _AIOUSBDevicePublishConversionPlan( dev, plan );
+    }
+    AIOUSBDeviceUnlock( dev );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOUSBDeviceInvalidateConversionPlan( AIOUSBDevice *dev )
+{
+    if ( !dev || !dev->conversionPlan )
+        return;
+
+    AIOUSBDeviceLock( dev );
+    AIOConversionPlan *plan = _AIOUSBDeviceNextConversionPlan( dev );
+    if ( plan ) {
+        AIOConversionPlanInvalidate( plan );
+        _AIOUSBDevicePublishConversionPlan( dev, plan );
+    }
+    AIOUSBDeviceUnlock( dev );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frees the current plan and every plan it retired. Only call this
+ *        once nothing converts with the device's plans any more.
+ */
+void AIOUSBDeviceFreeConversionPlan( AIOUSBDevice *dev )
+{
+    if ( !dev )
+        return;
+    for ( AIOConversionPlan *plan = dev->conversionPlan, *next; plan; plan = next ) {
+        next = plan->retired;
+        DeleteAIOConversionPlan( plan );
+    }
+    dev->conversionPlan = NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#ifdef SELF_TEST
+
+#include "AIOUSBDevice.h"
+#include "AIOUSB_ADC.h"
+#include "gtest/gtest.h"
+
+using namespace AIOUSB;
+
+static void init_config( ADCConfigBlock *config, unsigned mux_channels, unsigned per_group )
+{
+    memset( config, 0, sizeof(*config) );
+    ADCConfigBlockInitializeDefault( config );
+    config->mux_settings.ADCMUXChannels      = mux_channels;
+    config->mux_settings.ADCChannelsPerGroup = per_group;
+    config->mux_settings.defined             = AIOUSB_TRUE;
+}
+
+TEST(AIOConversionPlan, MatchesDirectFormula )
+{
+    ADCConfigBlock config;
+    AIOConversionPlan *plan = NewAIOConversionPlan();
+    unsigned short counts[16];
+    double volts[16];
+
+    init_config( &config, 16, 1 );
+    for ( int i = 0; i < 16; i ++ ) {
+        ADCConfigBlockSetGainCode( &config, i, i % AD_NUM_GAIN_CODES );
+        counts[i] = (unsigned short)( i * 4099 );
+    }
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOConversionPlanBuild( plan, &config ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOConversionPlanCountsToVolts( plan, 0, 16, counts, volts ) );
+    for ( int i = 0; i < 16; i ++ ) {
+        const struct ADRange *range = &adRanges[ i % AD_NUM_GAIN_CODES ];
+        EXPECT_NEAR( ((double)counts[i] / AI_16_MAX_COUNTS) * range->range + range->minVolts, volts[i], 1e-12 );
+        EXPECT_EQ( range->minVolts, plan->ranges[i].min );
+    }
+
+    /* The lookup table holds the original formula exactly */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOConversionPlanSetLUT( plan, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOConversionPlanCountsToVolts( plan, 4, 8, counts + 4, volts ) );
+    for ( int i = 0; i < 8; i ++ ) {
+        const struct ADRange *range = &adRanges[ (i + 4) % AD_NUM_GAIN_CODES ];
+        EXPECT_EQ( ((double)counts[i+4] / AI_16_MAX_COUNTS) * range->range + range->minVolts, volts[i] );
+    }
+
+    EXPECT_LT( AIOConversionPlanCountsToVolts( plan, 10, 8, counts, volts ), 0 );
+    DeleteAIOConversionPlan( plan );
+}
+
+TEST(AIOConversionPlan, GroupedChannelsShareGainRegister )
+{
+    ADCConfigBlock config;
+    AIOConversionPlan *plan = NewAIOConversionPlan();
+
+    init_config( &config, 64, 4 );
+    ADCConfigBlockSetGainCode( &config, 8, AD_GAIN_CODE_0_5V );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOConversionPlanBuild( plan, &config ) );
+    EXPECT_EQ( 64, plan->num_channels );
+    for ( int i = 8; i < 12; i ++ )
+        EXPECT_EQ( AD_GAIN_CODE_0_5V, plan->gain_code[i] );
+    EXPECT_EQ( ADCConfigBlockGetGainCode( &config, 12 ), plan->gain_code[12] );
+
+    DeleteAIOConversionPlan( plan );
+}
+
+TEST(AIOConversionPlan, DeviceRebuildsOnlyWhenGainsChange )
+{
+    AIOUSBDevice dev;
+    AIORET_TYPE result;
+    memset( &dev, 0, sizeof(dev) );
+    init_config( &dev.cachedConfigBlock, 16, 1 );
+
+    AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( &dev, &result );
+    ASSERT_EQ( AIOUSB_SUCCESS, result );
+    ASSERT_TRUE( plan );
+    plan->scale[0] = 42.0;      /* marker, survives if the plan is not rebuilt */
+
+    /* Scan range changes do not touch the gains */
+    AIOUSB_SetScanRange( &dev.cachedConfigBlock, 2, 5 );
+    EXPECT_EQ( plan, AIOUSBDeviceGetConversionPlan( &dev, &result ) );
+    AIOUSBDeviceReleaseConversionPlan( &dev, plan );
+    EXPECT_EQ( 42.0, plan->scale[0] );
+
+    ADCConfigBlockSetGainCode( &dev.cachedConfigBlock, 0, AD_GAIN_CODE_0_1V );
+    AIOConversionPlan *old = plan;
+    plan = AIOUSBDeviceGetConversionPlan( &dev, &result );
+    ASSERT_TRUE( plan );
+    EXPECT_NE( old, plan ) << "A rebuild publishes a new plan\n";
+    EXPECT_EQ( 42.0, old->scale[0] ) << "and leaves the one in use alone\n";
+    EXPECT_EQ( old, plan->retired );
+    EXPECT_EQ( AD_GAIN_CODE_0_1V, plan->gain_code[0] );
+    EXPECT_EQ( adRanges[AD_GAIN_CODE_0_1V].range / AI_16_MAX_COUNTS, plan->scale[0] );
+
+    AIOUSBDeviceReleaseConversionPlan( &dev, old );
+    EXPECT_EQ( old, plan->retired ) << "Kept while a reader holds a plan\n";
+    AIOUSBDeviceReleaseConversionPlan( &dev, plan );
+    EXPECT_FALSE( plan->retired ) << "and freed by the last one to leave\n";
+    EXPECT_EQ( 0, dev.conversionPlanReaders );
+
+    plan->scale[0] = 42.0;
+    AIOUSBDeviceInvalidateConversionPlan( &dev );
+    EXPECT_FALSE( dev.conversionPlan->retired ) << "Nobody reads, so the old plan goes straight away\n";
+    plan = AIOUSBDeviceGetConversionPlan( &dev, &result );
+    ASSERT_TRUE( plan );
+    EXPECT_NE( 42.0, plan->scale[0] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceSetConversionLUT( &dev, AIOUSB_TRUE ) );
+    AIOConversionPlan *lut_plan = AIOUSBDeviceGetConversionPlan( &dev, &result );
+    ASSERT_TRUE( lut_plan );
+    EXPECT_TRUE( lut_plan->lut[AD_GAIN_CODE_0_1V] );
+    EXPECT_EQ( plan, lut_plan->retired );
+    EXPECT_FALSE( plan->lut[AD_GAIN_CODE_0_1V] );
+    AIOUSBDeviceReleaseConversionPlan( &dev, plan );
+
+    AIOGainRange *ranges = NewAIOGainRangeFromAIOConversionPlan( lut_plan );
+    ASSERT_TRUE( ranges );
+    EXPECT_EQ( adRanges[AD_GAIN_CODE_0_1V].minVolts, ranges[0].min );
+    DeleteAIOGainRange( ranges );
+    AIOUSBDeviceReleaseConversionPlan( &dev, lut_plan );
+
+    /* Config changes over a long session do not pile plans up */
+    for ( int i = 0; i < 100; i ++ ) {
+        ADCConfigBlockSetGainCode( &dev.cachedConfigBlock, 0, ( i & 1 ) ? AD_GAIN_CODE_0_5V : AD_GAIN_CODE_0_10V );
+        plan = AIOUSBDeviceGetConversionPlan( &dev, &result );
+        ASSERT_TRUE( plan );
+        AIOUSBDeviceReleaseConversionPlan( &dev, plan );
+        EXPECT_FALSE( dev.conversionPlan->retired );
+    }
+
+    AIOUSBDeviceFreeConversionPlan( &dev );
+    EXPECT_FALSE( dev.conversionPlan );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file   AIOConversionPlan.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Per channel counts to volts tables compiled from an ADCConfigBlock
+ *
+ */
+
+#ifndef _AIO_CONVERSION_PLAN_H
+#define _AIO_CONVERSION_PLAN_H
+
+#include "AIOTypes.h"
+#include "ADCConfigBlock.h"
+#include "AIOCountsConverter.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/* BEGIN AIOUSB_API */
+
+/**
+ * @brief The gain setting of every channel turned into a multiplier and an
+ * offset ( volts = counts * scale + offset ), plus an optional 65536 entry
+ * table per gain code in use. A plan remembers the gain registers it was
+ * compiled from, so that a change to the config block is noticed no matter
+ * which setter made it.
+ *
+ * A device never changes a plan it has handed out. A new gain setting,
+ * AIOUSBDeviceSetConversionLUT() or AIOUSBDeviceInvalidateConversionPlan()
+ * publishes a new plan and keeps the old one on its retired list until no
+ * thread holds a plan from AIOUSBDeviceGetConversionPlan() any more, so
+ * hand every plan back with AIOUSBDeviceReleaseConversionPlan().
+ */
+typedef struct aio_conversion_plan {
+    unsigned num_channels;                                      /**< Channels covered, ADCMUXChannels */
+    unsigned long channels_per_group;
+    unsigned char gain_registers[AD_NUM_GAIN_CODE_REGISTERS];   /**< Registers the plan was compiled from */
+    int built;
+    int use_lut;
+    unsigned char gain_code[AD_MAX_CHANNELS];
+    double scale[AD_MAX_CHANNELS];                              /**< Volts per count */
+    double offset[AD_MAX_CHANNELS];                             /**< Volts at zero counts */
+    AIOGainRange ranges[AD_MAX_CHANNELS];                       /**< Same ranges in AIOCountsConverter form */
+    double *lut[AD_NUM_GAIN_CODES];                             /**< Optional counts to volts tables */
+    struct aio_conversion_plan *retired;                        /**< Plan this one replaced, freed once no reader holds a plan */
+} AIOConversionPlan;
+
+PUBLIC_EXTERN AIOConversionPlan *NewAIOConversionPlan( void );
+PUBLIC_EXTERN void DeleteAIOConversionPlan( AIOConversionPlan *plan );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanBuild( AIOConversionPlan *plan, const ADCConfigBlock *config );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanIsCurrent( const AIOConversionPlan *plan, const ADCConfigBlock *config );
+PUBLIC_EXTERN void AIOConversionPlanInvalidate( AIOConversionPlan *plan );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanSetLUT( AIOConversionPlan *plan, AIOUSB_BOOL use_lut );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanCountsToVolts( const AIOConversionPlan *plan, unsigned startChannel, unsigned numChannels, const unsigned short *counts, double *volts );
+PUBLIC_EXTERN AIOGainRange *NewAIOGainRangeFromAIOConversionPlan( const AIOConversionPlan *plan );
+
+PUBLIC_EXTERN AIOConversionPlan *AIOUSBDeviceGetConversionPlan( AIOUSBDevice *dev, AIORET_TYPE *result );
+PUBLIC_EXTERN void AIOUSBDeviceReleaseConversionPlan( AIOUSBDevice *dev, AIOConversionPlan *plan );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetConversionLUT( AIOUSBDevice *dev, AIOUSB_BOOL use_lut );
+PUBLIC_EXTERN void AIOUSBDeviceInvalidateConversionPlan( AIOUSBDevice *dev );
+PUBLIC_EXTERN void AIOUSBDeviceFreeConversionPlan( AIOUSBDevice *dev );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -12,6 +12,12 @@
 #include "AIOCountsConverter.h"
 #include "AIOUSB_Log.h"
 #include <pthread.h>
+#include <string.h>
+
+#if ( defined(__x86_64__) || defined(__i386__) ) && defined(__GNUC__) && !defined(AIOUSB_DISABLE_SIMD)
+#define AIO_CC_X86_KERNELS 1
+#include <immintrin.h>
+#endif
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -76,12 +82,18 @@ AIOCountsConverter *NewAIOCountsConverter( unsigned num_channels, AIOGainRange *
     tmp->Convert          = AIOCountsConverterConvert;
     tmp->ConvertFifo      = AIOCountsConverterConvertFifo;
     tmp->continue_conversion = default_out;
+    AIOCountsConverterSetKernel( tmp, AIO_CC_KERNEL_AUTO );
     return tmp;
 }
 
 /*----------------------------------------------------------------------------*/
 void DeleteAIOCountsConverter( AIOCountsConverter *ccv )
 {
+    if ( ccv ) {
+        free(ccv->scale);
+        free(ccv->offset);
+        free(ccv->tabled_ranges);
+    }
     free(ccv);
 }
 
@@ -113,6 +125,308 @@ double Convert( AIOGainRange range, unsigned short sum )
 
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Whole scan kernels. The average kernels collapse each group of
+ * per_value oversamples into one value (the same truncating integer
+ * average as the per sample loop) and the scale kernels apply
+ * volts = avg * scale + offset. Since scale is (max-min)/65536, a power
+ * of two division, the result is bit for bit the same as Convert().
+ */
+typedef void (*aio_cc_average_fn)( double *to, const uint16_t *from, unsigned num_values, unsigned per_value );
+typedef void (*aio_cc_scale_fn)( double *to, unsigned count, const double *scale, const double *offset );
+
+static void _aio_cc_average_scalar( double *to, const uint16_t *from, unsigned num_values, unsigned per_value )
+{
+    if ( per_value == 1 ) {
+        for ( unsigned i = 0; i < num_values; i ++ )
+            to[i] = (double)from[i];
+        return;
+    }
+    for ( unsigned i = 0; i < num_values; i ++, from += per_value ) {
+        unsigned sum = 0;
+        for ( unsigned j = 0; j < per_value; j ++ )
+            sum += from[j];
+        to[i] = (double)(sum / per_value);
+    }
+}
+
+static void _aio_cc_scale_scalar( double *to, unsigned count, const double *scale, const double *offset )
+{
+    for ( unsigned i = 0; i < count; i ++ )
+        to[i] = to[i] * scale[i] + offset[i];
+}
+
+#ifdef AIO_CC_X86_KERNELS
+__attribute__((target("sse2")))
+static void _aio_cc_average_sse2( double *to, const uint16_t *from, unsigned num_values, unsigned per_value )
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned i = 0;
+
+    if ( per_value == 1 ) {
+        for ( ; i + 8 <= num_values; i += 8 ) {
+            __m128i v  = _mm_loadu_si128( (const __m128i *)(from + i) );
+            __m128i lo = _mm_unpacklo_epi16( v, zero );
+            __m128i hi = _mm_unpackhi_epi16( v, zero );
+            _mm_storeu_pd( to + i    , _mm_cvtepi32_pd( lo ) );
+            _mm_storeu_pd( to + i + 2, _mm_cvtepi32_pd( _mm_srli_si128( lo, 8 ) ) );
+            _mm_storeu_pd( to + i + 4, _mm_cvtepi32_pd( hi ) );
+            _mm_storeu_pd( to + i + 6, _mm_cvtepi32_pd( _mm_srli_si128( hi, 8 ) ) );
+        }
+        for ( ; i < num_values; i ++ )
+            to[i] = (double)from[i];
+        return;
+    }
+
+    for ( ; i < num_values; i ++, from += per_value ) {
+        __m128i acc = zero;
+        unsigned j = 0, sum;
+        for ( ; j + 8 <= per_value; j += 8 ) {
+            __m128i v = _mm_loadu_si128( (const __m128i *)(from + j) );
+            acc = _mm_add_epi32( acc, _mm_unpacklo_epi16( v, zero ) );
+            acc = _mm_add_epi32( acc, _mm_unpackhi_epi16( v, zero ) );
+        }
+        acc = _mm_add_epi32( acc, _mm_srli_si128( acc, 8 ) );
+        acc = _mm_add_epi32( acc, _mm_srli_si128( acc, 4 ) );
+        sum = (unsigned)_mm_cvtsi128_si32( acc );
+        for ( ; j < per_value; j ++ )
+            sum += from[j];
+        to[i] = (double)(sum / per_value);
+    }
+}
+
+__attribute__((target("sse2")))
+static void _aio_cc_scale_sse2( double *to, unsigned count, const double *scale, const double *offset )
+{
+    unsigned i = 0;
+    for ( ; i + 2 <= count; i += 2 ) {
+        __m128d v = _mm_mul_pd( _mm_loadu_pd( to + i ), _mm_loadu_pd( scale + i ) );
+        _mm_storeu_pd( to + i, _mm_add_pd( v, _mm_loadu_pd( offset + i ) ) );
+    }
+    for ( ; i < count; i ++ )
+        to[i] = to[i] * scale[i] + offset[i];
+}
+
+__attribute__((target("avx2")))
+static void _aio_cc_average_avx2( double *to, const uint16_t *from, unsigned num_values, unsigned per_value )
+{
+    unsigned i = 0;
+
+    if ( per_value == 1 ) {
+        for ( ; i + 8 <= num_values; i += 8 ) {
+            __m256i v = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(from + i) ) );
+            _mm256_storeu_pd( to + i    , _mm256_cvtepi32_pd( _mm256_castsi256_si128( v ) ) );
+            _mm256_storeu_pd( to + i + 4, _mm256_cvtepi32_pd( _mm256_extracti128_si256( v, 1 ) ) );
+        }
+        for ( ; i < num_values; i ++ )
+            to[i] = (double)from[i];
+        return;
+    }
+
+    for ( ; i < num_values; i ++, from += per_value ) {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i acc = zero;
+        __m128i s;
+        unsigned j = 0, sum;
+        for ( ; j + 16 <= per_value; j += 16 ) {
+            __m256i v = _mm256_loadu_si256( (const __m256i *)(from + j) );
+            acc = _mm256_add_epi32( acc, _mm256_unpacklo_epi16( v, zero ) );
+            acc = _mm256_add_epi32( acc, _mm256_unpackhi_epi16( v, zero ) );
+        }
+        for ( ; j + 8 <= per_value; j += 8 )
+            acc = _mm256_add_epi32( acc, _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)(from + j) ) ) );
+        s = _mm_add_epi32( _mm256_castsi256_si128( acc ), _mm256_extracti128_si256( acc, 1 ) );
+        s = _mm_add_epi32( s, _mm_srli_si128( s, 8 ) );
+        s = _mm_add_epi32( s, _mm_srli_si128( s, 4 ) );
+        sum = (unsigned)_mm_cvtsi128_si32( s );
+        for ( ; j < per_value; j ++ )
+            sum += from[j];
+        to[i] = (double)(sum / per_value);
+    }
+}
+
+__attribute__((target("avx2")))
+static void _aio_cc_scale_avx2( double *to, unsigned count, const double *scale, const double *offset )
+{
+    unsigned i = 0;
+    for ( ; i + 4 <= count; i += 4 ) {
+        __m256d v = _mm256_mul_pd( _mm256_loadu_pd( to + i ), _mm256_loadu_pd( scale + i ) );
+        _mm256_storeu_pd( to + i, _mm256_add_pd( v, _mm256_loadu_pd( offset + i ) ) );
+    }
+    for ( ; i < count; i ++ )
+        to[i] = to[i] * scale[i] + offset[i];
+}
+#endif
+
+static AIOUSB_BOOL _aio_cc_kernel_supported( AIOCountsConverterKernel kernel )
+{
+    switch ( kernel ) {
+    case AIO_CC_KERNEL_PER_SAMPLE:
+    case AIO_CC_KERNEL_SCALAR:
+        return AIOUSB_TRUE;
+#ifdef AIO_CC_X86_KERNELS
+    case AIO_CC_KERNEL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2") ? AIOUSB_TRUE : AIOUSB_FALSE;
+    case AIO_CC_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? AIOUSB_TRUE : AIOUSB_FALSE;
+#endif
+    default:
+        return AIOUSB_FALSE;
+    }
+}
+
+static void _aio_cc_kernel_functions( AIOCountsConverterKernel kernel, aio_cc_average_fn *average, aio_cc_scale_fn *scale )
+{
+    switch ( kernel ) {
+#ifdef AIO_CC_X86_KERNELS
+    case AIO_CC_KERNEL_AVX2:
+        *average = _aio_cc_average_avx2;
+        *scale   = _aio_cc_scale_avx2;
+        break;
+    case AIO_CC_KERNEL_SSE2:
+        *average = _aio_cc_average_sse2;
+        *scale   = _aio_cc_scale_sse2;
+        break;
+#endif
+    default:
+        *average = _aio_cc_average_scalar;
+        *scale   = _aio_cc_scale_scalar;
+        break;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Chooses the conversion kernel. AIO_CC_KERNEL_AUTO resolves to
+ * the widest kernel the CPU supports.
+ * @return AIOUSB_SUCCESS, or -AIOUSB_ERROR_INVALID_PARAMETER if the
+ * kernel is unknown or not supported on this machine
+ */
+AIORET_TYPE AIOCountsConverterSetKernel( AIOCountsConverter *cc, AIOCountsConverterKernel kernel )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, cc );
+
+    if ( kernel == AIO_CC_KERNEL_AUTO ) {
+        kernel = AIO_CC_KERNEL_SCALAR;
+        if ( _aio_cc_kernel_supported( AIO_CC_KERNEL_AVX2 ) )
+            kernel = AIO_CC_KERNEL_AVX2;
+        else if ( _aio_cc_kernel_supported( AIO_CC_KERNEL_SSE2 ) )
+            kernel = AIO_CC_KERNEL_SSE2;
+    }
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, _aio_cc_kernel_supported( kernel ) );
+
+    cc->kernel = kernel;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIOCountsConverterKernel AIOCountsConverterGetKernel( AIOCountsConverter *cc )
+{
+    return cc ? cc->kernel : AIO_CC_KERNEL_AUTO;
+}
+
+/*----------------------------------------------------------------------------*/
+const char *AIOCountsConverterKernelName( AIOCountsConverterKernel kernel )
+{
+    switch ( kernel ) {
+    case AIO_CC_KERNEL_AUTO:       return "auto";
+    case AIO_CC_KERNEL_PER_SAMPLE: return "per_sample";
+    case AIO_CC_KERNEL_SCALAR:     return "scalar";
+    case AIO_CC_KERNEL_SSE2:       return "sse2";
+    case AIO_CC_KERNEL_AVX2:       return "avx2";
+    default:                       return "unknown";
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Builds the per channel scale / offset rows, repeated so that a
+ * row is at least 16 doubles long and always ends on a scan boundary.
+ * The rows are kept while gain_ranges holds the same values, whether or
+ * not it is the same array.
+ */
+static AIORET_TYPE _AIOCountsConverterBuildTables( AIOCountsConverter *cc )
+{
+    unsigned reps = ( 16 + cc->num_channels - 1 ) / cc->num_channels;
+    unsigned tile = reps * cc->num_channels;
+    double *scale, *offset;
+    AIOGainRange *tabled;
+
+    if ( cc->scale && cc->tile == tile && cc->tabled_ranges &&
+         memcmp( cc->tabled_ranges, cc->gain_ranges, cc->num_channels*sizeof(AIOGainRange) ) == 0 )
+        return AIOUSB_SUCCESS;
+
+    scale  = (double *)realloc( cc->scale, tile*sizeof(double) );
+    if ( scale )
+        cc->scale = scale;
+    offset = (double *)realloc( cc->offset, tile*sizeof(double) );
+    if ( offset )
+        cc->offset = offset;
+    tabled = (AIOGainRange *)realloc( cc->tabled_ranges, cc->num_channels*sizeof(AIOGainRange) );
+    if ( tabled )
+        cc->tabled_ranges = tabled;
+    cc->tile = 0;
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, scale && offset && tabled );
+
+    for ( unsigned i = 0; i < tile; i ++ ) {
+        AIOGainRange range = cc->gain_ranges[i % cc->num_channels];
+        cc->scale[i]  = (range.max - range.min) / ((( unsigned short )-1)+1);
+        cc->offset[i] = range.min;
+    }
+    cc->tile = tile;
+    memcpy( cc->tabled_ranges, cc->gain_ranges, cc->num_channels*sizeof(AIOGainRange) );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Converts num_scans complete scans ( num_channels * (num_oversamples+1)
+ * counts each ) into num_scans * num_channels volts in a single pass, using
+ * the kernel selected for cc. Does not touch the partial scan state used by
+ * AIOCountsConverterConvertFifo.
+ * @param cc Counts converter object
+ * @param tobuf  Destination, room for num_scans * num_channels doubles
+ * @param frombuf Raw counts starting on a scan boundary
+ * @param num_scans number of whole scans in frombuf
+ * @return Number of volts written to tobuf or negative error
+ */
+AIORET_TYPE AIOCountsConverterConvertScans( AIOCountsConverter *cc, double *tobuf, const uint16_t *frombuf, unsigned num_scans )
+{
+    aio_cc_average_fn average;
+    aio_cc_scale_fn scale;
+    unsigned per_value, total;
+    AIORET_TYPE retval;
+
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, cc && tobuf && frombuf );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, cc->num_channels > 0 && cc->gain_ranges );
+
+    if ( (retval = _AIOCountsConverterBuildTables( cc )) != AIOUSB_SUCCESS )
+        return retval;
+
+    _aio_cc_kernel_functions( cc->kernel, &average, &scale );
+    per_value = cc->num_oversamples + 1;
+    /* Groups shorter than one vector are summed faster by the plain loop,
+     * and a wide reload of those scalar stores stalls store forwarding */
+    if ( per_value > 1 && per_value < 8 ) {
+        average = _aio_cc_average_scalar;
+        scale   = _aio_cc_scale_scalar;
+    }
+    total     = num_scans * cc->num_channels;
+
+    /* Rows of cc->tile values stay in L1 between the two kernels */
+    for ( unsigned i = 0; i < total; i += cc->tile ) {
+        unsigned count = ( total - i < cc->tile ? total - i : cc->tile );
+        average( tobuf + i, frombuf + (size_t)i * per_value, count, per_value );
+        scale( tobuf + i, count, cc->scale, cc->offset );
+    }
+
+    return total;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @param cc Counts converter object
@@ -135,12 +449,41 @@ AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobufpt
 
     int tmpval = fromfifo->PopN( fromfifo, tmpbuf, rounded_num_counts );
     if ( tmpval != (int)rounded_num_counts*(int)sizeof(uint16_t ) ) {
+        free(tmpbuf);
         return -3;
     }
     int num_converted = 0;
     int initial = (cc->scan_count *(cc->num_channels)*(cc->num_oversamples + 1)) + 
         cc->channel_count * ( cc->num_oversamples + 1) + cc->os_count;
 
+    /* Whole scans starting on a scan boundary go through the vector kernel
+     * and a single PushN, the per sample loop below only handles the
+     * trailing partial scan */
+    if ( cc->kernel != AIO_CC_KERNEL_PER_SAMPLE && cc->channel_count == 0 && cc->os_count == 0 ) {
+        unsigned scan_size = cc->num_channels * ( cc->num_oversamples + 1 );
+        unsigned whole_scans = ( scan_size ? rounded_num_counts / scan_size : 0 );
+
+        if ( cc->continue_conversion == enhanced_out ) {
+            unsigned left = ( cc->num_scans > cc->scan_count ? cc->num_scans - cc->scan_count : 0 );
+            whole_scans = MIN( whole_scans, left );
+        }
+        double *voltbuf = ( whole_scans ? (double *)malloc( whole_scans*cc->num_channels*sizeof(double) ) : NULL );
+        if ( voltbuf ) {
+            AIORET_TYPE nvolts = AIOCountsConverterConvertScans( cc, voltbuf, tmpbuf, whole_scans );
+            if ( nvolts > 0 ) {
+                if ( tofifo->PushN( tofifo, voltbuf, (unsigned)nvolts ) != nvolts*(AIORET_TYPE)sizeof(double) ) {
+                    free(voltbuf);
+                    free(tmpbuf);
+                    return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+                }
+                num_converted       += (int)nvolts;
+                cc->scan_count      += whole_scans;
+                cc->converted_count += whole_scans * scan_size;
+            }
+            free(voltbuf);
+        }
+    }
+
     for ( int tobuf_pos = 0; cc->continue_conversion( cc, rounded_num_counts) ; cc->scan_count ++ ) {
         for ( ; cc->channel_count < cc->num_channels && cc->converted_count < rounded_num_counts; cc->channel_count ++ , tobuf_pos ++  ) {
             for ( ; cc->os_count < (cc->num_oversamples + 1) && cc->converted_count < rounded_num_counts; cc->os_count ++ ) {
@@ -156,7 +499,10 @@ AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobufpt
                 cc->os_count = 0;
                 cc->sum /= (cc->num_oversamples + 1);
                 tmpvolt = (double)Convert( cc->gain_ranges[cc->channel_count], cc->sum );
-                tofifo->Push( tofifo, tmpvolt );
+                if ( tofifo->Push( tofifo, tmpvolt ) <= 0 ) {
+                    free(tmpbuf);
+                    return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+                }
                 num_converted ++;
                 cc->sum = 0;
             } else {
@@ -234,6 +580,7 @@ PUBLIC_EXTERN void DeleteAIOGainRange( AIOGainRange *agr )
 #include "gtest/gtest.h"
 
 #include <iostream>
+#include <vector>
 using namespace AIOUSB;
 
 
@@ -461,6 +808,146 @@ TEST(Composite,FifoWriting )
     }
 }
 
+/**
+ * @brief Every kernel must give bit for bit the same volts as the per
+ * sample loop, including when blocks split scans at odd places.
+ */
+class ConverterKernel : public ::testing::TestWithParam<AIOCountsConverterKernel> {};
+TEST_P( ConverterKernel, MatchesPerSampleConversion )
+{
+    AIOCountsConverterKernel kernel = GetParam();
+    unsigned oversamples[] = { 0, 1, 2, 7, 16, 255 };
+    AIOGainRange ranges[16];
+    unsigned total = 5000;
+    unsigned short *counts = (unsigned short *)malloc( total*sizeof(unsigned short) );
+    double *expected = (double *)malloc( total*sizeof(double) );
+    double *actual   = (double *)malloc( total*sizeof(double) );
+
+    for ( int i = 0; i < 16; i ++ ) {
+        ranges[i].min = ( i % 2 ? 0.0 : -10.0 + i );
+        ranges[i].max = 10.0 + i;
+    }
+    for ( unsigned i = 0; i < total; i ++ )
+        counts[i] = (unsigned short)( i * 2654435761u >> 16 );
+
+    for ( unsigned ch = 1; ch <= 16; ch ++ ) {
+        for ( unsigned o = 0; o < sizeof(oversamples)/sizeof(oversamples[0]); o ++ ) {
+            AIOCountsConverter *ref = NewAIOCountsConverter( ch, ranges, oversamples[o], sizeof(unsigned short) );
+            AIOCountsConverter *cc  = NewAIOCountsConverter( ch, ranges, oversamples[o], sizeof(unsigned short) );
+            AIOFifoCounts *refin  = NewAIOFifoCounts( total + 1 );
+            AIOFifoCounts *in     = NewAIOFifoCounts( total + 1 );
+            AIOFifoVolts *refout  = NewAIOFifoVolts( total + 1 );
+            AIOFifoVolts *out     = NewAIOFifoVolts( total + 1 );
+            int nref = 0, n = 0;
+
+            ASSERT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetKernel( ref, AIO_CC_KERNEL_PER_SAMPLE ) );
+            ASSERT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetKernel( cc, kernel ) );
+
+            /* Uneven block sizes so that scans straddle calls */
+            for ( unsigned pos = 0, block = 37; pos < total; pos += block, block = block * 3 + 5 ) {
+                unsigned len = ( total - pos < block ? total - pos : block );
+                refin->PushN( refin, counts + pos, len );
+                in->PushN( in, counts + pos, len );
+                nref += ref->ConvertFifo( ref, refout, refin, len );
+                n    += cc->ConvertFifo( cc, out, in, len );
+            }
+            ASSERT_EQ( nref, n ) << "channels=" << ch << " oversamples=" << oversamples[o];
+            ASSERT_EQ( ref->scan_count, cc->scan_count );
+            ASSERT_EQ( ref->channel_count, cc->channel_count );
+            ASSERT_EQ( ref->os_count, cc->os_count );
+
+            refout->PopN( refout, expected, nref );
+            out->PopN( out, actual, n );
+            for ( int i = 0; i < n; i ++ )
+                ASSERT_EQ( expected[i], actual[i] ) << "channels=" << ch << " oversamples=" << oversamples[o] << " i=" << i;
+
+            DeleteAIOCountsConverter( ref );
+            DeleteAIOCountsConverter( cc );
+            DeleteAIOFifoCounts( refin );
+            DeleteAIOFifoCounts( in );
+            DeleteAIOFifoVolts( refout );
+            DeleteAIOFifoVolts( out );
+        }
+    }
+    free(counts);
+    free(expected);
+    free(actual);
+}
+
+static std::vector<AIOCountsConverterKernel> supported_kernels()
+{
+    std::vector<AIOCountsConverterKernel> kernels;
+    AIOCountsConverter *cc = NewAIOCountsConverter( 1, NULL, 0, sizeof(unsigned short) );
+    AIOCountsConverterKernel all[] = { AIO_CC_KERNEL_SCALAR, AIO_CC_KERNEL_SSE2, AIO_CC_KERNEL_AVX2 };
+    for ( unsigned i = 0; i < sizeof(all)/sizeof(all[0]); i ++ )
+        if ( AIOCountsConverterSetKernel( cc, all[i] ) == AIOUSB_SUCCESS )
+            kernels.push_back( all[i] );
+    DeleteAIOCountsConverter( cc );
+    return kernels;
+}
+
+INSTANTIATE_TEST_CASE_P( AllKernels, ConverterKernel, ::testing::ValuesIn( supported_kernels() ));
+
+TEST(Composite,ScanLimiterStopsVectorPath )
+{
+    AIOGainRange ranges[4] = { {0,10}, {0,10}, {0,10}, {0,10} };
+    unsigned short counts[4*3*10] = {0};
+    AIOCountsConverter *cc = NewAIOCountsConverterWithScanLimiter( NULL, 6, 4, ranges, 2, sizeof(unsigned short) );
+    AIOFifoCounts *infifo = NewAIOFifoCounts( 4*3*10 + 1 );
+    AIOFifoVolts *outfifo = NewAIOFifoVolts( 4*10 + 1 );
+
+    infifo->PushN( infifo, counts, 4*3*10 );
+    EXPECT_EQ( 6*4, cc->ConvertFifo( cc, outfifo, infifo, 4*3*10 ) );
+    EXPECT_EQ( 6, cc->scan_count );
+    EXPECT_EQ( 6*4*sizeof(double), AIOFifoReadSize( outfifo ) );
+
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOCountsConverterSetKernel( cc, (AIOCountsConverterKernel)42 ) );
+    EXPECT_STREQ( "per_sample", AIOCountsConverterKernelName( AIO_CC_KERNEL_PER_SAMPLE ) );
+
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+}
+
+TEST(Composite,ShortWriteIsAnError )
+{
+    AIOGainRange ranges[4] = { {0,10}, {0,10}, {0,10}, {0,10} };
+    unsigned short counts[4*3*10] = {0};
+    AIOCountsConverterKernel kernels[] = { AIO_CC_KERNEL_AUTO, AIO_CC_KERNEL_PER_SAMPLE };
+
+    for ( unsigned k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k ++ ) {
+        AIOCountsConverter *cc = NewAIOCountsConverter( 4, ranges, 2, sizeof(unsigned short) );
+        AIOFifoCounts *infifo = NewAIOFifoCounts( 4*3*10 + 1 );
+        AIOFifoVolts *outfifo = NewAIOFifoVolts( 4*2 );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetKernel( cc, kernels[k] ) );
+
+        infifo->PushN( infifo, counts, 4*3*10 );
+        EXPECT_EQ( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, cc->ConvertFifo( cc, outfifo, infifo, 4*3*10 ) ) << "kernel " << kernels[k];
+
+        DeleteAIOCountsConverter( cc );
+        DeleteAIOFifoCounts( infifo );
+        DeleteAIOFifoVolts( outfifo );
+    }
+}
+
+TEST(Composite,TablesFollowTheRangeValues )
+{
+    AIOGainRange ranges[2] = { {0,10}, {0,10} };
+    uint16_t counts[2] = { 0, 0 };
+    double volts[2];
+    AIOCountsConverter *cc = NewAIOCountsConverter( 2, ranges, 0, sizeof(unsigned short) );
+
+    ASSERT_EQ( 2, AIOCountsConverterConvertScans( cc, volts, counts, 1 ) );
+    EXPECT_EQ( 0.0, volts[1] );
+
+    /* Same array, new values */
+    ranges[1].min = -5;
+    ASSERT_EQ( 2, AIOCountsConverterConvertScans( cc, volts, counts, 1 ) );
+    EXPECT_EQ( -5.0, volts[1] );
+
+    DeleteAIOCountsConverter( cc );
+}
+
 class AllGainCode : public ::testing::TestWithParam<ADGainCode> {};
 TEST_P( AllGainCode, FromADCConfigBlock )
 {
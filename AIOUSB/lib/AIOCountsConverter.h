@@ -28,6 +28,20 @@ typedef struct {
     double max;
 } AIOGainRange;
 
+/**
+ * @brief Selects the loop used to turn whole scans of counts into volts.
+ * AIO_CC_KERNEL_AUTO picks the widest instruction set the running CPU
+ * supports, AIO_CC_KERNEL_PER_SAMPLE keeps the original one sample at a
+ * time conversion.
+ */
+typedef enum {
+    AIO_CC_KERNEL_AUTO = 0,
+    AIO_CC_KERNEL_PER_SAMPLE,
+    AIO_CC_KERNEL_SCALAR,
+    AIO_CC_KERNEL_SSE2,
+    AIO_CC_KERNEL_AVX2
+} AIOCountsConverterKernel;
+
 typedef struct aio_counts_converter {
     unsigned num_oversamples;
     unsigned num_channels;
@@ -44,6 +58,11 @@ typedef struct aio_counts_converter {
     AIORET_TYPE (*Convert)( struct aio_counts_converter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
     AIORET_TYPE (*ConvertFifo)( struct aio_counts_converter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
     AIOUSB_BOOL discardFirstSample;
+    AIOCountsConverterKernel kernel;
+    double *scale;                /**< (max-min)/65536 per channel, tiled to tile entries */
+    double *offset;               /**< min per channel, tiled to tile entries */
+    unsigned tile;                /**< Multiple of num_channels used as the vector row length */
+    AIOGainRange *tabled_ranges;  /**< Copy of the gain_ranges the scale/offset tables were built from */
 } AIOCountsConverter;
 
 
@@ -60,6 +79,10 @@ PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertNScans( AIOCountsConverter *c
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertAllAvailableScans( AIOCountsConverter *cc );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvert( AIOCountsConverter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertScans( AIOCountsConverter *cc, double *tobuf, const uint16_t *frombuf, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterSetKernel( AIOCountsConverter *cc, AIOCountsConverterKernel kernel );
+PUBLIC_EXTERN AIOCountsConverterKernel AIOCountsConverterGetKernel( AIOCountsConverter *cc );
+PUBLIC_EXTERN const char *AIOCountsConverterKernelName( AIOCountsConverterKernel kernel );
 
 PUBLIC_EXTERN AIOGainRange* NewAIOGainRangeFromADCConfigBlock( ADCConfigBlock *adc );
 PUBLIC_EXTERN void  DeleteAIOGainRange( AIOGainRange* );
@@ -0,0 +1,1009 @@
+/**
+ * @file   AIODIOStream.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Continuous DIO streaming with several bulk transfers kept in flight
+ *
+ */
+
+#include "AIOUSB_Log.h"
+#include "AIODIOStream.h"
+#include "AIODeviceTable.h"
+#include "AIOHistogram.h"
+#include "USBDevice.h"
+#include <libusb.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIO_DIO_STREAM_PACKET_SIZE      512
+#define AIO_DIO_STREAM_MAX_FAILURES     5
+
+/*----------------------------------------------------------------------------*/
+AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIOUSB_BOOL is_read, unsigned points )
+{
+    AIO_ERROR_VALID_DATA( NULL, points * sizeof(unsigned short) >= AIO_DIO_STREAM_PACKET_SIZE );
+
+    AIODIOStream *stream = (AIODIOStream *)calloc( 1, sizeof(AIODIOStream) );
+    AIO_ERROR_VALID_DATA( NULL, stream );
+
+    stream->fifo = NewAIOFifoCounts( points );
+    if ( !stream->fifo || AIOFifoSetSPSC( stream->fifo, AIOUSB_TRUE ) != AIOUSB_SUCCESS ) {
+        if ( stream->fifo )
+            DeleteAIOFifoCounts( stream->fifo );
+        free( stream );
+        return NULL;
+    }
+
+    stream->DeviceIndex = DeviceIndex;
+    stream->is_read = ( is_read ? AIOUSB_TRUE : AIOUSB_FALSE );
+    stream->depth = AIO_DIO_STREAM_DEFAULT_DEPTH;
+    stream->timeout = AIO_DIO_STREAM_DEFAULT_TIMEOUT;
+    stream->status = NOT_STARTED;
+
+    /* Leave room in the fifo for at least two transfers */
+    stream->transfer_size = AIO_DIO_STREAM_DEFAULT_TRANSFER_SIZE;
+    while ( stream->transfer_size > AIO_DIO_STREAM_PACKET_SIZE && stream->transfer_size > points * sizeof(unsigned short) / 2 )
+        stream->transfer_size /= 2;
+
+    return stream;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODIOStream( AIODIOStream *stream )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    AIODIOStreamStop( stream, AIOUSB_FALSE );
+    DeleteAIOFifoCounts( stream->fifo );
+    free( stream );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets how many bulk transfers are kept queued on the device and how
+ *        large each is. A depth of 0 moves one transfer at a time, which is
+ *        also what happens when the device has no libusb handle.
+ * @param stream
+ * @param depth Transfers in flight
+ * @param transfer_size Bytes per transfer, a multiple of 512 that fits in
+ *        the fifo, or 0 to keep the current size
+ * @return AIOUSB_SUCCESS or a negative error
+ */
+AIORET_TYPE AIODIOStreamSetTransfers( AIODIOStream *stream, unsigned depth, unsigned transfer_size )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_OPEN_FAILED, !( stream->status & RUNNING ) );
+    if ( transfer_size ) {
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, transfer_size % AIO_DIO_STREAM_PACKET_SIZE == 0 );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, transfer_size <= (unsigned)AIOFifoGetSize( stream->fifo ) );
+        stream->transfer_size = transfer_size;
+    }
+    stream->depth = depth;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamSetTimeout( AIODIOStream *stream, unsigned timeout )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_TIMEOUT, timeout > 0 );
+    stream->timeout = timeout;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamGetStatus( AIODIOStream *stream )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    return stream->status;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamGetExitCode( AIODIOStream *stream )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    return stream->exitcode;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Points waiting to be read from a read stream, or room for points
+ *        in a write stream
+ */
+AIORET_TYPE AIODIOStreamPointsAvailable( AIODIOStream *stream )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    if ( stream->is_read )
+        return AIOFifoReadSizeNumElements( stream->fifo );
+    return AIOFifoWriteSizeRemainingNumElements( stream->fifo );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to maxpoints points from a read stream without waiting
+ * @return Points copied to points, possibly 0
+ */
+AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *points, unsigned maxpoints )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, points );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, stream->is_read );
+
+    /* Read the count once, MIN() would let the worker change it in between */
+    unsigned available = (unsigned)AIOFifoReadSizeNumElements( stream->fifo );
+    unsigned n = MIN( maxpoints, available );
+    if ( n == 0 )
+        return 0;
+    return stream->fifo->PopN( stream->fifo, points, n ) / sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues up to npoints points on a write stream without waiting.
+ *        Points may be queued before AIODIOStreamStart() so the device
+ *        has data the moment it starts.
+ * @return Points accepted, possibly fewer than npoints when the fifo is full
+ */
+AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, unsigned short *points, unsigned npoints )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, points );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, !stream->is_read );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_OPEN_FAILED, !stream->draining );
+
+    unsigned room = (unsigned)AIOFifoWriteSizeRemainingNumElements( stream->fifo );
+    unsigned n = MIN( npoints, room );
+    if ( n == 0 )
+        return 0;
+    return stream->fifo->PushN( stream->fifo, points, n ) / sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ */
+static void _aiodiostream_fail( AIODIOStream *stream, AIORET_TYPE exitcode )
+{
+    __sync_bool_compare_and_swap( &stream->exitcode, AIOUSB_SUCCESS, exitcode );
+    stream->status = TERMINATED;
+}
+
+static void _aiodiostream_overrun( AIODIOStream *stream, USBDevice *usb )
+{
+    USB_DEVICE_COUNT( usb, overruns, 1 );
+    AIOUSB_WARN("DIO stream on device %lu overran its fifo\n", stream->DeviceIndex );
+    stream->status = TERMINATED_OVERRUN;
+}
+
+/**
+ * @brief Moves the next block of a write stream out of the fifo. While
+ *        running only whole packets are sent; once draining whatever is
+ *        left goes.
+ * @return Bytes placed in block, 0 if there was nothing to send
+ */
+static int _aiodiostream_fill( AIODIOStream *stream, unsigned char *block, AIOUSB_BOOL *dry )
+{
+    unsigned avail = (unsigned)AIOFifoReadSize( stream->fifo );
+    unsigned size;
+    if ( avail >= stream->transfer_size )
+        size = stream->transfer_size;
+    else if ( stream->draining )
+        size = avail;
+    else
+        size = ( avail / AIO_DIO_STREAM_PACKET_SIZE ) * AIO_DIO_STREAM_PACKET_SIZE;
+
+    if ( size == 0 ) {
+        if ( !*dry && !stream->draining ) {
+            stream->underruns ++;
+            *dry = AIOUSB_TRUE;
+        }
+        return 0;
+    }
+    *dry = AIOUSB_FALSE;
+    return (int)stream->fifo->Read( (AIOFifo *)stream->fifo, block, size );
+}
+
+/**
+ * @brief Hands a completed read to the fifo
+ * @return AIOUSB_FALSE if the application fell behind and the data did not fit
+ */
+static AIOUSB_BOOL _aiodiostream_consume( AIODIOStream *stream, USBDevice *usb, unsigned char *block, int bytes )
+{
+    if ( (unsigned)AIOFifoWriteSizeRemaining( stream->fifo ) < (unsigned)bytes ) {
+        _aiodiostream_overrun( stream, usb );
+        return AIOUSB_FALSE;
+    }
+    stream->fifo->Write( (AIOFifo *)stream->fifo, block, bytes );
+    return AIOUSB_TRUE;
+}
+
+static void _aiodiostream_idle( void )
+{
+    struct timespec ts = { 0, 100000 };
+    nanosleep( &ts, NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief One transfer at a time, for devices without a libusb handle or a
+ *        depth of 0. The block is still allocated once per stream rather
+ *        than once per transfer.
+ */
+static void _aiodiostream_sync_worker( AIODIOStream *stream, AIOUSBDevice *dev, USBDevice *usb )
+{
+    unsigned char *block = (unsigned char *)malloc( stream->transfer_size );
+    unsigned char endpoint = ( stream->is_read ? LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT : LIBUSB_ENDPOINT_OUT | USB_BULK_WRITE_ENDPOINT );
+    AIOUSB_BOOL dry = AIOUSB_TRUE;
+    uint64_t started = 0, last_end = 0;
+    int pending = 0, offset = 0, usbfail = 0;
+
+    if ( !block ) {
+        _aiodiostream_fail( stream, -AIOUSB_ERROR_NOT_ENOUGH_MEMORY );
+        return;
+    }
+
+    while ( stream->status & RUNNING ) {
+        int length = (int)stream->transfer_size, bytes = 0, usbresult;
+        if ( !stream->is_read ) {
+            if ( pending == 0 ) {
+                offset = 0;
+                if ( ( pending = _aiodiostream_fill( stream, block, &dry ) ) == 0 ) {
+                    if ( stream->draining && AIOFifoReadSize( stream->fifo ) == 0 ) {
+                        stream->status = TERMINATED;
+                        break;
+                    }
+                    _aiodiostream_idle();
+                    continue;
+                }
+            }
+            length = pending;
+        }
+
+        AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( dev, AIO_TRANSFER_DIO_STREAM );
+        if ( hists )
+            started = AIOTransferTimestamp();
+        usbresult = usb->usb_bulk_transfer( usb, endpoint, block + offset, length, &bytes, stream->timeout );
+        if ( hists )
+            AIOTransferHistogramsRecord( hists, started, AIOTransferTimestamp(), bytes, AIOFifoReadSize( stream->fifo ), &last_end );
+
+        if ( bytes > 0 ) {
+            __sync_fetch_and_add( &stream->bytes_transferred, (uint64_t)bytes );
+            if ( stream->is_read ) {
+                if ( !_aiodiostream_consume( stream, usb, block, bytes ) )
+                    break;
+            } else {
+                offset += bytes;
+                pending -= bytes;
+            }
+        }
+
+        if ( usbresult == LIBUSB_SUCCESS || ( usbresult == LIBUSB_ERROR_TIMEOUT && bytes > 0 ) ) {
+            usbfail = 0;
+        } else if ( usbresult != LIBUSB_ERROR_TIMEOUT && ++usbfail >= AIO_DIO_STREAM_MAX_FAILURES ) {
+            AIOUSB_ERROR("Stopping DIO stream after %d usb failures: %d\n", usbfail, usbresult );
+            _aiodiostream_fail( stream, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+        }
+    }
+
+    free( block );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bookkeeping for the asynchronous worker. The callbacks run on
+ *        whichever thread is handling events on the default context, which
+ *        may be the hotplug thread rather than the worker. They and the
+ *        worker hold lock while they touch busy, usbfail or the fifo, so a
+ *        write stream's fifo still has a single reader, and in_flight is
+ *        only changed atomically.
+ */
+typedef struct aio_dio_stream_async {
+    AIODIOStream *stream;
+    AIOUSBDevice *dev;
+    USBDevice *usb;
+    struct libusb_transfer **transfers;
+    AIOUSB_BOOL *busy;
+    uint64_t *submitted;                /**< When each of transfers last went on the bus */
+    unsigned depth;
+    pthread_mutex_t lock;
+    unsigned in_flight;                 /**< The worker frees the state once this drops to 0 */
+    int usbfail;
+    AIOUSB_BOOL dry;
+    uint64_t last_end;
+    int (*submit)( struct libusb_transfer *xfer ); /**< libusb_submit_transfer(), which the tests replace */
+} AIODIOStreamAsyncState;
+
+static unsigned _aiodiostream_async_index( AIODIOStreamAsyncState *state, struct libusb_transfer *xfer )
+{
+    unsigned i;
+    for ( i = 0; i < state->depth && state->transfers[i] != xfer; i ++ )
+        ;
+    return i;
+}
+
+/** @brief Stamps transfer i with the time it goes on the bus and submits it */
+static int _aiodiostream_async_submit( AIODIOStreamAsyncState *state, unsigned i )
+{
+    if ( state->submitted )
+        state->submitted[i] = AIOTransferTimestamp();
+    return state->submit( state->transfers[i] );
+}
+
+/**
+ * @brief Fills and queues every idle transfer of a write stream that it has
+ *        data for. Called with state->lock held.
+ */
+static void _aiodiostream_async_feed( AIODIOStreamAsyncState *state )
+{
+    unsigned i;
+    for ( i = 0; i < state->depth && ( state->stream->status & RUNNING ); i ++ ) {
+        struct libusb_transfer *xfer = state->transfers[i];
+        if ( state->busy[i] )
+            continue;
+        int size = _aiodiostream_fill( state->stream, xfer->buffer, &state->dry );
+        if ( size == 0 )
+            break;
+        xfer->length = size;
+        int usbresult = _aiodiostream_async_submit( state, i );
+        if ( usbresult != LIBUSB_SUCCESS ) {
+            _aiodiostream_fail( state->stream, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+            break;
+        }
+        state->busy[i] = AIOUSB_TRUE;
+        __atomic_add_fetch( &state->in_flight, 1, __ATOMIC_RELAXED );
+    }
+}
+
+/**
+ * @brief Accounts for one finished transfer and hands what a read brought
+ *        to the fifo. A write the device did not take all of, for instance
+ *        one that timed out part way, has the rest moved to the front of
+ *        its block to be sent again, as the synchronous worker does.
+ *        Called with state->lock held.
+ * @return AIOUSB_TRUE if the transfer should go back on the bus
+ */
+static AIOUSB_BOOL _aiodiostream_async_complete( AIODIOStreamAsyncState *state, struct libusb_transfer *xfer )
+{
+    AIODIOStream *stream = state->stream;
+    unsigned i = _aiodiostream_async_index( state, xfer );
+    uint64_t started = ( i < state->depth && state->submitted ? state->submitted[i] : 0 );
+
+    USB_DEVICE_COUNT( state->usb, bulk_transfers, 1 );
+    if ( stream->is_read )
+        USB_DEVICE_COUNT( state->usb, bulk_bytes_in, xfer->actual_length );
+    else
+        USB_DEVICE_COUNT( state->usb, bulk_bytes_out, xfer->actual_length );
+    AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( state->dev, AIO_TRANSFER_DIO_STREAM );
+    if ( hists )
+        AIOTransferHistogramsRecord( hists, started, AIOTransferTimestamp(), xfer->actual_length, AIOFifoReadSize( stream->fifo ), &state->last_end );
+
+    if ( xfer->actual_length > 0 ) {
+        __sync_fetch_and_add( &stream->bytes_transferred, (uint64_t)xfer->actual_length );
+        if ( stream->is_read && ( stream->status & RUNNING ) )
+            _aiodiostream_consume( stream, state->usb, xfer->buffer, xfer->actual_length );
+    }
+
+    if ( xfer->status == LIBUSB_TRANSFER_TIMED_OUT ) {
+        USB_DEVICE_COUNT( state->usb, timeouts, 1 );
+    } else if ( xfer->status != LIBUSB_TRANSFER_COMPLETED && xfer->status != LIBUSB_TRANSFER_CANCELLED ) {
+        USB_DEVICE_COUNT( state->usb, errors, 1 );
+        if ( xfer->status == LIBUSB_TRANSFER_NO_DEVICE || ++state->usbfail >= AIO_DIO_STREAM_MAX_FAILURES ) {
+            AIOUSB_ERROR("Stopping DIO stream after %d usb failures\n", state->usbfail );
+            _aiodiostream_fail( stream, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_IO ) );
+        }
+    } else {
+        state->usbfail = 0;
+    }
+
+    if ( !( stream->status & RUNNING ) || xfer->status == LIBUSB_TRANSFER_CANCELLED )
+        return AIOUSB_FALSE;
+    /* Reads go straight back on the bus; writes wait to be refilled once the device has all of them */
+    if ( stream->is_read )
+        return AIOUSB_TRUE;
+    if ( xfer->actual_length >= xfer->length )
+        return AIOUSB_FALSE;
+    if ( xfer->actual_length > 0 ) {
+        memmove( xfer->buffer, xfer->buffer + xfer->actual_length, xfer->length - xfer->actual_length );
+        xfer->length -= xfer->actual_length;
+    }
+    return AIOUSB_TRUE;
+}
+
+static void LIBUSB_CALL _aiodiostream_async_cb( struct libusb_transfer *xfer )
+{
+    AIODIOStreamAsyncState *state = (AIODIOStreamAsyncState *)xfer->user_data;
+    unsigned i = _aiodiostream_async_index( state, xfer );
+
+    pthread_mutex_lock( &state->lock );
+    if ( _aiodiostream_async_complete( state, xfer ) ) {
+        int usbresult = ( i < state->depth ? _aiodiostream_async_submit( state, i ) : state->submit( xfer ) );
+        if ( usbresult == LIBUSB_SUCCESS ) {
+            pthread_mutex_unlock( &state->lock );
+            return;
+        }
+        _aiodiostream_fail( state->stream, -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+    }
+    if ( i < state->depth )
+        state->busy[i] = AIOUSB_FALSE;
+    if ( !state->stream->is_read )
+        _aiodiostream_async_feed( state );
+    pthread_mutex_unlock( &state->lock );
+    /* Last touch of state, the worker may free it as soon as this hits 0 */
+    __atomic_sub_fetch( &state->in_flight, 1, __ATOMIC_RELEASE );
+}
+
+static void _aiodiostream_async_free( AIODIOStreamAsyncState *state )
+{
+    for ( unsigned i = 0; state->transfers && i < state->depth; i ++ ) {
+        if ( state->transfers[i] ) {
+            free( state->transfers[i]->buffer );
+            libusb_free_transfer( state->transfers[i] );
+        }
+    }
+    free( state->transfers );
+    free( state->busy );
+    free( state->submitted );
+    pthread_mutex_destroy( &state->lock );
+}
+
+/**
+ * @brief Keeps stream->depth bulk transfers queued on the device
+ * @return AIOUSB_FALSE if no transfer could be set up, in which case the
+ *         caller falls back to the synchronous worker
+ */
+static AIOUSB_BOOL _aiodiostream_async_worker( AIODIOStream *stream, AIOUSBDevice *dev, USBDevice *usb, libusb_device_handle *handle )
+{
+    AIODIOStreamAsyncState state;
+    AIOUSB_BOOL cancelled = AIOUSB_FALSE;
+    unsigned char endpoint = ( stream->is_read ? LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT : LIBUSB_ENDPOINT_OUT | USB_BULK_WRITE_ENDPOINT );
+    unsigned i;
+
+    memset( &state, 0, sizeof(state) );
+    state.stream = stream;
+    state.dev = dev;
+    state.usb = usb;
+    state.dry = AIOUSB_TRUE;
+    state.depth = stream->depth;
+    state.submit = libusb_submit_transfer;
+    pthread_mutex_init( &state.lock, NULL );
+    state.transfers = (struct libusb_transfer **)calloc( state.depth, sizeof(struct libusb_transfer *) );
+    state.busy = (AIOUSB_BOOL *)calloc( state.depth, sizeof(AIOUSB_BOOL) );
+    state.submitted = (uint64_t *)calloc( state.depth, sizeof(uint64_t) );
+    if ( !state.transfers || !state.busy || !state.submitted ) {
+        _aiodiostream_async_free( &state );
+        return AIOUSB_FALSE;
+    }
+
+    for ( i = 0; i < state.depth; i ++ ) {
+        unsigned char *block = (unsigned char *)malloc( stream->transfer_size );
+        if ( !block || !( state.transfers[i] = libusb_alloc_transfer( 0 ) ) ) {
+            free( block );
+            _aiodiostream_async_free( &state );
+            return AIOUSB_FALSE;
+        }
+        libusb_fill_bulk_transfer( state.transfers[i], handle, endpoint, block, stream->transfer_size, _aiodiostream_async_cb, &state, stream->timeout );
+    }
+
+    if ( stream->is_read ) {
+        for ( i = 0; i < state.depth; i ++ ) {
+            /* Counted first, a completion may run before submit returns */
+            pthread_mutex_lock( &state.lock );
+            __atomic_add_fetch( &state.in_flight, 1, __ATOMIC_RELAXED );
+            state.busy[i] = AIOUSB_TRUE;
+            if ( _aiodiostream_async_submit( &state, i ) != LIBUSB_SUCCESS ) {
+                state.busy[i] = AIOUSB_FALSE;
+                __atomic_sub_fetch( &state.in_flight, 1, __ATOMIC_RELAXED );
+                pthread_mutex_unlock( &state.lock );
+                break;
+            }
+            pthread_mutex_unlock( &state.lock );
+        }
+        if ( __atomic_load_n( &state.in_flight, __ATOMIC_ACQUIRE ) == 0 ) {
+            AIOUSB_DEVEL("Unable to queue asynchronous DIO transfers, using synchronous transfers\n");
+            _aiodiostream_async_free( &state );
+            return AIOUSB_FALSE;
+        }
+    }
+
+    for ( ;; ) {
+        struct timeval tv = { 0, 1000 };
+        if ( !stream->is_read && ( stream->status & RUNNING ) ) {
+            pthread_mutex_lock( &state.lock );
+            _aiodiostream_async_feed( &state );
+            if ( stream->draining && __atomic_load_n( &state.in_flight, __ATOMIC_ACQUIRE ) == 0 && AIOFifoReadSize( stream->fifo ) == 0 )
+                stream->status = TERMINATED;
+            pthread_mutex_unlock( &state.lock );
+        }
+        if ( !( stream->status & RUNNING ) ) {
+            if ( __atomic_load_n( &state.in_flight, __ATOMIC_ACQUIRE ) == 0 )
+                break;
+            if ( !cancelled ) {
+                pthread_mutex_lock( &state.lock );
+                for ( i = 0; i < state.depth; i ++ ) {
+                    if ( state.busy[i] )
+                        libusb_cancel_transfer( state.transfers[i] );
+                }
+                pthread_mutex_unlock( &state.lock );
+                cancelled = AIOUSB_TRUE;
+            }
+        }
+        if ( __atomic_load_n( &state.in_flight, __ATOMIC_ACQUIRE ) > 0 )
+            libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+        else
+            _aiodiostream_idle();
+    }
+
+    _aiodiostream_async_free( &state );
+    return AIOUSB_TRUE;
+}
+
+static void *_aiodiostream_worker( void *object )
+{
+    AIODIOStream *stream = (AIODIOStream *)object;
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( stream->DeviceIndex, &result );
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( stream->DeviceIndex, &result );
+
+    if ( result != AIOUSB_SUCCESS ) {
+        _aiodiostream_fail( stream, -(AIORET_TYPE)result );
+        return NULL;
+    }
+
+    libusb_device_handle *handle = USBDeviceGetUSBDeviceHandle( usb );
+    if ( !handle || stream->depth == 0 || !_aiodiostream_async_worker( stream, dev, usb, handle ) )
+        _aiodiostream_sync_worker( stream, dev, usb );
+
+    AIOUSB_DEVEL("DIO stream stopped after %llu bytes\n", (unsigned long long)stream->bytes_transferred );
+    return NULL;
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens the device for streaming in the stream's direction, unless
+ *        DIO_StreamOpen() already has, and starts the worker thread. A read
+ *        stream starts with an empty fifo; a write stream keeps any points
+ *        queued before the start.
+ */
+AIORET_TYPE AIODIOStreamStart( AIODIOStream *stream )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_OPEN_FAILED, stream->status == NOT_STARTED );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( stream->DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_SUPPORTED, device->bDIOStream );
+
+    if ( !device->bDIOOpen ) {
+        result = DIO_StreamOpen( stream->DeviceIndex, stream->is_read );
+        AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+        stream->opened = AIOUSB_TRUE;
+    } else {
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, device->bDIORead == stream->is_read );
+    }
+
+    if ( stream->is_read )
+        AIOFifoReset( stream->fifo );
+    stream->exitcode = AIOUSB_SUCCESS;
+    stream->bytes_transferred = 0;
+    stream->underruns = 0;
+    stream->draining = AIOUSB_FALSE;
+    stream->status = RUNNING;
+
+    if ( pthread_create( &stream->worker, NULL, _aiodiostream_worker, stream ) != 0 ) {
+        stream->status = NOT_STARTED;
+        if ( stream->opened )
+            DIO_StreamClose( stream->DeviceIndex );
+        stream->opened = AIOUSB_FALSE;
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the stream and waits for the worker to finish. With drain a
+ *        write stream first sends everything still in its fifo; read
+ *        streams keep whatever was already read for AIODIOStreamRead().
+ *        The stream may be started again afterwards.
+ * @return The stream's exit code, AIOUSB_SUCCESS unless the transfers failed
+ */
+AIORET_TYPE AIODIOStreamStop( AIODIOStream *stream, AIOUSB_BOOL drain )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, stream );
+    if ( stream->status == NOT_STARTED )
+        return AIOUSB_SUCCESS;
+
+    if ( drain && !stream->is_read )
+        stream->draining = AIOUSB_TRUE;
+    else if ( stream->status & RUNNING )
+        stream->status = TERMINATED;
+
+    pthread_join( stream->worker, NULL );
+    stream->draining = AIOUSB_FALSE;
+
+    if ( stream->opened )
+        DIO_StreamClose( stream->DeviceIndex );
+    stream->opened = AIOUSB_FALSE;
+
+    AIORET_TYPE exitcode = stream->exitcode;
+    stream->status = NOT_STARTED;
+    return exitcode;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+/*****************************************************************************
+ * Self-test
+ ****************************************************************************/
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "AIOUSBDevice.h"
+
+using namespace AIOUSB;
+
+static struct {
+    uint16_t next_in;                   /* Next point the mock device produces */
+    unsigned short *out;                /* Points the mock device was sent */
+    unsigned out_points;
+    unsigned out_max;
+    int transfers;
+    unsigned char last_request;
+    long delay_ns;                      /* Time each transfer takes on the bus */
+} mockdio;
+
+static int mockdio_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                     uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    mockdio.last_request = bRequest;
+    return 0;
+}
+
+static int mockdio_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                                  int *actual_length, unsigned int timeout )
+{
+    struct timespec ts = { 0, mockdio.delay_ns };
+    int i;
+    if ( endpoint & LIBUSB_ENDPOINT_IN ) {
+        for ( i = 0; i + 1 < length; i += 2 ) {
+            data[i] = mockdio.next_in & 0xff;
+            data[i + 1] = mockdio.next_in >> 8;
+            mockdio.next_in ++;
+        }
+    } else {
+        for ( i = 0; i + 1 < length && mockdio.out_points < mockdio.out_max; i += 2 )
+            mockdio.out[mockdio.out_points++] = data[i] | ( data[i + 1] << 8 );
+    }
+    mockdio.transfers ++;
+    *actual_length = length;
+    nanosleep( &ts, NULL );
+    return LIBUSB_SUCCESS;
+}
+
+class DIOStream : public ::testing::Test {
+ protected:
+    USBDevice usb;
+    AIOUSBDevice *dev;
+    int numDevices;
+    virtual void SetUp() {
+        memset( &mockdio, 0, sizeof(mockdio) );
+        mockdio.delay_ns = 20000;
+        memset( &usb, 0, sizeof(usb) );
+        usb.usb_control_transfer = mockdio_control_transfer;
+        usb.usb_bulk_transfer = mockdio_bulk_transfer;
+        numDevices = 0;
+        AIODeviceTableInit();
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_16A, &usb );
+        dev = AIODeviceTableGetDeviceAtIndex( 0, NULL );
+    }
+    virtual void TearDown() {
+        free( mockdio.out );
+        deviceTable[0].usb_device = NULL;
+        ClearAIODeviceTable( numDevices );
+    }
+};
+
+TEST_F(DIOStream, ReadDeliversEveryPointInOrder )
+{
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_TRUE, 65536 );
+    unsigned short points[1000];
+    unsigned total = 0;
+    ASSERT_TRUE( stream );
+    EXPECT_EQ( (unsigned)AIO_DIO_STREAM_DEFAULT_TRANSFER_SIZE, stream->transfer_size );
+    /* 1k points every ms, so the fifo holds 64 ms and a loaded machine that
+     * deschedules the reader for a while does not overrun it */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamSetTransfers( stream, stream->depth, 2048 ) );
+    mockdio.delay_ns = 1000000;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream ) );
+    EXPECT_EQ( AUR_DIO_STREAM_OPEN_INPUT, mockdio.last_request );
+    EXPECT_TRUE( dev->bDIOOpen );
+    EXPECT_EQ( -AIOUSB_ERROR_OPEN_FAILED, AIODIOStreamStart( stream ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODIOStreamWrite( stream, points, 1 ) );
+
+    while ( total < 100000 ) {
+        AIORET_TYPE n = AIODIOStreamRead( stream, points, 1000 );
+        ASSERT_GE( n, 0 );
+        ASSERT_EQ( RUNNING, AIODIOStreamGetStatus( stream ) );
+        for ( int i = 0; i < n; i ++, total ++ )
+            ASSERT_EQ( (uint16_t)total, points[i] );
+        if ( n == 0 )
+            sched_yield();
+    }
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_TRUE ) );
+    EXPECT_FALSE( dev->bDIOOpen );
+    EXPECT_GE( stream->bytes_transferred, 100000u * 2 );
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStream, ReadOverrunStopsTheStream )
+{
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_TRUE, 1024 );
+    ASSERT_TRUE( stream );
+    EXPECT_EQ( 1024u, stream->transfer_size ) << "two transfers fit in the fifo";
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamSetTransfers( stream, 2, 512 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODIOStreamSetTransfers( stream, 2, 1000 ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream ) );
+    while ( AIODIOStreamGetStatus( stream ) == RUNNING )
+        sched_yield();
+    EXPECT_EQ( TERMINATED_OVERRUN, AIODIOStreamGetStatus( stream ) );
+    EXPECT_EQ( 1u, usb.stats.overruns );
+    EXPECT_EQ( 1024, AIODIOStreamPointsAvailable( stream ) ) << "what arrived before the overrun can still be read";
+
+    AIODIOStreamStop( stream, AIOUSB_FALSE );
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStream, WriteDrainsEveryPointOnStop )
+{
+    const unsigned npoints = 50001;
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_FALSE, 4096 );
+    unsigned short points[777];
+    unsigned queued = 0;
+    ASSERT_TRUE( stream );
+    mockdio.out_max = npoints + 10;
+    mockdio.out = (unsigned short *)calloc( mockdio.out_max, sizeof(unsigned short) );
+
+    /* Queued before the start, so the device has data straight away */
+    for ( int i = 0; i < 100; i ++ )
+        points[i] = queued + i;
+    ASSERT_EQ( 100, AIODIOStreamWrite( stream, points, 100 ) );
+    queued = 100;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream ) );
+    EXPECT_EQ( AUR_DIO_STREAM_OPEN_OUTPUT, mockdio.last_request );
+
+    while ( queued < npoints ) {
+        unsigned n = MIN( 777u, npoints - queued );
+        for ( unsigned i = 0; i < n; i ++ )
+            points[i] = (unsigned short)( queued + i );
+        AIORET_TYPE accepted = AIODIOStreamWrite( stream, points, n );
+        ASSERT_GE( accepted, 0 );
+        queued += accepted;
+        if ( (unsigned)accepted < n )
+            sched_yield();
+    }
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_TRUE ) );
+    ASSERT_EQ( npoints, mockdio.out_points );
+    for ( unsigned i = 0; i < npoints; i ++ )
+        ASSERT_EQ( (unsigned short)i, mockdio.out[i] ) << "point " << i;
+    EXPECT_EQ( npoints * 2, stream->bytes_transferred );
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStream, AsyncCompletions )
+{
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_TRUE, 4096 );
+    AIODIOStreamAsyncState state;
+    struct libusb_transfer xfer;
+    struct libusb_transfer *transfers[1] = { &xfer };
+    AIOUSB_BOOL busy[1] = { AIOUSB_TRUE };
+    unsigned short data[64], points[64];
+    ASSERT_TRUE( stream );
+    for ( int i = 0; i < 64; i ++ )
+        data[i] = i;
+
+    memset( &xfer, 0, sizeof(xfer) );
+    memset( &state, 0, sizeof(state) );
+    pthread_mutex_init( &state.lock, NULL );
+    state.stream = stream;
+    state.dev = dev;
+    state.usb = &usb;
+    state.transfers = transfers;
+    state.busy = busy;
+    state.depth = 1;
+    xfer.user_data = &state;
+    xfer.buffer = (unsigned char *)data;
+    stream->status = RUNNING;
+
+    uint64_t submitted[1] = { AIOTransferTimestamp() };
+    AIOTransferHistograms hists;
+    state.submitted = submitted;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceEnableTransferHistograms( dev, AIOUSB_TRUE ) );
+
+    xfer.status = LIBUSB_TRANSFER_COMPLETED;
+    xfer.actual_length = sizeof(data);
+    EXPECT_TRUE( _aiodiostream_async_complete( &state, &xfer ) ) << "A running read resubmits";
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceGetTransferHistograms( dev, AIO_TRANSFER_DIO_STREAM, &hists ) );
+    EXPECT_EQ( 1u, hists.latency_ns.count ) << "Latency runs from the transfer's own submit time";
+    AIOUSBDeviceFreeTransferHistograms( dev );
+    ASSERT_EQ( 64, AIODIOStreamPointsAvailable( stream ) );
+    EXPECT_EQ( sizeof(data), usb.stats.bulk_bytes_in );
+    EXPECT_EQ( sizeof(data), stream->bytes_transferred );
+
+    xfer.status = LIBUSB_TRANSFER_ERROR;
+    xfer.actual_length = 0;
+    for ( int i = 1; i < AIO_DIO_STREAM_MAX_FAILURES; i ++ )
+        EXPECT_TRUE( _aiodiostream_async_complete( &state, &xfer ) );
+    EXPECT_FALSE( _aiodiostream_async_complete( &state, &xfer ) ) << "The last failure stops the stream";
+    EXPECT_EQ( (uint64_t)AIO_DIO_STREAM_MAX_FAILURES, usb.stats.errors );
+    EXPECT_EQ( TERMINATED, AIODIOStreamGetStatus( stream ) );
+    EXPECT_LT( AIODIOStreamGetExitCode( stream ), 0 );
+
+    /* A stopped stream retires the transfer instead of resubmitting it */
+    state.in_flight = 1;
+    _aiodiostream_async_cb( &xfer );
+    EXPECT_EQ( 0u, state.in_flight );
+    EXPECT_FALSE( busy[0] );
+    EXPECT_EQ( (uint64_t)AIO_DIO_STREAM_MAX_FAILURES + 2, usb.stats.bulk_transfers );
+
+    ASSERT_EQ( 64, AIODIOStreamRead( stream, points, 64 ) );
+    for ( int i = 0; i < 64; i ++ )
+        EXPECT_EQ( data[i], points[i] );
+
+    pthread_mutex_destroy( &state.lock );
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStream, AsyncWriteCompletionRefills )
+{
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_FALSE, 4096 );
+    AIODIOStreamAsyncState state;
+    struct libusb_transfer xfer;
+    struct libusb_transfer *transfers[1] = { &xfer };
+    AIOUSB_BOOL busy[1] = { AIOUSB_TRUE };
+    unsigned char block[512];
+    ASSERT_TRUE( stream );
+
+    memset( &xfer, 0, sizeof(xfer) );
+    memset( &state, 0, sizeof(state) );
+    pthread_mutex_init( &state.lock, NULL );
+    state.stream = stream;
+    state.dev = dev;
+    state.usb = &usb;
+    state.transfers = transfers;
+    state.busy = busy;
+    state.depth = 1;
+    state.in_flight = 1;
+    xfer.user_data = &state;
+    xfer.buffer = block;
+    xfer.status = LIBUSB_TRANSFER_COMPLETED;
+    xfer.actual_length = sizeof(block);
+    stream->status = RUNNING;
+
+    /* Nothing queued, so the transfer is left idle for the worker to refill */
+    _aiodiostream_async_cb( &xfer );
+    EXPECT_EQ( 0u, state.in_flight );
+    EXPECT_FALSE( busy[0] );
+    EXPECT_EQ( sizeof(block), usb.stats.bulk_bytes_out );
+    EXPECT_EQ( 1u, stream->underruns );
+    EXPECT_EQ( RUNNING, AIODIOStreamGetStatus( stream ) );
+
+    stream->status = NOT_STARTED;
+    pthread_mutex_destroy( &state.lock );
+    DeleteAIODIOStream( stream );
+}
+
+static struct libusb_transfer *mock_submitted;
+
+static int mock_submit( struct libusb_transfer *xfer )
+{
+    mock_submitted = xfer;
+    return LIBUSB_SUCCESS;
+}
+
+TEST_F(DIOStream, AsyncShortWritesResendTheRest )
+{
+    const unsigned npoints = 3000;
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_FALSE, 4096 );
+    AIODIOStreamAsyncState state;
+    struct libusb_transfer xfer;
+    struct libusb_transfer *transfers[1] = { &xfer };
+    AIOUSB_BOOL busy[1] = { AIOUSB_FALSE };
+    unsigned char block[1024];
+    unsigned short points[npoints];
+    int completions = 0;
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamSetTransfers( stream, 1, sizeof(block) ) );
+    mockdio.out_max = npoints;
+    mockdio.out = (unsigned short *)calloc( mockdio.out_max, sizeof(unsigned short) );
+    for ( unsigned i = 0; i < npoints; i ++ )
+        points[i] = (unsigned short)i;
+    ASSERT_EQ( (AIORET_TYPE)npoints, AIODIOStreamWrite( stream, points, npoints ) );
+
+    memset( &xfer, 0, sizeof(xfer) );
+    memset( &state, 0, sizeof(state) );
+    pthread_mutex_init( &state.lock, NULL );
+    state.stream = stream;
+    state.dev = dev;
+    state.usb = &usb;
+    state.transfers = transfers;
+    state.busy = busy;
+    state.depth = 1;
+    state.submit = mock_submit;
+    xfer.user_data = &state;
+    xfer.buffer = block;
+    stream->status = RUNNING;
+    stream->draining = AIOUSB_TRUE;
+
+    mock_submitted = NULL;
+    pthread_mutex_lock( &state.lock );
+    _aiodiostream_async_feed( &state );
+    pthread_mutex_unlock( &state.lock );
+
+    /* The device takes at most 300 bytes before each transfer times out */
+    while ( mock_submitted ) {
+        struct libusb_transfer *done = mock_submitted;
+        mock_submitted = NULL;
+        int taken = MIN( done->length, 300 );
+        for ( int i = 0; i + 1 < taken; i += 2 )
+            mockdio.out[mockdio.out_points++] = done->buffer[i] | ( done->buffer[i + 1] << 8 );
+        done->actual_length = taken;
+        done->status = ( taken < done->length ? LIBUSB_TRANSFER_TIMED_OUT : LIBUSB_TRANSFER_COMPLETED );
+        _aiodiostream_async_cb( done );
+        ASSERT_LT( ++completions, 100 );
+    }
+
+    EXPECT_EQ( 0u, state.in_flight );
+    EXPECT_FALSE( busy[0] );
+    EXPECT_EQ( RUNNING, AIODIOStreamGetStatus( stream ) ) << "timeouts with data are not failures";
+    EXPECT_EQ( block, xfer.buffer ) << "the transfer keeps its own block";
+    ASSERT_EQ( npoints, mockdio.out_points );
+    for ( unsigned i = 0; i < npoints; i ++ )
+        ASSERT_EQ( (unsigned short)i, mockdio.out[i] ) << "point " << i;
+    EXPECT_EQ( npoints * 2, stream->bytes_transferred );
+
+    stream->status = NOT_STARTED;
+    pthread_mutex_destroy( &state.lock );
+    DeleteAIODIOStream( stream );
+}
+
+TEST(DIOStreamSupport, NeedsAStreamingBoard )
+{
+    int numDevices = 0;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_32, NULL );
+    EXPECT_FALSE( NewAIODIOStream( 0, AIOUSB_TRUE, 100 ) ) << "smaller than one packet";
+    AIODIOStream *stream = NewAIODIOStream( 0, AIOUSB_TRUE, 1024 );
+    ASSERT_TRUE( stream );
+    EXPECT_EQ( -AIOUSB_ERROR_NOT_SUPPORTED, AIODIOStreamStart( stream ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_FALSE ) );
+    DeleteAIODIOStream( stream );
+    ClearAIODeviceTable( numDevices );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * @file   AIODIOStream.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Continuous DIO streaming with several bulk transfers kept in flight
+ *
+ */
+
+#ifndef _AIO_DIO_STREAM_H
+#define _AIO_DIO_STREAM_H
+
+#include "AIOTypes.h"
+#include "AIOFifo.h"
+#include "AIOUSB_DIO.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_DIO_STREAM_DEFAULT_DEPTH            4
+#define AIO_DIO_STREAM_DEFAULT_TRANSFER_SIZE    ( 16 * 1024 )
+#define AIO_DIO_STREAM_DEFAULT_TIMEOUT          1000
+
+/* BEGIN AIOUSB_API */
+
+/**
+ * @brief AIODIOStream is the DIO counterpart of AIOContinuousBuf. Where
+ * DIO_StreamFrame() moves one frame with one blocking bulk transfer at a
+ * time, a stream keeps several bulk transfers queued on the device from a
+ * background thread so the bus stays busy, and hands points to and from the
+ * application through a fifo.
+ *
+ * - Create it with NewAIODIOStream() for reading or writing
+ * - Optionally pick the number of transfers in flight and their size with
+ *   AIODIOStreamSetTransfers()
+ * - Set the clocks with DIO_StreamSetClocks() and call AIODIOStreamStart()
+ * - Consume points with AIODIOStreamRead() or produce them with
+ *   AIODIOStreamWrite() while the stream runs
+ * - AIODIOStreamStop() ends it, optionally letting a write stream drain
+ */
+typedef struct aio_dio_stream {
+    unsigned long DeviceIndex;
+    AIOUSB_BOOL is_read;
+    AIOFifoCounts *fifo;                /**< Points waiting for the application (read) or the device (write) */
+    unsigned depth;                     /**< Bulk transfers kept in flight, 0 moves one transfer at a time */
+    unsigned transfer_size;             /**< Bytes per bulk transfer, a multiple of 512 */
+    unsigned timeout;                   /**< Milliseconds one bulk transfer may take */
+    pthread_t worker;
+    volatile THREAD_STATUS status;      /**< NOT_STARTED, RUNNING, TERMINATED or TERMINATED_OVERRUN */
+    volatile AIOUSB_BOOL draining;      /**< Write streams: send what is left in the fifo, then stop */
+    AIOUSB_BOOL opened;                 /**< Start opened the device for streaming, so Stop closes it */
+    AIORET_TYPE exitcode;
+    volatile uint64_t bytes_transferred;
+    volatile uint64_t underruns;        /**< Times a write stream had nothing to send */
+} AIODIOStream;
+
+PUBLIC_EXTERN AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIOUSB_BOOL is_read, unsigned points );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOStream( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamSetTransfers( AIODIOStream *stream, unsigned depth, unsigned transfer_size );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamSetTimeout( AIODIOStream *stream, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamStart( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamStop( AIODIOStream *stream, AIOUSB_BOOL drain );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *points, unsigned maxpoints );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, unsigned short *points, unsigned npoints );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamPointsAvailable( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetStatus( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetExitCode( AIODIOStream *stream );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
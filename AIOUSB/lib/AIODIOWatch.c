@@ -0,0 +1,538 @@
+/**
+ * @file   AIODIOWatch.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Background polling of DIO inputs with timestamped edge events
+ *
+ */
+
+#include "AIOUSB_Log.h"
+#include "AIODIOWatch.h"
+#include "AIODeviceTable.h"
+#include "AIOHistogram.h"
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIO_DIO_WATCH_MAX_FAILURES      5
+#define AIO_DIO_WATCH_LONGEST_NAP_NS    ( 10 * 1000 * 1000ull )
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a watch of the inputs of DeviceIndex
+ * @param DeviceIndex
+ * @param period_us Time between polls, 0 for AIO_DIO_WATCH_DEFAULT_PERIOD_US
+ * @param capacity Slots in the ring of edges, rounded up to a power of two,
+ *        0 for AIO_DIO_WATCH_DEFAULT_CAPACITY. Subscribers can read the
+ *        last capacity - 1 of them.
+ * @return The watch, or NULL if the device has no DIO
+ */
+AIODIOWatch *NewAIODIOWatch( unsigned long DeviceIndex, unsigned period_us, unsigned capacity )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( NULL, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( NULL, device->DIOBytes );
+
+    unsigned size = 1;
+    while ( size < ( capacity ? capacity : AIO_DIO_WATCH_DEFAULT_CAPACITY ) )
+        size <<= 1;
+
+    AIODIOWatch *watch = (AIODIOWatch *)calloc( 1, sizeof(AIODIOWatch) );
+    AIO_ERROR_VALID_DATA( NULL, watch );
+    watch->nbytes = device->DIOBytes;
+    watch->image = (unsigned char *)calloc( 2, watch->nbytes );
+    watch->edges = (AIODIOEdge *)calloc( size, sizeof(AIODIOEdge) );
+    if ( !watch->image || !watch->edges ) {
+        free( watch->image );
+        free( watch->edges );
+        free( watch );
+        return NULL;
+    }
+
+    watch->scratch = watch->image + watch->nbytes;
+    watch->capacity = size;
+    watch->DeviceIndex = DeviceIndex;
+    watch->period_us = ( period_us ? period_us : AIO_DIO_WATCH_DEFAULT_PERIOD_US );
+    watch->status = NOT_STARTED;
+
+    return watch;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIODIOWatch( AIODIOWatch *watch )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    AIODIOWatchStop( watch );
+    free( watch->image );
+    free( watch->edges );
+    free( watch );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Changes the time between polls, also while the watch runs
+ */
+AIORET_TYPE AIODIOWatchSetPeriod( AIODIOWatch *watch, unsigned period_us )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, period_us > 0 );
+    watch->period_us = period_us;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOWatchGetStatus( AIODIOWatch *watch )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    return watch->status;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOWatchGetExitCode( AIODIOWatch *watch )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    return watch->exitcode;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the inputs seen by the latest poll
+ * @param watch
+ * @param buf DIOBytes bytes, laid out as DIO_ReadAll() fills them
+ * @param timestamp_ns When that poll was made, may be NULL
+ * @return AIOUSB_SUCCESS, or -AIOUSB_ERROR_DEVICE_NOT_FOUND before the
+ *         first poll completed
+ */
+AIORET_TYPE AIODIOWatchReadAll( AIODIOWatch *watch, void *buf, uint64_t *timestamp_ns )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf );
+
+    uint64_t seq, when;
+    do {
+        seq = __atomic_load_n( &watch->image_seq, __ATOMIC_ACQUIRE );
+        if ( seq == 0 )
+            return -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+        if ( seq & 1 )
+            continue;
+        memcpy( buf, watch->image, watch->nbytes );
+        when = watch->image_ns;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    } while ( ( seq & 1 ) || __atomic_load_n( &watch->image_seq, __ATOMIC_RELAXED ) != seq );
+
+    if ( timestamp_ns )
+        *timestamp_ns = when;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Follows the edges of watch from now on
+ * @return A subscriber to pass to AIODIOWatchNextEdges() and free with
+ *         AIODIOWatchUnsubscribe()
+ */
+AIODIOWatchSubscriber *AIODIOWatchSubscribe( AIODIOWatch *watch )
+{
+    AIO_ASSERT_RET( NULL, watch );
+    AIODIOWatchSubscriber *sub = (AIODIOWatchSubscriber *)calloc( 1, sizeof(AIODIOWatchSubscriber) );
+    AIO_ERROR_VALID_DATA( NULL, sub );
+    sub->watch = watch;
+    sub->next = __atomic_load_n( &watch->head, __ATOMIC_ACQUIRE );
+    return sub;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOWatchUnsubscribe( AIODIOWatchSubscriber *sub )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, sub );
+    free( sub );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Edges lost by sub because it fell more than the watch's
+ *        capacity - 1 behind
+ */
+AIORET_TYPE AIODIOWatchGetLost( AIODIOWatchSubscriber *sub )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, sub );
+    return (AIORET_TYPE)sub->lost;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to maxedges edges, oldest first, without waiting. Only
+ *        one thread may use a subscriber at a time.
+ * @return Edges copied to edges, possibly 0
+ */
+AIORET_TYPE AIODIOWatchNextEdges( AIODIOWatchSubscriber *sub, AIODIOEdge *edges, unsigned maxedges )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, sub );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, edges );
+    AIODIOWatch *watch = sub->watch;
+    uint64_t cap = watch->capacity;
+
+    /**
+     * The worker may be writing the slot of edge head before publishing
+     * it, so only the capacity - 1 edges before head are safe to copy
+     */
+    uint64_t head = __atomic_load_n( &watch->head, __ATOMIC_ACQUIRE );
+    if ( head - sub->next >= cap ) {
+        sub->lost += head - cap + 1 - sub->next;
+        sub->next = head - cap + 1;
+    }
+
+    uint64_t n = head - sub->next;
+    if ( n > maxedges )
+        n = maxedges;
+    for ( uint64_t i = 0; i < n; i ++ )
+        edges[i] = watch->edges[ ( sub->next + i ) & ( cap - 1 ) ];
+
+    /* Drop whatever the worker overwrote while it was being copied */
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    head = __atomic_load_n( &watch->head, __ATOMIC_RELAXED );
+    uint64_t stale = 0;
+    if ( head - sub->next >= cap ) {
+        stale = head - cap + 1 - sub->next;
+        if ( stale > n )
+            stale = n;
+        memmove( edges, edges + stale, ( n - stale ) * sizeof(AIODIOEdge) );
+        sub->lost += stale;
+    }
+    sub->next += n;
+
+    return (AIORET_TYPE)( n - stale );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @cond INTERNAL_DOCUMENTATION
+ */
+static void _aiodiowatch_publish_edge( AIODIOWatch *watch, unsigned bit, AIOUSB_BOOL rising, uint64_t when )
+{
+    uint64_t head = watch->head;
+    AIODIOEdge *edge = &watch->edges[ head & ( watch->capacity - 1 ) ];
+    edge->timestamp_ns = when;
+    edge->bit = bit;
+    edge->rising = rising;
+    __atomic_store_n( &watch->head, head + 1, __ATOMIC_RELEASE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Publishes the edges between image and scratch, then makes scratch
+ *        the latest image. Only the worker calls this.
+ */
+static void _aiodiowatch_publish( AIODIOWatch *watch, uint64_t when )
+{
+    if ( watch->image_seq ) {
+        for ( unsigned i = 0; i < watch->nbytes; i ++ ) {
+            unsigned changed = watch->image[i] ^ watch->scratch[i];
+            while ( changed ) {
+                unsigned b = __builtin_ctz( changed );
+                _aiodiowatch_publish_edge( watch, i * BITS_PER_BYTE + b, ( watch->scratch[i] >> b ) & 1 ? AIOUSB_TRUE : AIOUSB_FALSE, when );
+                changed &= changed - 1;
+            }
+        }
+    }
+
+    uint64_t seq = watch->image_seq;
+    __atomic_store_n( &watch->image_seq, seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    memcpy( watch->image, watch->scratch, watch->nbytes );
+    watch->image_ns = when;
+    __atomic_store_n( &watch->image_seq, seq + 2, __ATOMIC_RELEASE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sleeps until deadline in naps short enough to notice a stop
+ */
+static void _aiodiowatch_sleep_until( AIODIOWatch *watch, uint64_t deadline )
+{
+    uint64_t now;
+    while ( watch->status == RUNNING && ( now = AIOTransferTimestamp() ) < deadline ) {
+        uint64_t nap = deadline - now;
+        if ( nap > AIO_DIO_WATCH_LONGEST_NAP_NS )
+            nap = AIO_DIO_WATCH_LONGEST_NAP_NS;
+        struct timespec ts = { (time_t)( nap / 1000000000ull ), (long)( nap % 1000000000ull ) };
+        nanosleep( &ts, NULL );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_aiodiowatch_worker( void *object )
+{
+    AIODIOWatch *watch = (AIODIOWatch *)object;
+    int failures = 0;
+    uint64_t next = AIOTransferTimestamp();
+
+    while ( watch->status == RUNNING ) {
+        uint64_t start = AIOTransferTimestamp();
+        AIORESULT result = DIO_ReadAll( watch->DeviceIndex, watch->scratch );
+        uint64_t end = AIOTransferTimestamp();
+
+        if ( result == AIOUSB_SUCCESS ) {
+            failures = 0;
+            _aiodiowatch_publish( watch, start + ( end - start ) / 2 );
+            __sync_fetch_and_add( &watch->polls, 1 );
+        } else if ( ++failures >= AIO_DIO_WATCH_MAX_FAILURES ) {
+            AIOUSB_ERROR("DIO watch of device %lu stopped, DIO_ReadAll failed: %d\n", watch->DeviceIndex, (int)result );
+            watch->exitcode = -(AIORET_TYPE)result;
+            watch->status = TERMINATED;
+            break;
+        }
+
+        /* Keep to the schedule, but do not try to catch up on missed polls */
+        next += watch->period_us * 1000ull;
+        end = AIOTransferTimestamp();
+        if ( next < end ) {
+            __sync_fetch_and_add( &watch->late_polls, 1 );
+            next = end;
+        }
+        _aiodiowatch_sleep_until( watch, next );
+    }
+
+    return NULL;
+}
+/**
+ * @endcond
+ */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts polling. The first poll sets the image the next ones are
+ *        compared with, so it produces no edges. A watch whose reads
+ *        failed may be started again without calling AIODIOWatchStop().
+ */
+AIORET_TYPE AIODIOWatchStart( AIODIOWatch *watch )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_OPEN_FAILED, watch->status != RUNNING );
+
+    /* The worker stopped itself, but its thread still has to be joined */
+    if ( watch->status != NOT_STARTED ) {
+        pthread_join( watch->worker, NULL );
+        watch->status = NOT_STARTED;
+    }
+
+    watch->exitcode = AIOUSB_SUCCESS;
+    watch->status = RUNNING;
+    if ( pthread_create( &watch->worker, NULL, _aiodiowatch_worker, watch ) != 0 ) {
+        watch->status = NOT_STARTED;
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops polling and waits for the worker. The image, the edges and
+ *        the subscribers stay valid and the watch may be started again.
+ * @return The watch's exit code, AIOUSB_SUCCESS unless the reads failed
+ */
+AIORET_TYPE AIODIOWatchStop( AIODIOWatch *watch )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, watch );
+    if ( watch->status == NOT_STARTED )
+        return AIOUSB_SUCCESS;
+
+    if ( watch->status == RUNNING )
+        watch->status = TERMINATED;
+    pthread_join( watch->worker, NULL );
+    watch->status = NOT_STARTED;
+
+    return watch->exitcode;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "AIOUSBDevice.h"
+
+using namespace AIOUSB;
+
+static struct {
+    volatile uint32_t inputs;           /* What the mock board's inputs read, byte 0 lowest */
+    int reads;
+    int fail;                           /* Fail AUR_DIO_READ with this libusb code */
+} mockwatch;
+
+static int mockwatch_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                       uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest != AUR_DIO_READ )
+        return 0;
+    __sync_fetch_and_add( &mockwatch.reads, 1 );
+    if ( mockwatch.fail )
+        return mockwatch.fail;
+    uint32_t inputs = mockwatch.inputs;
+    for ( unsigned i = 0; i < wLength && i < sizeof(inputs); i ++ )
+        data[i] = ( inputs >> ( 8 * i ) ) & 0xff;
+    return wLength;
+}
+
+class DIOWatch : public ::testing::Test {
+ protected:
+    USBDevice usb;
+    int numDevices;
+    virtual void SetUp() {
+        memset( &mockwatch, 0, sizeof(mockwatch) );
+        memset( &usb, 0, sizeof(usb) );
+        usb.usb_control_transfer = mockwatch_control_transfer;
+        numDevices = 0;
+        AIODeviceTableInit();
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_IIRO_16, &usb );
+    }
+    virtual void TearDown() {
+        deviceTable[0].usb_device = NULL;
+        ClearAIODeviceTable( numDevices );
+    }
+    void waitForPolls( AIODIOWatch *watch, uint64_t count ) {
+        for ( int i = 0; i < 2000 && watch->polls < count && watch->status == RUNNING; i ++ ) {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep( &ts, NULL );
+        }
+    }
+};
+
+TEST_F(DIOWatch, EdgesReachEverySubscriber )
+{
+    AIODIOWatch *watch = NewAIODIOWatch( 0, 500, 0 );
+    ASSERT_TRUE( watch );
+    unsigned char image[4];
+    EXPECT_EQ( -AIOUSB_ERROR_DEVICE_NOT_FOUND, AIODIOWatchReadAll( watch, image, NULL ) );
+
+    mockwatch.inputs = 0x01;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOWatchStart( watch ) );
+    waitForPolls( watch, 1 );
+    AIODIOWatchSubscriber *first = AIODIOWatchSubscribe( watch );
+    AIODIOWatchSubscriber *second = AIODIOWatchSubscribe( watch );
+
+    mockwatch.inputs = 0x00020008;
+    waitForPolls( watch, watch->polls + 2 );
+    mockwatch.inputs = 0x00020000;
+    waitForPolls( watch, watch->polls + 2 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOWatchStop( watch ) );
+
+    AIODIOEdge edges[8], others[8];
+    ASSERT_EQ( 4, AIODIOWatchNextEdges( first, edges, 8 ) );
+    EXPECT_EQ( 0u, edges[0].bit );
+    EXPECT_FALSE( edges[0].rising );
+    EXPECT_EQ( 3u, edges[1].bit );
+    EXPECT_TRUE( edges[1].rising );
+    EXPECT_EQ( 17u, edges[2].bit );
+    EXPECT_TRUE( edges[2].rising );
+    EXPECT_EQ( 3u, edges[3].bit );
+    EXPECT_FALSE( edges[3].rising );
+    EXPECT_EQ( edges[1].timestamp_ns, edges[2].timestamp_ns ) << "Seen by the same poll";
+    EXPECT_LT( edges[2].timestamp_ns, edges[3].timestamp_ns );
+    EXPECT_EQ( 0, AIODIOWatchNextEdges( first, edges, 8 ) );
+
+    ASSERT_EQ( 4, AIODIOWatchNextEdges( second, others, 8 ) );
+    EXPECT_EQ( 0, memcmp( edges, others, 4 * sizeof(AIODIOEdge) ) );
+    EXPECT_EQ( 0, AIODIOWatchGetLost( second ) );
+
+    /* Snapshots are served from the image, not the board */
+    int reads = mockwatch.reads;
+    uint64_t when = 0;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOWatchReadAll( watch, image, &when ) );
+    EXPECT_EQ( 0x00, image[0] );
+    EXPECT_EQ( 0x02, image[2] );
+    EXPECT_LE( edges[3].timestamp_ns, when );
+    EXPECT_EQ( reads, mockwatch.reads );
+
+    AIODIOWatchUnsubscribe( first );
+    AIODIOWatchUnsubscribe( second );
+    DeleteAIODIOWatch( watch );
+}
+
+TEST_F(DIOWatch, SlowSubscriberLosesTheOldestEdges )
+{
+    AIODIOWatch *watch = NewAIODIOWatch( 0, 0, 3 );
+    ASSERT_TRUE( watch );
+    EXPECT_EQ( 4u, watch->capacity );
+    AIODIOWatchSubscriber *sub = AIODIOWatchSubscribe( watch );
+
+    _aiodiowatch_publish( watch, 1 );
+    for ( int i = 0; i < 10; i ++ ) {
+        watch->scratch[0] ^= 0x01;
+        _aiodiowatch_publish( watch, 2 + i );
+    }
+
+    AIODIOEdge edges[8];
+    ASSERT_EQ( 3, AIODIOWatchNextEdges( sub, edges, 8 ) );
+    EXPECT_EQ( 7, AIODIOWatchGetLost( sub ) );
+    EXPECT_EQ( 9u, edges[0].timestamp_ns );
+    EXPECT_EQ( 11u, edges[2].timestamp_ns );
+    EXPECT_TRUE( edges[1].rising );
+    EXPECT_FALSE( edges[2].rising );
+
+    AIODIOWatchUnsubscribe( sub );
+    DeleteAIODIOWatch( watch );
+}
+
+TEST_F(DIOWatch, ReadFailuresStopTheWatch )
+{
+    mockwatch.fail = LIBUSB_ERROR_IO;
+    AIODIOWatch *watch = NewAIODIOWatch( 0, 200, 0 );
+    ASSERT_TRUE( watch );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOWatchStart( watch ) );
+    waitForPolls( watch, 1 );
+    EXPECT_EQ( TERMINATED, AIODIOWatchGetStatus( watch ) );
+    EXPECT_EQ( AIO_DIO_WATCH_MAX_FAILURES, mockwatch.reads );
+    EXPECT_LT( AIODIOWatchStop( watch ), 0 );
+    DeleteAIODIOWatch( watch );
+}
+
+TEST_F(DIOWatch, RestartsAfterReadFailures )
+{
+    mockwatch.fail = LIBUSB_ERROR_IO;
+    AIODIOWatch *watch = NewAIODIOWatch( 0, 200, 0 );
+    ASSERT_TRUE( watch );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOWatchStart( watch ) );
+    waitForPolls( watch, 1 );
+    ASSERT_EQ( TERMINATED, AIODIOWatchGetStatus( watch ) );
+
+    mockwatch.fail = 0;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOWatchStart( watch ) ) << "The stopped worker is joined, not leaked";
+    waitForPolls( watch, 2 );
+    EXPECT_EQ( RUNNING, AIODIOWatchGetStatus( watch ) );
+    EXPECT_GE( watch->polls, 2u );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOWatchStop( watch ) );
+    DeleteAIODIOWatch( watch );
+}
+
+TEST(DIOWatchSupport, NeedsADIOBoard )
+{
+    int numDevices = 0;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTable( &numDevices, USB_IIRO_16 );
+    deviceTable[0].DIOBytes = 0;
+    EXPECT_FALSE( NewAIODIOWatch( 0, 0, 0 ) );
+    deviceTable[0].DIOBytes = 4;
+    ClearAIODeviceTable( numDevices );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+    return RUN_ALL_TESTS();
+}
+
+#endif
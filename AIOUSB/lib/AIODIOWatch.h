@@ -0,0 +1,96 @@
+/**
+ * @file   AIODIOWatch.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Background polling of DIO inputs with timestamped edge events
+ *
+ */
+
+#ifndef _AIO_DIO_WATCH_H
+#define _AIO_DIO_WATCH_H
+
+#include "AIOTypes.h"
+#include "AIOUSB_DIO.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_DIO_WATCH_DEFAULT_PERIOD_US     1000
+#define AIO_DIO_WATCH_DEFAULT_CAPACITY      1024
+
+/* BEGIN AIOUSB_API */
+
+/**
+ * @brief One input that changed between two polls
+ */
+typedef struct aio_dio_edge {
+    uint64_t timestamp_ns;              /**< CLOCK_MONOTONIC, the middle of the poll that saw it */
+    unsigned bit;
+    AIOUSB_BOOL rising;
+} AIODIOEdge;
+
+/**
+ * @brief AIODIOWatch reads the inputs of a device with DIO_ReadAll() at a
+ * fixed rate from one thread, so any number of threads can follow them
+ * without each paying for a control transfer.
+ *
+ * - AIODIOWatchReadAll() returns the latest image without touching USB
+ * - Every change between two polls becomes an AIODIOEdge in a ring of
+ *   capacity slots. The slot after head may be rewritten at any time, so
+ *   subscribers are given the last capacity - 1 edges. Each
+ *   AIODIOWatchSubscribe() gets its own cursor into it; the poller never
+ *   waits for subscribers, so one that falls more than capacity - 1 edges
+ *   behind loses the oldest and is told how many.
+ */
+typedef struct aio_dio_watch {
+    unsigned long DeviceIndex;
+    volatile unsigned period_us;
+    unsigned nbytes;                    /**< DIOBytes of the device */
+    pthread_t worker;
+    volatile THREAD_STATUS status;      /**< NOT_STARTED, RUNNING or TERMINATED */
+    AIORET_TYPE exitcode;
+    unsigned char *image;               /**< Latest inputs, consistent when image_seq is even */
+    unsigned char *scratch;             /**< What the poll in progress read */
+    uint64_t image_ns;
+    volatile uint64_t image_seq;        /**< Odd while the worker rewrites image, 0 before the first poll */
+    AIODIOEdge *edges;
+    unsigned capacity;                  /**< Size of edges, a power of two */
+    volatile uint64_t head;             /**< Edges published so far */
+    volatile uint64_t polls;
+    volatile uint64_t late_polls;       /**< Polls started more than a period after the one before */
+} AIODIOWatch;
+
+/**
+ * @brief A consumer's place in the edges of an AIODIOWatch
+ */
+typedef struct aio_dio_watch_subscriber {
+    AIODIOWatch *watch;
+    uint64_t next;                      /**< Edge to hand out next */
+    uint64_t lost;                      /**< Edges overwritten before they were handed out */
+} AIODIOWatchSubscriber;
+
+PUBLIC_EXTERN AIODIOWatch *NewAIODIOWatch( unsigned long DeviceIndex, unsigned period_us, unsigned capacity );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOWatch( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchSetPeriod( AIODIOWatch *watch, unsigned period_us );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchStart( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchStop( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchGetStatus( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchGetExitCode( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchReadAll( AIODIOWatch *watch, void *buf, uint64_t *timestamp_ns );
+PUBLIC_EXTERN AIODIOWatchSubscriber *AIODIOWatchSubscribe( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchUnsubscribe( AIODIOWatchSubscriber *sub );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchNextEdges( AIODIOWatchSubscriber *sub, AIODIOEdge *edges, unsigned maxedges );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchGetLost( AIODIOWatchSubscriber *sub );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
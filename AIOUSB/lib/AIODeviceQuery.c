@@ -171,6 +171,40 @@ AIORET_TYPE AIODeviceQueryGetNumCounters( AIODeviceQuery *devq )
     return devq->numCounters;
 }
 
+/*------------------------------------------------------------------------*/
+/**
+ * @brief Reads the traffic counters of the device in question as they are
+ * now, so calling this again later shows what has happened since
+ * @param devq AIODeviceQuery *
+ * @param stats Receives the counters
+ * @return AIOUSB_SUCCESS, otherwise an error
+ */
+AIORET_TYPE AIODeviceQueryGetIOStats( AIODeviceQuery *devq, USBDeviceIOStats *stats )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_AIODEVICE_QUERY, devq );
+
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( devq->index, &result );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_DEVICE_NOT_FOUND, dev );
+    return AIOUSBDeviceGetIOStats( dev, stats );
+}
+
+/*------------------------------------------------------------------------*/
+/**
+ * @brief Zeroes the traffic counters of the device in question
+ * @param devq AIODeviceQuery *
+ * @return AIOUSB_SUCCESS, otherwise an error
+ */
+AIORET_TYPE AIODeviceQueryResetIOStats( AIODeviceQuery *devq )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_AIODEVICE_QUERY, devq );
+
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( devq->index, &result );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_DEVICE_NOT_FOUND, dev );
+    return AIOUSBDeviceResetIOStats( dev );
+}
+
 
 
 
@@ -237,6 +271,24 @@ TEST(AIODeviceQuery,StringRepresentation)
     ClearAIODeviceTable( numDevices );
 }
 
+TEST(AIODeviceQuery,IOStatsOfAnUnopenedDeviceAreZero)
+{
+    int numDevices = 0;
+    USBDeviceIOStats stats;
+    AIODeviceTableInit();    
+    AIODeviceTableAddDeviceToDeviceTable( &numDevices, USB_AIO16_16A );
+
+    AIODeviceQuery *ndev = NewAIODeviceQuery( 0 );
+    memset( &stats, 0xff, sizeof(stats) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODeviceQueryGetIOStats( ndev, &stats ) );
+    EXPECT_EQ( 0u, stats.control_transfers );
+    EXPECT_EQ( 0u, stats.resets );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODeviceQueryResetIOStats( ndev ) );
+
+    DeleteAIODeviceQuery( ndev );
+    ClearAIODeviceTable( numDevices );
+}
+
 
 
 int 
@@ -13,6 +13,7 @@
 #define _AIO_DEVICE_QUERY_H
 
 #include "AIOTypes.h"
+#include "USBDevice.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -47,6 +48,8 @@ PUBLIC_EXTERN char * AIODeviceQueryGetName( AIODeviceQuery *devq );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetNumDIOBytes( AIODeviceQuery *devq );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetNumCounters( AIODeviceQuery *devq );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetIndex( AIODeviceQuery *devq );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetIOStats( AIODeviceQuery *devq, USBDeviceIOStats *stats );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryResetIOStats( AIODeviceQuery *devq );
 
 
 /* END AIOUSB_API */
@@ -1,5 +1,12 @@
 #include "AIODeviceTable.h" 
 #include "AIOPlugNPlay.h"
+#include "AIOConversionPlan.h"
+#include "AIOThreadPolicy.h"
+#include "AIOUSB_Log.h"
+#include "AIOContinuousBuffer.h"
+#include "USBSimulator.h"
+#include "AIOHistogram.h"
+#include "AIOUSB_DIO.h"
 #include <string.h>
 #include <errno.h>
 
@@ -9,6 +16,12 @@ namespace AIOUSB {
 
 AIOUSBDevice deviceTable[ MAX_USB_DEVICES ];
 
+/* Guards which entries of deviceTable[] are in use; see AIODeviceTableLockWrite() */
+static pthread_rwlock_t deviceTableGuard = PTHREAD_RWLOCK_INITIALIZER;
+/* USBDevices of boards that were replaced while an acquisition on them was
+ * still started, freed once it ends, see _AIODeviceTableReclaimRetired() */
+static USBDevice *retiredUSBDevices = NULL;
+
 
 static ProductIDName productIDNameTable[] = {
     { USB_DA12_8A_REV_A , "USB-DA12-8A-A"  },
@@ -155,6 +168,9 @@ AIOUSBDevice *_verified_device( AIOUSBDevice *dev, AIORESULT *result )
 {
     if ( dev && dev->valid == AIOUSB_TRUE ) {
         return dev;
+    } else if ( dev && dev->bDeviceWasHere ) {
+        *result = AIOUSB_ERROR_DEVICE_REMOVED;
+        return NULL;
     } else { 
         *result = AIOUSB_ERROR_INVALID_DEVICE_SETTING;
         return NULL;
@@ -173,11 +189,150 @@ AIOUSB_BOOL AIOUSB_SetInit()
     return AIOUSB_TRUE;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts one entry back in its never used state, leaving usb_device
+ * and the locks alone, so it can be used on an entry other threads may
+ * still be waiting on
+ */
+static void _reset_device( AIOUSBDevice *device )
+{
+    /* run-time settings */
+    device->discardFirstSample = AIOUSB_FALSE;
+    device->commTimeout = 5000;
+    device->miscClockHz = 1;
+
+    /* device-specific properties */
+    device->ProductID = 0;
+    device->DIOBytes
+        = device->Counters
+        = device->Tristates
+        = device->ConfigBytes
+        = device->ImmDACs
+        = device->DACsUsed
+        = device->ADCChannels
+        = device->ADCMUXChannels
+        = device->ADCChannelsPerGroup
+        = device->WDGBytes
+        = device->ImmADCs
+        = device->FlashSectors
+        = 0;
+    device->RootClock
+        = device->StreamingBlockSize
+        = 0;
+    device->bGateSelectable
+        = device->bGetName
+        = device->bDACStream
+        = device->bADCStream
+        = device->bDIOStream
+        = device->bDIOSPI
+        = device->bClearFIFO
+        = device->bDACBoardRange
+        = device->bDACChannelCal
+        = AIOUSB_FALSE;
+
+    /* device state */
+    device->bDACOpen
+        = device->bDACClosing
+        = device->bDACAborting
+        = device->bDACStarted
+        = device->bDIOOpen
+        = device->bDIORead
+        = AIOUSB_FALSE;
+    device->DACData = NULL;
+    device->PendingDACData = NULL;
+    device->DACDataBytes = NULL;
+    device->DACDataHead = device->DACDataQueued = 0;
+    device->PendingDACDataBytes = 0;
+    device->bDACInterlock = AIOUSB_FALSE;
+    device->DACResult = AIOUSB_SUCCESS;
+    device->bDACFinished = AIOUSB_FALSE;
+    device->DACDataWaiters = 0;
+    device->DACRequests = NULL;
+    device->LastDIOData = NULL;
+    device->DIOTransactionDepth = 0;
+    device->bDIODirty = AIOUSB_FALSE;
+    device->DIOCoalesceWindow = 0;
+    device->DIOCoalesceDeadline = 0;
+    device->bDIOCoalescing = AIOUSB_FALSE;
+    device->DIOFlushResult = AIOUSB_SUCCESS;
+    device->cachedName = NULL;
+    device->cachedSerialNumber = 0;
+    device->cachedConfigBlock.size = 0;       // .size == 0 == uninitialized
+    device->conversionPlan = NULL;
+    device->conversionPlanReaders = 0;
+    device->scanProfileResident = AIOUSB_FALSE;
+    device->bulkAcquirePolicy = NULL;
+    device->transferHistograms = NULL;
+    device->activeTransferHistograms = NULL;
+    device->openDeferred = AIOUSB_FALSE;
+    device->opening = AIOUSB_FALSE;
+    device->openResult = AIOUSB_SUCCESS;
+
+    /* worker thread state */
+    device->workerBusy = AIOUSB_FALSE;
+    device->workerStatus = 0;
+    device->workerResult = AIOUSB_SUCCESS;
+    device->valid = AIOUSB_FALSE;
+    device->testing = AIOUSB_FALSE;
+    device->bDeviceWasHere = AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/** @brief Like _reset_device(), and sets up the locks, for when nothing uses the table */
+static void _init_device( AIOUSBDevice *device )
+{
+    _reset_device( device );
+    pthread_mutex_init( &device->openLock, NULL );
+    AIOUSBDeviceInitLock( device );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes the device table guard for reading. Lookups take it for
+ * the moment they inspect the table, so it is cheap and many threads
+ * can hold it at once.
+ */
+AIORET_TYPE AIODeviceTableLockRead( void )
+{
+    return ( pthread_rwlock_rdlock( &deviceTableGuard ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes the device table guard for writing, for adding, removing
+ * or resetting entries.
+ * @note Lock order, outermost first:
+ * 1. AIOUSBDeviceLock(), held for a whole call on one device
+ * 2. The deferred open lock of that device
+ * 3. The device table guard, for reading, while looking a device up
+ * 4. AIOContinuousBuf and AIOFifo locks
+ * The guard is not recursive. While holding it for writing, do not look
+ * devices up (AIODeviceTableGetDeviceAtIndex(), CheckPNPData()) and do
+ * not take a device lock.
+ */
+AIORET_TYPE AIODeviceTableLockWrite( void )
+{
+    return ( pthread_rwlock_wrlock( &deviceTableGuard ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODeviceTableUnlock( void )
+{
+    return ( pthread_rwlock_unlock( &deviceTableGuard ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
 /*----------------------------------------------------------------------------*/
 void AIODeviceTableInit(void)
 {
     int index;
     AIORESULT result;
+    AIODeviceTableLockWrite();
+    while ( retiredUSBDevices ) {
+        USBDevice *usb = retiredUSBDevices;
+        retiredUSBDevices = usb->retired;
+        DeleteUSBDevice( usb );
+    }
     for(index = 0; index < MAX_USB_DEVICES; index++) {
         AIOUSBDevice *device = _get_device( index , &result );
         /* libusb handles */
@@ -189,63 +344,9 @@ void AIODeviceTableInit(void)
         } else {
             device->usb_device = NULL;
         }
-
-        /* run-time settings */
-        device->discardFirstSample = AIOUSB_FALSE;
-        device->commTimeout = 5000;
-        device->miscClockHz = 1;
-
-        /* device-specific properties */
-        device->ProductID = 0;
-        device->DIOBytes
-            = device->Counters
-            = device->Tristates
-            = device->ConfigBytes
-            = device->ImmDACs
-            = device->DACsUsed
-            = device->ADCChannels
-            = device->ADCMUXChannels
-            = device->ADCChannelsPerGroup
-            = device->WDGBytes
-            = device->ImmADCs
-            = device->FlashSectors
-            = 0;
-        device->RootClock
-            = device->StreamingBlockSize
-            = 0;
-        device->bGateSelectable
-            = device->bGetName
-            = device->bDACStream
-            = device->bADCStream
-            = device->bDIOStream
-            = device->bDIOSPI
-            = device->bClearFIFO
-            = device->bDACBoardRange
-            = device->bDACChannelCal
-            = AIOUSB_FALSE;
-
-        /* device state */
-        device->bDACOpen
-            = device->bDACClosing
-            = device->bDACAborting
-            = device->bDACStarted
-            = device->bDIOOpen
-            = device->bDIORead
-            = AIOUSB_FALSE;
-        device->DACData = NULL;
-        device->PendingDACData = NULL;
-        device->LastDIOData = NULL;
-        device->cachedName = NULL;
-        device->cachedSerialNumber = 0;
-        device->cachedConfigBlock.size = 0;       // .size == 0 == uninitialized
-
-        /* worker thread state */
-        device->workerBusy = AIOUSB_FALSE;
-        device->workerStatus = 0;
-        device->workerResult = AIOUSB_SUCCESS;
-        device->valid = AIOUSB_FALSE;
-        device->testing = AIOUSB_FALSE;
+        _init_device( device );
     }
+    AIODeviceTableUnlock();
     AIOUSB_SetInit();
 }
 
@@ -1030,7 +1131,7 @@ AIORESULT  _Card_Specific_Settings(unsigned long DeviceIndex)
  }
 
 /*----------------------------------------------------------------------------*/ 
-AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORESULT *res ) 
+static AIOUSBDevice *_lookup_device( unsigned long DeviceIndex , AIORESULT *res ) 
 {
     AIOUSBDevice *retval = NULL;
     AIO_ERROR_VALID_DATA_W_CODE( NULL, *res = AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit());
@@ -1080,6 +1181,15 @@ AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORES
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORESULT *res ) 
+{
+    AIODeviceTableLockRead();
+    AIOUSBDevice *retval = _lookup_device( DeviceIndex, res );
+    AIODeviceTableUnlock();
+    return retval;
+}
+
 /*----------------------------------------------------------------------------*/ 
 AIOUSBDevice *AIODeviceTableGetAIOUSBDeviceAtIndex( unsigned long DeviceIndex ) 
 {
@@ -1388,6 +1498,7 @@ AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevice
     AIOUSBDevice *device  = _get_device( *numAccesDevices , &result );
 
     device->usb_device    = usb_dev;
+    device->deviceIndex   = *numAccesDevices;
     device->ProductID     = productID;
     device->isInit        = AIOUSB_TRUE;
     device->valid         = AIOUSB_TRUE;
@@ -1413,6 +1524,7 @@ AIORET_TYPE ClearAIODeviceTable( int numDevices )
     AIORESULT result = AIOUSB_SUCCESS;
     for ( int i = 0; i < numDevices ; i ++ ) {
         AIOUSBDevice *device = &deviceTable[i];
+        AIOUSBDeviceStopDIOCoalescing( device );
         if ( device->LastDIOData )
             free(device->LastDIOData );
     }
@@ -1473,32 +1585,52 @@ AIORET_TYPE AIODeviceTablePopulateTableTest(unsigned long *products, int length
     return AIOUSB_SUCCESS;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frees what an entry owns. Runs under the table guard, so the
+ * caller stops the DIO coalescing thread first, see
+ * AIOUSBDeviceStopDIOCoalescing().
+ */
+static void _release_device( AIOUSBDevice *device )
+{
+    if (device->LastDIOData != NULL) {
+        free(device->LastDIOData);
+        device->LastDIOData = NULL;
+    }
+
+    if (device->cachedName != NULL) {
+        free(device->cachedName);
+        device->cachedName = NULL;
+    }
+
+    AIOUSBDeviceFreeConversionPlan( device );
+    DeleteAIOThreadPolicy( device->bulkAcquirePolicy );
+    device->bulkAcquirePolicy = NULL;
+    AIOUSBDeviceFreeTransferHistograms( device );
+}
+
 /*----------------------------------------------------------------------------*/
 void CloseAllDevices(void) 
 {
     if (!AIOUSB_IsInit())
         return;
     int index;
-    AIORESULT result = AIOUSB_SUCCESS;
+    /* Takes the device lock, which goes outside the table guard */
+    for(index = 0; index < MAX_USB_DEVICES; index++)
+        AIOUSBDeviceStopDIOCoalescing( _get_device_no_error( index ) );
+
+    AIODeviceTableLockWrite();
     for(index = 0; index < MAX_USB_DEVICES; index++) {
-        result = AIOUSB_SUCCESS;
-        AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( index, &result );
-        if ( result == AIOUSB_SUCCESS )  {
-            USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+        AIOUSBDevice *device = _get_device_no_error( index );
+        if ( device->valid || device->bDeviceWasHere )  {
+            /* Not AIOUSBDeviceGetUSBHandle(), which would open a device that was never used */
+            USBDevice *usb = device->usb_device;
             if ( usb ) 
                 USBDeviceClose( usb );
-        
-            if (device->LastDIOData != NULL) {
-                free(device->LastDIOData);
-                device->LastDIOData = NULL;
-            }
-        
-            if (device->cachedName != NULL) {
-                free(device->cachedName);
-                device->cachedName = NULL;
-            }
+            _release_device( device );
         }
     }
+    AIODeviceTableUnlock();
 }
 
 /*----------------------------------------------------------------------------*/
@@ -1542,14 +1674,28 @@ AIORET_TYPE AIODeviceTablePopulateTable(void)
     if ( result < AIOUSB_SUCCESS ) 
         return result;
 
+    /* Simulated boards named in AIO_SIMULATED_PRODUCTS follow the real ones */
+    USBSimulatorAddDevices( &usbdevices, &size );
+
+    AIODeviceTableLockWrite();
     for ( int i = 0; i < size ; i ++ ) {
         AIOUSBDevice *device = (AIOUSBDevice *)&deviceTable[ numAccesDevices++ ];
 
         unsigned productID = USBDeviceGetIdProduct( &usbdevices[i] );
         _setup_device_parameters( device, productID );
+        device->deviceIndex = numAccesDevices - 1;
         device->usb_device = CopyUSBDevice( &usbdevices[i] );
-        CheckPNPData( i );
 
+        /* Opening, claiming and the PNP probe wait for the first use, see AIOUSBDeviceOpen() */
+        if ( device->usb_device->device && !device->usb_device->deviceHandle )
+            device->openDeferred = AIOUSB_TRUE;
+    }
+    AIODeviceTableUnlock();
+
+    /* The probe looks the device up, so it runs after the guard is released */
+    for ( int index = 0; index < numAccesDevices; index ++ ) {
+        if ( !deviceTable[index].openDeferred )
+            CheckPNPData( index );
     }
 
     libusb_free_device_list(deviceList, AIOUSB_TRUE);    
@@ -1557,6 +1703,462 @@ AIORET_TYPE AIODeviceTablePopulateTable(void)
     return AIOUSB_SUCCESS;
 }
 
+/*----------------------------------------------------------------------------*/
+/** @cond INTERNAL_DOCUMENTATION */
+typedef struct aio_warmup_work {
+    const unsigned long *indices;
+    unsigned num_devices;
+    volatile unsigned next;
+    volatile AIORET_TYPE result;
+} AIOWarmUpWork;
+
+static void *_AIODeviceTableWarmUpWorker( void *object )
+{
+    AIOWarmUpWork *work = (AIOWarmUpWork *)object;
+    unsigned i;
+
+    while ( ( i = __sync_fetch_and_add( &work->next, 1 ) ) < work->num_devices ) {
+        AIOUSBDevice *device = ( work->indices[i] < MAX_USB_DEVICES ? _get_device_no_error( work->indices[i] ) : NULL );
+        AIORET_TYPE retval = ( device ? AIOUSBDeviceOpen( device ) : -AIOUSB_ERROR_INVALID_INDEX );
+        if ( retval != AIOUSB_SUCCESS )
+            __sync_bool_compare_and_swap( &work->result, AIOUSB_SUCCESS, retval );
+    }
+    return NULL;
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens, claims and probes devices ahead of their first use, several
+ * at a time. Devices that are already open are skipped.
+ * @param DeviceIndices Devices to warm up, NULL for every device that
+ *        enumeration found but has not opened yet
+ * @param num_devices Entries in DeviceIndices
+ * @param num_threads Devices opened at once, 0 for one thread per device
+ * @return AIOUSB_SUCCESS, or the first error met opening a device
+ */
+AIORET_TYPE AIODeviceTableWarmUp( const unsigned long *DeviceIndices, unsigned num_devices, unsigned num_threads )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
+    unsigned long pending[ MAX_USB_DEVICES ];
+    AIOWarmUpWork work;
+    pthread_t threads[ MAX_USB_DEVICES ];
+    unsigned started = 0;
+
+    if ( !DeviceIndices ) {
+        num_devices = 0;
+        for ( unsigned long index = 0; index < MAX_USB_DEVICES; index ++ ) {
+            if ( deviceTable[index].openDeferred )
+                pending[num_devices++] = index;
+        }
+        DeviceIndices = pending;
+    }
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, num_devices <= MAX_USB_DEVICES );
+    if ( !num_devices )
+        return AIOUSB_SUCCESS;
+
+    work.indices     = DeviceIndices;
+    work.num_devices = num_devices;
+    work.next        = 0;
+    work.result      = AIOUSB_SUCCESS;
+
+    if ( !num_threads || num_threads > num_devices )
+        num_threads = num_devices;
+
+    /* The calling thread takes a share of the work as well */
+    for ( ; started + 1 < num_threads; started ++ ) {
+        if ( pthread_create( &threads[started], NULL, _AIODeviceTableWarmUpWorker, &work ) != 0 )
+            break;
+    }
+    _AIODeviceTableWarmUpWorker( &work );
+    for ( unsigned i = 0; i < started; i ++ )
+        pthread_join( threads[i], NULL );
+
+    return work.result;
+}
+
+/*----------------------------------------------------------------------------*/
+/** @cond INTERNAL_DOCUMENTATION */
+#define AIO_HOTPLUG_QUEUE_SIZE  ( 2 * MAX_USB_DEVICES )
+
+typedef struct aio_hotplug_event {
+    libusb_device *device;
+    AIODeviceEvent event;
+} AIOHotplugEvent;
+
+static AIODeviceEventCallback hotplug_callback = NULL;
+static void *hotplug_user_data = NULL;
+static volatile AIOUSB_BOOL hotplug_running = AIOUSB_FALSE;
+static pthread_t hotplug_thread;
+static unsigned hotplug_poll_ms;
+static AIOUSB_BOOL hotplug_has_events;
+static libusb_hotplug_callback_handle hotplug_handle;
+
+/* libusb calls back from whichever thread handles events, possibly an
+ * acquisition's, so events are queued there and dealt with on hotplug_thread */
+static pthread_mutex_t hotplug_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static AIOHotplugEvent hotplug_queue[ AIO_HOTPLUG_QUEUE_SIZE ];
+static unsigned hotplug_queued;
+
+static AIORET_TYPE _AIODeviceTableFindUSBDevice( libusb_device *usb_device )
+{
+    for ( int index = 0; index < MAX_USB_DEVICES; index ++ ) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        if ( device->valid && device->usb_device && device->usb_device->device == usb_device )
+            return index;
+    }
+    return -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+}
+
+/**
+ * @brief Picks the entry for a board that just arrived: the entry of an
+ * unplugged board of the same product, so a board that is plugged back in
+ * keeps its DeviceIndex, then an unused entry, then any unplugged board's.
+ */
+static AIORET_TYPE _AIODeviceTableFreeIndex( unsigned productID )
+{
+    AIORET_TYPE unused = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, removed = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    for ( int index = 0; index < MAX_USB_DEVICES; index ++ ) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        if ( device->valid )
+            continue;
+        if ( device->bDeviceWasHere && device->ProductID == productID )
+            return index;
+        if ( !device->bDeviceWasHere && !device->usb_device && unused < 0 )
+            unused = index;
+        if ( device->bDeviceWasHere && removed < 0 )
+            removed = index;
+    }
+    return ( unused >= 0 ? unused : removed );
+}
+
+/**
+ * @brief Frees the retired USBDevices nothing can hold any more. Calls on a
+ * board hold its device lock, which the replacement took, so only the
+ * workers of an acquisition started on the old board can still use it.
+ */
+static void _AIODeviceTableReclaimRetired( void )
+{
+    USBDevice **link = &retiredUSBDevices;
+
+    AIODeviceTableLockWrite();
+    while ( *link ) {
+        USBDevice *usb = *link;
+        if ( AIOContinuousBufDeviceInUse( usb->retiredIndex ) > 0 ) {
+            link = &usb->retired;
+        } else {
+            *link = usb->retired;
+            DeleteUSBDevice( usb );
+        }
+    }
+    AIODeviceTableUnlock();
+}
+
+static AIORET_TYPE _AIODeviceTableAddArrived( libusb_device *usb_device, const struct libusb_device_descriptor *desc )
+{
+    AIORET_TYPE index;
+    AIOUSBDevice *device;
+
+    /* The coalescing thread of the entry has to be stopped before taking the
+     * guard for writing, so pick the entry, stop it, and check the entry is
+     * still the one to use once the guard is held */
+    for ( ;; ) {
+        AIODeviceTableLockRead();
+        if ( ( index = _AIODeviceTableFindUSBDevice( usb_device ) ) >= 0 ) {
+            AIODeviceTableUnlock();
+            return index;
+        }
+        index = _AIODeviceTableFreeIndex( desc->idProduct );
+        AIODeviceTableUnlock();
+        if ( index < 0 ) {
+            AIOUSB_ERROR("No room in the device table for product %#x\n", desc->idProduct );
+            return index;
+        }
+
+        device = _get_device_no_error( index );
+        AIOUSBDeviceStopDIOCoalescing( device );
+
+        /* Callers in the middle of a call on the old board hold these */
+        AIOUSBDeviceLock( device );
+        pthread_mutex_lock( &device->openLock );
+        AIODeviceTableLockWrite();
+        if ( !device->bDIOCoalescing &&
+             _AIODeviceTableFindUSBDevice( usb_device ) < 0 &&
+             _AIODeviceTableFreeIndex( desc->idProduct ) == index )
+            break;
+        AIODeviceTableUnlock();
+        pthread_mutex_unlock( &device->openLock );
+        AIOUSBDeviceUnlock( device );
+    }
+
+    USBDevice *usb = (USBDevice *)calloc( 1, sizeof(USBDevice) );
+    if ( !usb ) {
+        AIODeviceTableUnlock();
+        pthread_mutex_unlock( &device->openLock );
+        AIOUSBDeviceUnlock( device );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    if ( device->usb_device ) {
+        /* Acquisition workers that looked the old board up may still hold
+         * its USBDevice, so it is only closed here and freed once they end */
+        USBDeviceClose( device->usb_device );
+        device->usb_device->retired      = retiredUSBDevices;
+        device->usb_device->retiredIndex = index;
+        retiredUSBDevices = device->usb_device;
+        device->usb_device = NULL;
+    }
+    _release_device( device );
+    _reset_device( device );
+
+    usb->device     = USBDeviceRefLibusbDevice( usb_device );
+    usb->deviceDesc = *desc;
+
+    _setup_device_parameters( device, desc->idProduct );
+    device->deviceIndex  = index;
+    device->usb_device   = usb;
+    device->openDeferred = AIOUSB_TRUE;     /* Opened on first use, like the boards found at start up */
+    AIODeviceTableUnlock();
+    pthread_mutex_unlock( &device->openLock );
+    AIOUSBDeviceUnlock( device );
+    _AIODeviceTableReclaimRetired();
+
+    AIOUSB_DEVEL("Device %d arrived, product %#x on bus %d address %d\n", (int)index, desc->idProduct,
+                 libusb_get_bus_number( usb_device ), libusb_get_device_address( usb_device ) );
+    if ( hotplug_callback )
+        hotplug_callback( index, AIO_DEVICE_ARRIVED, hotplug_user_data );
+
+    return index;
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Adds a board that was plugged in after AIOUSB_Init() to the device
+ * table without rescanning the bus. The board is opened on first use.
+ * AIODeviceTableStartHotplug() calls this for you.
+ * @param usb_device The board libusb reported
+ * @return DeviceIndex of the board, which is its old one if it was only
+ * unplugged, or -AIOUSB_ERROR_DEVICE_NOT_FOUND if it is not an ACCES board
+ */
+AIORET_TYPE AIODeviceTableDeviceArrived( libusb_device *usb_device )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, usb_device );
+    struct libusb_device_descriptor desc;
+
+    if ( libusb_get_device_descriptor( usb_device, &desc ) != LIBUSB_SUCCESS ||
+         desc.idVendor != ACCES_VENDOR_ID || !VALID_ENUM( ProductIDS, desc.idProduct ) )
+        return -AIOUSB_ERROR_DEVICE_NOT_FOUND;
+
+    return _AIODeviceTableAddArrived( usb_device, &desc );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Marks the entry of a board that was unplugged as removed. Its
+ * USBDevice handle stops being handed out, every running AIOContinuousBuf
+ * on it stops with exit code -AIOUSB_ERROR_DEVICE_REMOVED, and calls
+ * with its DeviceIndex fail with AIOUSB_ERROR_DEVICE_REMOVED until it is
+ * plugged back in. AIODeviceTableStartHotplug() calls this for you.
+ * @param usb_device The board libusb reported
+ * @return DeviceIndex the board had, or -AIOUSB_ERROR_DEVICE_NOT_FOUND
+ */
+AIORET_TYPE AIODeviceTableDeviceLeft( libusb_device *usb_device )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, usb_device );
+    AIORET_TYPE index;
+
+    AIODeviceTableLockWrite();
+    if ( ( index = _AIODeviceTableFindUSBDevice( usb_device ) ) < 0 ) {
+        AIODeviceTableUnlock();
+        return index;
+    }
+
+    AIOUSBDevice *device = _get_device_no_error( index );
+    device->bDeviceWasHere = AIOUSB_TRUE;
+    device->valid          = AIOUSB_FALSE;
+    AIODeviceTableUnlock();
+
+    /* An open in progress holds openLock and looks the device up, so this waits until the guard is free */
+    pthread_mutex_lock( &device->openLock );
+    device->openDeferred   = AIOUSB_FALSE;
+    device->openResult     = -AIOUSB_ERROR_DEVICE_REMOVED;
+    pthread_mutex_unlock( &device->openLock );
+
+    AIOUSB_DEVEL("Device %d left\n", (int)index );
+    AIOContinuousBufDeviceRemoved( index );
+    if ( hotplug_callback )
+        hotplug_callback( index, AIO_DEVICE_LEFT, hotplug_user_data );
+
+    return index;
+}
+
+/*----------------------------------------------------------------------------*/
+/** @cond INTERNAL_DOCUMENTATION */
+static int LIBUSB_CALL _AIODeviceTableHotplugEvent( libusb_context *ctx, libusb_device *usb_device, libusb_hotplug_event event, void *user_data )
+{
+    pthread_mutex_lock( &hotplug_queue_lock );
+    if ( hotplug_queued < AIO_HOTPLUG_QUEUE_SIZE ) {
+        hotplug_queue[hotplug_queued].device = libusb_ref_device( usb_device );
+        hotplug_queue[hotplug_queued].event  = ( event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED ? AIO_DEVICE_ARRIVED : AIO_DEVICE_LEFT );
+        hotplug_queued ++;
+    } else {
+        AIOUSB_ERROR("Hotplug event %d dropped, queue is full\n", (int)event );
+    }
+    pthread_mutex_unlock( &hotplug_queue_lock );
+    return 0;                   /* Stay registered */
+}
+
+static void _AIODeviceTableHandleQueued( void )
+{
+    AIOHotplugEvent events[ AIO_HOTPLUG_QUEUE_SIZE ];
+    unsigned num_events;
+
+    pthread_mutex_lock( &hotplug_queue_lock );
+    num_events = hotplug_queued;
+    memcpy( events, hotplug_queue, num_events * sizeof(AIOHotplugEvent) );
+    hotplug_queued = 0;
+    pthread_mutex_unlock( &hotplug_queue_lock );
+
+    for ( unsigned i = 0; i < num_events; i ++ ) {
+        if ( events[i].event == AIO_DEVICE_ARRIVED )
+            AIODeviceTableDeviceArrived( events[i].device );
+        else
+            AIODeviceTableDeviceLeft( events[i].device );
+        libusb_unref_device( events[i].device );
+    }
+}
+
+/**
+ * @brief Fallback for platforms without hotplug events: compares the bus
+ * with the table, touching only the boards that came or went.
+ */
+static void _AIODeviceTablePoll( void )
+{
+    libusb_device **list = NULL;
+    ssize_t num_devices = libusb_get_device_list( NULL, &list );
+    if ( num_devices < 0 )
+        return;
+
+    for ( int index = 0; index < MAX_USB_DEVICES; index ++ ) {
+        AIOUSBDevice *device = _get_device_no_error( index );
+        if ( !device->valid || !device->usb_device || !device->usb_device->device )
+            continue;
+        ssize_t i;
+        for ( i = 0; i < num_devices && list[i] != device->usb_device->device; i ++ )
+            ;
+        if ( i == num_devices )
+            AIODeviceTableDeviceLeft( device->usb_device->device );
+    }
+
+    for ( ssize_t i = 0; i < num_devices; i ++ ) {
+        if ( _AIODeviceTableFindUSBDevice( list[i] ) < 0 )
+            AIODeviceTableDeviceArrived( list[i] );
+    }
+
+    libusb_free_device_list( list, AIOUSB_TRUE );
+}
+
+static void *_AIODeviceTableHotplugWorker( void *object )
+{
+    unsigned waited = 0;
+
+    while ( hotplug_running ) {
+        if ( hotplug_has_events ) {
+            struct timeval tv = { 0, 100000 };
+            libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+            _AIODeviceTableHandleQueued();
+        } else {
+            /* Short naps so AIODeviceTableStopHotplug() does not wait a whole interval */
+            usleep( 10000 );
+            waited += 10;
+            if ( waited >= hotplug_poll_ms ) {
+                _AIODeviceTablePoll();
+                waited = 0;
+            }
+        }
+    }
+    return NULL;
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Keeps the device table up to date as boards are plugged in and
+ * unplugged, instead of rescanning the bus and timing out on boards that
+ * are gone. Uses libusb hotplug events when the platform has them and
+ * otherwise polls the bus every poll_interval_ms.
+ * @param callback Called with the DeviceIndex after a board arrives or
+ *        leaves, from the hotplug thread; may be NULL
+ * @param user_data Passed to callback
+ * @param poll_interval_ms Polling period when there are no hotplug events,
+ *        0 for 1000
+ * @return AIOUSB_SUCCESS or a negative error
+ */
+AIORET_TYPE AIODeviceTableStartHotplug( AIODeviceEventCallback callback, void *user_data, unsigned poll_interval_ms )
+{
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_THREAD, !hotplug_running );
+
+    hotplug_callback   = callback;
+    hotplug_user_data  = user_data;
+    hotplug_poll_ms    = ( poll_interval_ms ? poll_interval_ms : 1000 );
+    hotplug_has_events = AIOUSB_FALSE;
+    hotplug_queued     = 0;
+
+    if ( libusb_has_capability( LIBUSB_CAP_HAS_HOTPLUG ) ) {
+        /* No LIBUSB_HOTPLUG_ENUMERATE, the table already holds the boards that are here */
+        int usbresult = libusb_hotplug_register_callback( NULL,
+                                                          (libusb_hotplug_event)( LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT ),
+                                                          (libusb_hotplug_flag)0,
+                                                          ACCES_VENDOR_ID,
+                                                          LIBUSB_HOTPLUG_MATCH_ANY,
+                                                          LIBUSB_HOTPLUG_MATCH_ANY,
+                                                          _AIODeviceTableHotplugEvent,
+                                                          NULL,
+                                                          &hotplug_handle );
+        if ( usbresult == LIBUSB_SUCCESS )
+            hotplug_has_events = AIOUSB_TRUE;
+        else
+            AIOUSB_WARN("Hotplug events unavailable (%d), polling instead\n", usbresult );
+    }
+
+    hotplug_running = AIOUSB_TRUE;
+    if ( pthread_create( &hotplug_thread, NULL, _AIODeviceTableHotplugWorker, NULL ) != 0 ) {
+        hotplug_running = AIOUSB_FALSE;
+        if ( hotplug_has_events )
+            libusb_hotplug_deregister_callback( NULL, hotplug_handle );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the thread started by AIODeviceTableStartHotplug(). No
+ * callbacks are made once this returns.
+ */
+AIORET_TYPE AIODeviceTableStopHotplug( void )
+{
+    if ( !hotplug_running )
+        return AIOUSB_SUCCESS;
+
+    hotplug_running = AIOUSB_FALSE;
+    pthread_join( hotplug_thread, NULL );
+    if ( hotplug_has_events ) {
+        libusb_hotplug_deregister_callback( NULL, hotplug_handle );
+        _AIODeviceTableHandleQueued();
+        hotplug_has_events = AIOUSB_FALSE;
+    }
+    hotplug_callback  = NULL;
+    hotplug_user_data = NULL;
+
+    return AIOUSB_SUCCESS;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief AIOUSB_Init() and AIOUSB_Exit() are not thread-safe and
@@ -1608,6 +2210,7 @@ AIORET_TYPE AIOUSB_Exit()
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_INIT, AIOUSB_IsInit() );
 
+    AIODeviceTableStopHotplug();
     CloseAllDevices();
     libusb_exit(NULL);
 #if defined(AIOUSB_ENABLE_MUTEX)
@@ -1647,9 +2250,15 @@ AIORET_TYPE AIOUSB_Reset( unsigned long DeviceIndex )
 #include "gtest/gtest.h"
 
 #include <stdlib.h>
+#include <unistd.h>
 
 using namespace AIOUSB;
 
+namespace AIOUSB {
+/* Not in AIOContinuousBuffer.h; starts the worker without talking to the board */
+AIORET_TYPE AIOContinuousBufStart( AIOContinuousBuf *buf );
+}
+
 TEST(AIODeviceTable,Cleanup) {
     int numDevices = 0;
     AIODeviceTableInit();    
@@ -1796,6 +2405,309 @@ TEST(AIODeviceTable,IncorrectIndices)
     ClearAIODeviceTable( numDevices );
 }
 
+static int probes;
+
+static int count_probes( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    __sync_fetch_and_add( &probes, 1 );
+    return -LIBUSB_ERROR_PIPE;
+}
+
+static int add_deferred_devices( USBDevice **usb, int count )
+{
+    int numDevices = 0;
+    AIODeviceTableInit();
+    for ( int i = 0; i < count; i ++ ) {
+        usb[i] = (USBDevice *)calloc( 1, sizeof(USBDevice) );
+        usb[i]->device = (libusb_device *)0x1;          /* Already "open", so no libusb call is made */
+        usb[i]->deviceHandle = (libusb_device_handle *)0x1;
+        usb[i]->usb_control_transfer = count_probes;
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16E, usb[i] );
+        deviceTable[i].openDeferred = AIOUSB_TRUE;
+    }
+    probes = 0;
+    return numDevices;
+}
+
+static void remove_deferred_devices( USBDevice **usb, int count )
+{
+    for ( int i = 0; i < count; i ++ ) {
+        deviceTable[i].usb_device = NULL;
+        free( usb[i] );
+    }
+}
+
+TEST(AIODeviceTable, DeferredOpenHappensOnFirstUse )
+{
+    USBDevice *usb[2];
+    add_deferred_devices( usb, 2 );
+
+    EXPECT_EQ( 0, probes );
+    EXPECT_EQ( usb[1], AIOUSBDeviceGetUSBHandle( &deviceTable[1] ) );
+    EXPECT_EQ( 1, probes ) << "Only the device that was used gets probed";
+    EXPECT_FALSE( deviceTable[1].openDeferred );
+    EXPECT_TRUE( deviceTable[0].openDeferred );
+
+    AIOUSBDeviceGetUSBHandle( &deviceTable[1] );
+    EXPECT_EQ( 1, probes );
+
+    remove_deferred_devices( usb, 2 );
+}
+
+TEST(AIODeviceTable, WarmUpOpensEveryDeferredDevice )
+{
+    USBDevice *usb[6];
+    add_deferred_devices( usb, 6 );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODeviceTableWarmUp( NULL, 0, 3 ) );
+    EXPECT_EQ( 6, probes );
+    for ( int i = 0; i < 6; i ++ )
+        EXPECT_FALSE( deviceTable[i].openDeferred );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODeviceTableWarmUp( NULL, 0, 3 ) );
+    EXPECT_EQ( 6, probes ) << "Devices are probed once";
+
+    unsigned long bad = MAX_USB_DEVICES + 1;
+    EXPECT_LT( AIODeviceTableWarmUp( &bad, 1, 1 ), 0 );
+
+    remove_deferred_devices( usb, 6 );
+}
+
+
+static volatile int num_events;
+static unsigned long last_index;
+static AIODeviceEvent last_event;
+
+static void record_event( unsigned long DeviceIndex, AIODeviceEvent event, void *user_data )
+{
+    last_index = DeviceIndex;
+    last_event = event;
+    __sync_fetch_and_add( &num_events, 1 );
+}
+
+/* The made up libusb_devices below must never reach libusb */
+static volatile int libusb_refs;
+
+static libusb_device *fake_ref( libusb_device *dev )
+{
+    __sync_fetch_and_add( &libusb_refs, 1 );
+    return dev;
+}
+
+static void fake_unref( libusb_device *dev )
+{
+    if ( dev )
+        __sync_fetch_and_sub( &libusb_refs, 1 );
+}
+
+static volatile int libusb_handles;
+
+static int fake_open( libusb_device *dev, libusb_device_handle **handle )
+{
+    __sync_fetch_and_add( &libusb_handles, 1 );
+    *handle = (libusb_device_handle *)dev;
+    return LIBUSB_SUCCESS;
+}
+
+static void fake_close( libusb_device_handle *handle )
+{
+    __sync_fetch_and_sub( &libusb_handles, 1 );
+}
+
+static void use_fake_libusb_devices( AIOUSB_BOOL fake )
+{
+    USBDeviceRefLibusbDevice   = ( fake ? fake_ref : libusb_ref_device );
+    USBDeviceUnrefLibusbDevice = ( fake ? fake_unref : libusb_unref_device );
+    USBDeviceOpenLibusbDevice  = ( fake ? fake_open : libusb_open );
+    USBDeviceCloseLibusbHandle = ( fake ? fake_close : libusb_close );
+    USBDeviceGetLibusbDescriptor = libusb_get_device_descriptor;
+    libusb_refs = libusb_handles = 0;
+}
+
+static AIORET_TYPE fake_arrival( libusb_device *usb_device, unsigned productID )
+{
+    struct libusb_device_descriptor desc;
+    memset( &desc, 0, sizeof(desc) );
+    desc.idVendor  = ACCES_VENDOR_ID;
+    desc.idProduct = productID;
+    return _AIODeviceTableAddArrived( usb_device, &desc );
+}
+
+TEST(AIODeviceTable, HotplugUpdatesOnlyTheBoardThatChanged )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIODeviceTableInit();
+    use_fake_libusb_devices( AIOUSB_TRUE );
+    num_events = 0;
+    hotplug_callback = record_event;
+
+    AIORET_TYPE first = fake_arrival( (libusb_device *)0x10, USB_AI16_16E );
+    AIORET_TYPE second = fake_arrival( (libusb_device *)0x20, USB_DIO_32 );
+    EXPECT_EQ( 0, first );
+    EXPECT_EQ( 1, second );
+    EXPECT_EQ( first, fake_arrival( (libusb_device *)0x10, USB_AI16_16E ) ) << "Boards already in the table are not added twice";
+    EXPECT_EQ( 2, num_events );
+    EXPECT_TRUE( deviceTable[first].openDeferred ) << "Arrivals are opened on first use";
+    EXPECT_EQ( AIO_DEVICE_ARRIVED, last_event );
+
+    EXPECT_EQ( first, AIODeviceTableDeviceLeft( (libusb_device *)0x10 ) );
+    EXPECT_EQ( 3, num_events );
+    EXPECT_EQ( AIO_DEVICE_LEFT, last_event );
+    EXPECT_EQ( (unsigned long)first, last_index );
+    EXPECT_TRUE( AIODeviceTableGetDeviceAtIndex( first, &result ) == NULL );
+    EXPECT_EQ( AIOUSB_ERROR_DEVICE_REMOVED, result );
+    EXPECT_TRUE( AIOUSBDeviceGetUSBHandle( &deviceTable[first] ) == NULL );
+    EXPECT_EQ( -AIOUSB_ERROR_DEVICE_REMOVED, AIOUSBDeviceOpen( &deviceTable[first] ) );
+    EXPECT_TRUE( AIODeviceTableGetDeviceAtIndex( second, &result ) != NULL ) << "Other boards are untouched";
+    EXPECT_LT( AIODeviceTableDeviceLeft( (libusb_device *)0x10 ), 0 );
+
+    EXPECT_EQ( first, fake_arrival( (libusb_device *)0x30, USB_AI16_16E ) ) << "A board plugged back in keeps its index";
+    EXPECT_TRUE( AIODeviceTableGetDeviceAtIndex( first, &result ) != NULL );
+
+    hotplug_callback = NULL;
+    CloseAllDevices();
+    EXPECT_EQ( 0, libusb_refs ) << "Every board that was referenced is let go";
+    for ( int i = 0; i < 2; i ++ ) {
+        DeleteUSBDevice( deviceTable[i].usb_device );
+        deviceTable[i].usb_device = NULL;
+    }
+    use_fake_libusb_devices( AIOUSB_FALSE );
+    AIODeviceTableInit();
+}
+
+static int fail_descriptor( libusb_device *dev, struct libusb_device_descriptor *desc )
+{
+    return LIBUSB_ERROR_IO;
+}
+
+TEST(AIODeviceTable, FailedDeferredOpenClosesItsHandleOnce )
+{
+    AIODeviceTableInit();
+    use_fake_libusb_devices( AIOUSB_TRUE );
+    USBDeviceGetLibusbDescriptor = fail_descriptor; /* Fails right after libusb_open() */
+
+    AIORET_TYPE index = fake_arrival( (libusb_device *)0x10, USB_AI16_16E );
+    ASSERT_EQ( 0, index );
+    EXPECT_TRUE( AIOUSBDeviceGetUSBHandle( &deviceTable[index] ) == NULL );
+    EXPECT_EQ( -AIOUSB_ERROR_USB_INIT, deviceTable[index].openResult );
+    EXPECT_EQ( 0, libusb_handles ) << "The handle is closed when the open fails";
+    EXPECT_TRUE( deviceTable[index].usb_device->deviceHandle == NULL );
+
+    CloseAllDevices();
+    EXPECT_EQ( 0, libusb_handles ) << "and not closed again with the table";
+    EXPECT_EQ( 0, libusb_refs );
+
+    DeleteUSBDevice( deviceTable[index].usb_device );
+    deviceTable[index].usb_device = NULL;
+    use_fake_libusb_devices( AIOUSB_FALSE );
+    AIODeviceTableInit();
+}
+
+static void *arrive_in_background( void *object )
+{
+    *(AIORET_TYPE *)object = fake_arrival( (libusb_device *)0x30, USB_AI16_16E );
+    return NULL;
+}
+
+TEST(AIODeviceTable, ReplacedBoardsWaitForTheDeviceLock )
+{
+    AIODeviceTableInit();
+    use_fake_libusb_devices( AIOUSB_TRUE );
+    ASSERT_EQ( 0, fake_arrival( (libusb_device *)0x10, USB_AI16_16E ) );
+    ASSERT_EQ( 0, AIODeviceTableDeviceLeft( (libusb_device *)0x10 ) );
+    USBDevice *old = deviceTable[0].usb_device;
+    ASSERT_TRUE( old != NULL );
+
+    AIORET_TYPE index = -1;
+    pthread_t arrival;
+    AIOUSBDeviceLock( &deviceTable[0] );
+    ASSERT_EQ( 0, pthread_create( &arrival, NULL, arrive_in_background, &index ) );
+    usleep( 20000 );
+    EXPECT_EQ( old, deviceTable[0].usb_device ) << "The board is not replaced under a caller holding the device lock";
+    AIOUSBDeviceUnlock( &deviceTable[0] );
+    pthread_join( arrival, NULL );
+
+    EXPECT_EQ( 0, index );
+    EXPECT_NE( old, deviceTable[0].usb_device );
+    EXPECT_TRUE( retiredUSBDevices == NULL ) << "Nothing started on the old board, so it is freed straight away";
+    EXPECT_EQ( 1, libusb_refs ) << "The old board is let go";
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceLock( &deviceTable[0] ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceUnlock( &deviceTable[0] ) );
+
+    CloseAllDevices();
+    DeleteUSBDevice( deviceTable[0].usb_device );
+    deviceTable[0].usb_device = NULL;
+    use_fake_libusb_devices( AIOUSB_FALSE );
+    AIODeviceTableInit();
+}
+
+static void *run_until_ended( void *object )
+{
+    AIOContinuousBuf *buf = (AIOContinuousBuf *)object;
+    while ( buf->status & RUNNING )
+        usleep( 1000 );
+    return NULL;
+}
+
+TEST(AIODeviceTable, RetiredBoardsAreFreedOnceTheirAcquisitionsEnd )
+{
+    AIODeviceTableInit();
+    use_fake_libusb_devices( AIOUSB_TRUE );
+    ASSERT_EQ( 0, fake_arrival( (libusb_device *)0x10, USB_AI16_16E ) );
+    ASSERT_EQ( 0, AIODeviceTableDeviceLeft( (libusb_device *)0x10 ) );
+
+    /* A started acquisition whose worker may still hold the old board */
+    AIOContinuousBuf *buf = NewAIOContinuousBuf( 0, 16, 0, 1024 );
+    AIOContinuousBufSetCallback( buf, run_until_ended );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStart( buf ) );
+    EXPECT_EQ( 1, AIOContinuousBufDeviceInUse( 0 ) );
+
+    USBDevice *old = deviceTable[0].usb_device;
+    ASSERT_EQ( 0, fake_arrival( (libusb_device *)0x20, USB_AI16_16E ) );
+    EXPECT_EQ( old, retiredUSBDevices ) << "The old USBDevice is kept for the acquisition";
+    EXPECT_EQ( 0UL, old->retiredIndex );
+    EXPECT_TRUE( old->deviceHandle == NULL );
+
+    AIOContinuousBufEnd( buf );
+    DeleteAIOContinuousBuf( buf );
+    EXPECT_EQ( 0, AIOContinuousBufDeviceInUse( 0 ) );
+    ASSERT_EQ( 0, AIODeviceTableDeviceLeft( (libusb_device *)0x20 ) );
+    ASSERT_EQ( 0, fake_arrival( (libusb_device *)0x30, USB_AI16_16E ) );
+    EXPECT_TRUE( retiredUSBDevices == NULL ) << "Boards replaced before are freed by the next arrival";
+
+    CloseAllDevices();
+    EXPECT_EQ( 0, libusb_refs );
+    DeleteUSBDevice( deviceTable[0].usb_device );
+    deviceTable[0].usb_device = NULL;
+    use_fake_libusb_devices( AIOUSB_FALSE );
+    AIODeviceTableInit();
+}
+
+TEST(AIODeviceTable, PollingNoticesUnpluggedBoards )
+{
+    AIODeviceTableInit();
+    use_fake_libusb_devices( AIOUSB_TRUE );
+    num_events = 0;
+    AIORET_TYPE index = fake_arrival( (libusb_device *)0x10, USB_AI16_16E );
+    ASSERT_EQ( 0, index );
+
+    /* The test libusb has no hotplug events and an empty bus */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODeviceTableStartHotplug( record_event, NULL, 10 ) );
+    EXPECT_LT( AIODeviceTableStartHotplug( record_event, NULL, 10 ), 0 );
+    for ( int i = 0; i < 200 && num_events == 0; i ++ )
+        usleep( 5000 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODeviceTableStopHotplug() );
+
+    EXPECT_EQ( 1, num_events );
+    EXPECT_EQ( AIO_DEVICE_LEFT, last_event );
+    EXPECT_FALSE( deviceTable[index].valid );
+
+    DeleteUSBDevice( deviceTable[index].usb_device );
+    deviceTable[index].usb_device = NULL;
+    use_fake_libusb_devices( AIOUSB_FALSE );
+    AIODeviceTableInit();
+}
+
 
 int 
 main(int argc, char *argv[] )
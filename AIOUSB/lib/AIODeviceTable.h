@@ -17,9 +17,27 @@ namespace AIOUSB
 
 PUBLIC_EXTERN AIOUSBDevice deviceTable[ MAX_USB_DEVICES ];
 /* BEGIN AIOUSB_API */
+typedef enum {
+    AIO_DEVICE_ARRIVED = 1,
+    AIO_DEVICE_LEFT    = 2
+} AIODeviceEvent;
+
+/**
+ * @brief Told about boards coming and going once AIODeviceTableStartHotplug() is running
+ */
+typedef void (*AIODeviceEventCallback)( unsigned long DeviceIndex, AIODeviceEvent event, void *user_data );
+
 PUBLIC_EXTERN AIORESULT AIODeviceTableAddDeviceToDeviceTable( int *numAccesDevices, unsigned long productID ) ;
 PUBLIC_EXTERN AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevices, unsigned long productID , USBDevice *usb_dev );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceTablePopulateTable(void);
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableWarmUp( const unsigned long *DeviceIndices, unsigned num_devices, unsigned num_threads );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableStartHotplug( AIODeviceEventCallback callback, void *user_data, unsigned poll_interval_ms );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableStopHotplug( void );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableDeviceArrived( libusb_device *usb_device );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableDeviceLeft( libusb_device *usb_device );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableLockRead( void );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableLockWrite( void );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableUnlock( void );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceTablePopulateTableTest(unsigned long *products, int length );
 PUBLIC_EXTERN AIORESULT AIODeviceTableClearDevices( void );
 PUBLIC_EXTERN AIORESULT ClearDevices( void );
@@ -20,6 +20,16 @@
 namespace AIOUSB {
 #endif 
 
+/**
+ * @brief Acquire / release accessors for the SPSC read and write
+ *        positions. These are the GCC / clang builtins that implement the
+ *        C11 and C++11 memory model, used directly so the same source
+ *        builds as both C and C++.
+ */
+#define AIO_FIFO_LOAD_RELAXED(pos)       __atomic_load_n( &(pos), __ATOMIC_RELAXED )
+#define AIO_FIFO_LOAD_ACQUIRE(pos)       __atomic_load_n( &(pos), __ATOMIC_ACQUIRE )
+#define AIO_FIFO_STORE_RELEASE(pos,val)  __atomic_store_n( &(pos), (val), __ATOMIC_RELEASE )
+
 size_t delta( AIOFifo *fifo  ) 
 {
     return ( fifo->write_pos < fifo->read_pos ? (fifo->read_pos - fifo->write_pos - 1 ) : ( (fifo->size - fifo->write_pos) + fifo->read_pos - 1 ));
@@ -51,6 +61,14 @@ AIORET_TYPE AIOFifoGetSizeNumElements( void *tmpfifo )
 }
 
 
+/**
+ * @brief Write space rounded down to whole elements, as used by the typed fifos
+ */
+size_t refsize_delta( AIOFifo *fifo )
+{
+    return ( delta( fifo ) / fifo->refsize ) * fifo->refsize;
+}
+
 size_t rdelta( AIOFifo *fifo  ) 
 {
     return ( fifo->read_pos <= fifo->write_pos ? (fifo->write_pos - fifo->read_pos ) : ( (fifo->size - fifo->read_pos) + fifo->write_pos ));
@@ -59,7 +77,7 @@ size_t rdelta( AIOFifo *fifo  )
 AIORET_TYPE AIOFifoReadSize( void *tmpfifo )
 {
     AIOFifo *fifo = (AIOFifo*)tmpfifo;
-    return rdelta( (AIOFifo*)fifo  );
+    return fifo->rdelta( (AIOFifo*)fifo  );
 }
 
 AIORET_TYPE AIOFifoReadSizeNumElements( void *tmpfifo )
@@ -67,46 +85,61 @@ AIORET_TYPE AIOFifoReadSizeNumElements( void *tmpfifo )
     return AIOFifoReadSize( tmpfifo ) / ((AIOFifo*)tmpfifo)->refsize;
 }
 
+/**
+ * @brief Number of bytes of storage backing a fifo of size bytes. SPSC
+ *        fifos round the usable capacity up to a power of two so that
+ *        positions can be masked instead of taken modulo the size.
+ */
+static size_t _AIOFifoStorageSize( AIOFifo *fifo, size_t size )
+{
+    size_t storage = fifo->refsize;
+    if ( !fifo->spsc )
+        return size;
+    while ( storage + fifo->refsize < size )
+        storage <<= 1;
+    return storage;
+}
+
 AIORET_TYPE _AIOFifoResize( AIOFifo *fifo, size_t newsize )
 {
-    fifo->data = realloc( fifo->data, newsize );
+    size_t storage = _AIOFifoStorageSize( fifo, newsize );
+    fifo->data = realloc( fifo->data, storage );
     if ( !fifo->data ) 
         return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-    else 
+    else {
         fifo->size = newsize;
+        fifo->mask = storage - 1;
+    }
     return AIOUSB_SUCCESS;
 }
 
 AIORET_TYPE AIOFifoResize( AIOFifo *fifo, size_t newsize )
 {
-    fifo->data = realloc( fifo->data, (newsize+1)*fifo->refsize );
-    if ( !fifo->data ) 
-        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-    else 
-        fifo->size = (newsize+1)*fifo->refsize;
-    return AIOUSB_SUCCESS;
+    return _AIOFifoResize( fifo, (newsize+1)*fifo->refsize );
 }
 
 size_t _calculate_size_write( AIOFifo *fifo, unsigned maxsize)
 {
-    int actsize = MIN(MIN( maxsize, fifo->size ), fifo->delta(fifo ));
+    size_t room = fifo->delta( fifo );
+    int actsize = MIN(MIN( maxsize, fifo->size ), room );
     actsize = (actsize / fifo->refsize) * fifo->refsize;
     return actsize;
 }
 
 size_t _calculate_size_read( AIOFifo *fifo, unsigned maxsize)
 {
-    return MIN(MIN( maxsize, fifo->size), rdelta(fifo) );
+    size_t avail = fifo->rdelta( fifo );
+    return MIN(MIN( maxsize, fifo->size), avail );
 }
 
 size_t _calculate_size_aon_write( AIOFifo *fifo, unsigned maxsize)
 {
-    return ( fifo->delta(fifo) < maxsize ? 0 : MIN(fifo->delta(fifo), maxsize ));
+    return ( fifo->delta(fifo) < maxsize ? 0 : maxsize );
 }
 
 size_t _calculate_size_aon_read( AIOFifo *fifo, unsigned maxsize )
 {
-    return ( rdelta(fifo) < maxsize ? 0 : maxsize );
+    return ( fifo->rdelta(fifo) < maxsize ? 0 : maxsize );
 }
 
 void AIOFifoInitialize( AIOFifo *nfifo, unsigned int size, unsigned refsize )
@@ -114,6 +147,7 @@ void AIOFifoInitialize( AIOFifo *nfifo, unsigned int size, unsigned refsize )
     nfifo->size     = size;
     nfifo->refsize  = refsize;
     nfifo->data     = malloc(size);
+    nfifo->mask     = size - 1;
     nfifo->Read     = AIOFifoRead;
     nfifo->Write    = AIOFifoWrite;
     nfifo->delta    = delta;
@@ -151,7 +185,12 @@ void AIOFifoReset( void *tmpfifo )
 {
     assert(tmpfifo);
     AIOFifo *fifo = (AIOFifo*)tmpfifo;
-    fifo->read_pos = fifo->write_pos = 0;
+    if ( fifo->spsc ) {
+        AIO_FIFO_STORE_RELEASE( fifo->read_pos, 0 );
+        AIO_FIFO_STORE_RELEASE( fifo->write_pos, 0 );
+    } else {
+        fifo->read_pos = fifo->write_pos = 0;
+    }
 }
 
 AIORET_TYPE AIOFifoGetRefSize( void *tmpfifo )
@@ -285,8 +324,241 @@ AIORET_TYPE AIOFifoReadAllOrNone( AIOFifo *fifo, void *tobuf , unsigned maxsize
     return actsize;
 }
 
-AIORET_TYPE AIOFifoReadPosition( void *nfifo )   { return ((AIOFifo *)nfifo)->read_pos ;  } ;
-AIORET_TYPE AIOFifoWritePosition( void *nfifo )  { return ((AIOFifo *)nfifo)->write_pos;  } ;
+AIORET_TYPE AIOFifoReadPosition( void *nfifo )   
+{ 
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    return ( fifo->spsc ? AIO_FIFO_LOAD_ACQUIRE(fifo->read_pos) & fifo->mask : fifo->read_pos );
+}
+
+AIORET_TYPE AIOFifoWritePosition( void *nfifo )  
+{ 
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    return ( fifo->spsc ? AIO_FIFO_LOAD_ACQUIRE(fifo->write_pos) & fifo->mask : fifo->write_pos );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bytes available to the consumer of an SPSC fifo
+ */
+size_t spsc_rdelta( AIOFifo *fifo )
+{
+    return AIO_FIFO_LOAD_ACQUIRE( fifo->write_pos ) - AIO_FIFO_LOAD_ACQUIRE( fifo->read_pos );
+}
+
+/**
+ * @brief Bytes available to the producer of an SPSC fifo. The capacity is
+ *        the same as the locked fifo ( size - refsize ) even though the
+ *        storage behind it may be larger.
+ */
+size_t spsc_delta( AIOFifo *fifo )
+{
+    return ( fifo->size - fifo->refsize ) - spsc_rdelta( fifo );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Producer side of the SPSC fifo. Only the writing thread may call
+ *        this. The data is copied before write_pos is published with
+ *        release ordering, so a reader that observes the new position with
+ *        acquire ordering also observes the data.
+ */
+AIORET_TYPE AIOFifoWriteSPSC( AIOFifo *fifo, void *frombuf , unsigned maxsize ) 
+{
+    unsigned int wpos = AIO_FIFO_LOAD_RELAXED( fifo->write_pos );
+    int actsize = fifo->_calculate_size_write( fifo, maxsize );
+    if ( actsize ) {
+        unsigned int offset = wpos & fifo->mask;
+        int basic_copy = MIN( (unsigned)actsize, fifo->mask + 1 - offset ), wrap_copy = actsize - basic_copy;
+        memcpy( &((char *)fifo->data)[offset], frombuf, basic_copy );
+        memcpy( &((char *)fifo->data)[0], (void*)((char *)frombuf+basic_copy), wrap_copy );
+        AIO_FIFO_STORE_RELEASE( fifo->write_pos, wpos + actsize );
+    }
+    return actsize;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Consumer side of the SPSC fifo. Only the reading thread may call
+ *        this.
+ */
+AIORET_TYPE AIOFifoReadSPSC( AIOFifo *fifo, void *tobuf , unsigned maxsize ) 
+{
+    unsigned int rpos = AIO_FIFO_LOAD_RELAXED( fifo->read_pos );
+    int actsize = fifo->_calculate_size_read( fifo, maxsize );
+    if ( actsize ) {
+        unsigned int offset = rpos & fifo->mask;
+        int basic_copy = MIN( (unsigned)actsize, fifo->mask + 1 - offset ), wrap_copy = actsize - basic_copy;
+        memcpy( tobuf                       , &((char *)fifo->data)[offset], basic_copy );
+        memcpy( &((char*)tobuf)[basic_copy] , &((char *)fifo->data)[0]     , wrap_copy );
+        AIO_FIFO_STORE_RELEASE( fifo->read_pos, rpos + actsize );
+    }
+    return actsize;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Switches a fifo between the locked ring buffer and the lock free
+ *        single producer / single consumer ring buffer. Push, PushN, Pop and
+ *        PopN keep the same signatures and all or none semantics of the
+ *        fifo they are called on. The fifo is emptied.
+ * @param nfifo Any AIOFifo, AIOFifoCounts or AIOFifoVolts
+ * @param spsc AIOUSB_TRUE to use the lock free implementation
+ * @return AIOUSB_SUCCESS, -AIOUSB_ERROR_NOT_ENOUGH_MEMORY or
+ *         -AIOUSB_ERROR_INVALID_PARAMETER if spsc is asked for and the
+ *         element size is not a power of two, in which case the fifo is
+ *         left as it was
+ */
+AIORET_TYPE AIOFifoSetSPSC( void *nfifo, AIOUSB_BOOL spsc )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_AIOFIFO, nfifo );
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    AIOUSB_BOOL allornone = ( fifo->_calculate_size_write == _calculate_size_aon_write ? AIOUSB_TRUE : AIOUSB_FALSE );
+    AIORET_TYPE retval;
+
+    /* The storage is refsize doubled until it fits, and positions are masked
+     * with mask, so that only works out for a power of two refsize */
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, !spsc || ( fifo->refsize && ( fifo->refsize & ( fifo->refsize - 1 ) ) == 0 ) );
+
+    AIOFifoReset( fifo );
+    fifo->spsc = ( spsc ? 1 : 0 );
+    retval = _AIOFifoResize( fifo, fifo->size );
+    if ( retval != AIOUSB_SUCCESS )
+        return retval;
+
+    if ( fifo->spsc ) {
+        fifo->Read   = AIOFifoReadSPSC;
+        fifo->Write  = AIOFifoWriteSPSC;
+        fifo->delta  = spsc_delta;
+        fifo->rdelta = spsc_rdelta;
+    } else {
+        fifo->Read   = ( allornone ? AIOFifoReadAllOrNone : AIOFifoRead );
+        fifo->Write  = ( allornone ? AIOFifoWriteAllOrNone : AIOFifoWrite );
+        fifo->delta  = ( allornone ? refsize_delta : delta );
+        fifo->rdelta = rdelta;
+    }
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOFifoIsSPSC( void *nfifo )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_AIOFIFO, nfifo );
+    return ((AIOFifo *)nfifo)->spsc ? AIOUSB_TRUE : AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Splits size bytes starting at pos into the contiguous pieces of storage
+ */
+static void _AIOFifoFillRegion( AIOFifo *fifo, unsigned pos, unsigned size, AIOFifoRegion *region )
+{
+    unsigned offset  = ( fifo->spsc ? pos & fifo->mask : pos );
+    unsigned storage = ( fifo->spsc ? fifo->mask + 1 : fifo->size );
+    unsigned first   = MIN( size, storage - offset );
+
+    region->ptr[0]  = &((char *)fifo->data)[offset];
+    region->size[0] = first;
+    region->ptr[1]  = ( size > first ? fifo->data : NULL );
+    region->size[1] = size - first;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reserves up to maxsize bytes of free space, in whole elements, so
+ *        that the producer can fill the fifo in place ( for instance by
+ *        handing region->ptr[0] to a bulk transfer ) instead of copying
+ *        through PushN. Nothing becomes visible to the reader until
+ *        AIOFifoWriteCommit() is called.
+ * @param nfifo Fifo to write into
+ * @param maxsize Largest number of bytes wanted
+ * @param region Filled in with the writable pieces of storage
+ * @return Number of bytes reserved, possibly 0
+ */
+AIORET_TYPE AIOFifoWriteReserve( void *nfifo, unsigned maxsize, AIOFifoRegion *region )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_AIOFIFO, nfifo );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, region );
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    unsigned pos = ( fifo->spsc ? AIO_FIFO_LOAD_RELAXED( fifo->write_pos ) : fifo->write_pos );
+    unsigned room = (unsigned)fifo->delta( fifo );
+    unsigned size = MIN( maxsize, room );
+
+    size = ( size / fifo->refsize ) * fifo->refsize;
+    _AIOFifoFillRegion( fifo, pos, size, region );
+    return size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Publishes size bytes written into a region obtained from
+ *        AIOFifoWriteReserve().
+ * @return size on success, -AIOUSB_ERROR_INVALID_PARAMETER if more than
+ *         the free space would be committed
+ */
+AIORET_TYPE AIOFifoWriteCommit( void *nfifo, unsigned size )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_AIOFIFO, nfifo );
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, size <= fifo->delta( fifo ) && size % fifo->refsize == 0 );
+
+    if ( fifo->spsc ) {
+        AIO_FIFO_STORE_RELEASE( fifo->write_pos, AIO_FIFO_LOAD_RELAXED( fifo->write_pos ) + size );
+    } else {
+        GRAB_RESOURCE( fifo );
+        fifo->write_pos = ( fifo->write_pos + size ) % fifo->size;
+        RELEASE_RESOURCE( fifo );
+    }
+    return size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Exposes up to maxsize bytes of unread data, in whole elements,
+ *        so the consumer can process it in place instead of copying it
+ *        out with PopN. The data stays in the fifo until
+ *        AIOFifoReadConsume() is called.
+ * @param nfifo Fifo to read from
+ * @param maxsize Largest number of bytes wanted
+ * @param region Filled in with the readable pieces of storage
+ * @return Number of bytes available in region, possibly 0
+ */
+AIORET_TYPE AIOFifoReadPeek( void *nfifo, unsigned maxsize, AIOFifoRegion *region )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_AIOFIFO, nfifo );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, region );
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    unsigned avail = (unsigned)fifo->rdelta( fifo );
+    unsigned size = MIN( maxsize, avail );
+    unsigned pos = ( fifo->spsc ? AIO_FIFO_LOAD_RELAXED( fifo->read_pos ) : fifo->read_pos );
+
+    size = ( size / fifo->refsize ) * fifo->refsize;
+    _AIOFifoFillRegion( fifo, pos, size, region );
+    return size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Releases size bytes previously returned by AIOFifoReadPeek()
+ *        back to the producer.
+ * @return size on success, -AIOUSB_ERROR_INVALID_PARAMETER if more than
+ *         the unread data would be consumed
+ */
+AIORET_TYPE AIOFifoReadConsume( void *nfifo, unsigned size )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_AIOFIFO, nfifo );
+    AIOFifo *fifo = (AIOFifo *)nfifo;
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, size <= fifo->rdelta( fifo ) && size % fifo->refsize == 0 );
+
+    if ( fifo->spsc ) {
+        AIO_FIFO_STORE_RELEASE( fifo->read_pos, AIO_FIFO_LOAD_RELAXED( fifo->read_pos ) + size );
+    } else {
+        GRAB_RESOURCE( fifo );
+        fifo->read_pos = ( fifo->read_pos + size ) % fifo->size;
+        RELEASE_RESOURCE( fifo );
+    }
+    return size;
+}
+
 
 
 TEMPLATE_AIOFIFO_API( Counts, uint16_t );
@@ -580,6 +852,154 @@ TEST(AIOFifo, ReadSizeInElementsWithLoop)
     DeleteAIOFifoCounts( counts );
 }
 
+TEST(AIOFifo, SPSCWrapsWithSameCapacity )
+{
+    int i, j;
+    AIORET_TYPE retval;
+    AIOFifoCounts *counts = NewAIOFifoCounts( 1000 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOFifoSetSPSC( counts, AIOUSB_TRUE ));
+    ASSERT_EQ( AIOUSB_TRUE, AIOFifoIsSPSC( counts ));
+    ASSERT_EQ( 1000, AIOFifoGetSizeNumElements( counts ) ) << "Capacity should not change when switching to SPSC";
+    ASSERT_EQ( 1000, AIOFifoWriteSizeRemainingNumElements( counts ) );
+
+    uint16_t frombuf[300], tobuf[300];
+    for ( int loop = 0, val = 0, expected = 0; loop < 20; loop ++ ) {
+        for ( i = 0; i < 300; i ++ ) 
+            frombuf[i] = val++;
+        retval = counts->PushN( counts, frombuf, 300 );
+        ASSERT_EQ( 300*sizeof(uint16_t), retval );
+        retval = counts->PopN( counts, tobuf, 300 );
+        ASSERT_EQ( 300*sizeof(uint16_t), retval );
+        for ( j = 0; j < 300; j ++ ) 
+            ASSERT_EQ( (uint16_t)expected++, tobuf[j] );
+    }
+
+    for ( i = 0; i < 1000; i ++ ) 
+        ASSERT_GE( counts->Push( counts, i ), 0 );
+    ASSERT_EQ( 0, AIOFifoWriteSizeRemainingNumElements( counts ));
+    ASSERT_EQ( 0, counts->Push( counts, 1 ) ) << "All or none writes still refuse to overfill";
+
+    AIOFifoReset( counts );
+    ASSERT_EQ( 0, AIOFifoReadSizeNumElements( counts ) );
+
+    DeleteAIOFifoCounts( counts );
+}
+
+TEST(AIOFifo, SPSCNeedsPowerOfTwoElements )
+{
+    AIOFifo *fifo = NewAIOFifo( 101*3, 3 );
+    unsigned char frombuf[30], tobuf[30];
+    for ( int i = 0; i < 30; i ++ ) 
+        frombuf[i] = i;
+
+    ASSERT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOFifoSetSPSC( fifo, AIOUSB_TRUE ));
+    ASSERT_EQ( AIOUSB_FALSE, AIOFifoIsSPSC( fifo )) << "A refused fifo keeps working as it was";
+    ASSERT_EQ( 30, fifo->Write( fifo, frombuf, 30 ));
+    ASSERT_EQ( 30, fifo->Read( fifo, tobuf, 30 ));
+    ASSERT_EQ( 0, memcmp( frombuf, tobuf, 30 ));
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOFifoSetSPSC( fifo, AIOUSB_FALSE ));
+    DeleteAIOFifo( fifo );
+
+    fifo = NewAIOFifo( 101*4, 4 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOFifoSetSPSC( fifo, AIOUSB_TRUE ));
+    ASSERT_EQ( AIOUSB_TRUE, AIOFifoIsSPSC( fifo ));
+    DeleteAIOFifo( fifo );
+}
+
+class AIOFifoRegionTest : public ::testing::TestWithParam<bool> {};
+
+TEST_P(AIOFifoRegionTest, ReserveCommitPeekConsume )
+{
+    AIOFifoCounts *counts = NewAIOFifoCounts( 100 );
+    AIOFifoRegion region;
+    uint16_t tobuf[100];
+    AIORET_TYPE retval;
+    AIOFifoSetSPSC( counts, GetParam() ? AIOUSB_TRUE : AIOUSB_FALSE );
+
+    /* Move the positions near the end of the storage so the next region wraps */
+    for ( int i = 0; i < 90; i ++ ) 
+        counts->Push( counts, i );
+    counts->PopN( counts, tobuf, 90 );
+
+    retval = AIOFifoWriteReserve( counts, 60*sizeof(uint16_t), &region );
+    ASSERT_EQ( 60*sizeof(uint16_t), retval );
+    ASSERT_EQ( retval, region.size[0] + region.size[1] );
+    ASSERT_GT( region.size[1], 0 ) << "Region should wrap around the end of the storage";
+    ASSERT_EQ( counts->data, region.ptr[1] );
+    ASSERT_EQ( 0, AIOFifoReadSizeNumElements( counts ) ) << "Nothing is visible before commit";
+
+    for ( unsigned i = 0, val = 1000; i < 2; i ++ ) 
+        for ( unsigned j = 0; j < region.size[i] / sizeof(uint16_t); j ++ ) 
+            ((uint16_t *)region.ptr[i])[j] = val++;
+
+    ASSERT_EQ( 60*sizeof(uint16_t), AIOFifoWriteCommit( counts, 60*sizeof(uint16_t) ));
+    ASSERT_EQ( 60, AIOFifoReadSizeNumElements( counts ) );
+
+    retval = AIOFifoReadPeek( counts, 1000, &region );
+    ASSERT_EQ( 60*sizeof(uint16_t), retval );
+    for ( unsigned i = 0, val = 1000; i < 2; i ++ ) 
+        for ( unsigned j = 0; j < region.size[i] / sizeof(uint16_t); j ++ ) 
+            ASSERT_EQ( val++, ((uint16_t *)region.ptr[i])[j] );
+
+    ASSERT_EQ( 20*sizeof(uint16_t), AIOFifoReadConsume( counts, 20*sizeof(uint16_t) ));
+    ASSERT_EQ( 40, AIOFifoReadSizeNumElements( counts ) );
+    ASSERT_EQ( 40*sizeof(uint16_t), counts->PopN( counts, tobuf, 40 ));
+    ASSERT_EQ( 1020, tobuf[0] );
+
+    ASSERT_LT( AIOFifoReadConsume( counts, sizeof(uint16_t) ), 0 ) << "Cannot consume more than is available";
+    ASSERT_LT( AIOFifoWriteCommit( counts, 101*sizeof(uint16_t) ), 0 ) << "Cannot commit more than the free space";
+
+    DeleteAIOFifoCounts( counts );
+}
+
+INSTANTIATE_TEST_CASE_P( LockedAndSPSC, AIOFifoRegionTest, ::testing::Values( false, true ));
+
+typedef struct {
+    AIOFifoVolts *fifo;
+    int total;
+} spsc_producer_args;
+
+static void *spsc_producer( void *object )
+{
+    spsc_producer_args *args = (spsc_producer_args *)object;
+    double vals[37];
+    for ( int sent = 0; sent < args->total ; ) {
+        int remaining = args->total - sent;
+        int n = MIN( 37, remaining );
+        for ( int i = 0; i < n; i ++ ) 
+            vals[i] = sent + i;
+        if ( args->fifo->PushN( args->fifo, vals, n ) > 0 ) 
+            sent += n;
+    }
+    return NULL;
+}
+
+TEST(AIOFifo, SPSCProducerConsumer )
+{
+    pthread_t producer;
+    spsc_producer_args args;
+    double vals[64];
+    int received = 0;
+
+    args.fifo  = NewAIOFifoVolts( 250 );
+    args.total = 200000;
+    AIOFifoSetSPSC( args.fifo, AIOUSB_TRUE );
+
+    ASSERT_EQ( 0, pthread_create( &producer, NULL, spsc_producer, &args ));
+    while ( received < args.total ) {
+        int available = AIOFifoReadSizeNumElements( args.fifo );
+        int n = MIN( 64, available );
+        if ( n <= 0 ) 
+            continue;
+        ASSERT_EQ( n*sizeof(double), args.fifo->PopN( args.fifo, vals, n ));
+        for ( int i = 0; i < n; i ++ , received ++ ) 
+            ASSERT_EQ( (double)received, vals[i] );
+    }
+    pthread_join( producer, NULL );
+
+    DeleteAIOFifoVolts( args.fifo );
+}
+
 int main(int argc, char *argv[] )
 {
 
@@ -33,12 +33,25 @@ AIORET_TYPE AIOFifoWrite( AIOFifo *fifo, void *frombuf , unsigned maxsize );
 #define RELEASE_RESOURCE(obj);
 #endif
 
+#ifndef AIO_FIFO_CACHELINE_SIZE
+#define AIO_FIFO_CACHELINE_SIZE 64
+#endif
+
+/**
+ * @brief read_pos and write_pos each sit on their own cache line so the
+ * producer and consumer threads of a single producer / single consumer
+ * fifo do not bounce the same line between cores. In SPSC mode the
+ * positions are free running byte counters that are masked into a power
+ * of two sized storage area; otherwise they are offsets into data. The
+ * storage is a whole number of elements, so SPSC mode needs refsize to be
+ * a power of two and AIOFifoSetSPSC() refuses any other.
+ */
 #define AIO_FIFO_INTERFACE                                                           \
     void *data;                                                                      \
     unsigned int refsize;                                                            \
     unsigned int size;                                                               \
-    volatile unsigned int read_pos;                                                  \
-    volatile unsigned int write_pos;                                                 \
+    unsigned int mask;                                                               \
+    unsigned int spsc;                                                               \
     AIO_EITHER_TYPE kind;                                                            \
     AIORET_TYPE (*Read)( struct AIOFifo *fifo, void *tobuf, unsigned maxsize );      \
     AIORET_TYPE (*Write)( struct AIOFifo *fifo, void *tobuf, unsigned maxsize );     \
@@ -46,7 +59,12 @@ AIORET_TYPE AIOFifoWrite( AIOFifo *fifo, void *frombuf , unsigned maxsize );
     size_t (*delta)( struct AIOFifo *fifo  );                                        \
     size_t (*rdelta)( struct AIOFifo *fifo  );                                       \
     size_t (*_calculate_size_write)( struct AIOFifo *fifo, unsigned maxsize );       \
-    size_t (*_calculate_size_read)( struct AIOFifo *fifo, unsigned maxsize );
+    size_t (*_calculate_size_read)( struct AIOFifo *fifo, unsigned maxsize );        \
+    char _read_pad[AIO_FIFO_CACHELINE_SIZE];                                         \
+    volatile unsigned int read_pos;                                                  \
+    char _write_pad[AIO_FIFO_CACHELINE_SIZE - sizeof(unsigned int)];                 \
+    volatile unsigned int write_pos;                                                 \
+    char _end_pad[AIO_FIFO_CACHELINE_SIZE - sizeof(unsigned int)];
 
     /* void (*Reset)( struct aio_fifo *fifo );                                          \ */
 
@@ -77,6 +95,17 @@ typedef struct AIOFifo {
 } AIOFifo;
 
 
+/**
+ * @brief Up to two contiguous pieces of fifo storage, as returned by
+ * AIOFifoWriteReserve() and AIOFifoReadPeek(). The second piece is only
+ * used when the region wraps past the end of the storage, in which case
+ * it starts at the beginning of the storage.
+ */
+typedef struct aio_fifo_region {
+    void *ptr[2];
+    unsigned int size[2];       /**< Bytes in each piece */
+} AIOFifoRegion;
+
 typedef uint32_t TYPE;
 typedef void INPUT_TYPE;
 
@@ -165,6 +194,8 @@ AIORET_TYPE AIOFifo##NAME ##Initialize( AIOFifo##NAME *nfifo )
     nfifo->delta = NAME##delta;                                                                     \
     nfifo->refsize = sizeof(TYPE);                                                                  \
     nfifo->kind = aioeither_value_##TYPE;                                                           \
+    if ( nfifo->spsc )                                                                              \
+        retval = AIOFifoSetSPSC( nfifo, AIOUSB_TRUE );                                              \
     return retval;                                                                                  \
 }                                                                                                   \
 AIOFifo##NAME *NewAIOFifo##NAME( unsigned int size )                                                \
@@ -220,6 +251,12 @@ PUBLIC_EXTERN AIORET_TYPE AIOFifoGetSizeNumElements( void *tmpfifo );
 PUBLIC_EXTERN AIORET_TYPE AIOFifoResize( AIOFifo *fifo, size_t newsize );
 PUBLIC_EXTERN AIORET_TYPE AIOFifoReadPosition( void *nfifo );
 PUBLIC_EXTERN AIORET_TYPE AIOFifoWritePosition( void *nfifo );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoSetSPSC( void *nfifo, AIOUSB_BOOL spsc );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoIsSPSC( void *nfifo );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoWriteReserve( void *nfifo, unsigned maxsize, AIOFifoRegion *region );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoWriteCommit( void *nfifo, unsigned size );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoReadPeek( void *nfifo, unsigned maxsize, AIOFifoRegion *region );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoReadConsume( void *nfifo, unsigned size );
 /* END AIOUSB_API */
 
 #endif
@@ -0,0 +1,461 @@
+/**
+ * @file   AIOHistogram.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Log linear histograms and the per device transfer histograms built on them
+ *
+ * Every device can record, for the bulk transfers of ADC_BulkAcquire(),
+ * the AIOContinuousBuf workers and DIO_StreamFrame(), how long each
+ * transfer took, how many bytes it moved, how long the library took to
+ * start the next one and how full the fifo was. Recording is off until
+ * AIOUSBDeviceEnableTransferHistograms() turns it on, and can be read
+ * with AIOUSBDeviceGetTransferHistograms() or
+ * AIOUSBDeviceTransferHistogramsToJSON() while an acquisition runs.
+ */
+
+#include "AIOHistogram.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_Log.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+void AIOHistogramReset( AIOHistogram *hist )
+{
+    memset( hist, 0, sizeof(*hist) );
+    hist->min = UINT64_MAX;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Values below 16 get a bucket each, after that every power of two
+ * is split into 16 buckets by the 4 bits below its top bit
+ */
+unsigned AIOHistogramBucketIndex( uint64_t value )
+{
+    if ( value < AIO_HISTOGRAM_SUB_BUCKETS )
+        return (unsigned)value;
+
+    unsigned shift = ( 63 - __builtin_clzll( value ) ) - AIO_HISTOGRAM_SUB_BUCKET_BITS;
+    return ( shift + 1 ) * AIO_HISTOGRAM_SUB_BUCKETS + (unsigned)( ( value >> shift ) - AIO_HISTOGRAM_SUB_BUCKETS );
+}
+
+/*----------------------------------------------------------------------------*/
+uint64_t AIOHistogramBucketLowerBound( unsigned index )
+{
+    if ( index < AIO_HISTOGRAM_SUB_BUCKETS )
+        return index;
+
+    unsigned shift = index / AIO_HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)( AIO_HISTOGRAM_SUB_BUCKETS + index % AIO_HISTOGRAM_SUB_BUCKETS ) << shift;
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOHistogramRecord( AIOHistogram *hist, uint64_t value )
+{
+    uint64_t seen;
+
+    __sync_fetch_and_add( &hist->buckets[ AIOHistogramBucketIndex( value ) ], 1 );
+    __sync_fetch_and_add( &hist->sum, value );
+    while ( value < ( seen = hist->min ) && !__sync_bool_compare_and_swap( &hist->min, seen, value ) )
+        ;
+    while ( value > ( seen = hist->max ) && !__sync_bool_compare_and_swap( &hist->max, seen, value ) )
+        ;
+    __sync_fetch_and_add( &hist->count, 1 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Value below which percentile percent of the records fall, given
+ * as the lower bound of its bucket and clamped to the recorded min and max
+ * @param hist Histogram
+ * @param percentile 0 to 100
+ */
+uint64_t AIOHistogramPercentile( const AIOHistogram *hist, double percentile )
+{
+    uint64_t total = 0, seen = 0, rank;
+
+    for ( unsigned i = 0; i < AIO_HISTOGRAM_NUM_BUCKETS; i ++ )
+        total += hist->buckets[i];
+    if ( !total )
+        return 0;
+
+    percentile = ( percentile < 0 ? 0 : percentile > 100 ? 100 : percentile );
+    rank = (uint64_t)( percentile / 100.0 * total + 0.5 );
+    rank = ( rank < 1 ? 1 : rank );
+
+    for ( unsigned i = 0; i < AIO_HISTOGRAM_NUM_BUCKETS; i ++ ) {
+        seen += hist->buckets[i];
+        if ( seen >= rank ) {
+            if ( seen == total )
+                return hist->max;
+            uint64_t value = AIOHistogramBucketLowerBound( i );
+            value = ( value < hist->min ? hist->min : value );
+            return ( value > hist->max ? hist->max : value );
+        }
+    }
+    return hist->max;
+}
+
+/*----------------------------------------------------------------------------*/
+double AIOHistogramMean( const AIOHistogram *hist )
+{
+    return ( hist->count ? (double)hist->sum / hist->count : 0 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Summary statistics and every bucket in use, as
+ * {"count":N,...,"buckets":[[lower_bound,count],...]}
+ * @return String to be freed by the caller
+ */
+char *AIOHistogramToJSON( const AIOHistogram *hist )
+{
+    size_t size = 256 + AIO_HISTOGRAM_NUM_BUCKETS * 48, len;
+    char *json = (char *)malloc( size );
+    AIO_ERROR_VALID_DATA( NULL, json );
+
+    len = snprintf( json, size, "{\"count\":%llu,\"min\":%llu,\"max\":%llu,\"mean\":%.1f,"
+                    "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"buckets\":[",
+                    (unsigned long long)hist->count,
+                    (unsigned long long)( hist->count ? hist->min : 0 ),
+                    (unsigned long long)hist->max,
+                    AIOHistogramMean( hist ),
+                    (unsigned long long)AIOHistogramPercentile( hist, 50 ),
+                    (unsigned long long)AIOHistogramPercentile( hist, 90 ),
+                    (unsigned long long)AIOHistogramPercentile( hist, 99 ),
+                    (unsigned long long)AIOHistogramPercentile( hist, 99.9 ) );
+
+    for ( unsigned i = 0, first = 1; i < AIO_HISTOGRAM_NUM_BUCKETS; i ++ ) {
+        if ( !hist->buckets[i] )
+            continue;
+        len += snprintf( json + len, size - len, "%s[%llu,%llu]", ( first ? "" : "," ),
+                         (unsigned long long)AIOHistogramBucketLowerBound( i ),
+                         (unsigned long long)hist->buckets[i] );
+        first = 0;
+    }
+    snprintf( json + len, size - len, "]}" );
+
+    return json;
+}
+
+/*----------------------------------------------------------------------------*/
+uint64_t AIOTransferTimestamp( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Records one bulk transfer
+ * @param hists Histograms of the path the transfer was made on
+ * @param start_ns When it was started, from AIOTransferTimestamp(), 0 if
+ *        only its completion was seen
+ * @param end_ns When it completed
+ * @param bytes Bytes it moved
+ * @param fifo_fill Bytes waiting in the fifo, negative for paths without one
+ * @param last_end_ns The caller's record of when its previous transfer
+ *        completed, 0 before the first; updated to end_ns
+ */
+void AIOTransferHistogramsRecord( AIOTransferHistograms *hists, uint64_t start_ns, uint64_t end_ns, long bytes,
+                                  long fifo_fill, uint64_t *last_end_ns )
+{
+    uint64_t begin = ( start_ns ? start_ns : end_ns );
+
+    if ( start_ns && end_ns >= start_ns )
+        AIOHistogramRecord( &hists->latency_ns, end_ns - start_ns );
+    if ( bytes >= 0 )
+        AIOHistogramRecord( &hists->bytes, (uint64_t)bytes );
+    if ( last_end_ns && *last_end_ns && begin >= *last_end_ns )
+        AIOHistogramRecord( &hists->gap_ns, begin - *last_end_ns );
+    if ( fifo_fill >= 0 )
+        AIOHistogramRecord( &hists->fifo_fill, (uint64_t)fifo_fill );
+    if ( last_end_ns )
+        *last_end_ns = end_ns;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _AIOTransferHistogramsReset( AIOTransferHistograms *hists )
+{
+    AIOHistogramReset( &hists->latency_ns );
+    AIOHistogramReset( &hists->bytes );
+    AIOHistogramReset( &hists->gap_ns );
+    AIOHistogramReset( &hists->fifo_fill );
+}
+
+/*----------------------------------------------------------------------------*/
+char *AIOTransferHistogramsToJSON( const AIOTransferHistograms *hists )
+{
+    char *parts[4] = { AIOHistogramToJSON( &hists->latency_ns ), AIOHistogramToJSON( &hists->bytes ),
+                       AIOHistogramToJSON( &hists->gap_ns ), AIOHistogramToJSON( &hists->fifo_fill ) };
+    char *json = NULL;
+
+    if ( parts[0] && parts[1] && parts[2] && parts[3] ) {
+        size_t size = strlen( parts[0] ) + strlen( parts[1] ) + strlen( parts[2] ) + strlen( parts[3] ) + 128;
+        if ( ( json = (char *)malloc( size ) ) )
+            snprintf( json, size, "{\"latency_ns\":%s,\"bytes\":%s,\"gap_ns\":%s,\"fifo_fill\":%s}",
+                      parts[0], parts[1], parts[2], parts[3] );
+    }
+    for ( int i = 0; i < 4; i ++ )
+        free( parts[i] );
+
+    return json;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts or stops recording the bulk transfers of dev. The
+ * histograms are allocated the first time and kept until the device is
+ * released, so turning recording off leaves them readable.
+ */
+AIORET_TYPE AIOUSBDeviceEnableTransferHistograms( AIOUSBDevice *dev, AIOUSB_BOOL enable )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+
+    if ( !enable ) {
+        dev->activeTransferHistograms = NULL;
+        return AIOUSB_SUCCESS;
+    }
+
+    if ( !dev->transferHistograms ) {
+        AIOTransferHistograms *hists = (AIOTransferHistograms *)malloc( AIO_TRANSFER_NUM_PATHS * sizeof(AIOTransferHistograms) );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_ENOUGH_MEMORY, hists );
+        for ( int i = 0; i < AIO_TRANSFER_NUM_PATHS; i ++ )
+            _AIOTransferHistogramsReset( &hists[i] );
+        if ( !__sync_bool_compare_and_swap( &dev->transferHistograms, NULL, hists ) )
+            free( hists );
+    }
+    dev->activeTransferHistograms = dev->transferHistograms;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceTransferHistogramsEnabled( AIOUSBDevice *dev )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+    return ( dev->activeTransferHistograms ? AIOUSB_TRUE : AIOUSB_FALSE );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceResetTransferHistograms( AIOUSBDevice *dev )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+
+    if ( dev->transferHistograms ) {
+        for ( int i = 0; i < AIO_TRANSFER_NUM_PATHS; i ++ )
+            _AIOTransferHistogramsReset( &dev->transferHistograms[i] );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the histograms of one path; they are empty if recording
+ * has never been enabled
+ */
+AIORET_TYPE AIOUSBDeviceGetTransferHistograms( AIOUSBDevice *dev, AIOTransferPath path, AIOTransferHistograms *snapshot )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, snapshot && path >= 0 && path < AIO_TRANSFER_NUM_PATHS );
+
+    if ( dev->transferHistograms )
+        memcpy( snapshot, &dev->transferHistograms[path], sizeof(*snapshot) );
+    else
+        _AIOTransferHistogramsReset( snapshot );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief All paths of a device as
+ * {"enabled":true,"bulk_acquire":{...},"continuous":{...},"dio_stream":{...}}
+ * @return String to be freed by the caller
+ */
+char *AIOUSBDeviceTransferHistogramsToJSON( AIOUSBDevice *dev )
+{
+    static const char *names[AIO_TRANSFER_NUM_PATHS] = { "bulk_acquire", "continuous", "dio_stream" };
+    AIOTransferHistograms *snapshot;
+    char *parts[AIO_TRANSFER_NUM_PATHS] = { NULL }, *json = NULL;
+    size_t size = 64, len;
+
+    AIO_ASSERT_RET( NULL, dev );
+    snapshot = (AIOTransferHistograms *)malloc( sizeof(AIOTransferHistograms) );
+    AIO_ERROR_VALID_DATA( NULL, snapshot );
+
+    for ( int i = 0; i < AIO_TRANSFER_NUM_PATHS; i ++ ) {
+        AIOUSBDeviceGetTransferHistograms( dev, (AIOTransferPath)i, snapshot );
+        if ( !( parts[i] = AIOTransferHistogramsToJSON( snapshot ) ) )
+            goto out_AIOUSBDeviceTransferHistogramsToJSON;
+        size += strlen( names[i] ) + strlen( parts[i] ) + 8;
+    }
+
+    if ( ( json = (char *)malloc( size ) ) ) {
+        len = snprintf( json, size, "{\"enabled\":%s", ( dev->activeTransferHistograms ? "true" : "false" ) );
+        for ( int i = 0; i < AIO_TRANSFER_NUM_PATHS; i ++ )
+            len += snprintf( json + len, size - len, ",\"%s\":%s", names[i], parts[i] );
+        snprintf( json + len, size - len, "}" );
+    }
+
+ out_AIOUSBDeviceTransferHistogramsToJSON:
+    for ( int i = 0; i < AIO_TRANSFER_NUM_PATHS; i ++ )
+        free( parts[i] );
+    free( snapshot );
+    return json;
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOUSBDeviceFreeTransferHistograms( AIOUSBDevice *dev )
+{
+    if ( !dev )
+        return;
+    dev->activeTransferHistograms = NULL;
+    free( dev->transferHistograms );
+    dev->transferHistograms = NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_DIO.h"
+#include "USBDevice.h"
+
+using namespace AIOUSB;
+
+TEST(AIOHistogram, BucketsHoldEveryValueToWithinASixteenth )
+{
+    uint64_t values[] = { 0, 1, 15, 16, 17, 31, 32, 33, 1000, 123456789, UINT64_MAX / 3, UINT64_MAX };
+
+    for ( size_t i = 0; i < sizeof(values) / sizeof(values[0]); i ++ ) {
+        unsigned index = AIOHistogramBucketIndex( values[i] );
+        uint64_t low = AIOHistogramBucketLowerBound( index );
+        ASSERT_LT( index, (unsigned)AIO_HISTOGRAM_NUM_BUCKETS );
+        EXPECT_LE( low, values[i] );
+        EXPECT_LE( values[i] - low, values[i] / 16 ) << values[i];
+        if ( index + 1 < AIO_HISTOGRAM_NUM_BUCKETS )
+            EXPECT_GT( AIOHistogramBucketLowerBound( index + 1 ), values[i] ) << values[i];
+    }
+    EXPECT_EQ( (unsigned)AIO_HISTOGRAM_NUM_BUCKETS - 1, AIOHistogramBucketIndex( UINT64_MAX ) );
+}
+
+TEST(AIOHistogram, Percentiles )
+{
+    AIOHistogram *hist = (AIOHistogram *)malloc( sizeof(AIOHistogram) );
+    AIOHistogramReset( hist );
+    EXPECT_EQ( 0u, AIOHistogramPercentile( hist, 50 ) );
+
+    for ( uint64_t v = 1; v <= 1000; v ++ )
+        AIOHistogramRecord( hist, v * 1000 );
+
+    EXPECT_EQ( 1000u, hist->count );
+    EXPECT_EQ( 1000u, hist->min );
+    EXPECT_EQ( 1000000u, hist->max );
+    EXPECT_DOUBLE_EQ( 500500.0, AIOHistogramMean( hist ) );
+    EXPECT_NEAR( 500000.0, (double)AIOHistogramPercentile( hist, 50 ), 500000.0 / 16 );
+    EXPECT_NEAR( 990000.0, (double)AIOHistogramPercentile( hist, 99 ), 990000.0 / 16 );
+    EXPECT_EQ( 1000000u, AIOHistogramPercentile( hist, 100 ) );
+    EXPECT_EQ( 1000u, AIOHistogramPercentile( hist, 0 ) );
+
+    char *json = AIOHistogramToJSON( hist );
+    EXPECT_TRUE( strstr( json, "\"count\":1000," ) );
+    EXPECT_TRUE( strstr( json, "\"buckets\":[[" ) );
+    free( json );
+    free( hist );
+}
+
+static int mock_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                               int *actual_length, unsigned int timeout )
+{
+    struct timespec wait = { 0, 200000 };
+    nanosleep( &wait, NULL );
+    memset( data, 0, length );
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+static int mock_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                  uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    return wLength;
+}
+
+TEST(AIOHistogram, RecordsDIOStreamTransfersOnlyWhileEnabled )
+{
+    USBDevice usb;
+    AIOTransferHistograms *snapshot = (AIOTransferHistograms *)malloc( sizeof(AIOTransferHistograms) );
+    unsigned short *frame = (unsigned short *)calloc( 32 * 1024, sizeof(unsigned short) );
+    unsigned long bytes;
+    int numDevices = 0;
+
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = mock_control_transfer;
+    usb.usb_bulk_transfer = mock_bulk_transfer;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_16H, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, NULL );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_StreamOpen( 0, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_StreamFrame( 0, 32 * 1024, frame, &bytes ) );
+    AIOUSBDeviceGetTransferHistograms( dev, AIO_TRANSFER_DIO_STREAM, snapshot );
+    EXPECT_EQ( 0u, snapshot->latency_ns.count );
+    EXPECT_EQ( AIOUSB_FALSE, AIOUSBDeviceTransferHistogramsEnabled( dev ) );
+
+    /* 64K bytes in 31K blocks is three transfers, two gaps between them */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceEnableTransferHistograms( dev, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_StreamFrame( 0, 32 * 1024, frame, &bytes ) );
+    AIOUSBDeviceGetTransferHistograms( dev, AIO_TRANSFER_DIO_STREAM, snapshot );
+    EXPECT_EQ( 3u, snapshot->latency_ns.count );
+    EXPECT_GE( snapshot->latency_ns.min, 200000u );
+    EXPECT_EQ( 31u * 1024, snapshot->bytes.max );
+    EXPECT_EQ( 2u, snapshot->gap_ns.count );
+    EXPECT_EQ( 0u, snapshot->fifo_fill.count );
+
+    char *json = AIOUSBDeviceTransferHistogramsToJSON( dev );
+    ASSERT_TRUE( json );
+    EXPECT_TRUE( strstr( json, "{\"enabled\":true,\"bulk_acquire\":{\"latency_ns\":{\"count\":0," ) );
+    EXPECT_TRUE( strstr( json, "\"dio_stream\":{\"latency_ns\":{\"count\":3," ) );
+    free( json );
+
+    /* Disabled, the histograms stay as they were until reset */
+    AIOUSBDeviceEnableTransferHistograms( dev, AIOUSB_FALSE );
+    DIO_StreamFrame( 0, 32 * 1024, frame, &bytes );
+    AIOUSBDeviceGetTransferHistograms( dev, AIO_TRANSFER_DIO_STREAM, snapshot );
+    EXPECT_EQ( 3u, snapshot->latency_ns.count );
+    AIOUSBDeviceResetTransferHistograms( dev );
+    AIOUSBDeviceGetTransferHistograms( dev, AIO_TRANSFER_DIO_STREAM, snapshot );
+    EXPECT_EQ( 0u, snapshot->latency_ns.count );
+
+    DIO_StreamClose( 0 );
+    AIOUSBDeviceFreeTransferHistograms( dev );
+    deviceTable[0].usb_device = NULL;
+    free( frame );
+    free( snapshot );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  return RUN_ALL_TESTS();
+}
+
+#endif
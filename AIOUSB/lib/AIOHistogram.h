@@ -0,0 +1,96 @@
+/**
+ * @file   AIOHistogram.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Log linear histograms and the per device transfer histograms built on them
+ *
+ */
+
+#ifndef _AIO_HISTOGRAM_H
+#define _AIO_HISTOGRAM_H
+
+#include "AIOTypes.h"
+#include "ADCConfigBlock.h"
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_HISTOGRAM_SUB_BUCKET_BITS   4
+#define AIO_HISTOGRAM_SUB_BUCKETS       ( 1 << AIO_HISTOGRAM_SUB_BUCKET_BITS )
+#define AIO_HISTOGRAM_NUM_BUCKETS       ( ( 64 - AIO_HISTOGRAM_SUB_BUCKET_BITS + 1 ) * AIO_HISTOGRAM_SUB_BUCKETS )
+
+/* BEGIN AIOUSB_API */
+
+/**
+ * @brief Counts of 64 bit values in buckets that are exact below 16 and
+ * then split every power of two into 16, so any value is placed to
+ * within 1/16th of itself. Recording is lock free and may run while
+ * another thread takes a snapshot; a snapshot can then be a record or
+ * two out of step between count and buckets.
+ */
+typedef struct aio_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[AIO_HISTOGRAM_NUM_BUCKETS];
+} AIOHistogram;
+
+typedef enum {
+    AIO_TRANSFER_BULK_ACQUIRE = 0,      /**< ADC_BulkAcquire() worker */
+    AIO_TRANSFER_CONTINUOUS,            /**< AIOContinuousBuf workers */
+    AIO_TRANSFER_DIO_STREAM,            /**< DIO_StreamFrame() */
+    AIO_TRANSFER_NUM_PATHS
+} AIOTransferPath;
+
+/**
+ * @brief What the bulk transfers of one path looked like
+ */
+typedef struct aio_transfer_histograms {
+    AIOHistogram latency_ns;            /**< Time spent in each bulk transfer */
+    AIOHistogram bytes;                 /**< Bytes each transfer moved */
+    AIOHistogram gap_ns;                /**< From the end of one transfer to the start of the next */
+    AIOHistogram fifo_fill;             /**< Bytes waiting in the fifo when a transfer completed */
+} AIOTransferHistograms;
+
+PUBLIC_EXTERN void AIOHistogramReset( AIOHistogram *hist );
+PUBLIC_EXTERN void AIOHistogramRecord( AIOHistogram *hist, uint64_t value );
+PUBLIC_EXTERN unsigned AIOHistogramBucketIndex( uint64_t value );
+PUBLIC_EXTERN uint64_t AIOHistogramBucketLowerBound( unsigned index );
+PUBLIC_EXTERN uint64_t AIOHistogramPercentile( const AIOHistogram *hist, double percentile );
+PUBLIC_EXTERN double AIOHistogramMean( const AIOHistogram *hist );
+PUBLIC_EXTERN char *AIOHistogramToJSON( const AIOHistogram *hist );
+
+PUBLIC_EXTERN uint64_t AIOTransferTimestamp( void );
+PUBLIC_EXTERN void AIOTransferHistogramsRecord( AIOTransferHistograms *hists, uint64_t start_ns, uint64_t end_ns, long bytes, long fifo_fill, uint64_t *last_end_ns );
+PUBLIC_EXTERN char *AIOTransferHistogramsToJSON( const AIOTransferHistograms *hists );
+
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceEnableTransferHistograms( AIOUSBDevice *dev, AIOUSB_BOOL enable );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceTransferHistogramsEnabled( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceResetTransferHistograms( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetTransferHistograms( AIOUSBDevice *dev, AIOTransferPath path, AIOTransferHistograms *snapshot );
+PUBLIC_EXTERN char *AIOUSBDeviceTransferHistogramsToJSON( AIOUSBDevice *dev );
+PUBLIC_EXTERN void AIOUSBDeviceFreeTransferHistograms( AIOUSBDevice *dev );
+
+/* END AIOUSB_API */
+
+/**
+ * @brief Histograms the transfers of path should be recorded in, NULL
+ * while recording is off. This is the only cost to a transfer loop when
+ * the histograms are disabled. activeTransferHistograms is loaded once,
+ * so the result is never built from a pointer cleared in between.
+ */
+#define AIO_TRANSFER_HISTOGRAMS( dev, path )  ( __extension__ ({                      \
+    struct aio_transfer_histograms *_aio_active = ( (dev) ? __atomic_load_n( &(dev)->activeTransferHistograms, __ATOMIC_ACQUIRE ) : NULL ); \
+    ( _aio_active ? &_aio_active[path] : NULL );                                        \
+  }) )
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
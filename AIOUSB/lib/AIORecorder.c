@@ -0,0 +1,717 @@
+/**
+ * @file   AIORecorder.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Memory mapped binary recordings of raw counts from an AIOContinuousBuf
+ *
+ * A recording is a series of segment files, each preallocated to the
+ * segment size and mapped shared, so that recording a block of scans is a
+ * memcpy out of the AIOContinuousBuf fifo and into the page cache. The
+ * segment header keeps a running count of the records in it, so a segment
+ * cut short by a crash can still be read back. Closing a segment trims
+ * the file to the records that were actually written.
+ */
+
+#include "AIORecorder.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_Log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+static void _AIORecordingSegmentPath( char *path, size_t size, const char *prefix, unsigned index )
+{
+    snprintf( path, size, "%s.%04u.aiorec", prefix, index );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates, preallocates and maps the next segment file and writes
+ * its header
+ */
+static AIORET_TYPE _AIORecorderOpenSegment( AIORecorder *rec )
+{
+    char path[AIO_RECORDING_MAX_PATH + 16];
+    AIORecordingHeader *header;
+
+    _AIORecordingSegmentPath( path, sizeof(path), rec->prefix, rec->num_segments );
+    rec->fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( rec->fd < 0 ) {
+        AIOUSB_ERROR("Can't create recording segment %s: %s\n", path, strerror(errno) );
+        return -AIOUSB_ERROR_OPEN_FAILED;
+    }
+
+    /* Reserve the blocks up front so that writing through the map never
+     * has to wait on the filesystem to allocate them */
+    if ( posix_fallocate( rec->fd, 0, (off_t)rec->segment_size ) != 0 &&
+         ftruncate( rec->fd, (off_t)rec->segment_size ) != 0 ) {
+        AIOUSB_ERROR("Can't size recording segment %s: %s\n", path, strerror(errno) );
+        close( rec->fd );
+        rec->fd = -1;
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    void *map = mmap( NULL, rec->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, rec->fd, 0 );
+    if ( map == MAP_FAILED ) {
+        AIOUSB_ERROR("Can't map recording segment %s: %s\n", path, strerror(errno) );
+        close( rec->fd );
+        rec->fd = -1;
+        return -AIOUSB_ERROR_INVALID_MEMORY;
+    }
+    madvise( map, rec->segment_size, MADV_SEQUENTIAL );
+
+    rec->map          = (unsigned char *)map;
+    rec->map_size     = rec->segment_size;
+    rec->write_offset = rec->header.header_size;
+
+    header = (AIORecordingHeader *)rec->map;
+    memcpy( header, &rec->header, sizeof(*header) );
+    header->segment_index = rec->num_segments;
+    header->first_scan    = rec->num_scans;
+    header->num_scans     = 0;
+    if ( rec->header.config_length )
+        memcpy( rec->map + sizeof(*header), rec->config_json, rec->header.config_length );
+
+    rec->num_segments ++;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Unmaps the current segment and trims the unused preallocation
+ */
+static AIORET_TYPE _AIORecorderCloseSegment( AIORecorder *rec )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+
+    if ( rec->fd < 0 )
+        return AIOUSB_SUCCESS;
+
+    munmap( rec->map, rec->map_size );
+    if ( ftruncate( rec->fd, (off_t)rec->write_offset ) != 0 )
+        retval = -AIOUSB_ERROR_INVALID_DATA;
+    close( rec->fd );
+
+    rec->fd       = -1;
+    rec->map      = NULL;
+    rec->map_size = 0;
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies size bytes into the segments. size may end part way through
+ * a record, as long as the next call carries on with the rest of it.
+ */
+static AIORET_TYPE _AIORecorderWriteBytes( AIORecorder *rec, const unsigned char *data, size_t size )
+{
+    AIORET_TYPE retval;
+
+    while ( size ) {
+        if ( rec->fd < 0 && ( retval = _AIORecorderOpenSegment( rec ) ) != AIOUSB_SUCCESS )
+            return retval;
+
+        size_t room = rec->map_size - rec->write_offset;
+        size_t n = MIN( room, size );
+        memcpy( rec->map + rec->write_offset, data, n );
+        rec->write_offset += n;
+        data += n;
+        size -= n;
+
+        AIORecordingHeader *header = (AIORecordingHeader *)rec->map;
+        uint64_t scans = ( rec->write_offset - rec->header.header_size ) / rec->header.record_size;
+        rec->num_scans   += scans - header->num_scans;
+        header->num_scans = scans;
+
+        if ( rec->write_offset == rec->map_size && ( retval = _AIORecorderCloseSegment( rec ) ) != AIOUSB_SUCCESS )
+            return retval;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a recorder that writes segments named <prefix>.NNNN.aiorec
+ * @param prefix Path and file name prefix of the segments
+ * @param num_channels Channels per scan
+ * @param num_oversamples Oversamples per channel, each scan record holds
+ *        num_channels * ( num_oversamples + 1 ) counts
+ * @param clock_hz Scan clock, kept in the header for the reader
+ * @param config Config block saved in the header, may be NULL
+ * @param segment_size Bytes per segment file, 0 for AIO_RECORDING_DEFAULT_SEGMENT.
+ *        It is rounded down to a whole number of records.
+ * @return New recorder, or NULL on failure
+ */
+AIORecorder *NewAIORecorder( const char *prefix,
+                             unsigned num_channels,
+                             unsigned num_oversamples,
+                             unsigned long clock_hz,
+                             ADCConfigBlock *config,
+                             size_t segment_size )
+{
+    AIO_ASSERT_RET( NULL, prefix && strlen(prefix) < AIO_RECORDING_MAX_PATH );
+    AIO_ASSERT_RET( NULL, num_channels > 0 && num_channels <= AD_MAX_CHANNELS );
+
+    AIORecorder *rec = (AIORecorder *)calloc( 1, sizeof(AIORecorder) );
+    AIO_ERROR_VALID_DATA( NULL, rec );
+
+    strcpy( rec->prefix, prefix );
+    rec->fd = -1;
+
+    memcpy( rec->header.magic, AIO_RECORDING_MAGIC, sizeof(AIO_RECORDING_MAGIC) );
+    rec->header.version         = AIO_RECORDING_VERSION;
+    rec->header.num_channels    = num_channels;
+    rec->header.num_oversamples = num_oversamples;
+    rec->header.record_size     = num_channels * ( num_oversamples + 1 ) * sizeof(unsigned short);
+    rec->header.clock_hz        = clock_hz;
+
+    if ( config ) {
+        rec->config_json = ADCConfigBlockToJSON( config );
+        rec->header.config_length = ( rec->config_json ? strlen( rec->config_json ) : 0 );
+        rec->header.start_channel = ADCConfigBlockGetStartChannel( config );
+        if ( config->mux_settings.defined ) {
+            rec->header.mux_channels       = config->mux_settings.ADCMUXChannels;
+            rec->header.channels_per_group = config->mux_settings.ADCChannelsPerGroup;
+        }
+    }
+
+    size_t header_size = sizeof(AIORecordingHeader) + rec->header.config_length;
+    rec->header.header_size = ( header_size + AIO_RECORDING_HEADER_ALIGN - 1 ) / AIO_RECORDING_HEADER_ALIGN * AIO_RECORDING_HEADER_ALIGN;
+
+    if ( !segment_size )
+        segment_size = AIO_RECORDING_DEFAULT_SEGMENT;
+    size_t records = ( segment_size > rec->header.header_size ?
+                       ( segment_size - rec->header.header_size ) / rec->header.record_size : 0 );
+    rec->segment_size = rec->header.header_size + MAX( records, (size_t)1 ) * rec->header.record_size;
+
+    return rec;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a recorder for the raw counts of a counts AIOContinuousBuf,
+ * taking the channels, oversample, clock and config block from buf
+ */
+AIORecorder *NewAIORecorderForContinuousBuf( AIOContinuousBuf *buf, const char *prefix, size_t segment_size )
+{
+    AIO_ASSERT_RET( NULL, buf );
+    AIO_ERROR_VALID_DATA( NULL, buf->fifo->refsize == sizeof(unsigned short) );
+
+    return NewAIORecorder( prefix,
+                           AIOContinuousBufNumberChannels( buf ),
+                           AIOContinuousBufGetOversample( buf ),
+                           buf->hz,
+                           AIOContinuousBufGetADCConfigBlock( buf ),
+                           segment_size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Closes the current segment. Further writes start a new one.
+ */
+AIORET_TYPE AIORecorderClose( AIORecorder *rec )
+{
+    AIO_ASSERT( rec );
+    return _AIORecorderCloseSegment( rec );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIORecorder( AIORecorder *rec )
+{
+    AIO_ASSERT( rec );
+    AIORET_TYPE retval = _AIORecorderCloseSegment( rec );
+
+    free( rec->config_json );
+    free( rec );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Appends num_scans scan records of raw counts
+ * @return Number of scans written, or negative error
+ */
+AIORET_TYPE AIORecorderWriteScans( AIORecorder *rec, const unsigned short *counts, unsigned num_scans )
+{
+    AIO_ASSERT( rec );
+    AIO_ASSERT( counts || !num_scans );
+
+    AIORET_TYPE retval = _AIORecorderWriteBytes( rec, (const unsigned char *)counts, (size_t)num_scans * rec->header.record_size );
+    return ( retval == AIOUSB_SUCCESS ? (AIORET_TYPE)num_scans : retval );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Moves every whole scan record available in buf into the recording,
+ * copying straight out of the fifo storage and releasing it afterwards.
+ * @return Number of scans recorded, or negative error
+ */
+AIORET_TYPE AIORecorderDrain( AIORecorder *rec, AIOContinuousBuf *buf )
+{
+    AIO_ASSERT( rec );
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER, buf->fifo->refsize == sizeof(unsigned short) );
+
+    AIOFifoRegion region;
+    AIORET_TYPE retval = AIOContinuousBufPeek( buf, &region );
+    if ( retval <= 0 )
+        return retval;
+
+    size_t size = ( (size_t)retval / rec->header.record_size ) * rec->header.record_size;
+    size_t first = MIN( size, (size_t)region.size[0] );
+    if ( !size )
+        return 0;
+
+    if ( ( retval = _AIORecorderWriteBytes( rec, (const unsigned char *)region.ptr[0], first ) ) != AIOUSB_SUCCESS )
+        return retval;
+    if ( size > first && ( retval = _AIORecorderWriteBytes( rec, (const unsigned char *)region.ptr[1], size - first ) ) != AIOUSB_SUCCESS )
+        return retval;
+
+    AIOContinuousBufConsume( buf, size );
+    return (AIORET_TYPE)( size / rec->header.record_size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Records from buf until its acquisition stops and everything left in
+ * it has been written. Call it once the acquisition has been started, from
+ * whichever thread would otherwise have been reading buf.
+ * @param rec
+ * @param buf
+ * @param min_scans Scans to wait for before each drain, larger values mean
+ *        fewer and bigger copies
+ * @param timeout_ms Longest wait for min_scans, < 0 waits until they arrive
+ *        or the acquisition stops
+ * @return Number of scans recorded, or negative error
+ */
+AIORET_TYPE AIORecorderRecord( AIORecorder *rec, AIOContinuousBuf *buf, unsigned long min_scans, int timeout_ms )
+{
+    AIO_ASSERT( rec );
+    AIO_ASSERT_AIOCONTBUF( buf );
+    AIORET_TYPE total = 0, retval;
+    unsigned long samples_per_record = rec->header.record_size / sizeof(unsigned short);
+
+    for ( ;; ) {
+        AIOContinuousBufWaitForSamples( buf, MAX( min_scans, 1UL ) * samples_per_record, timeout_ms );
+        AIOUSB_BOOL stopped = ( AIOContinuousBufGetStatus( buf ) & RUNNING ? AIOUSB_FALSE : AIOUSB_TRUE );
+
+        /* Once stopped nothing more can be pushed, so this drain is the last */
+        if ( ( retval = AIORecorderDrain( rec, buf ) ) < 0 )
+            return retval;
+        total += retval;
+        if ( stopped )
+            break;
+    }
+
+    return total;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecorderGetNumberScans( AIORecorder *rec )
+{
+    AIO_ASSERT( rec );
+    return (AIORET_TYPE)rec->num_scans;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecorderGetNumberSegments( AIORecorder *rec )
+{
+    AIO_ASSERT( rec );
+    return (AIORET_TYPE)rec->num_segments;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE _AIORecordingMapSegment( AIORecordingSegment *segment, const char *path )
+{
+    struct stat st;
+    const AIORecordingHeader *header;
+
+    segment->fd = open( path, O_RDONLY );
+    if ( segment->fd < 0 )
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+
+    if ( fstat( segment->fd, &st ) != 0 || (size_t)st.st_size < sizeof(AIORecordingHeader) ) {
+        close( segment->fd );
+        return -AIOUSB_ERROR_INVALID_DATA;
+    }
+
+    void *map = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, segment->fd, 0 );
+    if ( map == MAP_FAILED ) {
+        close( segment->fd );
+        return -AIOUSB_ERROR_INVALID_MEMORY;
+    }
+
+    segment->map      = (unsigned char *)map;
+    segment->map_size = (size_t)st.st_size;
+    segment->header   = header = (const AIORecordingHeader *)map;
+
+    if ( memcmp( header->magic, AIO_RECORDING_MAGIC, sizeof(AIO_RECORDING_MAGIC) ) != 0 ||
+         header->version != AIO_RECORDING_VERSION ||
+         !header->record_size ||
+         header->header_size > segment->map_size ||
+         header->header_size + header->num_scans * header->record_size > segment->map_size ) {
+        munmap( segment->map, segment->map_size );
+        close( segment->fd );
+        return -AIOUSB_ERROR_INVALID_DATA;
+    }
+
+    segment->counts = (const unsigned short *)( segment->map + header->header_size );
+    madvise( segment->map, segment->map_size, MADV_SEQUENTIAL );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Builds the counts to volts plan from the config block JSON in the
+ * first segment
+ */
+static void _AIORecordingLoadConfig( AIORecording *recording )
+{
+    const AIORecordingHeader *header = recording->segments[0].header;
+    if ( !header->config_length || header->header_size < sizeof(*header) + header->config_length )
+        return;
+
+    char *json = (char *)malloc( header->config_length + 1 );
+    if ( !json )
+        return;
+    memcpy( json, recording->segments[0].map + sizeof(*header), header->config_length );
+    json[header->config_length] = '\0';
+
+    recording->config = NewADCConfigBlockFromJSON( json );
+    free( json );
+    if ( !recording->config )
+        return;
+
+    /* The JSON only carries the gain registers, the header knows how they map onto channels */
+    recording->config->mux_settings.ADCMUXChannels      = ( header->mux_channels ? header->mux_channels : AD_NUM_GAIN_CODE_REGISTERS );
+    recording->config->mux_settings.ADCChannelsPerGroup = ( header->channels_per_group ? header->channels_per_group : 1 );
+    recording->config->mux_settings.defined             = AIOUSB_TRUE;
+
+    recording->plan = NewAIOConversionPlan();
+    if ( recording->plan && AIOConversionPlanBuild( recording->plan, recording->config ) != AIOUSB_SUCCESS ) {
+        DeleteAIOConversionPlan( recording->plan );
+        recording->plan = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Maps every segment of the recording written with prefix
+ * @return New recording, or NULL if the first segment is missing or damaged
+ */
+AIORecording *NewAIORecording( const char *prefix )
+{
+    AIO_ASSERT_RET( NULL, prefix && strlen(prefix) < AIO_RECORDING_MAX_PATH );
+    char path[AIO_RECORDING_MAX_PATH + 16];
+    AIORecordingSegment segment;
+
+    AIORecording *recording = (AIORecording *)calloc( 1, sizeof(AIORecording) );
+    AIO_ERROR_VALID_DATA( NULL, recording );
+
+    for ( unsigned index = 0; ; index ++ ) {
+        _AIORecordingSegmentPath( path, sizeof(path), prefix, index );
+        if ( _AIORecordingMapSegment( &segment, path ) != AIOUSB_SUCCESS )
+            break;
+
+        const AIORecordingHeader *first = ( index ? recording->segments[0].header : segment.header );
+        AIORecordingSegment *tmp = (AIORecordingSegment *)realloc( recording->segments, ( index + 1 ) * sizeof(AIORecordingSegment) );
+        if ( !tmp || segment.header->record_size != first->record_size || segment.header->first_scan != recording->num_scans ) {
+            munmap( segment.map, segment.map_size );
+            close( segment.fd );
+            if ( tmp )
+                recording->segments = tmp;
+            break;
+        }
+
+        recording->segments = tmp;
+        recording->segments[index] = segment;
+        recording->num_segments ++;
+        recording->num_scans += segment.header->num_scans;
+    }
+
+    if ( !recording->num_segments ) {
+        free( recording->segments );
+        free( recording );
+        return NULL;
+    }
+
+    _AIORecordingLoadConfig( recording );
+    return recording;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteAIORecording( AIORecording *recording )
+{
+    AIO_ASSERT( recording );
+
+    for ( unsigned i = 0; i < recording->num_segments; i ++ ) {
+        munmap( recording->segments[i].map, recording->segments[i].map_size );
+        close( recording->segments[i].fd );
+    }
+    free( recording->segments );
+    if ( recording->config )
+        DeleteADCConfigBlock( recording->config );
+    DeleteAIOConversionPlan( recording->plan );
+    free( recording );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecordingGetNumberScans( AIORecording *recording )
+{
+    AIO_ASSERT( recording );
+    return (AIORET_TYPE)recording->num_scans;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecordingGetNumberChannels( AIORecording *recording )
+{
+    AIO_ASSERT( recording );
+    return recording->segments[0].header->num_channels;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecordingGetOversample( AIORecording *recording )
+{
+    AIO_ASSERT( recording );
+    return recording->segments[0].header->num_oversamples;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecordingGetClock( AIORecording *recording )
+{
+    AIO_ASSERT( recording );
+    return (AIORET_TYPE)recording->segments[0].header->clock_hz;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Points at the raw counts of first_scan onwards. Scans never span
+ * two segments, so the run stops at the end of the segment holding
+ * first_scan.
+ * @param recording
+ * @param first_scan Scan number within the whole recording
+ * @param num_scans In: scans wanted. Out: scans the returned pointer covers
+ * @return Counts of first_scan inside the mapping, or NULL past the end
+ */
+const unsigned short *AIORecordingGetCounts( AIORecording *recording, uint64_t first_scan, unsigned *num_scans )
+{
+    AIO_ASSERT_RET( NULL, recording && num_scans );
+
+    for ( unsigned i = 0; i < recording->num_segments; i ++ ) {
+        const AIORecordingHeader *header = recording->segments[i].header;
+        if ( first_scan >= header->first_scan + header->num_scans )
+            continue;
+
+        uint64_t offset = first_scan - header->first_scan;
+        *num_scans = (unsigned)MIN( (uint64_t)*num_scans, header->num_scans - offset );
+        return recording->segments[i].counts + offset * ( header->record_size / sizeof(unsigned short) );
+    }
+
+    *num_scans = 0;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Converts scans to volts using the gains recorded in the header,
+ * averaging the oversamples of each channel
+ * @param volts Room for num_scans * channels values
+ * @return Number of scans converted, or negative error
+ */
+AIORET_TYPE AIORecordingGetVolts( AIORecording *recording, uint64_t first_scan, unsigned num_scans, double *volts )
+{
+    AIO_ASSERT( recording );
+    AIO_ASSERT( volts || !num_scans );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_ADCCONFIG, recording->plan );
+
+    const AIORecordingHeader *header = recording->segments[0].header;
+    unsigned num_channels = header->num_channels;
+    unsigned num_samples  = header->num_oversamples + 1;
+    const AIOConversionPlan *plan = recording->plan;
+    AIORET_TYPE done = 0;
+
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_CHANNEL_NUMBER, header->start_channel + num_channels <= plan->num_channels );
+
+    while ( (unsigned)done < num_scans ) {
+        unsigned run = num_scans - (unsigned)done;
+        const unsigned short *counts = AIORecordingGetCounts( recording, first_scan + done, &run );
+        if ( !counts )
+            break;
+
+        for ( unsigned scan = 0; scan < run; scan ++ ) {
+            for ( unsigned channel = 0; channel < num_channels; channel ++ ) {
+                unsigned long sum = 0;
+                for ( unsigned os = 0; os < num_samples; os ++ )
+                    sum += *counts++;
+                unsigned plan_channel = header->start_channel + channel;
+                *volts++ = ( (double)sum / num_samples ) * plan->scale[plan_channel] + plan->offset[plan_channel];
+            }
+        }
+        done += run;
+    }
+
+    return done;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include <stdlib.h>
+
+using namespace AIOUSB;
+
+class AIORecorderTest : public ::testing::Test {
+ protected:
+    char dir[64];
+    char prefix[128];
+    virtual void SetUp() {
+        strcpy( dir, "/tmp/aiorecXXXXXX" );
+        ASSERT_TRUE( mkdtemp( dir ) );
+        snprintf( prefix, sizeof(prefix), "%s/run", dir );
+    }
+    virtual void TearDown() {
+        char path[256];
+        for ( unsigned i = 0; i < 64; i ++ ) {
+            snprintf( path, sizeof(path), "%s.%04u.aiorec", prefix, i );
+            unlink( path );
+        }
+        rmdir( dir );
+    }
+};
+
+TEST_F(AIORecorderTest, RollsSegmentsAndReadsBack )
+{
+    unsigned num_channels = 4, num_scans = 1000;
+    unsigned short *counts = (unsigned short *)malloc( num_scans * num_channels * sizeof(unsigned short) );
+    for ( unsigned i = 0; i < num_scans * num_channels; i ++ )
+        counts[i] = (unsigned short)i;
+
+    /* Room for 300 scans after the header */
+    AIORecorder *rec = NewAIORecorder( prefix, num_channels, 0, 1000, NULL, AIO_RECORDING_HEADER_ALIGN + 300 * num_channels * sizeof(unsigned short) );
+    ASSERT_TRUE( rec );
+    EXPECT_EQ( 700, AIORecorderWriteScans( rec, counts, 700 ) );
+    EXPECT_EQ( 300, AIORecorderWriteScans( rec, &counts[700*num_channels], 300 ) );
+    EXPECT_EQ( 1000, AIORecorderGetNumberScans( rec ) );
+    EXPECT_EQ( 4, AIORecorderGetNumberSegments( rec ) );
+    DeleteAIORecorder( rec );
+
+    AIORecording *recording = NewAIORecording( prefix );
+    ASSERT_TRUE( recording );
+    EXPECT_EQ( 1000, AIORecordingGetNumberScans( recording ) );
+    EXPECT_EQ( 4, AIORecordingGetNumberChannels( recording ) );
+    EXPECT_EQ( 1000, AIORecordingGetClock( recording ) );
+
+    unsigned run = 200;
+    const unsigned short *mapped = AIORecordingGetCounts( recording, 250, &run );
+    ASSERT_TRUE( mapped );
+    EXPECT_EQ( 50, run ) << "Runs stop at the end of a segment";
+    EXPECT_EQ( 0, memcmp( mapped, &counts[250*num_channels], run * num_channels * sizeof(unsigned short) ) );
+
+    run = 10;
+    mapped = AIORecordingGetCounts( recording, 995, &run );
+    EXPECT_EQ( 5, run );
+    EXPECT_EQ( counts[999*num_channels+3], mapped[4*num_channels+3] );
+
+    run = 1;
+    EXPECT_FALSE( AIORecordingGetCounts( recording, 1000, &run ) );
+
+    double volts[4];
+    EXPECT_LT( AIORecordingGetVolts( recording, 0, 1, volts ), 0 ) << "No config block was recorded";
+
+    DeleteAIORecording( recording );
+    free( counts );
+}
+
+TEST_F(AIORecorderTest, ConvertsWithRecordedGains )
+{
+    ADCConfigBlock config;
+    memset( &config, 0, sizeof(config) );
+    ADCConfigBlockInitializeDefault( &config );
+    config.mux_settings.ADCMUXChannels      = 16;
+    config.mux_settings.ADCChannelsPerGroup = 1;
+    config.mux_settings.defined             = AIOUSB_TRUE;
+    ADCConfigBlockSetStartChannel( &config, 2 );
+    ADCConfigBlockSetGainCode( &config, 2, AD_GAIN_CODE_0_10V );
+    ADCConfigBlockSetGainCode( &config, 3, AD_GAIN_CODE_10V );
+
+    /* Two channels, one oversample */
+    unsigned short counts[] = { 0, 0, 65535, 65535,   65535, 65535, 32768, 32768 };
+    AIORecorder *rec = NewAIORecorder( prefix, 2, 1, 50000, &config, 0 );
+    ASSERT_TRUE( rec );
+    EXPECT_EQ( 2, AIORecorderWriteScans( rec, counts, 2 ) );
+    DeleteAIORecorder( rec );
+
+    AIORecording *recording = NewAIORecording( prefix );
+    ASSERT_TRUE( recording );
+    EXPECT_EQ( 1, AIORecordingGetOversample( recording ) );
+
+    double volts[4];
+    ASSERT_EQ( 2, AIORecordingGetVolts( recording, 0, 2, volts ) );
+    EXPECT_NEAR( 0.0, volts[0], 1e-9 );
+    EXPECT_NEAR( 10.0, volts[1], 1e-9 );
+    EXPECT_NEAR( 10.0, volts[2], 1e-9 );
+    EXPECT_NEAR( 0.0, volts[3], 1e-3 );
+
+    DeleteAIORecording( recording );
+}
+
+TEST_F(AIORecorderTest, DrainsContinuousBuf )
+{
+    unsigned num_channels = 16;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 100, num_channels );
+    ASSERT_TRUE( buf );
+    AIORecorder *rec = NewAIORecorder( prefix, num_channels, 0, 1000, NULL, 0 );
+    ASSERT_TRUE( rec );
+
+    unsigned short data[60*16];
+    for ( unsigned i = 0; i < sizeof(data)/sizeof(data[0]); i ++ )
+        data[i] = (unsigned short)i;
+
+    /* Wrap the fifo so that the drain has to copy two pieces */
+    for ( int round = 0; round < 3; round ++ ) {
+        AIOContinuousBufPushN( buf, data, 60*num_channels );
+        EXPECT_EQ( 60, AIORecorderDrain( rec, buf ) );
+    }
+    EXPECT_EQ( 0, AIOContinuousBufCountScansAvailable( buf ) );
+    DeleteAIORecorder( rec );
+
+    AIORecording *recording = NewAIORecording( prefix );
+    ASSERT_TRUE( recording );
+    ASSERT_EQ( 180, AIORecordingGetNumberScans( recording ) );
+    unsigned run = 60;
+    const unsigned short *mapped = AIORecordingGetCounts( recording, 120, &run );
+    ASSERT_EQ( 60, run );
+    EXPECT_EQ( 0, memcmp( mapped, data, sizeof(data) ) );
+
+    DeleteAIORecording( recording );
+    DeleteAIOContinuousBuf( buf );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  return RUN_ALL_TESTS();
+}
+
+#endif
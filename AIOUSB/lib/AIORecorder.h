@@ -0,0 +1,117 @@
+/**
+ * @file   AIORecorder.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Memory mapped binary recordings of raw counts from an AIOContinuousBuf
+ *
+ */
+
+#ifndef _AIO_RECORDER_H
+#define _AIO_RECORDER_H
+
+#include "AIOTypes.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOConversionPlan.h"
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_RECORDING_MAGIC             "AIOREC1"
+#define AIO_RECORDING_VERSION           1
+#define AIO_RECORDING_HEADER_ALIGN      4096
+#define AIO_RECORDING_DEFAULT_SEGMENT   (256*1024*1024)
+#define AIO_RECORDING_MAX_PATH          1024
+
+/* BEGIN AIOUSB_API */
+
+/**
+ * @brief Start of every segment file. The ADCConfigBlock JSON follows the
+ * header, and the scan records start at header_size, which is a multiple
+ * of AIO_RECORDING_HEADER_ALIGN. A scan record holds
+ * num_channels * ( num_oversamples + 1 ) raw counts in acquisition order.
+ */
+typedef struct aio_recording_header {
+    char magic[8];                      /**< AIO_RECORDING_MAGIC */
+    uint32_t version;
+    uint32_t header_size;               /**< Bytes before the first scan record */
+    uint32_t num_channels;
+    uint32_t num_oversamples;
+    uint32_t record_size;               /**< Bytes per scan record */
+    uint32_t segment_index;
+    uint32_t start_channel;             /**< Channel of the first count in a record */
+    uint32_t mux_channels;              /**< ADCMUXChannels of the device that recorded */
+    uint32_t channels_per_group;        /**< ADCChannelsPerGroup of the device that recorded */
+    uint32_t config_length;             /**< Bytes of ADCConfigBlock JSON, 0 if none */
+    uint64_t clock_hz;
+    uint64_t first_scan;                /**< Scan number of the first record in this segment */
+    uint64_t num_scans;                 /**< Records in this segment, updated as they are written */
+} AIORecordingHeader;
+
+/**
+ * @brief Writes scan records into preallocated, memory mapped segment files
+ * named <prefix>.NNNN.aiorec, starting a new segment whenever the current
+ * one is full.
+ */
+typedef struct aio_recorder {
+    char prefix[AIO_RECORDING_MAX_PATH];
+    size_t segment_size;                /**< Bytes preallocated per segment */
+    AIORecordingHeader header;          /**< Template for each new segment */
+    char *config_json;
+    int fd;                             /**< Current segment, -1 when none is open */
+    unsigned char *map;
+    size_t map_size;
+    size_t write_offset;
+    unsigned num_segments;
+    uint64_t num_scans;                 /**< Records written over all segments */
+} AIORecorder;
+
+typedef struct aio_recording_segment {
+    int fd;
+    unsigned char *map;
+    size_t map_size;
+    const AIORecordingHeader *header;
+    const unsigned short *counts;
+} AIORecordingSegment;
+
+/**
+ * @brief Read side of a recording. The segments are mapped read only and
+ * counts are handed out as pointers into the mappings.
+ */
+typedef struct aio_recording {
+    unsigned num_segments;
+    AIORecordingSegment *segments;
+    uint64_t num_scans;
+    ADCConfigBlock *config;             /**< Parsed from the first segment, NULL if none was recorded */
+    AIOConversionPlan *plan;
+} AIORecording;
+
+PUBLIC_EXTERN AIORecorder *NewAIORecorder( const char *prefix, unsigned num_channels, unsigned num_oversamples, unsigned long clock_hz, ADCConfigBlock *config, size_t segment_size );
+PUBLIC_EXTERN AIORecorder *NewAIORecorderForContinuousBuf( AIOContinuousBuf *buf, const char *prefix, size_t segment_size );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIORecorder( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderWriteScans( AIORecorder *rec, const unsigned short *counts, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderDrain( AIORecorder *rec, AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderRecord( AIORecorder *rec, AIOContinuousBuf *buf, unsigned long min_scans, int timeout_ms );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderGetNumberScans( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderGetNumberSegments( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderClose( AIORecorder *rec );
+
+PUBLIC_EXTERN AIORecording *NewAIORecording( const char *prefix );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIORecording( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetNumberScans( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetNumberChannels( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetOversample( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetClock( AIORecording *recording );
+PUBLIC_EXTERN const unsigned short *AIORecordingGetCounts( AIORecording *recording, uint64_t first_scan, unsigned *num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetVolts( AIORecording *recording, uint64_t first_scan, unsigned num_scans, double *volts );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
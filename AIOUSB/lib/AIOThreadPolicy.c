@@ -0,0 +1,293 @@
+/**
+ * @file   AIOThreadPolicy.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Scheduling, CPU affinity and memory locking for acquisition threads
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "AIOThreadPolicy.h"
+#include "AIOUSB_Log.h"
+#include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+AIOThreadPolicy *NewAIOThreadPolicy( void )
+{
+    AIOThreadPolicy *policy = (AIOThreadPolicy *)calloc( 1, sizeof(AIOThreadPolicy) );
+    if ( policy )
+        policy->priority = -1;
+    return policy;
+}
+
+/*----------------------------------------------------------------------------*/
+AIOThreadPolicy *NewAIOThreadPolicyCopy( const AIOThreadPolicy *policy )
+{
+    AIO_ASSERT_RET( NULL, policy );
+    AIOThreadPolicy *tmp = (AIOThreadPolicy *)malloc( sizeof(AIOThreadPolicy) );
+    if ( tmp ) {
+        *tmp = *policy;
+        memset( &tmp->report, 0, sizeof(tmp->report) );
+    }
+    return tmp;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIOThreadPolicy( AIOThreadPolicy *policy )
+{
+    free( policy );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @param policy
+ * @param sched_class
+ * @param priority Priority within sched_class, < 0 for the highest one. It is
+ *        clamped to what the class allows when the policy is applied.
+ */
+AIORET_TYPE AIOThreadPolicySetScheduler( AIOThreadPolicy *policy, AIOThreadSchedClass sched_class, int priority )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, sched_class >= AIO_THREAD_SCHED_INHERIT && sched_class <= AIO_THREAD_SCHED_RR );
+    policy->sched_class = sched_class;
+    policy->priority    = priority;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOThreadPolicyAddCPU( AIOThreadPolicy *policy, unsigned cpu )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, cpu < AIO_THREAD_POLICY_MAX_CPUS );
+    if ( !( policy->cpus[cpu / 8] & ( 1 << ( cpu % 8 ) ) ) ) {
+        policy->cpus[cpu / 8] |= ( 1 << ( cpu % 8 ) );
+        policy->num_cpus ++;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOThreadPolicyClearCPUs( AIOThreadPolicy *policy )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    memset( policy->cpus, 0, sizeof(policy->cpus) );
+    policy->num_cpus = 0;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOThreadPolicySetLockMemory( AIOThreadPolicy *policy, AIOUSB_BOOL lock_memory )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    policy->lock_memory = lock_memory;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Touches bytes of stack when the policy is applied, so the pages are
+ *        mapped before the thread starts moving data. Capped at
+ *        AIO_THREAD_POLICY_MAX_PREFAULT.
+ */
+AIORET_TYPE AIOThreadPolicySetStackPrefault( AIOThreadPolicy *policy, size_t bytes )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    policy->prefault_stack = ( bytes > AIO_THREAD_POLICY_MAX_PREFAULT ? AIO_THREAD_POLICY_MAX_PREFAULT : bytes );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/** @cond INTERNAL_DOCUMENTATION */
+static int _aio_sched_class_to_policy( AIOThreadSchedClass sched_class )
+{
+    switch ( sched_class ) {
+    case AIO_THREAD_SCHED_FIFO:
+        return SCHED_FIFO;
+    case AIO_THREAD_SCHED_RR:
+        return SCHED_RR;
+    default:
+        return SCHED_OTHER;
+    }
+}
+
+__attribute__((noinline)) static size_t _aio_prefault_stack( size_t bytes )
+{
+    long page = sysconf( _SC_PAGESIZE );
+    volatile unsigned char *stack = (volatile unsigned char *)alloca( bytes );
+    for ( size_t i = 0; i < bytes; i += ( page > 0 ? page : 4096 ) )
+        stack[i] = 0;
+    return bytes;
+}
+/** @endcond */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Applies policy to the calling thread and records the result in
+ *        policy->report. Acquisition workers call this first thing.
+ * @param policy
+ * @return AIOUSB_SUCCESS if every requested setting took effect,
+ *         -AIOUSB_ERROR_INVALID_THREAD if any of them was refused; the
+ *         report says which
+ */
+AIORET_TYPE AIOThreadPolicyApply( AIOThreadPolicy *policy )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    AIOThreadPolicyReport report;
+    struct sched_param param;
+    int sched_policy;
+
+    memset( &report, 0, sizeof(report) );
+
+    if ( policy->sched_class != AIO_THREAD_SCHED_INHERIT ) {
+        int os_policy = _aio_sched_class_to_policy( policy->sched_class );
+        int lo = sched_get_priority_min( os_policy ), hi = sched_get_priority_max( os_policy );
+        param.sched_priority = ( policy->priority < 0 ? hi : policy->priority );
+        param.sched_priority = ( param.sched_priority < lo ? lo : param.sched_priority > hi ? hi : param.sched_priority );
+        report.sched_error = pthread_setschedparam( pthread_self(), os_policy, &param );
+    }
+
+#ifdef __linux__
+    cpu_set_t cpus;
+    if ( policy->num_cpus > 0 ) {
+        CPU_ZERO( &cpus );
+        for ( unsigned cpu = 0; cpu < AIO_THREAD_POLICY_MAX_CPUS && cpu < CPU_SETSIZE; cpu ++ ) {
+            if ( policy->cpus[cpu / 8] & ( 1 << ( cpu % 8 ) ) )
+                CPU_SET( cpu, &cpus );
+        }
+        report.affinity_error = pthread_setaffinity_np( pthread_self(), sizeof(cpus), &cpus );
+    }
+    if ( pthread_getaffinity_np( pthread_self(), sizeof(cpus), &cpus ) == 0 )
+        report.num_cpus = CPU_COUNT( &cpus );
+#else
+    if ( policy->num_cpus > 0 )
+        report.affinity_error = ENOSYS;
+#endif
+
+    if ( policy->lock_memory && mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 )
+        report.mlock_error = errno;
+
+    if ( policy->prefault_stack )
+        report.stack_prefaulted = _aio_prefault_stack( policy->prefault_stack );
+
+    if ( pthread_getschedparam( pthread_self(), &sched_policy, &param ) == 0 ) {
+        report.sched_policy   = sched_policy;
+        report.sched_priority = param.sched_priority;
+    }
+    report.applied = 1;
+    policy->report = report;
+
+    if ( report.sched_error || report.affinity_error || report.mlock_error ) {
+        AIOUSB_WARN("Thread policy only partly applied: sched=%d affinity=%d mlock=%d\n",
+                    report.sched_error, report.affinity_error, report.mlock_error );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies out what the last AIOThreadPolicyApply() on policy achieved
+ * @return AIOUSB_SUCCESS, or -AIOUSB_ERROR_INVALID_THREAD if no thread has
+ *         applied the policy yet
+ */
+AIORET_TYPE AIOThreadPolicyGetReport( const AIOThreadPolicy *policy, AIOThreadPolicyReport *report )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, policy );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, report );
+    *report = policy->report;
+    return ( report->applied ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_THREAD );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+
+using namespace AIOUSB;
+
+static void *apply_policy( void *object )
+{
+    AIOThreadPolicyApply( (AIOThreadPolicy *)object );
+    return NULL;
+}
+
+TEST(AIOThreadPolicy,ReportsWhatWasApplied)
+{
+    AIOThreadPolicy *policy = NewAIOThreadPolicy();
+    AIOThreadPolicyReport report;
+    pthread_t thread;
+
+    ASSERT_TRUE( policy );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_THREAD, AIOThreadPolicyGetReport( policy, &report ) );
+
+    AIOThreadPolicyAddCPU( policy, 0 );
+    AIOThreadPolicySetScheduler( policy, AIO_THREAD_SCHED_FIFO, -1 );
+    AIOThreadPolicySetStackPrefault( policy, 64*1024 );
+
+    pthread_create( &thread, NULL, apply_policy, policy );
+    pthread_join( thread, NULL );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOThreadPolicyGetReport( policy, &report ) );
+    EXPECT_EQ( 0, report.affinity_error );
+    EXPECT_EQ( 1, report.num_cpus );
+    EXPECT_EQ( (size_t)64*1024, report.stack_prefaulted );
+    /* Unprivileged runs are refused SCHED_FIFO and must say so */
+    if ( report.sched_error == 0 ) {
+        EXPECT_EQ( SCHED_FIFO, report.sched_policy );
+        EXPECT_EQ( sched_get_priority_max(SCHED_FIFO), report.sched_priority );
+    } else {
+        EXPECT_EQ( EPERM, report.sched_error );
+        EXPECT_EQ( SCHED_OTHER, report.sched_policy );
+    }
+
+    DeleteAIOThreadPolicy( policy );
+}
+
+TEST(AIOThreadPolicy,CopyStartsWithoutReport)
+{
+    AIOThreadPolicy *policy = NewAIOThreadPolicy();
+    AIOThreadPolicyReport report;
+    AIOThreadPolicyAddCPU( policy, 3 );
+    AIOThreadPolicyAddCPU( policy, 3 );
+    EXPECT_EQ( 1, policy->num_cpus );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOThreadPolicyAddCPU( policy, AIO_THREAD_POLICY_MAX_CPUS ) );
+
+    policy->report.applied = 1;
+    AIOThreadPolicy *copy = NewAIOThreadPolicyCopy( policy );
+    EXPECT_EQ( 1, copy->num_cpus );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_THREAD, AIOThreadPolicyGetReport( copy, &report ) );
+
+    DeleteAIOThreadPolicy( copy );
+    DeleteAIOThreadPolicy( policy );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  return RUN_ALL_TESTS();
+}
+
+#endif
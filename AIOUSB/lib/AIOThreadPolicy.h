@@ -0,0 +1,80 @@
+/**
+ * @file   AIOThreadPolicy.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Scheduling, CPU affinity and memory locking for acquisition threads
+ *
+ */
+
+#ifndef _AIO_THREAD_POLICY_H
+#define _AIO_THREAD_POLICY_H
+
+#include "AIOTypes.h"
+#include <stdlib.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_THREAD_POLICY_MAX_CPUS      1024
+#define AIO_THREAD_POLICY_MAX_PREFAULT  (4*1024*1024)
+
+/* BEGIN AIOUSB_API */
+
+typedef enum {
+    AIO_THREAD_SCHED_INHERIT = 0,       /**< Leave the thread with the creator's scheduling */
+    AIO_THREAD_SCHED_OTHER,
+    AIO_THREAD_SCHED_FIFO,
+    AIO_THREAD_SCHED_RR
+} AIOThreadSchedClass;
+
+/**
+ * @brief What a thread found when it applied an AIOThreadPolicy to itself.
+ * The sched and CPU fields are read back from the thread afterwards, so they
+ * show what the thread really runs with rather than what was asked for.
+ */
+typedef struct aio_thread_policy_report {
+    int applied;                        /**< Non zero once a thread has applied the policy */
+    int sched_policy;                   /**< SCHED_* the thread runs with */
+    int sched_priority;                 /**< Priority the thread runs with */
+    int sched_error;                    /**< errno from changing the scheduler, 0 if it worked or wasn't asked for */
+    int num_cpus;                       /**< CPUs the thread may run on */
+    int affinity_error;                 /**< errno from changing the affinity */
+    int mlock_error;                    /**< errno from mlockall() */
+    size_t stack_prefaulted;            /**< Bytes of stack touched */
+} AIOThreadPolicyReport;
+
+/**
+ * @brief How an acquisition worker thread should be run. The thread applies
+ * the policy to itself when it starts and records the outcome in report.
+ */
+typedef struct aio_thread_policy {
+    AIOThreadSchedClass sched_class;
+    int priority;                       /**< < 0 picks the highest priority of sched_class */
+    int num_cpus;                       /**< CPUs set in cpus, 0 leaves the affinity alone */
+    unsigned char cpus[AIO_THREAD_POLICY_MAX_CPUS/8];
+    AIOUSB_BOOL lock_memory;            /**< mlockall( MCL_CURRENT | MCL_FUTURE ) */
+    size_t prefault_stack;              /**< Bytes of stack to touch before any work is done */
+    AIOThreadPolicyReport report;
+} AIOThreadPolicy;
+
+PUBLIC_EXTERN AIOThreadPolicy *NewAIOThreadPolicy( void );
+PUBLIC_EXTERN AIOThreadPolicy *NewAIOThreadPolicyCopy( const AIOThreadPolicy *policy );
+PUBLIC_EXTERN void DeleteAIOThreadPolicy( AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicySetScheduler( AIOThreadPolicy *policy, AIOThreadSchedClass sched_class, int priority );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyAddCPU( AIOThreadPolicy *policy, unsigned cpu );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyClearCPUs( AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicySetLockMemory( AIOThreadPolicy *policy, AIOUSB_BOOL lock_memory );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicySetStackPrefault( AIOThreadPolicy *policy, size_t bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyApply( AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyGetReport( const AIOThreadPolicy *policy, AIOThreadPolicyReport *report );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -509,6 +509,7 @@ CREATE_ENUM_W_START( ResultCode, 0,
                      AIOUSB_ERROR_AIOCOMMANDLINE_HELP,
                      AIOUSB_ERROR_INVALID_LIBUSB_DEVICE_HANDLE,
                      AIOUSB_FIFO_COPY_ERROR,
+                     AIOUSB_ERROR_DEVICE_REMOVED,
                      AIOUSB_ERROR_LIBUSB /* Always make the LIBUSB the last element */
                      );
 
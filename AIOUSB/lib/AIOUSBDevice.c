@@ -63,6 +63,11 @@ char *AIOUSBDeviceToJSON( AIOUSBDevice *device )
     sprintf( &tmpbuf[strlen(tmpbuf)], "{\"%s\":%d,", "device_index", device->deviceIndex );
     sprintf( &tmpbuf[strlen(tmpbuf)],  "\"%s\":%d,", "adc_channels_per_group", device->ADCChannels );
     sprintf( &tmpbuf[strlen(tmpbuf)],  "\"%s\":%d,", "adc_mux_channels", device->ADCMUXChannels );
+    USBDeviceIOStats stats;
+    AIOUSBDeviceGetIOStats( device, &stats );
+    char *statsjson = USBDeviceIOStatsToJSON( &stats );
+    sprintf( &tmpbuf[strlen(tmpbuf)],  "\"%s\":%s,", "io_stats", statsjson );
+    free( statsjson );
     sprintf( &tmpbuf[strlen(tmpbuf)],  "\"%s\":%s", "adcconfig", ADCConfigBlockToJSON( AIOUSBDeviceGetADCConfigBlock( device )));
     strcat( tmpbuf, "}" );
 
@@ -226,9 +231,93 @@ USBDevice *AIOUSBDeviceGetUSBHandle( AIOUSBDevice *dev )
 {
     if ( !dev ) 
         return NULL;
+    if ( ( dev->openDeferred ? AIOUSBDeviceOpen( dev ) : dev->openResult ) != AIOUSB_SUCCESS )
+        return NULL;
     return dev->usb_device;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens, claims and probes a device that AIODeviceTablePopulateTable()
+ * only enumerated. AIOUSBDeviceGetUSBHandle() calls this on first use, so
+ * there is normally no need to call it directly. Threads that get here
+ * together wait for the first one to finish.
+ * @param dev
+ * @return AIOUSB_SUCCESS once the device is open, the error from opening it,
+ * or -AIOUSB_ERROR_DEVICE_REMOVED once the board has been unplugged
+ */
+AIORET_TYPE AIOUSBDeviceOpen( AIOUSBDevice *dev )
+{
+    AIO_ASSERT_RET( AIOUSB_ERROR_INVALID_DEVICE, dev );
+
+    if ( !dev->openDeferred )
+        return dev->openResult;
+
+    /* The PNP probe below looks the handle up again */
+    if ( dev->opening && pthread_equal( dev->opener, pthread_self() ) )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &dev->openLock );
+    if ( dev->openDeferred ) {
+        dev->opener  = pthread_self();
+        dev->opening = AIOUSB_TRUE;
+
+        dev->openResult = USBDeviceOpen( dev->usb_device );
+        if ( dev->openResult == AIOUSB_SUCCESS )
+            CheckPNPData( dev->deviceIndex );
+
+        dev->opening = AIOUSB_FALSE;
+        __sync_synchronize();
+        dev->openDeferred = AIOUSB_FALSE;
+    }
+    AIORET_TYPE retval = dev->openResult;
+    pthread_mutex_unlock( &dev->openLock );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets up the per device lock. Called by the device table for each
+ * entry it (re)initializes.
+ */
+AIORET_TYPE AIOUSBDeviceInitLock( AIOUSBDevice *dev )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+    pthread_mutexattr_t attr;
+    AIORET_TYPE retval = -AIOUSB_ERROR_INVALID_MUTEX;
+
+    if ( pthread_mutexattr_init( &attr ) == 0 ) {
+        if ( pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE ) == 0 &&
+             pthread_mutex_init( &dev->lock, &attr ) == 0 )
+            retval = AIOUSB_SUCCESS;
+        pthread_mutexattr_destroy( &attr );
+    }
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Serializes the calls made on one device, so threads driving
+ * different devices never wait on each other. The lock is recursive, so
+ * calls that use other calls on the same device may take it again.
+ * @note Lock order: a device lock is taken before the device table guard
+ * (lookups take it briefly) and before any AIOContinuousBuf or fifo lock.
+ * Never take a device lock while holding the table guard for writing.
+ */
+AIORET_TYPE AIOUSBDeviceLock( AIOUSBDevice *dev )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+    return ( pthread_mutex_lock( &dev->lock ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *dev )
+{
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_DEVICE, dev );
+    return ( pthread_mutex_unlock( &dev->lock ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOUSBDeviceSetUSBHandle( AIOUSBDevice *dev, USBDevice *usb )
 {
@@ -279,6 +368,35 @@ AIORET_TYPE AIOUSBDeviceSetDiscardFirstSample( AIOUSBDevice *device , AIOUSB_BOO
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Traffic counters of the device, all zero until it has been opened
+ * @param device
+ * @param stats Receives a copy of the counters
+ * @return AIOUSB_SUCCESS, < 0 on a missing argument
+ */
+AIORET_TYPE AIOUSBDeviceGetIOStats( AIOUSBDevice *device, USBDeviceIOStats *stats )
+{
+    AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_DEVICE, device );
+    AIO_ASSERT( stats );
+
+    if ( !device->usb_device ) {
+        memset( stats, 0, sizeof(USBDeviceIOStats) );
+        return AIOUSB_SUCCESS;
+    }
+    return USBDeviceGetIOStats( device->usb_device, stats );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceResetIOStats( AIOUSBDevice *device )
+{
+    AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_DEVICE, device );
+
+    if ( !device->usb_device )
+        return AIOUSB_SUCCESS;
+    return USBDeviceResetIOStats( device->usb_device );
+}
+
 
 #ifdef __cplusplus
 }
@@ -312,6 +430,45 @@ TEST(Initialization,AddingDeviceSetsInit )
 }
 
 
+static void *try_device_lock( void *object )
+{
+    AIOUSBDevice *dev = (AIOUSBDevice *)object;
+    long busy = pthread_mutex_trylock( &dev->lock );
+    if ( !busy )
+        pthread_mutex_unlock( &dev->lock );
+    return (void *)busy;
+}
+
+static long device_lock_busy( AIOUSBDevice *dev )
+{
+    pthread_t thread;
+    void *busy;
+    pthread_create( &thread, NULL, try_device_lock, dev );
+    pthread_join( thread, &busy );
+    return (long)busy;
+}
+
+TEST(Locking, LockIsPerDeviceAndRecursive )
+{
+    int numDevices = 0;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_32, NULL );
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_32, NULL );
+    AIOUSBDevice *first = &deviceTable[0], *second = &deviceTable[1];
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceLock( first ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceLock( first ) ) << "Calls that use other calls take it again";
+    EXPECT_EQ( EBUSY, device_lock_busy( first ) );
+    EXPECT_EQ( 0, device_lock_busy( second ) ) << "Other devices are not held up";
+
+    AIOUSBDeviceUnlock( first );
+    EXPECT_EQ( EBUSY, device_lock_busy( first ) );
+    AIOUSBDeviceUnlock( first );
+    EXPECT_EQ( 0, device_lock_busy( first ) );
+
+    ClearAIODeviceTable( numDevices );
+}
+
 TEST(Initialization, SetDifferentConfigBlocks ) 
 {
     AIOUSBDevice *dev;
@@ -372,6 +529,108 @@ TEST(TestingFeatures, PropogateTesting )
     ClearAIODeviceTable( numDevices );
 }
 
+/*
+ * Stand in for libusb under the transfer wrappers of USBDevice.c, so the
+ * counts they keep can be checked without a board. Each call takes the
+ * next scripted result.
+ */
+static struct {
+    int results[8];
+    int bytes[8];
+    int calls;
+} fakeusb;
+
+extern "C" int LIBUSB_CALL libusb_control_transfer( libusb_device_handle *dev_handle, uint8_t request_type, uint8_t bRequest,
+                                                    uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength,
+                                                    unsigned int timeout )
+{
+    int call = fakeusb.calls++;
+    return ( fakeusb.results[call] < 0 ? fakeusb.results[call] : fakeusb.bytes[call] );
+}
+
+extern "C" int LIBUSB_CALL libusb_bulk_transfer( libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data,
+                                                 int length, int *actual_length, unsigned int timeout )
+{
+    int call = fakeusb.calls++;
+    *actual_length = fakeusb.bytes[call];
+    return fakeusb.results[call];
+}
+
+static void script( int result0, int bytes0, int result1 = 0, int bytes1 = 0 )
+{
+    memset( &fakeusb, 0, sizeof(fakeusb) );
+    fakeusb.results[0] = result0;
+    fakeusb.bytes[0] = bytes0;
+    fakeusb.results[1] = result1;
+    fakeusb.bytes[1] = bytes1;
+}
+
+TEST(IOStats, CountedByTheTransferWrappers )
+{
+    USBDevice usb;
+    USBDeviceIOStats stats;
+    unsigned char data[512];
+    int bytes;
+    int numDevices = 0;
+    memset( &usb, 0, sizeof(usb) );
+    usb.deviceHandle = (libusb_device_handle *)0x42;
+    usb.usb_request = usb_request;
+    usb.usb_control_transfer = usb_control_transfer;
+    usb.usb_bulk_transfer = usb_bulk_transfer;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AIO16_16A, &usb );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, NULL );
+    /* Adding the device may already have talked to it */
+    AIOUSBDeviceResetIOStats( dev );
+
+    script( LIBUSB_SUCCESS, 8 );
+    EXPECT_EQ( 8, usb.usb_control_transfer( &usb, 0, 0, 0, 0, data, 8, 1000 ) );
+    script( LIBUSB_ERROR_PIPE, 0 );
+    EXPECT_EQ( LIBUSB_ERROR_PIPE, usb.usb_control_transfer( &usb, 0, 0, 0, 0, data, 8, 1000 ) );
+    script( LIBUSB_ERROR_TIMEOUT, 0 );
+    EXPECT_EQ( LIBUSB_ERROR_TIMEOUT, usb.usb_control_transfer( &usb, 0, 0, 0, 0, data, 8, 1000 ) );
+
+    /* A timeout that brought data is restarted for the rest */
+    script( LIBUSB_ERROR_TIMEOUT, 100, LIBUSB_SUCCESS, 412 );
+    EXPECT_EQ( LIBUSB_SUCCESS, usb.usb_bulk_transfer( &usb, LIBUSB_ENDPOINT_IN | 0x06, data, 512, &bytes, 1000 ) );
+    EXPECT_EQ( 512, bytes );
+    EXPECT_EQ( 2, fakeusb.calls );
+    script( LIBUSB_ERROR_IO, 0 );
+    EXPECT_EQ( LIBUSB_ERROR_IO, usb.usb_bulk_transfer( &usb, LIBUSB_ENDPOINT_OUT | 0x02, data, 512, &bytes, 1000 ) );
+    script( LIBUSB_SUCCESS, 512 );
+    EXPECT_EQ( LIBUSB_SUCCESS, usb.usb_bulk_transfer( &usb, LIBUSB_ENDPOINT_OUT | 0x02, data, 512, &bytes, 1000 ) );
+
+    usb.usb_request( &usb, 0, 0, 0, 0, NULL, 0, 1000 );
+    usb.usb_request( &usb, 0, 0, 0, 0, NULL, 0, 1000 );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceGetIOStats( dev, &stats ) );
+    EXPECT_EQ( 3u, stats.control_transfers );
+    EXPECT_EQ( 8u, stats.control_bytes );
+    EXPECT_EQ( 3u, stats.bulk_transfers ) << "One per call, however many libusb calls it took";
+    EXPECT_EQ( 512u, stats.bulk_bytes_in );
+    EXPECT_EQ( 512u, stats.bulk_bytes_out );
+    EXPECT_EQ( 1u, stats.retries );
+    EXPECT_EQ( 2u, stats.timeouts ) << "Counted whether or not data came with them";
+    EXPECT_EQ( 2u, stats.errors );
+    EXPECT_EQ( 2u, stats.requests );
+    EXPECT_EQ( 0u, stats.overruns );
+
+    char *json = AIOUSBDeviceToJSON( dev );
+    EXPECT_TRUE( strstr( json, "\"io_stats\":{\"control_transfers\":3,\"control_bytes\":8," ) ) << json;
+    EXPECT_TRUE( strstr( json, "\"requests\":2,\"timeouts\":2,\"errors\":2,\"retries\":1," ) ) << json;
+    free( json );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSBDeviceResetIOStats( dev ) );
+    AIOUSBDeviceGetIOStats( dev, &stats );
+    EXPECT_EQ( 0u, stats.requests );
+    EXPECT_EQ( 0u, stats.bulk_transfers );
+    EXPECT_EQ( 0u, stats.errors );
+
+    deviceTable[0].usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
 
 
 int main(int argc, char *argv[] )
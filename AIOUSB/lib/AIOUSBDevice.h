@@ -71,17 +71,40 @@ struct AIOUSBDevice {
     AIOUSB_BOOL bDACClosing;
     AIOUSB_BOOL bDACAborting;
     AIOUSB_BOOL bDACStarted;
-    unsigned char **DACData;
-    unsigned char *PendingDACData;
-    pthread_mutex_t hDACDataMutex;
-    sem_t hDACDataSem;
+    unsigned char **DACData;          /**< Ring of frames queued by DACOutputFrame() */
+    unsigned char *PendingDACData;    /**< Frame sent last, repeated while nothing newer is queued */
+    pthread_mutex_t hDACDataMutex;    /**< Guards the DACData ring */
+    sem_t hDACDataSem;                /**< Free DACData slots */
+    unsigned long *DACDataBytes;      /**< Bytes held in each DACData slot */
+    unsigned DACDataHead;             /**< Oldest queued DACData slot */
+    unsigned DACDataQueued;           /**< DACData slots waiting to be sent */
+    unsigned long PendingDACDataBytes;
+    AIOUSB_BOOL bDACInterlock;        /**< Play each frame once and wait for the next instead of looping */
+    pthread_t DACThread;
+    unsigned long DACResult;          /**< Why the DAC output thread stopped, AIOUSB_SUCCESS if it was asked to */
+    AIOUSB_BOOL bDACFinished;         /**< The DAC output thread takes no more frames, set under hDACDataMutex */
+    unsigned DACDataWaiters;          /**< DACOutputFrame() calls waiting for a slot, counted under hDACDataMutex */
+    const struct dac_stream_requests *DACRequests; /**< Control requests the stream was opened with */
     AIOUSB_BOOL bDIOOpen;
     AIOUSB_BOOL bDIORead;
     AIOUSB_BOOL bDeviceWasHere;
-    unsigned char *LastDIOData;
+    unsigned char *LastDIOData;       /**< Shadow of the outputs, what the board has or is about to be sent */
+    unsigned DIOTransactionDepth;     /**< Open DIO_BeginTransaction() calls, writes only change LastDIOData meanwhile */
+    AIOUSB_BOOL bDIODirty;            /**< LastDIOData has changes the board has not been sent */
+    unsigned long DIOCoalesceWindow;  /**< Microseconds a DIO_Write1() may wait to share a transfer, 0 sends at once */
+    uint64_t DIOCoalesceDeadline;     /**< AIOTransferTimestamp() by which the dirty image goes out */
+    AIOUSB_BOOL bDIOCoalescing;       /**< DIOCoalesceThread is running */
+    pthread_t DIOCoalesceThread;
+    AIORESULT DIOFlushResult;         /**< First failed background flush, returned by the next DIO write */
     char *cachedName;
     unsigned long cachedSerialNumber;
     ADCConfigBlock cachedConfigBlock; /**< .size == 0 == uninitialized */
+    struct aio_conversion_plan *conversionPlan; /**< Built on first use from cachedConfigBlock */
+    int conversionPlanReaders;        /**< Plans handed out and not yet released, see AIOUSBDeviceGetConversionPlan() */
+    AIOUSB_BOOL scanProfileResident;  /**< Leave the GetScan config on the device between scans */
+    struct aio_thread_policy *bulkAcquirePolicy; /**< Applied by the ADC_BulkAcquire worker, NULL to leave it alone */
+    struct aio_transfer_histograms *transferHistograms;  /**< One per AIOTransferPath, allocated when first enabled */
+    struct aio_transfer_histograms * volatile activeTransferHistograms; /**< transferHistograms while recording, NULL otherwise */
 
     /**
      * state of worker thread; these fields are deliberately unspecific so that
@@ -104,7 +127,15 @@ struct AIOUSBDevice {
     AIOUSB_BOOL bFirmware20;
     USB_SPEED USBSpeed;
     AIOPlugNPlay PNPData;
-    
+
+    /** Enumeration only records the descriptor, the first use opens the device */
+    AIOUSB_BOOL openDeferred;   /**< AIOUSB_TRUE == usb_device still has to be opened and probed */
+    AIOUSB_BOOL opening;        /**< AIOUSB_TRUE while opener is opening it */
+    pthread_t opener;
+    AIORET_TYPE openResult;     /**< Outcome of the deferred open */
+    pthread_mutex_t openLock;
+
+    pthread_mutex_t lock;       /**< Recursive, held for a whole immediate call, see AIOUSBDeviceLock() */
 };
 /* unsigned long PNPData; */
 /* USBSpeed: TUSBSpeed; */
@@ -125,6 +156,10 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceInitializeWithProductID( AIOUSBDevice *dev
 PUBLIC_EXTERN USBDevice *AIOUSBDeviceGetUSBHandle( AIOUSBDevice *dev );
 PUBLIC_EXTERN USBDevice *AIOUSBDeviceGetUSBHandleFromDeviceIndex( unsigned long DeviceIndex, AIOUSBDevice **dev, AIORESULT *res );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetUSBHandle( AIOUSBDevice *dev, USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceOpen( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceInitLock( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceLock( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *dev );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetADCConfigBlock( AIOUSBDevice *dev, ADCConfigBlock *conf );
 PUBLIC_EXTERN ADCConfigBlock * AIOUSBDeviceGetADCConfigBlock( AIOUSBDevice *dev );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceCopyADCConfigBlock( AIOUSBDevice *dev, ADCConfigBlock *newone );
@@ -137,6 +172,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetDiscardFirstSample( AIOUSBDevice *devic
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetTimeout( AIOUSBDevice *device, unsigned timeout );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetTimeout( AIOUSBDevice *device );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceWriteADCConfig( AIOUSBDevice *device, ADCConfigBlock *config );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetIOStats( AIOUSBDevice *device, USBDeviceIOStats *stats );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceResetIOStats( AIOUSBDevice *device );
 /* END AIOUSB_API */
 
 #ifdef __aiousb_cplusplus
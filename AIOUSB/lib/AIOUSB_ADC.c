@@ -12,6 +12,8 @@
 #include "AIOTypes.h"
 #include "AIODeviceTable.h"
 #include "AIOUSB_Core.h"
+#include "AIOConversionPlan.h"
+#include "AIOHistogram.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -208,17 +210,13 @@ unsigned long WriteConfigBlock(unsigned long DeviceIndex)
         if ( result  != AIOUSB_SUCCESS )
             goto out_WriteConfigBlock;
 
-        bytesTransferred = usb->usb_control_transfer(usb,
-                                                     USB_WRITE_TO_DEVICE, 
-                                                     AUR_ADC_SET_CONFIG,
-                                                     0, 
-                                                     0, 
-                                                     configBlock->registers, 
-                                                     configBlock->size, 
-                                                     deviceDesc->commTimeout
-                                                     );
+        bytesTransferred = USBDeviceWriteADCConfigRegisters( usb,
+                                                             configBlock->registers, 
+                                                             configBlock->size, 
+                                                             deviceDesc->commTimeout
+                                                             );
         if ( bytesTransferred != ( int )configBlock->size )
-            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+            result = labs(bytesTransferred);
     }
 
 out_WriteConfigBlock:
@@ -302,71 +300,43 @@ RETURN_AIOUSB_GetBulkAcquire:
 
 
 
-/*--------------------------------------------------------------------------*/
 /**
- * @brief Performs a scan and averages the voltage values.
- * @param DeviceIndex
- * @param counts
- * @return
- * @note In theory, all the A/D functions, including AIOUSB_GetScan(), should work
- * in all measurement modes, including calibration mode; in practice,
- * however, the device will return only a single sample in calibration mode;
- * therefore, users must be careful to select a single channel and set
- * oversample to zero during calibration mode; attempting to read more than
- * one channel or use an oversample setting of more than zero in calibration
- * mode will result in a timeout error; as a convenience to the user we
- * automatically impose this restriction here in AIOUSB_GetScan(); if the
- * device is changed to permit normal use of the A/D functions in
- * calibration mode, we will have to modify this function to somehow
- * recognize which devices support that capability, or simply delete this
- * restriction altogether and rely on the users' good judgment
- *
- * @note The oversample setting dictates how many samples to take _in addition_ to
- * the primary sample; if oversample is zero, we take just one sample for
- * each channel; if oversample is greater than zero then we average the
- * primary sample and all of its over-samples; if the discardFirstSample
- * setting is enabled, then we discard the primary sample, leaving just the
- * over-samples; thus, if discardFirstSample is enabled, we must take at
- * least one over-sample in order to have any data left; there's another
- * complication: the device buffer is limited to a small number of samples,
- * so we have to limit the number of over-samples to what the device buffer
- * can accommodate, so the actual oversample setting depends on the number
- * of channels being scanned; we also preserve and restore the original
- * oversample setting specified by the user; since the user is expecting to
- * average (1 + oversample) samples, then if discardFirstSample is enabled
- * we simply always add one
+ * @brief Scan settings AIOUSB_GetScan() and ADC_GetScansBatch() put into the
+ * device for the length of an immediate read, and what is needed to undo them
  */
-PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short counts[] )
-{
+typedef struct {
     ADConfigBlock origConfigBlock;
-    AIOUSB_BOOL configChanged, discardFirstSample; 
-    int samplesToAverage = 0, sampleIndex = 0;
-    int numChannels, samplesPerChannel, libusbresult;
-    unsigned numSamples, overSample;     
-    int bytesTransferred;
+    AIOUSB_BOOL configChanged;
+    AIOUSB_BOOL discardFirstSample;
+    int numChannels;
+    int samplesPerChannel;
+} AIOUSBImmediateScan;
 
-    unsigned short *sampleBuffer;
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Narrows the cached config to what an immediate scan can use and
+ * writes it to the device, see the notes on AIOUSB_GetScan()
+ */
+static AIORET_TYPE AIOUSB_BeginImmediateScan( AIOUSBDevice *deviceDesc, USBDevice *usb, AIOUSBImmediateScan *scan )
+{
     AIORET_TYPE result = AIOUSB_SUCCESS;
-    unsigned char bcdata[] = {0x05,0x00,0x00,0x00 };
+    unsigned overSample;
+    int numChannels, samplesPerChannel;
 
-    AIO_ASSERT( counts );
-
-    AIOUSBDevice *deviceDesc =  AIODeviceTableGetDeviceAtIndex( DeviceIndex , (AIORESULT*)&result );
-    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
-
-    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex , (AIORESULT*)&result );
-
-    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
-    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_SUPPORTED , deviceDesc->bADCStream == AIOUSB_TRUE );
-
-    origConfigBlock     = deviceDesc->cachedConfigBlock;
+    scan->origConfigBlock = deviceDesc->cachedConfigBlock;
+    scan->configChanged   = AIOUSB_FALSE;
 
-    result = USBDeviceFetchADCConfigBlock( usb, &origConfigBlock );
-    AIO_ASSERT_RET( result, result >= AIOUSB_SUCCESS );
+    /**
+     * With a resident scan profile the device holds the scan settings, not
+     * the user's, so cachedConfigBlock is the only copy of the latter
+     */
+    if ( !deviceDesc->scanProfileResident ) {
+        result = USBDeviceFetchADCConfigBlock( usb, &scan->origConfigBlock );
+        AIO_ASSERT_RET( result, result >= AIOUSB_SUCCESS );
+    }
 
-    configChanged       = AIOUSB_FALSE;
-    discardFirstSample  = deviceDesc->discardFirstSample;
-    overSample          = ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock);
+    scan->discardFirstSample  = deviceDesc->discardFirstSample;
+    overSample                = ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock);
 
     numChannels = ADCConfigBlockGetEndChannel( &deviceDesc->cachedConfigBlock ) - 
                   ADCConfigBlockGetStartChannel( &deviceDesc->cachedConfigBlock) + 1;
@@ -375,13 +345,13 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
         if (numChannels > 1) {
             ADCConfigBlockSetScanRange(&deviceDesc->cachedConfigBlock, ADCConfigBlockGetStartChannel(&deviceDesc->cachedConfigBlock), ADCConfigBlockGetStartChannel(&deviceDesc->cachedConfigBlock) );
             numChannels = 1;
-            configChanged = AIOUSB_TRUE;
+            scan->configChanged = AIOUSB_TRUE;
         }
         if (overSample > 0) {
             ADCConfigBlockSetOversample(&deviceDesc->cachedConfigBlock, 0 );
-            configChanged = AIOUSB_TRUE;
+            scan->configChanged = AIOUSB_TRUE;
         }
-        discardFirstSample = AIOUSB_FALSE;           // this feature can't be used in calibration mode either
+        scan->discardFirstSample = AIOUSB_FALSE;           // this feature can't be used in calibration mode either
     }
 
     /**
@@ -390,11 +360,11 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
     ADCConfigBlockSetTriggerMode( &deviceDesc->cachedConfigBlock,
                                   ( ADCConfigBlockGetTriggerMode( &deviceDesc->cachedConfigBlock ) | AD_TRIGGER_SCAN) &
                                   (  ~(AD_TRIGGER_TIMER | AD_TRIGGER_EXTERNAL) ) );
-    configChanged = AIOUSB_TRUE;
+    scan->configChanged = AIOUSB_TRUE;
 
     samplesPerChannel = 1 + ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock );
 
-    if (discardFirstSample)
+    if (scan->discardFirstSample)
         samplesPerChannel++;
     if (samplesPerChannel > 256)
         samplesPerChannel = 256;               /* rained by maximum oversample of 255 */
@@ -409,24 +379,55 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
     overSample = samplesPerChannel - 1;
     if (overSample != (unsigned)ADCConfigBlockGetOversample(&deviceDesc->cachedConfigBlock ) ) {
         ADCConfigBlockSetOversample(&deviceDesc->cachedConfigBlock, overSample);
-        configChanged = AIOUSB_TRUE;
+        scan->configChanged = AIOUSB_TRUE;
     }
 
+    scan->numChannels       = numChannels;
+    scan->samplesPerChannel = samplesPerChannel;
+
     /**
      * Needs to be the correct values written out ...
      * Should resemble (04|05) F0 0E
+     * No transfer happens if the device already holds this profile
      */
-    if ( configChanged )
+    if ( scan->configChanged )
         result = USBDevicePutADCConfigBlock( usb, &deviceDesc->cachedConfigBlock );
-    
 
-    numSamples = numChannels * samplesPerChannel;
- 
-    sampleBuffer = ( unsigned short* )malloc( numSamples * sizeof(unsigned short) );
-    if (!sampleBuffer ) {
-        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-        goto out_AIOUSB_GetScan;
+    return ( result < 0 ? result : AIOUSB_SUCCESS );
+}
+
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Puts back the user's config once an immediate scan is done
+ */
+static void AIOUSB_EndImmediateScan( AIOUSBDevice *deviceDesc, USBDevice *usb, AIOUSBImmediateScan *scan )
+{
+    if ( scan->configChanged ) {
+        deviceDesc->cachedConfigBlock = scan->origConfigBlock;
+        if ( !deviceDesc->scanProfileResident )
+            USBDevicePutADCConfigBlock( usb, &deviceDesc->cachedConfigBlock );
     }
+}
+
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Starts one acquisition block big enough for num_scans scans,
+ * triggers each scan in turn and reads the whole block back in a single
+ * bulk transfer
+ * @param timestamps If not NULL, receives the CLOCK_MONOTONIC time at which
+ * the trigger for each scan was sent
+ */
+static AIORET_TYPE AIOUSB_AcquireImmediateScans( AIOUSBDevice *deviceDesc,
+                                                 USBDevice *usb,
+                                                 const AIOUSBImmediateScan *scan,
+                                                 unsigned num_scans,
+                                                 unsigned short *sampleBuffer,
+                                                 struct timespec *timestamps
+                                                 )
+{
+    unsigned numSamples = num_scans * scan->numChannels * scan->samplesPerChannel;
+    unsigned char bcdata[] = {0x05,0x00,0x00,0x00 };
+    int bytesTransferred, libusbresult;
 
     /* BC */
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -438,73 +439,242 @@ PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short co
                                                  sizeof(bcdata),
                                                  deviceDesc->commTimeout
                                                  );
-    if ( bytesTransferred != (int)sizeof(bcdata) ) { 
-        result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);       
-        goto out_freebuf_AIOUSB_GetScan;
+    if ( bytesTransferred != (int)sizeof(bcdata) )
+        return -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+
+    /* BF, once per scan */
+    for ( unsigned i = 0; i < num_scans; i ++ ) {
+        if ( timestamps )
+            clock_gettime( CLOCK_MONOTONIC, &timestamps[i] );
+        bytesTransferred = usb->usb_control_transfer(usb,
+                                                     USB_WRITE_TO_DEVICE,
+                                                     AUR_ADC_IMMEDIATE,
+                                                     0, 
+                                                     0, 
+                                                     ( unsigned char* )sampleBuffer, 
+                                                     0,
+                                                     deviceDesc->commTimeout
+                                                     );
+        if ( bytesTransferred < 0 )
+            return -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+        else if ( bytesTransferred != 0 )
+            return -AIOUSB_ERROR_INVALID_DATA;
     }
 
-    /* BF */
-    bytesTransferred = usb->usb_control_transfer(usb,
-                                                 USB_WRITE_TO_DEVICE,
-                                                 AUR_ADC_IMMEDIATE,
-                                                 0, 
-                                                 0, 
-                                                 ( unsigned char* )sampleBuffer, 
-                                                 0,
-                                                 deviceDesc->commTimeout
-                                                 );
-    if (bytesTransferred == 0) {
-        libusbresult = adc_get_bulk_data( &deviceDesc->cachedConfigBlock,
-                                         usb,
-                                         LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
-                                         ( unsigned char* )sampleBuffer, 
-                                         numSamples * sizeof(unsigned short), 
-                                         (int*)&bytesTransferred,
-                                         deviceDesc->commTimeout
-                                          );
-
-        if (libusbresult != LIBUSB_SUCCESS) {
-            result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbresult);
-        } else if (bytesTransferred != (int)(numSamples * sizeof(unsigned short)) ) {
-            result = -AIOUSB_ERROR_INVALID_DATA;
-        } else {
-            /**
-             * Compute the average of all the samples taken for each channel, discarding
-             * the first sample if that option is enabled; each byte in sampleBuffer[] is
-             * 1 of 2 bytes for each sample, the first byte being the LSB and the second
-             * byte the MSB, in other words, little-endian format; so for convenience we
-             * simply declare sampleBuffer[] to be of type 'unsigned short' and the data
-             * is already in the correct format; the device returns data only for the
-             * channels requested, from startChannel to endChannel; AIOUSB_GetScan()
-             * returns the averaged data readings in counts[], putting the reading for
-             * startChannel in counts[0], and the reading for endChannel in counts[numChannels-1]
-             */
-            result = AIOUSB_SUCCESS;
-            samplesToAverage = discardFirstSample ? samplesPerChannel - 1 : samplesPerChannel;
-            sampleIndex = 0;
-
-            for(int channel = 0; channel < numChannels; channel++) {
-                unsigned long sampleSum = 0;
-                if (discardFirstSample)
-                    sampleIndex++;                 /* skip over first sample */
-                int sample;
-                for(sample = 0; sample < samplesToAverage; sample++)
-                    sampleSum += sampleBuffer[ sampleIndex++ ];
-                counts[ channel ] = ( unsigned short )((sampleSum + samplesToAverage / 2) / samplesToAverage);
-            }
-        }
+    libusbresult = adc_get_bulk_data( &deviceDesc->cachedConfigBlock,
+                                      usb,
+                                      LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
+                                      ( unsigned char* )sampleBuffer, 
+                                      numSamples * sizeof(unsigned short), 
+                                      (int*)&bytesTransferred,
+                                      deviceDesc->commTimeout
+                                      );
+
+    if (libusbresult != LIBUSB_SUCCESS)
+        return -LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbresult);
+    else if (bytesTransferred != (int)(numSamples * sizeof(unsigned short)) )
+        return -AIOUSB_ERROR_INVALID_DATA;
+
+    return AIOUSB_SUCCESS;
+}
+
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Compute the average of all the samples taken for each channel,
+ * discarding the first sample if that option is enabled; each byte in
+ * sampleBuffer[] is 1 of 2 bytes for each sample, the first byte being the
+ * LSB and the second byte the MSB, in other words, little-endian format; so
+ * for convenience we simply declare sampleBuffer[] to be of type 'unsigned
+ * short' and the data is already in the correct format; the device returns
+ * data only for the channels requested, from startChannel to endChannel; the
+ * averaged readings go in counts[], putting the reading for startChannel in
+ * counts[0], and the reading for endChannel in counts[numChannels-1]
+ */
+static void AIOUSB_AverageImmediateScan( const AIOUSBImmediateScan *scan, const unsigned short *sampleBuffer, unsigned short counts[] )
+{
+    int samplesToAverage = scan->discardFirstSample ? scan->samplesPerChannel - 1 : scan->samplesPerChannel;
+    int sampleIndex = 0;
+
+    for(int channel = 0; channel < scan->numChannels; channel++) {
+        unsigned long sampleSum = 0;
+        if (scan->discardFirstSample)
+            sampleIndex++;                 /* skip over first sample */
+        int sample;
+        for(sample = 0; sample < samplesToAverage; sample++)
+            sampleSum += sampleBuffer[ sampleIndex++ ];
+        counts[ channel ] = ( unsigned short )((sampleSum + samplesToAverage / 2) / samplesToAverage);
     }
+}
 
-        
-    out_freebuf_AIOUSB_GetScan:
-        free(sampleBuffer);
-    
-    if (configChanged) {
-        deviceDesc->cachedConfigBlock = origConfigBlock;
-	USBDevicePutADCConfigBlock( usb, &deviceDesc->cachedConfigBlock );
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Performs a scan and averages the voltage values.
+ * @param DeviceIndex
+ * @param counts
+ * @return
+ * @note In theory, all the A/D functions, including AIOUSB_GetScan(), should work
+ * in all measurement modes, including calibration mode; in practice,
+ * however, the device will return only a single sample in calibration mode;
+ * therefore, users must be careful to select a single channel and set
+ * oversample to zero during calibration mode; attempting to read more than
+ * one channel or use an oversample setting of more than zero in calibration
+ * mode will result in a timeout error; as a convenience to the user we
+ * automatically impose this restriction here in AIOUSB_GetScan(); if the
+ * device is changed to permit normal use of the A/D functions in
+ * calibration mode, we will have to modify this function to somehow
+ * recognize which devices support that capability, or simply delete this
+ * restriction altogether and rely on the users' good judgment
+ *
+ * @note The oversample setting dictates how many samples to take _in addition_ to
+ * the primary sample; if oversample is zero, we take just one sample for
+ * each channel; if oversample is greater than zero then we average the
+ * primary sample and all of its over-samples; if the discardFirstSample
+ * setting is enabled, then we discard the primary sample, leaving just the
+ * over-samples; thus, if discardFirstSample is enabled, we must take at
+ * least one over-sample in order to have any data left; there's another
+ * complication: the device buffer is limited to a small number of samples,
+ * so we have to limit the number of over-samples to what the device buffer
+ * can accommodate, so the actual oversample setting depends on the number
+ * of channels being scanned; we also preserve and restore the original
+ * oversample setting specified by the user; since the user is expecting to
+ * average (1 + oversample) samples, then if discardFirstSample is enabled
+ * we simply always add one
+ */
+PRIVATE AIORET_TYPE AIOUSB_GetScan( unsigned long DeviceIndex, unsigned short counts[] )
+{
+    AIOUSBImmediateScan scan;
+    unsigned short *sampleBuffer;
+    AIORET_TYPE result = AIOUSB_SUCCESS;
+
+    AIO_ASSERT( counts );
+
+    AIOUSBDevice *deviceDesc =  AIODeviceTableGetDeviceAtIndex( DeviceIndex , (AIORESULT*)&result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex , (AIORESULT*)&result );
+
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_SUPPORTED , deviceDesc->bADCStream == AIOUSB_TRUE );
+
+    /* The scan rewrites cachedConfigBlock and puts it back at the end */
+    AIOUSBDeviceLock( deviceDesc );
+    result = AIOUSB_BeginImmediateScan( deviceDesc, usb, &scan );
+    if ( result != AIOUSB_SUCCESS )
+        goto out_AIOUSB_GetScan;
+
+    sampleBuffer = ( unsigned short* )malloc( scan.numChannels * scan.samplesPerChannel * sizeof(unsigned short) );
+    if (!sampleBuffer ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AIOUSB_GetScan;
     }
 
+    result = AIOUSB_AcquireImmediateScans( deviceDesc, usb, &scan, 1, sampleBuffer, NULL );
+    if ( result == AIOUSB_SUCCESS )
+        AIOUSB_AverageImmediateScan( &scan, sampleBuffer, counts );
+
+    free(sampleBuffer);
+
  out_AIOUSB_GetScan:
+    AIOUSB_EndImmediateScan( deviceDesc, usb, &scan );
+    AIOUSBDeviceUnlock( deviceDesc );
+
+    return result;
+}
+
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Takes several immediate scans with one acquisition block, which
+ * costs one config write, one block setup and one bulk read for all of them
+ * instead of one of each per ADC_GetScan() call. Every scan is averaged and
+ * culled exactly as ADC_GetScan() does it.
+ * @param DeviceIndex
+ * @param num_scans Number of scans wanted. The device buffer
+ * (DEVICE_SAMPLE_BUFFER_SIZE samples) bounds how many fit in one block, so
+ * fewer may be taken; the return value says how many.
+ * @param counts If not NULL, receives num_scans rows of averaged counts, one
+ * entry per channel from the start channel to the end channel
+ * @param volts If not NULL, receives the same rows converted to volts. At
+ * least one of counts and volts must be given.
+ * @param timestamps If not NULL, receives the CLOCK_MONOTONIC time at which
+ * each scan was triggered
+ * @return Number of scans taken, or a negative error
+ */
+AIORET_TYPE ADC_GetScansBatch( unsigned long DeviceIndex,
+                               unsigned num_scans,
+                               unsigned short *counts,
+                               double *volts,
+                               struct timespec *timestamps
+                               )
+{
+    AIOUSBImmediateScan scan;
+    AIORESULT res = AIOUSB_SUCCESS;
+    AIORET_TYPE result;
+    unsigned short *sampleBuffer = NULL, *scanCounts = counts;
+    unsigned samplesPerScan, startChannel;
+
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, num_scans > 0 );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, counts || volts );
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &res );
+    AIO_ERROR_VALID_DATA_RETVAL( (long)res, res == AIOUSB_SUCCESS );
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &res );
+    AIO_ERROR_VALID_DATA_RETVAL( (long)res, res == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_SUPPORTED, deviceDesc->bADCStream == AIOUSB_TRUE );
+
+    AIOUSBDeviceLock( deviceDesc );
+    startChannel = ADCConfigBlockGetStartChannel( &deviceDesc->cachedConfigBlock );
+
+    result = AIOUSB_BeginImmediateScan( deviceDesc, usb, &scan );
+    if ( result != AIOUSB_SUCCESS )
+        goto out_ADC_GetScansBatch;
+
+    samplesPerScan = scan.numChannels * scan.samplesPerChannel;
+    if ( num_scans > DEVICE_SAMPLE_BUFFER_SIZE / samplesPerScan )
+        num_scans = DEVICE_SAMPLE_BUFFER_SIZE / samplesPerScan;
+
+    sampleBuffer = ( unsigned short* )malloc( num_scans * samplesPerScan * sizeof(unsigned short) );
+    if ( !counts )
+        scanCounts = ( unsigned short* )malloc( num_scans * scan.numChannels * sizeof(unsigned short) );
+    if ( !sampleBuffer || !scanCounts ) {
+        result = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_ADC_GetScansBatch;
+    }
+
+    result = AIOUSB_AcquireImmediateScans( deviceDesc, usb, &scan, num_scans, sampleBuffer, timestamps );
+    if ( result != AIOUSB_SUCCESS )
+        goto out_ADC_GetScansBatch;
+
+    for ( unsigned i = 0; i < num_scans; i ++ )
+        AIOUSB_AverageImmediateScan( &scan, sampleBuffer + i * samplesPerScan, scanCounts + i * scan.numChannels );
+
+    /**
+     * The conversion plan follows the user's gain settings, so convert
+     * only after those are back in cachedConfigBlock
+     */
+    AIOUSB_EndImmediateScan( deviceDesc, usb, &scan );
+    scan.configChanged = AIOUSB_FALSE;
+
+    if ( volts ) {
+        AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( deviceDesc, &result );
+        if ( !plan )
+            goto out_ADC_GetScansBatch;
+        for ( unsigned i = 0; i < num_scans && result == AIOUSB_SUCCESS; i ++ )
+            result = AIOConversionPlanCountsToVolts( plan, startChannel, scan.numChannels,
+                                                     scanCounts + i * scan.numChannels,
+                                                     volts + i * scan.numChannels );
+        AIOUSBDeviceReleaseConversionPlan( deviceDesc, plan );
+        if ( result != AIOUSB_SUCCESS )
+            goto out_ADC_GetScansBatch;
+    }
+
+    result = num_scans;
+
+ out_ADC_GetScansBatch:
+    AIOUSB_EndImmediateScan( deviceDesc, usb, &scan );
+    AIOUSBDeviceUnlock( deviceDesc );
+    if ( scanCounts != counts )
+        free( scanCounts );
+    free( sampleBuffer );
 
     return result;
 }
@@ -561,11 +731,14 @@ PRIVATE unsigned long AIOUSB_ArrayCountsToVolts(
 
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
     if (result == AIOUSB_SUCCESS) {
-        for(int channel = 0; channel < numChannels; channel++) {
-            int gainCode = ADCConfigBlockGetGainCode( &deviceDesc->cachedConfigBlock , startChannel + channel );
-            const struct ADRange *const range = &adRanges[ gainCode ];
-            volts[ channel ] = ( (( double )counts[ channel ] / ( double )AI_16_MAX_COUNTS) * range->range ) + range->minVolts;
-        }
+        AIORET_TYPE retval;
+        AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( deviceDesc, &retval );
+        if ( !plan )
+            return (unsigned long)labs(retval);
+        retval = AIOConversionPlanCountsToVolts( plan, startChannel, numChannels, counts, volts );
+        AIOUSBDeviceReleaseConversionPlan( deviceDesc, plan );
+        if ( retval != AIOUSB_SUCCESS )
+            result = (AIORESULT)labs(retval);
     }
 
      return result;
@@ -691,11 +864,13 @@ AIORET_TYPE ADC_GetChannelV(unsigned long DeviceIndex, unsigned long ChannelInde
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
     AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
 
+    /**
+     * AIOUSB_GetScan() writes the narrowed scan range out together with the
+     * rest of its scan profile, so no separate write is needed here
+     */
     ADConfigBlock origConfigBlock = deviceDesc->cachedConfigBlock;
     AIOUSB_SetScanRange(&deviceDesc->cachedConfigBlock, ChannelIndex, ChannelIndex);
 
-    result = WriteConfigBlock(DeviceIndex);
-
     result = AIOUSB_GetScan(DeviceIndex, &counts);
 
     if (result >= AIOUSB_SUCCESS) {
@@ -708,11 +883,49 @@ AIORET_TYPE ADC_GetChannelV(unsigned long DeviceIndex, unsigned long ChannelInde
     }
 
     deviceDesc->cachedConfigBlock = origConfigBlock;
-    WriteConfigBlock(DeviceIndex);
+    if ( !deviceDesc->scanProfileResident )
+        WriteConfigBlock(DeviceIndex);
 
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Lets the configuration used by ADC_GetScan(), ADC_GetScanV() and
+ * ADC_GetChannelV() stay loaded on the device between calls. Repeated
+ * readings then need no config transfers at all; cachedConfigBlock still
+ * holds the user's settings and is written back by the next
+ * WriteConfigBlock() or when residency is turned off.
+ * @param DeviceIndex
+ * @param resident AIOUSB_TRUE to leave the scan profile on the device
+ * @return AIOUSB_SUCCESS or an error
+ */
+AIORET_TYPE ADC_SetScanProfileResident( unsigned long DeviceIndex, AIOUSB_BOOL resident )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_NOT_SUPPORTED, deviceDesc->bADCStream == AIOUSB_TRUE );
+
+    AIOUSB_BOOL was_resident = deviceDesc->scanProfileResident;
+    deviceDesc->scanProfileResident = resident;
+
+    if ( was_resident && !resident && deviceDesc->cachedConfigBlock.size )
+        result = WriteConfigBlock( DeviceIndex );
+
+    return result == AIOUSB_SUCCESS ? AIOUSB_SUCCESS : -(AIORET_TYPE)result;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE ADC_GetScanProfileResident( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( -(AIORET_TYPE)result, result == AIOUSB_SUCCESS );
+
+    return deviceDesc->scanProfileResident ? AIOUSB_TRUE : AIOUSB_FALSE;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Preferred way to get immediate scan readings. Will Scan all channels ( ie vectored ) 
@@ -1593,13 +1806,11 @@ unsigned long ADC_BulkAcquire(
         acquireParams->BufSize      = BufSize;
         acquireParams->pBuf         = pBuf;
 
-        struct sched_param schedParam = { sched_get_priority_max(SCHED_FIFO) };
-        pthread_attr_t workerThreadAttr;
         pthread_t workerThreadID;
 
-        pthread_attr_init(&workerThreadAttr);
-        pthread_attr_setschedpolicy(&workerThreadAttr, SCHED_FIFO);
-        pthread_attr_setschedparam(&workerThreadAttr, &schedParam);
+        /* Scheduling and affinity come from deviceDesc->bulkAcquirePolicy, applied by the worker */
+        if ( deviceDesc->bulkAcquirePolicy )
+            memset( &deviceDesc->bulkAcquirePolicy->report, 0, sizeof(deviceDesc->bulkAcquirePolicy->report) );
 
         int threadResult = pthread_create( &workerThreadID, NULL, BulkAcquireWorker, acquireParams );
 
@@ -1628,7 +1839,6 @@ unsigned long ADC_BulkAcquire(
             free(acquireParams);
             result = AIOUSB_ERROR_INVALID_THREAD;
         }
-        pthread_attr_destroy(&workerThreadAttr);
         pthread_detach(workerThreadID);
     } else {
         result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
@@ -1637,6 +1847,46 @@ unsigned long ADC_BulkAcquire(
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets the scheduling, CPU affinity and memory locking the
+ *        ADC_BulkAcquire() worker thread applies to itself when it starts
+ * @param DeviceIndex
+ * @param policy Policy to copy, or NULL to run the worker as created
+ * @return AIOUSB_SUCCESS or negative error
+ */
+AIORET_TYPE ADC_SetBulkAcquireThreadPolicy( unsigned long DeviceIndex, const AIOThreadPolicy *policy )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOThreadPolicy *tmp = NULL;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA_RETVAL( (long)result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_OPEN_FAILED, !deviceDesc->workerBusy );
+
+    if ( policy ) {
+        tmp = NewAIOThreadPolicyCopy( policy );
+        AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, tmp );
+    }
+    DeleteAIOThreadPolicy( deviceDesc->bulkAcquirePolicy );
+    deviceDesc->bulkAcquirePolicy = tmp;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief What the last ADC_BulkAcquire() worker got from its thread policy
+ * @return AIOUSB_SUCCESS, -AIOUSB_ERROR_INVALID_PARAMETER if no policy is
+ *         set or -AIOUSB_ERROR_INVALID_THREAD if no worker has applied it yet
+ */
+AIORET_TYPE ADC_GetBulkAcquireThreadPolicyReport( unsigned long DeviceIndex, AIOThreadPolicyReport *report )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA_RETVAL( (long)result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_PARAMETER, deviceDesc->bulkAcquirePolicy && report );
+    return AIOThreadPolicyGetReport( deviceDesc->bulkAcquirePolicy, report );
+}
+
 static void *startAcquire(void *params)
 {
     static AIORESULT result = AIOUSB_SUCCESS;
@@ -1651,15 +1901,6 @@ static void *startAcquire(void *params)
     return &result;
 }
 
-#define STREAMING_PNA_DEFINITIONS                                       \
-    struct timespec foo , bar;                                          \
-    unsigned deltas[16*8192];                                           \
-    unsigned transactions[16*8192];                                     \
-    int tindex = 0;                                                     \
-    int num_reads = 0;
-
-
-
 /*----------------------------------------------------------------------------*/
 /**
  * @brief we assume the parameters passed to BulkAcquireWorker() have
@@ -1683,16 +1924,15 @@ static void *BulkAcquireWorker(void *params)
     usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
     AIO_ERROR_VALID_DATA_W_CODE( &result, result = AIOUSB_ERROR_INVALID_USBDEVICE , usb );
 
+    if ( deviceDesc->bulkAcquirePolicy )
+        AIOThreadPolicyApply( deviceDesc->bulkAcquirePolicy );
 
     pthread_t startAcquireThread;
     unsigned long streamingBlockSize , bytesRemaining;
     int threadResult;
 
-#ifdef PNA_TESTING
-    STREAMING_PNA_DEFINITIONS;
-#endif
-
-    int bytesTransferred;
+    uint64_t started = 0, lastEnd = 0;
+    int bytesTransferred = 0;
     unsigned char *data;
 
     /* Needed to allow us to start bulk acquire waiting before we signal the board to start collecting data */
@@ -1710,16 +1950,11 @@ static void *BulkAcquireWorker(void *params)
 
     data = ( unsigned char* )acquireParams->pBuf;
 
-#ifdef PNA_TESTING
-    clock_gettime( CLOCK_MONOTONIC_RAW, &bar );
-#endif
-
     while(bytesRemaining > 0) {
         unsigned long bytesToTransfer = (bytesRemaining < streamingBlockSize) ? bytesRemaining : streamingBlockSize;
-#ifdef PNA_TESTING
-        clock_gettime( CLOCK_MONOTONIC_RAW, &foo );
-        deltas[num_reads++] =  ( foo.tv_sec - bar.tv_sec )*1e9 + (foo.tv_nsec - bar.tv_nsec );
-#endif
+        AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( deviceDesc, AIO_TRANSFER_BULK_ACQUIRE );
+        if ( hists )
+            started = AIOTransferTimestamp();
 
         libusbResult = usb->usb_bulk_transfer(usb,
                                               LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
@@ -1729,11 +1964,8 @@ static void *BulkAcquireWorker(void *params)
                                               4000
                                               );
 
-#ifdef PNA_TESTING
-        clock_gettime( CLOCK_MONOTONIC_RAW, &bar );
-        transactions[tindex++] = bytesTransferred;
-        deltas[num_reads++] = ( bar.tv_sec - foo.tv_sec )*1e9 + (bar.tv_nsec - foo.tv_nsec);
-#endif
+        if ( hists )
+            AIOTransferHistogramsRecord( hists, started, AIOTransferTimestamp(), bytesTransferred, -1, &lastEnd );
         if (libusbResult != LIBUSB_SUCCESS) {
             result = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbResult);
             break;
@@ -1743,23 +1975,6 @@ static void *BulkAcquireWorker(void *params)
             deviceDesc->workerStatus = bytesRemaining;
         }
     }
-#ifdef PNA_TESTING
-    FILE *fp = fopen("delays.dat","w");
-    FILE *fp2 = fopen("data.dat","w");
-    if ( !fp || !fp2 ) {
-        printf("Can't open file delays.dat for writing");
-    } else {
-        for(int i= 0; i < num_reads ; i ++ ) {
-            fprintf(fp,"%u\n", deltas[i] );
-
-        }
-        for ( int i = 0 ; i < tindex ; i ++ ) {
-            fprintf(fp2,"%u\n", transactions[i] );
-        }
-        fclose(fp2);
-        fclose(fp);
-    }
-#endif
     
  out_BulkAcquireWorker:
     deviceDesc->workerStatus = 0;
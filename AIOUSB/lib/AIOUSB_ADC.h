@@ -5,6 +5,8 @@
 #include "AIOBuf.h"
 #include "ADCConfigBlock.h"
 #include "USBDevice.h"
+#include "AIOThreadPolicy.h"
+#include <time.h>
 
 #ifdef __aiousb_cplusplus
 namespace AIOUSB
@@ -17,6 +19,9 @@ namespace AIOUSB
 PUBLIC_EXTERN AIORET_TYPE ADC_GetScanV( unsigned long DeviceIndex, double *voltages );
 PUBLIC_EXTERN AIORESULT ADC_RangeAll( unsigned long DeviceIndex, unsigned char *pGainCodes, unsigned long bSingleEnded );
 PUBLIC_EXTERN AIORET_TYPE ADC_GetChannelV( unsigned long DeviceIndex, unsigned long ChannelIndex, double *singlevoltage );
+PUBLIC_EXTERN AIORET_TYPE ADC_SetScanProfileResident( unsigned long DeviceIndex, AIOUSB_BOOL resident );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetScanProfileResident( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetScansBatch( unsigned long DeviceIndex, unsigned num_scans, unsigned short *counts, double *volts, struct timespec *timestamps );
 
     
 PUBLIC_EXTERN AIORET_TYPE ADC_GetScan( unsigned long DeviceIndex, unsigned short *pBuf );
@@ -34,6 +39,8 @@ PUBLIC_EXTERN AIORESULT ADC_QueryCal( unsigned long DeviceIndex );
 PUBLIC_EXTERN AIOUSB_BOOL ADC_CanCalibrate( unsigned long ProductID );
 PUBLIC_EXTERN AIORESULT ADC_Initialize( unsigned long DeviceIndex, unsigned char *pConfigBuf, unsigned long *ConfigBufSize,     const char *CalFileName );
 PUBLIC_EXTERN AIORESULT ADC_BulkAcquire( unsigned long DeviceIndex, unsigned long BufSize, void *pBuf );
+PUBLIC_EXTERN AIORET_TYPE ADC_SetBulkAcquireThreadPolicy( unsigned long DeviceIndex, const AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetBulkAcquireThreadPolicyReport( unsigned long DeviceIndex, AIOThreadPolicyReport *report );
 PUBLIC_EXTERN AIORESULT ADC_BulkPoll( unsigned long DeviceIndex, unsigned long *BytesLeft     );
 
 /* FastScan Functions */
@@ -20,7 +20,6 @@ namespace AIOUSB {
         if( !d )                                                        \
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_INDEX;            \
         if( ( r = f ) != AIOUSB_SUCCESS ) {                             \
-            AIOUSB_UnLock();                                            \
             return r;                                                   \
         }                                                               \
     } while (0)
@@ -55,12 +54,10 @@ AIORET_TYPE _check_block_index(AIOUSBDevice *deviceDesc, unsigned long BlockInde
         BlockIndex = CounterIndex / COUNTERS_PER_BLOCK;
         CounterIndex = CounterIndex % COUNTERS_PER_BLOCK;
         if (BlockIndex >= deviceDesc->Counters) {
-            AIOUSB_UnLock();
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_PARAMETER;
         }
     } else {
         if ( BlockIndex >= deviceDesc->Counters || CounterIndex >= COUNTERS_PER_BLOCK ) {
-            AIOUSB_UnLock();
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_PARAMETER;
         }
     }
@@ -178,7 +175,6 @@ AIORET_TYPE CTR_8254Mode(
         goto out_CTR_8254Mode;
     }
 
-    AIOUSB_UnLock();
     controlValue = (( unsigned short )CounterIndex << (6 + 8))  | (0x3u << (4 + 8))  | 
                    (( unsigned short )Mode << (1 + 8))          | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -194,7 +190,6 @@ AIORET_TYPE CTR_8254Mode(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Mode:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -233,7 +228,6 @@ AIORET_TYPE CTR_8254Load(
         goto out_CTR_8254Load;
     }
 
-    AIOUSB_UnLock();
     controlValue = (( unsigned short )CounterIndex << (6 + 8)) | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
@@ -248,7 +242,6 @@ AIORET_TYPE CTR_8254Load(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Load:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -277,7 +270,6 @@ AIORET_TYPE CTR_8254ModeLoad(
         goto out_CTR_8254ModeLoad;
     }
 
-    AIOUSB_UnLock();
     controlValue    = (( unsigned short )CounterIndex << (6 + 8))    | (0x3u << (4 + 8))  | 
                       (( unsigned short )Mode << (1 + 8))  | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer( usb,
@@ -293,7 +285,6 @@ AIORET_TYPE CTR_8254ModeLoad(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ModeLoad:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -316,7 +307,6 @@ AIORET_TYPE CTR_8254ReadModeLoad(
 
     JUMP_IF_NO_VALID_USB( deviceDesc , retval, _check_valid_input_for_modeload( deviceDesc, BlockIndex, CounterIndex, Mode, LoadValue, pReadValue), usb, out_CTR_8254ReadModeLoad );
 
-    AIOUSB_UnLock();
 
     controlValue = (( unsigned short )CounterIndex << (6 + 8)) |  (0x3u << (4 + 8)) | 
                    (( unsigned short )Mode << (1 + 8))         |  ( unsigned short )BlockIndex;
@@ -337,7 +327,6 @@ AIORET_TYPE CTR_8254ReadModeLoad(
         result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254ReadModeLoad:
-    AIOUSB_UnLock();
     return retval;
 }
 
@@ -359,7 +348,6 @@ AIORET_TYPE CTR_8254Read(
 
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_valid_counter_device( deviceDesc, BlockIndex, CounterIndex ), usb, out_CTR_8254Read );
 
-    AIOUSB_UnLock();
 
     controlValue = (( unsigned short )CounterIndex << 8) | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -378,7 +366,6 @@ AIORET_TYPE CTR_8254Read(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Read:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -397,7 +384,6 @@ AIORET_TYPE CTR_8254ReadAll(
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_valid_counter_device_for_read( deviceDesc, pData ) , usb, out_CTR_8254ReadAll);
 
     READ_BYTES = deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short);
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_CTR_READALL,
@@ -411,7 +397,6 @@ AIORET_TYPE CTR_8254ReadAll(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ReadAll:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -434,7 +419,6 @@ AIORET_TYPE CTR_8254ReadStatus(
 
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_block_index( deviceDesc, BlockIndex, CounterIndex ), usb, out_CTR_8254ReadStatus );  
 
-    AIOUSB_UnLock();
 
     controlValue = (( unsigned short )CounterIndex << 8) | ( unsigned short )BlockIndex;
 
@@ -454,7 +438,6 @@ AIORET_TYPE CTR_8254ReadStatus(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254ReadStatus:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -538,7 +521,6 @@ AIORET_TYPE CTR_StartOutputFreq(unsigned long DeviceIndex, unsigned long BlockIn
 
     if (*pHz <= 0) {
                                 /* turn off counters */
-          AIOUSB_UnLock();
           result = CTR_8254Mode(DeviceIndex, BlockIndex, 1, 2);
           if (result != AIOUSB_SUCCESS)
               return result;
@@ -548,7 +530,6 @@ AIORET_TYPE CTR_StartOutputFreq(unsigned long DeviceIndex, unsigned long BlockIn
           *pHz = 0;                                                                   /* actual clock speed*/
       } else {
            long rootClock = deviceDesc->RootClock;
-          AIOUSB_UnLock();
            long frequency = ( long )*pHz;
            long MIN_DIVISOR = 2;
            long MAX_DIVISOR = 65535;
@@ -621,7 +602,6 @@ AIORET_TYPE CTR_8254SelectGate(
     JUMP_IF_NO_VALID_USB( deviceDesc, result, _check_valid_counter_device_for_gate(deviceDesc, GateIndex ), usb, out_CTR_8254SelectGate );
 
     
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
                                                  AUR_CTR_SELGATE,
@@ -635,7 +615,6 @@ AIORET_TYPE CTR_8254SelectGate(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254SelectGate:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -656,7 +635,6 @@ AIORET_TYPE CTR_8254ReadLatched(
     
     READ_BYTES = deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short) + 1 ;/* for "old data" flag */
     
-    AIOUSB_UnLock();
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_CTR_READLATCHED,
@@ -670,7 +648,6 @@ AIORET_TYPE CTR_8254ReadLatched(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ReadLatched:
-    AIOUSB_UnLock();
     return retval;
 }
 
@@ -160,6 +160,16 @@ ProductIDName productIDNameTable[] = {
 
 #if defined(AIOUSB_ENABLE_MUTEX)
 static pthread_mutex_t aiousbMutex;
+static pthread_once_t aiousbMutexOnce = PTHREAD_ONCE_INIT;
+
+static void _AIOUSB_InitMutex( void )
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( &aiousbMutex, &attr );
+    pthread_mutexattr_destroy( &attr );
+}
 #endif
 
 
@@ -167,31 +177,30 @@ static pthread_mutex_t aiousbMutex;
 /**
  * @brief
  * Notes on mutual exclusion / threading:
- * - Our mutual exclusion scheme is _not_ intended to be bulletproof. It's primarily intended
- *   to ensure mutually exclusive access to deviceTable[] and other global variables. It does
- *   NOT ensure mutually exclusive access to the USB bus. In fact, we want to permit threads
- *   to communicate with multiple devices simultaneously, to the extent possible with USB.
+ * - Each AIOUSBDevice has its own recursive lock, AIOUSBDeviceLock(). The immediate
+ *   calls that change what the library caches about a device (DIO outputs, ADC
+ *   configuration) hold it for the whole call, so threads driving different devices
+ *   never wait on each other, and threads sharing one device do not interleave
+ *   inside a call.
  *
- * - Nor does this scheme prevent multiple threads from altering the configuration of the same
- *   device or communicating with the same device. In other words, it's entirely possible for
- *   one thread to configure and communicate with a device, only to have another thread come
- *   along and to the same. It's up to the users of this library to ensure that such a scenario
- *   doesn't occur.
+ * - deviceTable[] itself is guarded by a read/write lock, see AIODeviceTableLockRead()
+ *   and AIODeviceTableLockWrite(). Lookups take it for reading, while enumeration,
+ *   AIOUSB_Exit() and hotplug events take it for writing. The lock order is documented
+ *   at AIODeviceTableLockWrite().
  *
- * - This library does seek to permit one thread to control one device, and another thread to
- *   control another device. Each thread may then safely communicate with its own device and
- *   alter the portion of deviceTable[] that pertains to its device.
+ * - None of this makes a sequence of calls atomic. Two threads configuring the same device
+ *   can still undo each other's settings between calls; it's up to the users of this
+ *   library to ensure that such a scenario doesn't occur, either by giving each device to
+ *   one thread or by holding AIOUSBDeviceLock() across the sequence.
  *
- * - Our mutual exclusion scheme also permits two threads to cooperate in the operation of a
- *   single device, such as in cases where a background thread does the actual work and the
- *   foreground thread monitors the progress. In such a case, the background thread might update
- *   a status variable which the foreground thread monitors. This form of resource sharing is
- *   supported by our mutual exclusion scheme.
+ * - AIOUSB_Lock() and AIOUSB_UnLock() remain for programs that used them to serialize
+ *   their own code. The library no longer takes that process wide lock itself.
  */
 
 AIOUSB_BOOL AIOUSB_Lock() {
     assert(AIOUSB_IsInit());
 #if defined(AIOUSB_ENABLE_MUTEX)
+    pthread_once( &aiousbMutexOnce, _AIOUSB_InitMutex );
     return(pthread_mutex_lock(&aiousbMutex) == 0);
 #else
     return AIOUSB_TRUE;
@@ -201,6 +210,7 @@ AIOUSB_BOOL AIOUSB_Lock() {
 AIOUSB_BOOL AIOUSB_UnLock() {
     assert(AIOUSB_IsInit());
 #if defined(AIOUSB_ENABLE_MUTEX)
+    pthread_once( &aiousbMutexOnce, _AIOUSB_InitMutex );
     return(pthread_mutex_unlock(&aiousbMutex) == 0);
 #else
     return AIOUSB_TRUE;
@@ -355,7 +365,6 @@ DeviceDescriptor *DeviceTableAtIndex( unsigned long DeviceIndex ) {
 
 /*------------------------------------------------------------------------*/
 /**
- * @todo Replace AIOUSB_Lock() with thread safe lock on a per device index basis
  * @todo Insert correct error messages into global error string in case of failure
  */
 DeviceDescriptor *DeviceTableAtIndex_Lock( unsigned long DeviceIndex ) 
@@ -764,6 +773,8 @@ unsigned long GenericVendorWrite(
     if (bytesTransferred != (int)*bytes_written) {
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     }
+    if ( Request == AUR_ADC_SET_CONFIG )
+        USBDeviceInvalidateADCConfigCache( usb );
 
     return result;
 }
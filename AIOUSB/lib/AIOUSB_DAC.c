@@ -6,6 +6,7 @@
  * @brief Core code to handle DACs on AIOUSB devices.
  */
 
+#include "AIOUSB_DAC.h"
 #include "AIOUSB_Core.h"
 #include "AIODeviceTable.h"
 #include <math.h>
@@ -28,18 +29,22 @@ unsigned long DACDirect(unsigned long DeviceIndex,unsigned short Channel,unsigne
         return AIOUSB_ERROR_NOT_SUPPORTED;
     }
 
-    if ( deviceDesc->bDACStream && (deviceDesc->bDACOpen || deviceDesc->bDACClosing )) {
-        return AIOUSB_ERROR_OPEN_FAILED;
-    }
-
     if (Channel >= deviceDesc->ImmDACs) {
         return AIOUSB_ERROR_INVALID_PARAMETER;
     }
+
+    /* Held across the transfer so DACOutputOpen() cannot start a stream in between */
+    AIOUSBDeviceLock( deviceDesc );
+    if ( deviceDesc->bDACStream && (deviceDesc->bDACOpen || deviceDesc->bDACClosing )) {
+        AIOUSBDeviceUnlock( deviceDesc );
+        return AIOUSB_ERROR_OPEN_FAILED;
+    }
     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
-    if ( result != AIOUSB_SUCCESS ) 
+    if ( result != AIOUSB_SUCCESS ) {
+        AIOUSBDeviceUnlock( deviceDesc );
         return result;
-    
-    
+    }
+
     int bytesTransferred = usb->usb_control_transfer(usb, 
                                                      USB_WRITE_TO_DEVICE, 
                                                      AUR_DAC_IMMEDIATE,
@@ -49,6 +54,7 @@ unsigned long DACDirect(unsigned long DeviceIndex,unsigned short Channel,unsigne
                                                      0, /* wLength */
                                                      deviceDesc->commTimeout
                                                      );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != 0)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
@@ -139,16 +145,6 @@ unsigned long DACMultiDirect( unsigned long DeviceIndex,
 
     AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_SUPPORTED, deviceDesc->ImmDACs );
-    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_OPEN_FAILED, 
-                          !(
-                            ( deviceDesc->bDACDIOStream || deviceDesc->bDACSlowWaveStream || deviceDesc->bDACStream ) && 
-                            ( deviceDesc->bDACOpen || deviceDesc->bDACClosing )
-                            )
-                          );
-
-                          
-    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
-    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
 
     /**
      * determine highest channel number addressed in pDACData; no checking is
@@ -186,17 +182,26 @@ unsigned long DACMultiDirect( unsigned long DeviceIndex,
         *( unsigned short* )&configBuffer[ countOffset ] = pDACData[ index * 2 + 1 ];
     }
 
-    int bytesTransferred = usb->usb_control_transfer(usb,
-                                                     USB_WRITE_TO_DEVICE, 
-                                                     AUR_DAC_IMMEDIATE,
-                                                     0, 
-                                                     0, 
-                                                     configBuffer, 
-                                                     configBytes, 
-                                                     deviceDesc->commTimeout
-                                                     );
-    if (bytesTransferred != configBytes)
-        result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+    /* Held across the transfer so DACOutputOpen() cannot start a stream in between */
+    AIOUSBDeviceLock( deviceDesc );
+    USBDevice *usb = NULL;
+    if ( ( deviceDesc->bDACDIOStream || deviceDesc->bDACSlowWaveStream || deviceDesc->bDACStream ) &&
+         ( deviceDesc->bDACOpen || deviceDesc->bDACClosing ) ) {
+        result = AIOUSB_ERROR_OPEN_FAILED;
+    } else if ( ( usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result ) ) != NULL ) {
+        int bytesTransferred = usb->usb_control_transfer(usb,
+                                                         USB_WRITE_TO_DEVICE, 
+                                                         AUR_DAC_IMMEDIATE,
+                                                         0, 
+                                                         0, 
+                                                         configBuffer, 
+                                                         configBytes, 
+                                                         deviceDesc->commTimeout
+                                                         );
+        if (bytesTransferred != configBytes)
+            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+    }
+    AIOUSBDeviceUnlock( deviceDesc );
         
     free(configBuffer);
 
@@ -226,7 +231,7 @@ unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode
     if (deviceDesc->bDACBoardRange == AIOUSB_FALSE)
         return AIOUSB_ERROR_NOT_SUPPORTED;
 
-      
+    AIOUSBDeviceLock( deviceDesc );
     int bytesTransferred = usb->usb_control_transfer(usb,
                                                      USB_WRITE_TO_DEVICE, 
                                                      AUR_DAC_RANGE,
@@ -236,6 +241,7 @@ unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode
                                                      0 /* wLength */, 
                                                      deviceDesc->commTimeout
                                                      );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != 0)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
         
@@ -245,77 +251,915 @@ unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode
 
 
 /*----------------------------------------------------------------------------*/
-unsigned long DACOutputOpen(unsigned long DeviceIndex,double *pClockHz) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+/**
+ * @brief Streaming output on the boards with bDACStream set. Frames are
+ * queued by DACOutputFrame() into a ring of DAC_FRAME_SLOTS slots and a
+ * thread started by DACOutputStart() keeps the bulk out endpoint fed from
+ * it. Once the queue is empty the thread repeats the last frame it sent,
+ * so a single frame plays as a continuous waveform and the caller can
+ * queue the next one without the output stalling. With the interlock set
+ * every frame is played once instead.
+ *
+ * bDACOpen, bDACClosing and bDACStarted change under AIOUSBDeviceLock.
+ * hDACDataSem counts the free slots of the ring and hDACDataMutex guards
+ * DACData, DACDataHead, DACDataQueued, DACDataWaiters and bDACFinished.
+ *
+ * The frame words follow the FrameData bit fields of DACOutputFrameRaw() in
+ * doc/AIOUSB_API_Reference.html. How the board's stream clock is programmed
+ * and how streaming is started and stopped is not documented there, so the
+ * control requests come from the table installed with
+ * DACOutputSetStreamRequests(), and streaming fails with
+ * AIOUSB_ERROR_NOT_SUPPORTED until there is one.
+ */
+#define DAC_FRAME_SLOTS         4
+#define DAC_MIN_DIVISOR         2
+#define DAC_COUNT_MASK          0x0FFF
+#define DAC_LOOP                0x1000  /* Jump back to the start of the board's buffer */
+#define DAC_EOD                 0x2000  /* Last DAC of a point, the next word goes to the first DAC */
+#define DAC_EOF                 0x4000  /* Pulse the frame pin */
+#define DAC_EOM                 0x8000  /* Stop after this word */
+
+static const DACStreamRequests *dac_stream_requests = NULL;
+
+typedef struct dac_worker_args {
+    AIOUSBDevice *device;
+    USBDevice *usb;
+} DACWorkerArgs;
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Installs the vendor requests DACOutputOpen(), DACOutputStart() and
+ * DACOutputClose() use to drive the stream, or removes them with NULL.
+ * Streams already open keep the table they were opened with, so the table
+ * must stay valid until they are closed.
+ * @return AIOUSB_SUCCESS, or AIOUSB_ERROR_INVALID_PARAMETER if a request is
+ * missing
+ */
+unsigned long DACOutputSetStreamRequests( const DACStreamRequests *requests )
+{
+    if ( requests && ( !requests->set_clock || !requests->start || !requests->stop ) )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    __atomic_store_n( &dac_stream_requests, requests, __ATOMIC_RELEASE );
+    return AIOUSB_SUCCESS;
+}
+
+static void _dac_idle( void )
+{
+    struct timespec ts = { 0, 1000000 };
+    nanosleep( &ts, NULL );
+}
+
+static void _dac_free_frames( AIOUSBDevice *device )
+{
+    unsigned slot;
+    if ( device->DACData ) {
+        for ( slot = 0; slot < DAC_FRAME_SLOTS; slot ++ )
+            free( device->DACData[slot] );
+        free( device->DACData );
+    }
+    free( device->DACDataBytes );
+    free( device->PendingDACData );
+    device->DACData = NULL;
+    device->DACDataBytes = NULL;
+    device->PendingDACData = NULL;
+    device->PendingDACDataBytes = 0;
+    device->DACDataHead = device->DACDataQueued = 0;
+}
+
+/**
+ * @brief Takes the oldest queued frame as the one to send, freeing its
+ * slot. Returns AIOUSB_FALSE if nothing is queued.
+ */
+static AIOUSB_BOOL _dac_next_frame( AIOUSBDevice *device )
+{
+    AIOUSB_BOOL found = AIOUSB_FALSE;
+    pthread_mutex_lock( &device->hDACDataMutex );
+    if ( device->DACDataQueued ) {
+        free( device->PendingDACData );
+        device->PendingDACData = device->DACData[device->DACDataHead];
+        device->PendingDACDataBytes = device->DACDataBytes[device->DACDataHead];
+        device->DACData[device->DACDataHead] = NULL;
+        device->DACDataHead = ( device->DACDataHead + 1 ) % DAC_FRAME_SLOTS;
+        device->DACDataQueued --;
+        found = AIOUSB_TRUE;
+    }
+    pthread_mutex_unlock( &device->hDACDataMutex );
+    if ( found )
+        sem_post( &device->hDACDataSem );
+    return found;
 }
 
+/**
+ * @brief Stops the ring taking frames, unless drained is set and frames are
+ * still queued, and wakes every DACOutputFrame() waiting for a slot, which
+ * then gives up. Returns AIOUSB_TRUE once stopped.
+ */
+static AIOUSB_BOOL _dac_finish( AIOUSBDevice *device, AIOUSB_BOOL drained )
+{
+    unsigned waiters = 0;
+    AIOUSB_BOOL finished = AIOUSB_FALSE;
+    pthread_mutex_lock( &device->hDACDataMutex );
+    if ( !drained || device->DACDataQueued == 0 ) {
+        device->bDACFinished = finished = AIOUSB_TRUE;
+        waiters = device->DACDataWaiters;
+    }
+    pthread_mutex_unlock( &device->hDACDataMutex );
+    while ( waiters -- )
+        sem_post( &device->hDACDataSem );
+    return finished;
+}
+
+static unsigned long _dac_send_frame( AIOUSBDevice *device, USBDevice *usb )
+{
+    int bytes = 0;
+    int libusbResult = usb->usb_bulk_transfer( usb,
+                                               LIBUSB_ENDPOINT_OUT | USB_BULK_WRITE_ENDPOINT,
+                                               device->PendingDACData,
+                                               ( int )device->PendingDACDataBytes,
+                                               &bytes,
+                                               device->commTimeout
+                                               );
+    if ( libusbResult != LIBUSB_SUCCESS )
+        return LIBUSB_RESULT_TO_AIOUSB_RESULT( libusbResult );
+    if ( bytes != ( int )device->PendingDACDataBytes )
+        return AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+    return AIOUSB_SUCCESS;
+}
+
+/**
+ * @brief Feeds the board from the ring. Uses the USBDevice DACOutputStart()
+ * checked rather than looking the board up again, so a board replaced or
+ * closed meanwhile does not change what it writes to.
+ */
+static void *_dac_output_worker( void *object )
+{
+    DACWorkerArgs *args = (DACWorkerArgs *)object;
+    AIOUSBDevice *device = args->device;
+    USBDevice *usb = args->usb;
+    unsigned long result = AIOUSB_SUCCESS;
+    free( args );
+
+    while ( !device->bDACAborting ) {
+        if ( _dac_next_frame( device ) ) {
+            if ( ( result = _dac_send_frame( device, usb ) ) != AIOUSB_SUCCESS )
+                break;
+        } else if ( device->bDACClosing ) {
+            if ( _dac_finish( device, AIOUSB_TRUE ) )
+                return NULL;
+        } else if ( !device->bDACInterlock && device->PendingDACData ) {
+            if ( ( result = _dac_send_frame( device, usb ) ) != AIOUSB_SUCCESS )
+                break;
+        } else {
+            _dac_idle();
+        }
+    }
+
+    device->DACResult = result;
+    _dac_finish( device, AIOUSB_FALSE );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Prepares a streaming DAC board for DACOutputFrame(). pClockHz is the
+ * rate points are played at and is set to the nearest rate the board can
+ * actually generate. Returns AIOUSB_ERROR_NOT_SUPPORTED until
+ * DACOutputSetStreamRequests() has installed the board's requests.
+ */
+unsigned long DACOutputOpen(unsigned long DeviceIndex,double *pClockHz) {
+    AIO_ASSERT( pClockHz );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    const DACStreamRequests *requests = __atomic_load_n( &dac_stream_requests, __ATOMIC_ACQUIRE );
+    if ( !device->bDACStream || !requests )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+    if ( *pClockHz <= 0 || device->RootClock == 0 )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    AIOUSBDeviceLock( device );
+    if ( device->bDACOpen || device->bDACClosing ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_OPEN_FAILED;
+    }
+
+    double divisor = floor( device->RootClock / *pClockHz + 0.5 );
+    if ( divisor < DAC_MIN_DIVISOR )
+        divisor = DAC_MIN_DIVISOR;
+    if ( divisor > 0xFFFFFFFFu )
+        divisor = 0xFFFFFFFFu;
+    unsigned long counts = ( unsigned long )divisor;
+
+    device->DACData = ( unsigned char ** )calloc( DAC_FRAME_SLOTS, sizeof(unsigned char *) );
+    device->DACDataBytes = ( unsigned long * )calloc( DAC_FRAME_SLOTS, sizeof(unsigned long) );
+    if ( !device->DACData || !device->DACDataBytes ) {
+        _dac_free_frames( device );
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    if ( ( result = requests->stop( device, usb, AIOUSB_TRUE ) ) != AIOUSB_SUCCESS ||
+         ( result = requests->set_clock( device, usb, counts ) ) != AIOUSB_SUCCESS ) {
+        _dac_free_frames( device );
+        AIOUSBDeviceUnlock( device );
+        return result;
+    }
+
+    pthread_mutex_init( &device->hDACDataMutex, NULL );
+    sem_init( &device->hDACDataSem, 0, DAC_FRAME_SLOTS );
+    device->DACRequests = requests;
+    device->DACResult = AIOUSB_SUCCESS;
+    device->DACDataWaiters = 0;
+    device->bDACInterlock = AIOUSB_FALSE;
+    device->bDACAborting = device->bDACClosing = device->bDACStarted = device->bDACFinished = AIOUSB_FALSE;
+    device->bDACOpen = AIOUSB_TRUE;
+    AIOUSBDeviceUnlock( device );
+    *pClockHz = ( double )device->RootClock / counts;
+
+    return AIOUSB_SUCCESS;
+}
 
 /*----------------------------------------------------------------------------*/
+static unsigned long _dac_output_close( unsigned long DeviceIndex, unsigned long bWait, AIOUSB_BOOL reset )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    AIOUSBDeviceLock( device );
+    if ( !device->bDACOpen || device->bDACClosing ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_OPEN_FAILED;
+    }
+
+    if ( !bWait )
+        device->bDACAborting = AIOUSB_TRUE;
+    device->bDACClosing = AIOUSB_TRUE;
+    AIOUSB_BOOL started = device->bDACStarted;
+    AIOUSBDeviceUnlock( device );
+
+    if ( started ) {
+        pthread_join( device->DACThread, NULL );
+        result = device->DACResult;
+    } else {
+        _dac_finish( device, AIOUSB_FALSE );
+    }
+
+    /* Callers woken by _dac_finish() still use the semaphore and mutex */
+    for ( ;; ) {
+        pthread_mutex_lock( &device->hDACDataMutex );
+        unsigned waiters = device->DACDataWaiters;
+        pthread_mutex_unlock( &device->hDACDataMutex );
+        if ( !waiters )
+            break;
+        _dac_idle();
+    }
+
+    AIORESULT usbResult = AIOUSB_SUCCESS;
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &usbResult );
+    if ( usbResult == AIOUSB_SUCCESS ) {
+        unsigned long stopped = device->DACRequests->stop( device, usb, reset );
+        if ( result == AIOUSB_SUCCESS )
+            result = stopped;
+    }
+
+    _dac_free_frames( device );
+    sem_destroy( &device->hDACDataSem );
+    pthread_mutex_destroy( &device->hDACDataMutex );
+    AIOUSBDeviceLock( device );
+    device->DACRequests = NULL;
+    device->bDACOpen = device->bDACClosing = device->bDACAborting = device->bDACStarted = AIOUSB_FALSE;
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
+/**
+ * @brief Stops streaming and returns the DAC outputs to their reset state.
+ * With bWait every queued frame is played first, otherwise output stops at
+ * the end of the frame being sent.
+ */
 unsigned long DACOutputClose(unsigned long DeviceIndex,unsigned long bWait) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    return _dac_output_close( DeviceIndex, bWait, AIOUSB_TRUE );
 }
 
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief As DACOutputClose() but the outputs are left at the last point played
+ */
 unsigned long DACOutputCloseNoEnd( unsigned long DeviceIndex, unsigned long bWait ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    return _dac_output_close( DeviceIndex, bWait, AIOUSB_FALSE );
 }
 
 
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets how many DACs each point of a frame holds counts for, which
+ * may only be changed before DACOutputStart()
+ */
 unsigned long DACOutputSetCount(unsigned long DeviceIndex, unsigned long NewCount) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !device->bDACStream )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+    if ( NewCount < 1 || NewCount > device->ImmDACs )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    AIOUSBDeviceLock( device );
+    if ( device->bDACStarted )
+        result = AIOUSB_ERROR_OPEN_FAILED;
+    else
+        device->DACsUsed = NewCount;
+    AIOUSBDeviceUnlock( device );
+    return result;
 } 
 
 
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues a frame of FramePoints * DACsUsed words. Before
+ * DACOutputStart() a full ring is an error; once streaming the call waits
+ * for the thread to free a slot, and fails if the thread stops first.
+ */
+static unsigned long _dac_queue_frame( unsigned long DeviceIndex,
+                                       unsigned long FramePoints,
+                                       unsigned short *FrameData,
+                                       AIOUSB_BOOL raw
+                                       )
+{
+    AIO_ASSERT( FrameData );
+
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !device->bDACStream )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+    if ( FramePoints == 0 )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    /* Counted as a waiter under the device lock so DACOutputClose() can't
+     * tear the ring down until this call is done with it */
+    AIOUSBDeviceLock( device );
+    if ( !device->bDACOpen || device->bDACClosing ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_OPEN_FAILED;
+    }
+    unsigned long dacs = device->DACsUsed;
+    AIOUSB_BOOL started = device->bDACStarted;
+    pthread_mutex_lock( &device->hDACDataMutex );
+    if ( device->bDACFinished )
+        result = ( device->DACResult != AIOUSB_SUCCESS ? device->DACResult : AIOUSB_ERROR_OPEN_FAILED );
+    else
+        device->DACDataWaiters ++;
+    pthread_mutex_unlock( &device->hDACDataMutex );
+    AIOUSBDeviceUnlock( device );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    unsigned long words = FramePoints * dacs;
+    unsigned long bytes = words * sizeof(unsigned short);
+    unsigned char *frame = NULL;
+    unsigned long word;
+
+    if ( dacs == 0 ) {
+        result = AIOUSB_ERROR_INVALID_PARAMETER;
+        goto out;
+    }
+    if ( !( frame = ( unsigned char * )malloc( bytes ) ) ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out;
+    }
+
+    for ( word = 0; word < words; word ++ ) {
+        unsigned short value = FrameData[word];
+        if ( !raw ) {
+            if ( value & ~DAC_COUNT_MASK ) {
+                result = AIOUSB_ERROR_INVALID_PARAMETER;
+                goto out;
+            }
+            if ( word % dacs == dacs - 1 )
+                value |= DAC_EOD;
+            if ( word == words - 1 )
+                value |= DAC_EOF;
+        }
+        frame[2 * word] = ( unsigned char )( value & 0xFF );
+        frame[2 * word + 1] = ( unsigned char )( value >> 8 );
+    }
+
+    if ( started ) {
+        while ( sem_wait( &device->hDACDataSem ) != 0 )
+            ;
+    } else if ( sem_trywait( &device->hDACDataSem ) != 0 ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out;
+    }
+
+    pthread_mutex_lock( &device->hDACDataMutex );
+    if ( device->bDACFinished ) {
+        result = ( device->DACResult != AIOUSB_SUCCESS ? device->DACResult : AIOUSB_ERROR_OPEN_FAILED );
+    } else {
+        unsigned slot = ( device->DACDataHead + device->DACDataQueued ) % DAC_FRAME_SLOTS;
+        device->DACData[slot] = frame;
+        device->DACDataBytes[slot] = bytes;
+        device->DACDataQueued ++;
+        frame = NULL;
+    }
+    pthread_mutex_unlock( &device->hDACDataMutex );
+
+ out:
+    free( frame );
+    pthread_mutex_lock( &device->hDACDataMutex );
+    device->DACDataWaiters --;
+    pthread_mutex_unlock( &device->hDACDataMutex );
+    return result;
+}
+
+/**
+ * @brief Queues a frame of FramePoints points, each holding a 12 bit count
+ * for every DAC in use. EOD is set on the last count of every point and EOF
+ * on the last of the frame. Counts above 12 bits are refused with
+ * AIOUSB_ERROR_INVALID_PARAMETER; use DACOutputFrameRaw() to set the other
+ * bits yourself.
+ */
 unsigned long DACOutputFrame(unsigned long DeviceIndex,
                              unsigned long FramePoints,
                              unsigned short *FrameData
                              ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    return _dac_queue_frame( DeviceIndex, FramePoints, FrameData, AIOUSB_FALSE );
 }
 
 
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief As DACOutputFrame() but the words are sent to the board unchanged
+ */
 unsigned long DACOutputFrameRaw(
                                 unsigned long DeviceIndex,
                                 unsigned long FramePoints,
                                 unsigned short *FrameData
                                 ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    return _dac_queue_frame( DeviceIndex, FramePoints, FrameData, AIOUSB_TRUE );
 }
 
 
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts the board clocking points out and the thread feeding it.
+ * Returns AIOUSB_ERROR_NOT_SUPPORTED until DACOutputSetStreamRequests() has
+ * installed the board's requests.
+ */
 unsigned long DACOutputStart(
                              unsigned long DeviceIndex
                              ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !device->bDACStream || !__atomic_load_n( &dac_stream_requests, __ATOMIC_ACQUIRE ) )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    DACWorkerArgs *args = ( DACWorkerArgs * )malloc( sizeof(DACWorkerArgs) );
+    if ( !args )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    args->device = device;
+    args->usb = usb;
+
+    AIOUSBDeviceLock( device );
+    if ( !device->bDACOpen || device->bDACClosing || device->bDACStarted ) {
+        result = AIOUSB_ERROR_OPEN_FAILED;
+    } else if ( ( result = device->DACRequests->start( device, usb ) ) == AIOUSB_SUCCESS ) {
+        device->DACResult = AIOUSB_SUCCESS;
+        if ( pthread_create( &device->DACThread, NULL, _dac_output_worker, args ) != 0 )
+            result = AIOUSB_ERROR_INVALID_THREAD;
+        else
+            device->bDACStarted = AIOUSB_TRUE;
+    }
+    AIOUSBDeviceUnlock( device );
+
+    if ( result != AIOUSB_SUCCESS )
+        free( args );
+    return result;
 }
 
 
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief With bInterlock set each frame is played once and output waits for
+ * the next; otherwise the last frame loops until a new one is queued.
+ */
 unsigned long DACOutputSetInterlock(
                                     unsigned long DeviceIndex,
                                     unsigned long bInterlock
                                     ) {
-  // TODO: this function is not yet implemented
-    return AIOUSB_ERROR_NOT_SUPPORTED;
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !device->bDACStream )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+
+    AIOUSBDeviceLock( device );
+    if ( !device->bDACOpen )
+        result = AIOUSB_ERROR_OPEN_FAILED;
+    else
+        device->bDACInterlock = bInterlock ? AIOUSB_TRUE : AIOUSB_FALSE;
+    AIOUSBDeviceUnlock( device );
+    return result;
 } 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Plays NumSamples points once at *ClockHz and waits for them to finish
+ */
+unsigned long DACOutputProcess( unsigned long DeviceIndex, double *ClockHz, unsigned long NumSamples, unsigned short *pSampleData )
+{
+    unsigned long result = DACOutputOpen( DeviceIndex, ClockHz );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( ( result = DACOutputSetInterlock( DeviceIndex, AIOUSB_TRUE ) ) != AIOUSB_SUCCESS ||
+         ( result = DACOutputFrame( DeviceIndex, NumSamples, pSampleData ) ) != AIOUSB_SUCCESS ||
+         ( result = DACOutputStart( DeviceIndex ) ) != AIOUSB_SUCCESS ) {
+        DACOutputClose( DeviceIndex, AIOUSB_FALSE );
+        return result;
+    }
+    return DACOutputClose( DeviceIndex, AIOUSB_TRUE );
+}
+
 #ifdef __cplusplus
 }
 #endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "AIOUSBDevice.h"
+
+using namespace AIOUSB;
+
+#define MOCK_MAX_FRAMES 4096
+
+static struct {
+    int sent;                           /* Bulk transfers seen */
+    unsigned short first[MOCK_MAX_FRAMES]; /* First word of each */
+    unsigned short second[MOCK_MAX_FRAMES];
+    int bytes[MOCK_MAX_FRAMES];
+    unsigned long divisor;
+    int starts, stops;
+    AIOUSB_BOOL lastReset;
+    int hold;                           /* Bulk transfers wait while set */
+    int fail;                           /* and then fail if this is */
+    int strays;                         /* Bulk transfers sent to a board the stream was not started on */
+} mock;
+
+/* Stand-ins for the undocumented control requests, see DACOutputSetStreamRequests() */
+static unsigned long mock_set_clock( AIOUSBDevice *device, USBDevice *usb, unsigned long divisor )
+{
+    mock.divisor = divisor;
+    return AIOUSB_SUCCESS;
+}
+
+static unsigned long mock_start( AIOUSBDevice *device, USBDevice *usb )
+{
+    mock.starts ++;
+    return AIOUSB_SUCCESS;
+}
+
+static unsigned long mock_stop( AIOUSBDevice *device, USBDevice *usb, AIOUSB_BOOL reset )
+{
+    mock.stops ++;
+    mock.lastReset = reset;
+    return AIOUSB_SUCCESS;
+}
+
+static const DACStreamRequests mock_requests = { mock_set_clock, mock_start, mock_stop };
+
+/* Only CheckPNPData() reads the board when it is added */
+static int mock_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                  uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    return 0;
+}
+
+static int mock_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                               int *actual_length, unsigned int timeout )
+{
+    struct timespec ts = { 0, 100000 };
+    while ( __atomic_load_n( &mock.hold, __ATOMIC_ACQUIRE ) )
+        nanosleep( &ts, NULL );
+    if ( __atomic_load_n( &mock.fail, __ATOMIC_ACQUIRE ) )
+        return LIBUSB_ERROR_IO;
+    if ( mock.sent < MOCK_MAX_FRAMES ) {
+        mock.first[mock.sent] = data[0] | ( data[1] << 8 );
+        mock.second[mock.sent] = data[2] | ( data[3] << 8 );
+        mock.bytes[mock.sent] = length;
+    }
+    __sync_fetch_and_add( &mock.sent, 1 );
+    *actual_length = length;
+    nanosleep( &ts, NULL );
+    return LIBUSB_SUCCESS;
+}
+
+class DACStream : public ::testing::Test {
+ protected:
+    USBDevice usb;
+    int numDevices;
+    virtual void SetUp() {
+        memset( &mock, 0, sizeof(mock) );
+        memset( &usb, 0, sizeof(usb) );
+        usb.usb_control_transfer = mock_control_transfer;
+        usb.usb_bulk_transfer = mock_bulk_transfer;
+        DACOutputSetStreamRequests( &mock_requests );
+        numDevices = 0;
+        AIODeviceTableInit();
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DA12_8A, &usb );
+    }
+    virtual void TearDown() {
+        DACOutputSetStreamRequests( NULL );
+        deviceTable[0].usb_device = NULL;
+        ClearAIODeviceTable( numDevices );
+    }
+    void waitForFrames( int count ) {
+        while ( mock.sent < count ) {
+            struct timespec ts = { 0, 100000 };
+            nanosleep( &ts, NULL );
+        }
+    }
+};
+
+TEST_F(DACStream, OpenProgramsTheNearestRate )
+{
+    double hz = 99000;
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    EXPECT_EQ( 121u, mock.divisor );
+    EXPECT_DOUBLE_EQ( 12000000.0 / 121, hz );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, DACOutputOpen( 0, &hz ) );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, DACDirect( 0, 0, 0 ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputClose( 0, AIOUSB_TRUE ) );
+    EXPECT_EQ( 2, mock.stops );
+    EXPECT_TRUE( mock.lastReset );
+    EXPECT_EQ( 0, mock.starts );
+    EXPECT_EQ( 0, mock.sent );
+}
+
+TEST_F(DACStream, LastFrameLoopsUntilTheNextIsQueued )
+{
+    double hz = 100000;
+    unsigned short first[] = { 0x111, 0x222, 0x333, 0x444 };
+    unsigned short second[] = { 0x555, 0x666, 0x777, 0x888 };
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 2 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, 2, first ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputStart( 0 ) );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, DACOutputSetCount( 0, 3 ) );
+
+    waitForFrames( 5 );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, 2, second ) );
+    int queued = mock.sent;
+    waitForFrames( queued + 5 );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputClose( 0, AIOUSB_TRUE ) );
+
+    /* The last DAC of each point carries EOD */
+    EXPECT_EQ( 0x111, mock.first[0] );
+    EXPECT_EQ( 0x222 | DAC_EOD, mock.second[0] );
+    EXPECT_EQ( 8, mock.bytes[0] );
+    EXPECT_EQ( 1, mock.starts );
+
+    int recorded = MIN( mock.sent, MOCK_MAX_FRAMES );
+    int i = 0;
+    while ( i < recorded && mock.first[i] == 0x111 )
+        i ++;
+    EXPECT_GE( i, 5 );
+    ASSERT_LT( i, recorded );
+    for ( ; i < recorded; i ++ )
+        EXPECT_EQ( 0x555, mock.first[i] ) << "transfer " << i;
+}
+
+TEST_F(DACStream, InterlockPlaysEachFrameOnce )
+{
+    double hz = 100000;
+    unsigned short frames[3][5] = { { 1, 2, 3, 4, 5 }, { 6, 7, 8, 9, 10 }, { 11, 12, 13, 14, 15 } };
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetInterlock( 0, AIOUSB_TRUE ) );
+    for ( int i = 0; i < 3; i ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrameRaw( 0, 1, frames[i] ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrameRaw( 0, 1, frames[0] ) );
+    EXPECT_EQ( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, DACOutputFrameRaw( 0, 1, frames[0] ) ) << "the ring is full";
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputStart( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputClose( 0, AIOUSB_TRUE ) );
+
+    ASSERT_EQ( 4, mock.sent );
+    EXPECT_EQ( 1, mock.first[0] );
+    EXPECT_EQ( 6, mock.first[1] );
+    EXPECT_EQ( 11, mock.first[2] );
+    EXPECT_EQ( 1, mock.first[3] );
+    EXPECT_EQ( 10, mock.bytes[0] );
+}
+
+TEST_F(DACStream, ProcessPlaysTheSamplesOnce )
+{
+    double hz = 1000;
+    unsigned short samples[10] = { 0 };
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputProcess( 0, &hz, 2, samples ) );
+    EXPECT_EQ( 1, mock.sent );
+    EXPECT_EQ( 20, mock.bytes[0] );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACDirect( 0, 0, 0 ) ) << "closed again";
+}
+
+TEST_F(DACStream, FramesFollowTheDocumentedBitFields )
+{
+    double hz = 1000;
+    unsigned short points[] = { 0x001, 0x002, 0x003, 0x004, 0x005, 0x006 };
+    unsigned short wide[] = { 0x001, 0x1002 };
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 2 ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, DACOutputFrame( 0, 1, wide ) ) << "counts above 12 bits are refused";
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrameRaw( 0, 1, wide ) ) << "unless sent raw";
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, 3, points ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetInterlock( 0, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputStart( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputCloseNoEnd( 0, AIOUSB_TRUE ) );
+    EXPECT_FALSE( mock.lastReset );
+
+    ASSERT_EQ( 2, mock.sent );
+    EXPECT_EQ( 0x001, mock.first[0] );
+    EXPECT_EQ( 0x1002, mock.second[0] );
+    EXPECT_EQ( 0x001, mock.first[1] );
+    EXPECT_EQ( 0x002 | DAC_EOD, mock.second[1] );
+    EXPECT_EQ( 12, mock.bytes[1] );
+}
+
+static int mock_stray_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                                int *actual_length, unsigned int timeout )
+{
+    __sync_fetch_and_add( &mock.strays, 1 );
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+TEST_F(DACStream, WorkerKeepsTheBoardItWasStartedOn )
+{
+    double hz = 100000;
+    unsigned short frame[] = { 1, 2 };
+    USBDevice replacement;
+    memset( &replacement, 0, sizeof(replacement) );
+    replacement.usb_bulk_transfer = mock_stray_transfer;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 2 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, 1, frame ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputStart( 0 ) );
+    waitForFrames( 2 );
+    deviceTable[0].usb_device = &replacement;
+    int sent = mock.sent;
+    waitForFrames( sent + 5 );
+    deviceTable[0].usb_device = &usb;
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputClose( 0, AIOUSB_FALSE ) );
+    EXPECT_EQ( 0, mock.strays );
+}
+
+static void *start_stream( void *object )
+{
+    *(unsigned long *)object = DACOutputStart( 0 );
+    return NULL;
+}
+
+TEST_F(DACStream, ConcurrentStartsCreateOneWorker )
+{
+    double hz = 100000;
+    unsigned short frame[] = { 1, 2 };
+    pthread_t threads[8];
+    unsigned long results[8];
+    int started = 0;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 2 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrame( 0, 1, frame ) );
+    for ( int i = 0; i < 8; i ++ )
+        pthread_create( &threads[i], NULL, start_stream, &results[i] );
+    for ( int i = 0; i < 8; i ++ ) {
+        pthread_join( threads[i], NULL );
+        if ( results[i] == AIOUSB_SUCCESS )
+            started ++;
+        else
+            EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, results[i] );
+    }
+    EXPECT_EQ( 1, started );
+    EXPECT_EQ( 1, mock.starts );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputClose( 0, AIOUSB_FALSE ) );
+}
+
+static void *queue_frame( void *object )
+{
+    unsigned short frame[] = { 1, 2 };
+    *(unsigned long *)object = DACOutputFrameRaw( 0, 1, frame );
+    return NULL;
+}
+
+TEST_F(DACStream, FailedWorkerWakesEveryWaitingFrame )
+{
+    double hz = 100000;
+    unsigned short frame[] = { 1, 2 };
+    pthread_t threads[3];
+    unsigned long results[3];
+    unsigned long failed = LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_IO );
+    AIOUSBDevice *device = &deviceTable[0];
+    struct timespec ts = { 0, 100000 };
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputOpen( 0, &hz ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputSetCount( 0, 2 ) );
+    for ( int i = 0; i < DAC_FRAME_SLOTS; i ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrameRaw( 0, 1, frame ) );
+    mock.hold = 1;
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputStart( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DACOutputFrameRaw( 0, 1, frame ) ) << "the worker freed a slot before it blocked";
+
+    for ( int i = 0; i < 3; i ++ )
+        pthread_create( &threads[i], NULL, queue_frame, &results[i] );
+    for ( ;; ) {
+        pthread_mutex_lock( &device->hDACDataMutex );
+        unsigned waiters = device->DACDataWaiters;
+        pthread_mutex_unlock( &device->hDACDataMutex );
+        if ( waiters == 3 )
+            break;
+        nanosleep( &ts, NULL );
+    }
+    __atomic_store_n( &mock.fail, 1, __ATOMIC_RELEASE );
+    __atomic_store_n( &mock.hold, 0, __ATOMIC_RELEASE );
+
+    for ( int i = 0; i < 3; i ++ ) {
+        pthread_join( threads[i], NULL );
+        EXPECT_EQ( failed, results[i] );
+    }
+    EXPECT_EQ( failed, DACOutputFrameRaw( 0, 1, frame ) ) << "later frames are refused too";
+    EXPECT_EQ( failed, DACOutputClose( 0, AIOUSB_FALSE ) );
+}
+
+TEST(DACStreamSupport, OnlyOnStreamingBoards )
+{
+    int numDevices = 0;
+    double hz = 1000;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_32, NULL );
+    EXPECT_EQ( AIOUSB_ERROR_NOT_SUPPORTED, DACOutputOpen( 0, &hz ) );
+    EXPECT_EQ( AIOUSB_ERROR_NOT_SUPPORTED, DACOutputStart( 0 ) );
+    ClearAIODeviceTable( numDevices );
+}
+
+TEST(DACStreamSupport, IncompleteRequestTablesAreRefused )
+{
+    DACStreamRequests partial = { mock_set_clock, mock_start, NULL };
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, DACOutputSetStreamRequests( &partial ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DACOutputSetStreamRequests( NULL ) );
+}
+
+TEST(DACStreamSupport, RefusedUntilTheControlRequestsAreKnown )
+{
+    int numDevices = 0;
+    double hz = 1000;
+    USBDevice usb;
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = mock_control_transfer;
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DA12_8A, &usb );
+    EXPECT_EQ( AIOUSB_ERROR_NOT_SUPPORTED, DACOutputOpen( 0, &hz ) );
+    EXPECT_EQ( AIOUSB_ERROR_NOT_SUPPORTED, DACOutputStart( 0 ) );
+    deviceTable[0].usb_device = NULL;
+    ClearAIODeviceTable( numDevices );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release(listeners.default_result_printer());
+#endif
+
+    return RUN_ALL_TESTS();
+}
+
+#endif
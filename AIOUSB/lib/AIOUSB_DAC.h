@@ -2,6 +2,7 @@
 #define _AIOUSB_DAC_H
 
 #include "AIOTypes.h"
+#include "USBDevice.h"
 
 
 #ifdef __aiousb_cplusplus
@@ -9,7 +10,22 @@ namespace AIOUSB
 {
 #endif
 
+/**
+ * @brief Vendor requests that program the stream clock of a bDACStream board
+ * and start and stop the stream. Their encodings are not documented for the
+ * boards this library knows, so none are built in: DACOutputOpen() and
+ * DACOutputStart() return AIOUSB_ERROR_NOT_SUPPORTED until a table is
+ * installed with DACOutputSetStreamRequests(). Each returns an AIOUSB
+ * result code.
+ */
+typedef struct dac_stream_requests {
+    unsigned long (*set_clock)( AIOUSBDevice *device, USBDevice *usb, unsigned long divisor ); /**< Points are clocked at RootClock / divisor */
+    unsigned long (*start)( AIOUSBDevice *device, USBDevice *usb );
+    unsigned long (*stop)( AIOUSBDevice *device, USBDevice *usb, AIOUSB_BOOL reset );         /**< reset returns the outputs to their reset state */
+} DACStreamRequests;
+
 /* BEGIN AIOUSB_API */
+PUBLIC_EXTERN unsigned long DACOutputSetStreamRequests( const DACStreamRequests *requests );
 PUBLIC_EXTERN unsigned long DACDirect(unsigned long DeviceIndex,unsigned short Channel,unsigned short Value );
 PUBLIC_EXTERN unsigned long DACMultiDirect(unsigned long DeviceIndex,unsigned short *pDACData,unsigned long DACDataCount );
 PUBLIC_EXTERN unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode );
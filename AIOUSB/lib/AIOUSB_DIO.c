@@ -10,7 +10,10 @@
 #include "AIODeviceTable.h"
 #include "AIOUSB_Core.h"
 #include "USBDevice.h"
+#include "AIOHistogram.h"
+#include "AIOUSB_Log.h"
 #include <arpa/inet.h>
+#include <time.h>
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -113,8 +116,7 @@ AIORESULT DIO_ConfigureWithDIOBuf(
     AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
 
     AIO_ERROR_VALID_DATA(-AIOUSB_ERROR_NOT_ENOUGH_MEMORY, device->LastDIOData != 0 );
-    char *tmp = DIOBufToBinary(buf);
-    memcpy(device->LastDIOData, tmp, DIOBufByteSize( buf ) );
+    unsigned char *tmp = DIOBufRawBytes(buf);
 
     bufferSize = device->DIOBytes + MASK_BYTES_SIZE(device);
 
@@ -137,6 +139,11 @@ AIORESULT DIO_ConfigureWithDIOBuf(
         dest += 1;
     }
 
+    /* Held across the transfer so a DIO write cannot land between the
+     * board taking the new configuration and LastDIOData matching it */
+    AIOUSBDeviceLock( device );
+    memcpy(device->LastDIOData, tmp, DIOBufByteSize( buf ) );
+    device->bDIODirty = AIOUSB_FALSE;
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE,
                                                  AUR_DIO_CONFIG,
@@ -146,7 +153,7 @@ AIORESULT DIO_ConfigureWithDIOBuf(
                                                  bufferSize,
                                                  device->commTimeout 
                                                  );
-
+    AIOUSBDeviceUnlock( device );
 
     if (bytesTransferred != bufferSize )
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
@@ -171,8 +178,6 @@ AIORESULT DIO_Configure(
     AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
     AIO_ERROR_VALID_DATA(result, result == AIOUSB_SUCCESS );
 
-    memcpy(device->LastDIOData, pData, device->DIOBytes);
-
     USBDevice *usb = _check_dio_get_device_handle( DeviceIndex, &device, &result );
 
     AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
@@ -190,6 +195,9 @@ AIORESULT DIO_Configure(
     dest += MASK_BYTES_SIZE( device );
     memset(dest, 0, MASK_BYTES_SIZE( device ) );
     
+    AIOUSBDeviceLock( device );
+    memcpy(device->LastDIOData, pData, device->DIOBytes);
+    device->bDIODirty = AIOUSB_FALSE;
     int bytesTransferred = usb->usb_control_transfer(usb,
                                                      USB_WRITE_TO_DEVICE,
                                                      AUR_DIO_CONFIG,
@@ -199,6 +207,7 @@ AIORESULT DIO_Configure(
                                                      bufferSize,
                                                      device->commTimeout 
                                                      );
+    AIOUSBDeviceUnlock( device );
 
     if (bytesTransferred != bufferSize)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
@@ -226,8 +235,6 @@ AIORESULT DIO_ConfigureEx(
 
     AIO_ERROR_VALID_DATA( AIOUSB_ERROR_DEVICE_NOT_CONNECTED, result == AIOUSB_SUCCESS );
 
-    memcpy(device->LastDIOData, pData, device->DIOBytes);
-
     int bufferSize = device->DIOBytes + MASK_BYTES_SIZE( device) + TRISTATE_BYTES_SIZE(device);
     unsigned char *configBuffer = ( unsigned char* )malloc(bufferSize);
 
@@ -240,6 +247,9 @@ AIORESULT DIO_ConfigureEx(
     dest += MASK_BYTES_SIZE( device );
     memcpy(dest, pTristateMask, TRISTATE_BYTES_SIZE( device ) );
 
+    AIOUSBDeviceLock( device );
+    memcpy(device->LastDIOData, pData, device->DIOBytes);
+    device->bDIODirty = AIOUSB_FALSE;
     int bytesTransferred = usb->usb_control_transfer(usb,
                                                      USB_WRITE_TO_DEVICE,
                                                      AUR_DIO_CONFIG,
@@ -249,6 +259,7 @@ AIORESULT DIO_ConfigureEx(
                                                      bufferSize,
                                                      device->commTimeout
                                                      );
+    AIOUSBDeviceUnlock( device );
 
     if (bytesTransferred != bufferSize)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
@@ -321,7 +332,9 @@ AIORESULT DIO_WriteAll(
 
     char foo[10] = {};
     memcpy(foo, pData, device->DIOBytes);
+    AIOUSBDeviceLock( device );
     memcpy(device->LastDIOData, pData, device->DIOBytes);
+    device->bDIODirty = AIOUSB_FALSE;
 
     int bytesTransferred = usb->usb_control_transfer(usb,
                                                      USB_WRITE_TO_DEVICE,
@@ -332,6 +345,7 @@ AIORESULT DIO_WriteAll(
                                                      device->DIOBytes,
                                                      device->commTimeout
                                                      );
+    AIOUSBDeviceUnlock( device );
 
 
     if (bytesTransferred != (signed)device->DIOBytes )
@@ -340,6 +354,83 @@ AIORESULT DIO_WriteAll(
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief DIO_WriteAll() from a DIOBuf laid out as DIO_ReadAllToDIOBuf()
+ *        fills it, sent from its packed bits without a copy
+ * @param DeviceIndex Device to write to
+ * @param buf At least DIOBytes * 8 bits
+ * @return AIORESULT
+ */
+AIORESULT DIO_WriteAllFromDIOBuf(
+                                 unsigned long DeviceIndex,
+                                 DIOBuf *buf
+                                 )
+{
+    AIO_ASSERT( buf );
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_INVALID_PARAMETER, DIOBufByteSize( buf ) >= device->DIOBytes );
+
+    return DIO_WriteAll( DeviceIndex, DIOBufRawBytes( buf ) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends the whole LastDIOData image in one AUR_DIO_WRITE. The
+ * caller holds the device lock.
+ */
+static AIORESULT _dio_flush_locked( AIOUSBDevice *device, USBDevice *usb )
+{
+    int bytesTransferred = usb->usb_control_transfer( usb,
+                                                      USB_WRITE_TO_DEVICE,
+                                                      AUR_DIO_WRITE,
+                                                      0,
+                                                      0,
+                                                      device->LastDIOData,
+                                                      device->DIOBytes,
+                                                      device->commTimeout
+                                                      );
+    if ( bytesTransferred != (signed)device->DIOBytes )
+        return LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred );
+
+    device->bDIODirty = AIOUSB_FALSE;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Changes the bits of mask in one byte of LastDIOData. The caller
+ * holds the device lock.
+ */
+static void _dio_stage_locked( AIOUSBDevice *device, unsigned long ByteIndex, unsigned char mask, unsigned char value )
+{
+    if ( !device->bDIODirty && device->DIOCoalesceWindow )
+        device->DIOCoalesceDeadline = AIOTransferTimestamp() + device->DIOCoalesceWindow * 1000ull;
+
+    device->LastDIOData[ByteIndex] = ( device->LastDIOData[ByteIndex] & ~mask ) | ( value & mask );
+    device->bDIODirty = AIOUSB_TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Whether staged changes stay in LastDIOData for now: an open
+ * transaction or the coalescing thread sends them later. A failed
+ * background flush is handed to the caller once through result.
+ */
+static AIOUSB_BOOL _dio_deferred_locked( AIOUSBDevice *device, AIORESULT *result )
+{
+    if ( device->DIOTransactionDepth )
+        return AIOUSB_TRUE;
+    if ( !device->bDIOCoalescing )
+        return AIOUSB_FALSE;
+
+    *result = device->DIOFlushResult;
+    device->DIOFlushResult = AIOUSB_SUCCESS;
+    return AIOUSB_TRUE;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_Write8(
                      unsigned long DeviceIndex,
@@ -351,36 +442,21 @@ AIORESULT DIO_Write8(
     AIOUSBDevice *device = NULL;
     USBDevice *usb = _check_dio_get_device_handle( DeviceIndex, &device, &result );
 
-    if ( !device->DIOBytes )
+    if ( !device || !device->DIOBytes )
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
     if (!usb  )
         return AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
 
-    int dioBytes = device->DIOBytes;
-
-
-    unsigned char * dataBuffer = ( unsigned char* )malloc(dioBytes);
-
-
-    if (!dataBuffer )
-        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    if ( ByteIndex >= device->DIOBytes )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
 
-    device->LastDIOData[ ByteIndex ] = Data;
-    memcpy(dataBuffer, device->LastDIOData, dioBytes);
-    
-    int bytesTransferred = usb->usb_control_transfer(usb,
-                                                     USB_WRITE_TO_DEVICE,
-                                                     AUR_DIO_WRITE,
-                                                     0,
-                                                     0,
-                                                     dataBuffer,
-                                                     dioBytes,
-                                                     device->commTimeout
-                                                     );
-    if (bytesTransferred != dioBytes)
-        result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
-    free(dataBuffer);
+    /* The other bytes come from LastDIOData, so no other write may land in between */
+    AIOUSBDeviceLock( device );
+    _dio_stage_locked( device, ByteIndex, 0xff, Data );
+    if ( !_dio_deferred_locked( device, &result ) )
+        result = _dio_flush_locked( device, usb );
+    AIOUSBDeviceUnlock( device );
 
     return result;
 }
@@ -411,23 +487,20 @@ AIORESULT DIO_Write1(
     usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_USBDEVICE , usb );
 
-    unsigned char value = deviceDesc->LastDIOData[ BYTE_INDEX(BitIndex) ];
-    unsigned char bitMask = 1 << (BitIndex % BITS_PER_BYTE);
-    if (bData == AIOUSB_FALSE)
-        value &= ~bitMask;
-    else
-        value |= bitMask;
-
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_BAD_TOKEN_TYPE,  deviceDesc->DIOBytes );
     AIO_ERROR_VALID_DATA_RETVAL( AIOUSB_ERROR_INVALID_ADDRESS, BYTE_INDEX( BitIndex ) < deviceDesc->DIOBytes );
 
-    if ( bData ) {
-        deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] = deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] | ( 1 << (BitIndex & 7));
-    } else {
-        deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] = deviceDesc->LastDIOData[BYTE_INDEX(BitIndex)] & ( ~(1 << (BitIndex & 7)));
+    AIOUSBDeviceLock( deviceDesc );
+    /* Only this bit changes on the board if nothing else is waiting to go out */
+    AIOUSB_BOOL single = !deviceDesc->bDIODirty;
+    _dio_stage_locked( deviceDesc, BYTE_INDEX(BitIndex), 1 << (BitIndex & 7), bData ? 0xff : 0 );
+
+    if ( _dio_deferred_locked( deviceDesc, &result ) ) {
+        AIOUSBDeviceUnlock( deviceDesc );
+        return result;
     }
-    
-    if ( deviceDesc->bFirmware20 && DeviceHasPNPByte( &deviceDesc->PNPData ) && ( deviceDesc->PNPData.HasDIOWrite1 != 0 ) ) {
+
+    if ( single && deviceDesc->bFirmware20 && DeviceHasPNPByte( &deviceDesc->PNPData ) && ( deviceDesc->PNPData.HasDIOWrite1 != 0 ) ) {
         retval = usb->usb_control_transfer( usb,
                                             USB_WRITE_TO_DEVICE,
                                             AUR_DIO_WRITE,
@@ -436,16 +509,12 @@ AIORESULT DIO_Write1(
                                             0,
                                             0,
                                             deviceDesc->commTimeout );
+        if ( retval >= 0 )
+            deviceDesc->bDIODirty = AIOUSB_FALSE;
     } else {
-        retval = usb->usb_control_transfer( usb,
-                                            USB_WRITE_TO_DEVICE,
-                                            AUR_DIO_WRITE,
-                                            0,
-                                            0,
-                                            &deviceDesc->LastDIOData[0],
-                                            deviceDesc->DIOBytes,
-                                            deviceDesc->commTimeout );
+        retval = _dio_flush_locked( deviceDesc, usb ) == AIOUSB_SUCCESS ? 0 : -1;
     }
+    AIOUSBDeviceUnlock( deviceDesc );
     if ( retval < 0 ) {
         result = AIOUSB_ERROR_INTERNAL_ERROR;
     }
@@ -453,6 +522,216 @@ AIORESULT DIO_Write1(
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Changes several outputs at once and sends them in one transfer
+ * @param DeviceIndex Device to write to
+ * @param pMask DIOBytes bytes, a set bit selects the output to change
+ * @param pData DIOBytes bytes with the new values of the selected outputs
+ * @return AIORESULT
+ */
+AIORESULT DIO_WriteMask(
+                        unsigned long DeviceIndex,
+                        void *pMask,
+                        void *pData
+                        )
+{
+    AIO_ASSERT( pMask );
+    AIO_ASSERT( pData );
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = NULL;
+    USBDevice *usb = _check_dio_get_device_handle( DeviceIndex, &device, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_DEVICE_NOT_CONNECTED, usb );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, device->LastDIOData );
+
+    AIOUSBDeviceLock( device );
+    for ( unsigned i = 0; i < device->DIOBytes; i ++ ) {
+        unsigned char mask = ((unsigned char *)pMask)[i];
+        if ( mask )
+            _dio_stage_locked( device, i, mask, ((unsigned char *)pData)[i] );
+    }
+    if ( device->bDIODirty && !_dio_deferred_locked( device, &result ) )
+        result = _dio_flush_locked( device, usb );
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Holds back DIO_Write1(), DIO_Write8() and DIO_WriteMask() until
+ * the matching DIO_CommitTransaction(), which sends everything they
+ * changed in a single transfer. Transactions nest and belong to the
+ * device, so writes from other threads join an open one.
+ * @param DeviceIndex Device to write to
+ * @return AIORESULT
+ */
+AIORESULT DIO_BeginTransaction( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, device->LastDIOData );
+
+    AIOUSBDeviceLock( device );
+    device->DIOTransactionDepth ++;
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Closes the transaction opened by DIO_BeginTransaction(), the
+ * outermost one sends the changed outputs
+ * @param DeviceIndex Device to write to
+ * @return AIORESULT
+ */
+AIORESULT DIO_CommitTransaction( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    AIOUSBDeviceLock( device );
+    if ( !device->DIOTransactionDepth ) {
+        result = AIOUSB_ERROR_INVALID_PARAMETER;
+    } else if ( --device->DIOTransactionDepth == 0 && device->bDIODirty ) {
+        USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+        result = usb ? _dio_flush_locked( device, usb ) : AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+    }
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends outputs the coalescing window is still holding back
+ * without waiting for it to expire
+ * @param DeviceIndex Device to write to
+ * @return AIORESULT
+ */
+AIORESULT DIO_FlushWrites( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+
+    AIOUSBDeviceLock( device );
+    result = device->DIOFlushResult;
+    device->DIOFlushResult = AIOUSB_SUCCESS;
+    if ( result == AIOUSB_SUCCESS && device->bDIODirty && !device->DIOTransactionDepth ) {
+        USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+        result = usb ? _dio_flush_locked( device, usb ) : AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+    }
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends the image once the oldest unsent change is DIOCoalesceWindow
+ * old. A failure is kept for the next write rather than retried, the
+ * board may be gone.
+ */
+static void *_dio_coalesce_worker( void *object )
+{
+    AIOUSBDevice *device = (AIOUSBDevice *)object;
+    const uint64_t longest_nap = 10 * 1000 * 1000ull;
+
+    AIOUSBDeviceLock( device );
+    while ( device->bDIOCoalescing ) {
+        uint64_t nap = device->DIOCoalesceWindow * 1000ull;
+        if ( device->bDIODirty && !device->DIOTransactionDepth ) {
+            uint64_t now = AIOTransferTimestamp();
+            if ( now >= device->DIOCoalesceDeadline ) {
+                AIORESULT result = device->usb_device ? _dio_flush_locked( device, device->usb_device ) : AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+                if ( result != AIOUSB_SUCCESS ) {
+                    AIOUSB_WARN("Coalesced DIO write failed: %d\n", (int)result );
+                    if ( device->DIOFlushResult == AIOUSB_SUCCESS )
+                        device->DIOFlushResult = result;
+                    device->bDIODirty = AIOUSB_FALSE;
+                }
+                continue;
+            }
+            nap = device->DIOCoalesceDeadline - now;
+        }
+        if ( nap > longest_nap )
+            nap = longest_nap;
+        AIOUSBDeviceUnlock( device );
+
+        struct timespec ts = { (time_t)( nap / 1000000000ull ), (long)( nap % 1000000000ull ) };
+        nanosleep( &ts, NULL );
+
+        AIOUSBDeviceLock( device );
+    }
+    AIOUSBDeviceUnlock( device );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the coalescing thread of a device without sending what it
+ * holds, for when the device is being torn down
+ */
+void AIOUSBDeviceStopDIOCoalescing( AIOUSBDevice *device )
+{
+    if ( !device )
+        return;
+
+    AIOUSBDeviceLock( device );
+    AIOUSB_BOOL running = device->bDIOCoalescing;
+    device->bDIOCoalescing = AIOUSB_FALSE;
+    device->DIOCoalesceWindow = 0;
+    AIOUSBDeviceUnlock( device );
+
+    if ( running )
+        pthread_join( device->DIOCoalesceThread, NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Lets DIO_Write1(), DIO_Write8() and DIO_WriteMask() return without
+ * talking to the board; a background thread sends all changes made within
+ * WindowUs microseconds of the first one in one transfer. Callers that
+ * flip relays one bit at a time get one transfer per burst instead of one
+ * per bit, at the cost of up to WindowUs of latency.
+ * @param DeviceIndex Device to write to
+ * @param WindowUs How long a change may wait, 0 sends what is pending and
+ *        goes back to one transfer per write
+ * @return AIORESULT
+ */
+AIORESULT DIO_SetWriteCoalescing( unsigned long DeviceIndex, unsigned long WindowUs )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    AIO_ERROR_VALID_DATA( result, result == AIOUSB_SUCCESS );
+    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, device->LastDIOData );
+
+    if ( WindowUs == 0 ) {
+        AIOUSBDeviceStopDIOCoalescing( device );
+        return DIO_FlushWrites( DeviceIndex );
+    }
+
+    AIOUSBDeviceLock( device );
+    device->DIOCoalesceWindow = WindowUs;
+    if ( !device->bDIOCoalescing ) {
+        device->bDIOCoalescing = AIOUSB_TRUE;
+        if ( pthread_create( &device->DIOCoalesceThread, NULL, _dio_coalesce_worker, device ) != 0 ) {
+            device->bDIOCoalescing = AIOUSB_FALSE;
+            device->DIOCoalesceWindow = 0;
+            result = AIOUSB_ERROR_INVALID_THREAD;
+        }
+    }
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_ReadAll(
                       unsigned long DeviceIndex,
@@ -510,38 +789,27 @@ AIORET_TYPE DIO_ReadAllToDIOBuf(
     AIORET_TYPE result = AIOUSB_SUCCESS;
     AIOUSBDevice *device = NULL;
     int bytesTransferred;
-    char *tmpbuf;
 
     USBDevice *usb = _check_dio_get_device_handle( DeviceIndex, &device,  (AIORESULT*)&result );
     AIO_ASSERT_AIORET_TYPE( AIOUSB_ERROR_INVALID_DEVICE , result == AIOUSB_SUCCESS );
 
-    tmpbuf = (char*)malloc( sizeof(char)*device->DIOBytes );
+    if ( DIOBufSize( buf ) != device->DIOBytes * BITS_PER_BYTE && 
+         DIOBufResize( buf, device->DIOBytes * BITS_PER_BYTE ) == NULL )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
-    AIO_ERROR_VALID_DATA( AIOUSB_ERROR_NOT_ENOUGH_MEMORY, tmpbuf );
-    
+    /* The packed bits are in the board's byte order, so read straight into them */
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_DIO_READ,
                                                  0, 
                                                  0, 
-                                                 (unsigned char *)tmpbuf,
+                                                 DIOBufRawBytes( buf ),
                                                  device->DIOBytes,
                                                  device->commTimeout
                                                  );
 
-    if ( bytesTransferred < 0 || bytesTransferred != (int)device->DIOBytes ) {
+    if ( bytesTransferred < 0 || bytesTransferred != (int)device->DIOBytes )
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
-        goto cleanup_DIO_ReadAll;
-    }
-
-    if ( DIOBufResize( buf, device->DIOBytes ) == NULL ) {
-        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-        goto cleanup_DIO_ReadAll;
-    }
-    
-    DIOBufReplaceString( buf, tmpbuf, device->DIOBytes );
-    cleanup_DIO_ReadAll:
-    free(tmpbuf);
 
     return result;
 }
@@ -594,8 +862,8 @@ AIORESULT DIO_Read8(
 
     AIO_ERROR_VALID_DATA(AIOUSB_ERROR_NOT_ENOUGH_MEMORY, readBuffer );
 
-    if ( (result = DIO_ReadAll(DeviceIndex, readBuffer->buffer)) == AIOUSB_SUCCESS ) {
-        *pdat = (unsigned char)readBuffer->buffer[ByteIndex];
+    if ( (result = DIO_ReadAll(DeviceIndex, DIOBufRawBytes( readBuffer ))) == AIOUSB_SUCCESS ) {
+        *pdat = DIOBufRawBytes( readBuffer )[ByteIndex];
     }
 
     DeleteDIOBuf( readBuffer );
@@ -780,6 +1048,7 @@ AIORESULT DIO_StreamFrame(
     int libusbResult;
     int minval;
     int bytes;
+    uint64_t started = 0, lastEnd = 0;
 
     //
     // If its a stream write operation have to preload tmpdata with the first 'N' bytes
@@ -788,7 +1057,11 @@ AIORESULT DIO_StreamFrame(
             memcpy(tmpdata, data, MIN(streamingBlockSize,remaining));
    
     while (remaining > 0) {
+        AIOTransferHistograms *hists = AIO_TRANSFER_HISTOGRAMS( device, AIO_TRANSFER_DIO_STREAM );
+        if ( hists )
+            started = AIOTransferTimestamp();
         minval = ((remaining < streamingBlockSize) ? pow_of_minsize(remaining) : streamingBlockSize);
+        bytes = 0;
         libusbResult = deviceHandle->usb_bulk_transfer(deviceHandle,
                                                            GET_ENDPOINT( device->bDIORead ),
                                                            tmpdata,
@@ -796,6 +1069,8 @@ AIORESULT DIO_StreamFrame(
                                                            &bytes,
                                                            10000
                                                            );
+        if ( hists )
+            AIOTransferHistogramsRecord( hists, started, AIOTransferTimestamp(), bytes, -1, &lastEnd );
 
         if (libusbResult == LIBUSB_SUCCESS || libusbResult == LIBUSB_ERROR_OVERFLOW ) {
             if (bytes > 0) {
@@ -929,6 +1204,124 @@ TEST(DIO,CheckConfigureEx)
 }
 
 
+static struct {
+    int writes;                         /* AUR_DIO_WRITE transfers seen */
+    unsigned char last[4];              /* Image the last one carried */
+    int fail;                           /* Fail AUR_DIO_WRITE with this libusb code */
+} dio_mock;
+
+static int dio_mock_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                      uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest != AUR_DIO_WRITE )
+        return 0;
+    __sync_fetch_and_add( &dio_mock.writes, 1 );
+    if ( dio_mock.fail )
+        return dio_mock.fail;
+    if ( data )
+        memcpy( dio_mock.last, data, wLength < sizeof(dio_mock.last) ? wLength : sizeof(dio_mock.last) );
+    return wLength;
+}
+
+class DIOWrites : public ::testing::Test {
+ protected:
+    USBDevice usb;
+    int numDevices;
+    virtual void SetUp() {
+        memset( &dio_mock, 0, sizeof(dio_mock) );
+        memset( &usb, 0, sizeof(usb) );
+        usb.usb_control_transfer = dio_mock_control_transfer;
+        numDevices = 0;
+        AIODeviceTableInit();
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_IIRO_16, &usb );
+    }
+    virtual void TearDown() {
+        deviceTable[0].usb_device = NULL;
+        ClearAIODeviceTable( numDevices );
+    }
+    void waitForWrites( int count ) {
+        for ( int i = 0; i < 1000 && dio_mock.writes < count; i ++ ) {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep( &ts, NULL );
+        }
+    }
+};
+
+TEST_F(DIOWrites, TransactionSendsTwelveRelaysInOneTransfer )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginTransaction( 0 ) );
+    for ( int bit = 0; bit < 12; bit ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, bit, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginTransaction( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write8( 0, 2, 0x5a ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitTransaction( 0 ) );
+    EXPECT_EQ( 0, dio_mock.writes ) << "Only the outermost commit sends";
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitTransaction( 0 ) );
+    EXPECT_EQ( 1, dio_mock.writes );
+    EXPECT_EQ( 0xff, dio_mock.last[0] );
+    EXPECT_EQ( 0x0f, dio_mock.last[1] );
+    EXPECT_EQ( 0x5a, dio_mock.last[2] );
+
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, DIO_CommitTransaction( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginTransaction( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitTransaction( 0 ) );
+    EXPECT_EQ( 1, dio_mock.writes ) << "Nothing changed, nothing sent";
+}
+
+TEST_F(DIOWrites, WriteMaskChangesOnlySelectedOutputs )
+{
+    unsigned char mask[4] = { 0x0f, 0xf0, 0, 0 };
+    unsigned char data[4] = { 0xff, 0x00, 0xff, 0xff };
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write8( 0, 1, 0xa5 ) );
+    EXPECT_EQ( 1, dio_mock.writes );
+    EXPECT_EQ( 0xa5, dio_mock.last[1] );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, DIO_Write8( 0, 4, 0 ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_WriteMask( 0, mask, data ) );
+    EXPECT_EQ( 2, dio_mock.writes );
+    EXPECT_EQ( 0x0f, dio_mock.last[0] );
+    EXPECT_EQ( 0x05, dio_mock.last[1] );
+    EXPECT_EQ( 0x00, dio_mock.last[2] );
+}
+
+TEST_F(DIOWrites, CoalescingBatchesWrite1Calls )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_SetWriteCoalescing( 0, 20000 ) );
+    for ( int bit = 0; bit < 8; bit ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, bit, bit & 1 ) );
+    EXPECT_EQ( 0, dio_mock.writes );
+
+    waitForWrites( 1 );
+    EXPECT_EQ( 1, dio_mock.writes );
+    EXPECT_EQ( 0xaa, dio_mock.last[0] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 8, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_FlushWrites( 0 ) );
+    EXPECT_EQ( 2, dio_mock.writes ) << "Flush does not wait for the window";
+    EXPECT_EQ( 0x01, dio_mock.last[1] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_SetWriteCoalescing( 0, 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 9, AIOUSB_TRUE ) );
+    EXPECT_EQ( 3, dio_mock.writes ) << "Back to one transfer per write";
+}
+
+TEST_F(DIOWrites, FailedBackgroundFlushIsReportedOnce )
+{
+    dio_mock.fail = LIBUSB_ERROR_IO;
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_SetWriteCoalescing( 0, 1000 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 0, AIOUSB_TRUE ) );
+    waitForWrites( 1 );
+
+    dio_mock.fail = 0;
+    EXPECT_NE( AIOUSB_SUCCESS, DIO_Write1( 0, 1, AIOUSB_TRUE ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 2, AIOUSB_TRUE ) );
+    waitForWrites( 2 );
+    EXPECT_EQ( 0x07, dio_mock.last[0] );
+}
+
+
 #include <unistd.h>
 #include <stdio.h>
 
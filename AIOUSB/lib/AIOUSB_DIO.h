@@ -26,9 +26,17 @@ PUBLIC_EXTERN unsigned long DIO_Configure( unsigned long DeviceIndex, unsigned c
 PUBLIC_EXTERN unsigned long DIO_ConfigureEx( unsigned long DeviceIndex, void *pOutMask, void *pData, void *pTristateMask ); 
 PUBLIC_EXTERN unsigned long DIO_ConfigurationQuery( unsigned long DeviceIndex, void *pOutMask, void *pTristateMask ); 
 PUBLIC_EXTERN unsigned long DIO_WriteAll( unsigned long DeviceIndex, void *pData ); 
+PUBLIC_EXTERN AIORESULT DIO_WriteAllFromDIOBuf( unsigned long DeviceIndex, DIOBuf *buf );
 PUBLIC_EXTERN unsigned long DIO_Write8( unsigned long DeviceIndex, unsigned long ByteIndex, unsigned char Data ); 
 
 PUBLIC_EXTERN unsigned long DIO_Write1( unsigned long DeviceIndex, unsigned long BitIndex, unsigned char bData ); 
+PUBLIC_EXTERN AIORESULT DIO_WriteMask( unsigned long DeviceIndex, void *pMask, void *pData );
+
+PUBLIC_EXTERN AIORESULT DIO_BeginTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_CommitTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_FlushWrites( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_SetWriteCoalescing( unsigned long DeviceIndex, unsigned long WindowUs );
+PUBLIC_EXTERN void AIOUSBDeviceStopDIOCoalescing( AIOUSBDevice *device );
 
 
 PUBLIC_EXTERN AIORET_TYPE DIO_ReadAllToDIOBuf( unsigned long DeviceIndex, DIOBuf *buf );
@@ -1,5 +1,28 @@
+/**
+ * @file   AIOUSB_Log.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Log output, either written as it happens or handed to a background writer
+ *
+ * In asynchronous mode a thread that logs never takes message_lock and
+ * never touches outfile. It copies the format pointer and its arguments
+ * into a fixed size record in a ring that only it writes to, and a
+ * background thread formats the records of every ring in time order.
+ * When a ring is full the message is dropped and counted instead of
+ * making the thread wait.
+ */
+
 #include "AIOUSB_Log.h"
 #include "AIOTypes.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -11,6 +34,655 @@ FILE *outfile = NULL;
 
 AIO_DEBUG_LEVEL AIOUSB_DEBUG_LEVEL = (AIO_DEBUG_LEVEL)7;
 
+volatile int aiousb_log_async = 0;
+
+#define AIO_LOG_PAYLOAD_SIZE ( AIOUSB_LOG_RECORD_SIZE - sizeof(uint64_t) - sizeof(const char *) )
+
+/**
+ * @brief One message: fmt is the string literal handed to AIOUSB_LOG and
+ * payload holds its arguments, integers and doubles as 8 bytes each and
+ * strings copied in place
+ */
+typedef struct aio_log_record {
+    uint64_t timestamp;
+    const char *fmt;
+    unsigned char payload[AIO_LOG_PAYLOAD_SIZE];
+} AIOLogRecord;
+
+/**
+ * @brief Single producer, single consumer ring. head is only advanced by the
+ * writer thread and tail only by the thread that owns the ring.
+ */
+typedef struct aio_log_ring {
+    struct aio_log_ring *next;
+    volatile unsigned head;
+    volatile unsigned tail;
+    unsigned mask;
+    volatile int closed;                /**< The owning thread has exited */
+    uint64_t dropped;
+    AIOLogRecord *records;
+} AIOLogRing;
+
+static AIOLogRing * volatile log_rings = NULL;
+static unsigned log_ring_records = AIOUSB_LOG_RING_RECORDS;
+static volatile int log_writer_running = 0;
+static pthread_t log_writer;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_key_once = PTHREAD_ONCE_INIT;
+static uint64_t log_dropped_reported = 0;
+static __thread AIOLogRing *log_thread_ring = NULL;
+
+/*----------------------------------------------------------------------------*/
+static uint64_t _log_now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _log_ring_release( void *object )
+{
+    ((AIOLogRing *)object)->closed = 1;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _log_make_ring_key( void )
+{
+    pthread_key_create( &log_ring_key, _log_ring_release );
+}
+
+/*----------------------------------------------------------------------------*/
+static AIOLogRing *_log_thread_ring( void )
+{
+    AIOLogRing *ring = log_thread_ring;
+    if ( ring )
+        return ring;
+
+    pthread_once( &log_ring_key_once, _log_make_ring_key );
+
+    /* Rings are never freed, the ring of a thread that has exited is handed on once it is empty */
+    for ( ring = log_rings; ring; ring = ring->next ) {
+        if ( ring->closed && ring->head == ring->tail && __sync_bool_compare_and_swap( &ring->closed, 1, 0 ) ) {
+            pthread_setspecific( log_ring_key, ring );
+            log_thread_ring = ring;
+            return ring;
+        }
+    }
+
+    ring = (AIOLogRing *)calloc( 1, sizeof(AIOLogRing) );
+    if ( !ring )
+        return NULL;
+    ring->mask    = log_ring_records - 1;
+    ring->records = (AIOLogRecord *)malloc( log_ring_records * sizeof(AIOLogRecord) );
+    if ( !ring->records ) {
+        free( ring );
+        return NULL;
+    }
+
+    pthread_setspecific( log_ring_key, ring );
+
+    do {
+        ring->next = log_rings;
+    } while ( !__sync_bool_compare_and_swap( &log_rings, ring->next, ring ) );
+
+    log_thread_ring = ring;
+    return ring;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Steps over the flags, width, precision and length of the
+ * conversion that starts after the '%' at *fmt
+ * @param fmt Left pointing at the conversion character
+ * @param stars Number of '*' widths and precisions, each an int argument
+ * @return The length modifier: 'H' for hh, 'h', 'l', 'q' for ll, 'j', 'z', 't', 'L' or 0
+ */
+static char _log_parse_spec( const char **fmt, int *stars )
+{
+    const char *p = *fmt;
+    char length = 0;
+
+    *stars = 0;
+    while ( *p && strchr( "-+ #0'", *p ) )
+        p ++;
+    if ( *p == '*' ) {
+        (*stars) ++;
+        p ++;
+    }
+    while ( isdigit( (unsigned char)*p ) )
+        p ++;
+    if ( *p == '.' ) {
+        p ++;
+        if ( *p == '*' ) {
+            (*stars) ++;
+            p ++;
+        }
+        while ( isdigit( (unsigned char)*p ) )
+            p ++;
+    }
+    if ( *p == 'h' ) {
+        length = ( p[1] == 'h' ? 'H' : 'h' );
+        p += ( length == 'H' ? 2 : 1 );
+    } else if ( *p == 'l' ) {
+        length = ( p[1] == 'l' ? 'q' : 'l' );
+        p += ( length == 'q' ? 2 : 1 );
+    } else if ( *p && strchr( "jztLq", *p ) ) {
+        length = *p++;
+    }
+
+    *fmt = p;
+    return length;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _log_put( AIOLogRecord *rec, size_t *used, const void *value, size_t size )
+{
+    if ( *used + size > sizeof(rec->payload) )
+        return 0;
+    memcpy( &rec->payload[*used], value, size );
+    *used += size;
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the arguments described by rec->fmt into rec->payload
+ * @return 1 if everything fit, 0 if the message has to be dropped
+ */
+static int _log_capture( AIOLogRecord *rec, va_list ap )
+{
+    size_t used = 0;
+
+    for ( const char *p = rec->fmt; *p; p ++ ) {
+        if ( *p != '%' )
+            continue;
+        if ( *++p == '%' )
+            continue;
+
+        int stars;
+        char length = _log_parse_spec( &p, &stars );
+        for ( int i = 0; i < stars; i ++ ) {
+            int star = va_arg( ap, int );
+            if ( !_log_put( rec, &used, &star, sizeof(star) ) )
+                return 0;
+        }
+
+        switch ( *p ) {
+        case 'd': case 'i': {
+            long long value;
+            switch ( length ) {
+            case 'H': value = (signed char)va_arg( ap, int ); break;
+            case 'h': value = (short)va_arg( ap, int ); break;
+            case 'l': value = va_arg( ap, long ); break;
+            case 'q': value = va_arg( ap, long long ); break;
+            case 'j': value = va_arg( ap, intmax_t ); break;
+            case 'z': value = va_arg( ap, ssize_t ); break;
+            case 't': value = va_arg( ap, ptrdiff_t ); break;
+            default:  value = va_arg( ap, int ); break;
+            }
+            if ( !_log_put( rec, &used, &value, sizeof(value) ) )
+                return 0;
+            break;
+        }
+        case 'u': case 'o': case 'x': case 'X': case 'c': {
+            unsigned long long value;
+            switch ( length ) {
+            case 'H': value = (unsigned char)va_arg( ap, unsigned ); break;
+            case 'h': value = (unsigned short)va_arg( ap, unsigned ); break;
+            case 'l': value = va_arg( ap, unsigned long ); break;
+            case 'q': value = va_arg( ap, unsigned long long ); break;
+            case 'j': value = va_arg( ap, uintmax_t ); break;
+            case 'z': value = va_arg( ap, size_t ); break;
+            case 't': value = va_arg( ap, ptrdiff_t ); break;
+            default:  value = va_arg( ap, unsigned ); break;
+            }
+            if ( !_log_put( rec, &used, &value, sizeof(value) ) )
+                return 0;
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            double value = ( length == 'L' ? (double)va_arg( ap, long double ) : va_arg( ap, double ) );
+            if ( !_log_put( rec, &used, &value, sizeof(value) ) )
+                return 0;
+            break;
+        }
+        case 's': {
+            const char *str = va_arg( ap, const char * );
+            str = ( str ? str : "(null)" );
+            size_t len = strlen( str );
+            size_t room = sizeof(rec->payload) - used;
+            if ( room == 0 )
+                return 0;
+            len = ( len < room - 1 ? len : room - 1 );
+            memcpy( &rec->payload[used], str, len );
+            rec->payload[used + len] = 0;
+            used += len + 1;
+            break;
+        }
+        case 'p': {
+            void *value = va_arg( ap, void * );
+            if ( !_log_put( rec, &used, &value, sizeof(value) ) )
+                return 0;
+            break;
+        }
+        case 'n':
+            (void)va_arg( ap, void * );
+            break;
+        default:
+            return 0;
+        }
+        if ( !*p )
+            break;
+    }
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*/
+#define AIO_LOG_PRINT( out, spec, stars, star, value ) \
+    ( stars == 2 ? fprintf( out, spec, star[0], star[1], value ) :  \
+      stars == 1 ? fprintf( out, spec, star[0], value ) :           \
+      fprintf( out, spec, value ) )
+
+/**
+ * @brief Writes rec to out as fprintf would have written its format and arguments
+ */
+static void _log_render( FILE *out, const AIOLogRecord *rec )
+{
+    const unsigned char *arg = rec->payload;
+    const char *text = rec->fmt;
+
+    for ( const char *p = rec->fmt; *p; p ++ ) {
+        if ( *p != '%' )
+            continue;
+        fwrite( text, 1, p - text, out );
+        const char *start = p;
+        if ( *++p == '%' ) {
+            fputc( '%', out );
+            text = p + 1;
+            continue;
+        }
+
+        int stars, star[2] = {0, 0};
+        const char *conv = p;
+        char length = _log_parse_spec( &conv, &stars );
+        for ( int i = 0; i < stars; i ++ ) {
+            memcpy( &star[i], arg, sizeof(int) );
+            arg += sizeof(int);
+        }
+
+        /* The flags, width and precision, with the length rewritten for the stored type */
+        char spec[32];
+        size_t n = (size_t)( conv - start ) - ( length == 'H' || ( length == 'q' && conv[-1] == 'l' ) ? 2 : length ? 1 : 0 );
+        n = ( n < sizeof(spec) - 4 ? n : sizeof(spec) - 4 );
+        memcpy( spec, start, n );
+        spec[n] = 0;
+
+        switch ( *conv ) {
+        case 'd': case 'i': {
+            long long value;
+            memcpy( &value, arg, sizeof(value) );
+            arg += sizeof(value);
+            strcat( spec, "ll" );
+            strncat( spec, conv, 1 );
+            AIO_LOG_PRINT( out, spec, stars, star, value );
+            break;
+        }
+        case 'u': case 'o': case 'x': case 'X': case 'c': {
+            unsigned long long value;
+            memcpy( &value, arg, sizeof(value) );
+            arg += sizeof(value);
+            if ( *conv == 'c' ) {
+                strcat( spec, "c" );
+                AIO_LOG_PRINT( out, spec, stars, star, (int)value );
+            } else {
+                strcat( spec, "ll" );
+                strncat( spec, conv, 1 );
+                AIO_LOG_PRINT( out, spec, stars, star, value );
+            }
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            double value;
+            memcpy( &value, arg, sizeof(value) );
+            arg += sizeof(value);
+            strncat( spec, conv, 1 );
+            AIO_LOG_PRINT( out, spec, stars, star, value );
+            break;
+        }
+        case 's': {
+            const char *value = (const char *)arg;
+            arg += strlen( value ) + 1;
+            strcat( spec, "s" );
+            AIO_LOG_PRINT( out, spec, stars, star, value );
+            break;
+        }
+        case 'p': {
+            void *value;
+            memcpy( &value, arg, sizeof(value) );
+            arg += sizeof(value);
+            strcat( spec, "p" );
+            AIO_LOG_PRINT( out, spec, stars, star, value );
+            break;
+        }
+        default:
+            break;
+        }
+        if ( !*conv ) {
+            text = conv;
+            break;
+        }
+        p = conv;
+        text = conv + 1;
+    }
+    fputs( text, out );
+}
+
+static int _log_drain( void );
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues a message for the background writer. This is what
+ * AIOUSB_LOG calls in asynchronous mode; fmt has to be a string literal
+ * since only the pointer is kept.
+ * @return AIOUSB_SUCCESS, or -AIOUSB_ERROR_NOT_ENOUGH_MEMORY if the message
+ * was dropped
+ */
+AIORET_TYPE AIOUSB_LogRecord( const char *fmt, ... )
+{
+    AIOLogRing *ring = _log_thread_ring();
+    if ( !ring )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    unsigned tail = ring->tail;
+    if ( tail - ring->head > ring->mask ) {
+        __sync_fetch_and_add( &ring->dropped, 1 );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    AIOLogRecord *rec = &ring->records[tail & ring->mask];
+    va_list ap;
+    va_start( ap, fmt );
+    rec->timestamp = _log_now();
+    rec->fmt = fmt;
+    int ok = _log_capture( rec, ap );
+    va_end( ap );
+    if ( !ok ) {
+        __sync_fetch_and_add( &ring->dropped, 1 );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    __sync_synchronize();
+    ring->tail = tail + 1;
+
+    /* AIOUSB_LogStopAsync() may have written out the rings after this
+     * thread saw aiousb_log_async set, so nobody would drain this one */
+    __sync_synchronize();
+    if ( !aiousb_log_async ) {
+        pthread_mutex_lock( &message_lock );
+        if ( !aiousb_log_async && !log_writer_running )
+            _log_drain();
+        pthread_mutex_unlock( &message_lock );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Writes out every queued record, oldest first across all rings.
+ * Called by the writer thread, or with message_lock held once it is gone.
+ * @return Number of records written
+ */
+static int _log_drain( void )
+{
+    FILE *out = ( !outfile ? stdout : outfile );
+    int written = 0;
+
+    for ( ;; ) {
+        AIOLogRing *oldest = NULL;
+        for ( AIOLogRing *ring = log_rings; ring; ring = ring->next ) {
+            if ( ring->head == ring->tail )
+                continue;
+            __sync_synchronize();
+            if ( !oldest || ring->records[ring->head & ring->mask].timestamp <
+                            oldest->records[oldest->head & oldest->mask].timestamp )
+                oldest = ring;
+        }
+        if ( !oldest )
+            break;
+        _log_render( out, &oldest->records[oldest->head & oldest->mask] );
+        __sync_synchronize();
+        oldest->head ++;
+        written ++;
+    }
+
+    unsigned long long dropped = AIOUSB_LogDropped();
+    if ( dropped != log_dropped_reported ) {
+        fprintf( out, AIO_WARN_STR "%llu log messages dropped" AIO_RESET_STR "\n", dropped - log_dropped_reported );
+        log_dropped_reported = dropped;
+    }
+    if ( written )
+        fflush( out );
+    return written;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_log_writer( void *object )
+{
+    while ( log_writer_running ) {
+        if ( !_log_drain() ) {
+            struct timespec pause = { 0, 1000000 };
+            nanosleep( &pause, NULL );
+        }
+    }
+    _log_drain();
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Switches AIOUSB_LOG to the asynchronous mode described at the top
+ * of this file and starts the thread that writes the messages
+ * @param ring_records Messages each logging thread can have queued, rounded
+ * up to a power of two, 0 for AIOUSB_LOG_RING_RECORDS
+ * @return AIOUSB_SUCCESS, or an error if the writer could not be started
+ */
+AIORET_TYPE AIOUSB_LogStartAsync( unsigned ring_records )
+{
+    if ( log_writer_running )
+        return AIOUSB_SUCCESS;
+
+    unsigned records = 2;
+    ring_records = ( ring_records ? ring_records : AIOUSB_LOG_RING_RECORDS );
+    while ( records < ring_records )
+        records <<= 1;
+    log_ring_records = records;
+
+    pthread_mutex_lock( &message_lock );
+    log_writer_running = 1;
+    if ( pthread_create( &log_writer, NULL, _log_writer, NULL ) != 0 ) {
+        log_writer_running = 0;
+        pthread_mutex_unlock( &message_lock );
+        return -AIOUSB_ERROR_INVALID_THREAD;
+    }
+    aiousb_log_async = 1;
+    pthread_mutex_unlock( &message_lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Goes back to writing messages as they happen, after the background
+ * writer has written out everything queued so far
+ */
+AIORET_TYPE AIOUSB_LogStopAsync( void )
+{
+    if ( !log_writer_running )
+        return AIOUSB_SUCCESS;
+
+    AIOUSB_LogFlush();
+    log_writer_running = 0;
+    pthread_join( log_writer, NULL );
+
+    /* Direct writers only start once the writer is gone. Records queued
+     * after its last drain by threads that saw aiousb_log_async still set
+     * are written here, or by AIOUSB_LogRecord() itself */
+    pthread_mutex_lock( &message_lock );
+    aiousb_log_async = 0;
+    __sync_synchronize();
+    _log_drain();
+    pthread_mutex_unlock( &message_lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Waits until every message queued before this call has been written
+ */
+AIORET_TYPE AIOUSB_LogFlush( void )
+{
+    for ( ;; ) {
+        int pending = 0;
+        for ( AIOLogRing *ring = log_rings; ring; ring = ring->next )
+            pending |= ( ring->head != ring->tail );
+        if ( !pending || !log_writer_running )
+            break;
+        struct timespec pause = { 0, 1000000 };
+        nanosleep( &pause, NULL );
+    }
+    pthread_mutex_lock( &message_lock );
+    fflush( !outfile ? stdout : outfile );
+    pthread_mutex_unlock( &message_lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Messages thrown away because a thread's ring was full or their
+ * arguments did not fit in a record, since the library was loaded
+ */
+unsigned long long AIOUSB_LogDropped( void )
+{
+    unsigned long long dropped = 0;
+    for ( AIOLogRing *ring = log_rings; ring; ring = ring->next )
+        dropped += __sync_fetch_and_add( &ring->dropped, 0 );
+    return dropped;
+}
+
 #ifdef __cplusplus
 }
 #endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+
+using namespace AIOUSB;
+
+static char *read_log( FILE *fp )
+{
+    long size = ftell( fp );
+    char *text = (char *)calloc( size + 1, 1 );
+    rewind( fp );
+    size_t got = fread( text, 1, size, fp );
+    text[got] = 0;
+    return text;
+}
+
+TEST(AIOUSBLog, RecordsRenderLikeFprintf )
+{
+    FILE *fp = tmpfile();
+    outfile = fp;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_LogStartAsync( 16 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_LogRecord( "a=%d b=%-4s| c=%5.2f d=%#lx e=%hhu f=%*d g=%c %%\n",
+                                                 -7, "xy", 3.14159, 0xbeefUL, 300, 3, 9, 'z' ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_LogRecord( "%s and %llu\n", (const char *)NULL, 1ULL << 40 ) );
+    AIOUSB_LogFlush();
+    AIOUSB_LogStopAsync();
+    outfile = NULL;
+
+    char *text = read_log( fp );
+    EXPECT_STREQ( "a=-7 b=xy  | c= 3.14 d=0xbeef e=44 f=  9 g=z %\n"
+                  "(null) and 1099511627776\n", text );
+    free( text );
+    fclose( fp );
+}
+
+TEST(AIOUSBLog, MacrosGoThroughTheRingWhenAsync )
+{
+    FILE *fp = tmpfile();
+    outfile = fp;
+    AIOUSB_LogStartAsync( 0 );
+    AIOUSB_LOG( "queued %d\n", 1 );
+    AIOUSB_LogStopAsync();
+    AIOUSB_LOG( "direct %d\n", 2 );
+    outfile = NULL;
+
+    char *text = read_log( fp );
+    EXPECT_STREQ( "queued 1\n" AIO_RESET_STR "direct 2\n" AIO_RESET_STR, text );
+    free( text );
+    fclose( fp );
+}
+
+TEST(AIOUSBLog, RecordsQueuedAfterStoppingAreWritten )
+{
+    FILE *fp = tmpfile();
+    outfile = fp;
+    AIOUSB_LogStartAsync( 0 );
+    AIOUSB_LogRecord( "early %d\n", 1 );
+    AIOUSB_LogStopAsync();
+    /* What a thread that saw aiousb_log_async just before it was cleared does */
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_LogRecord( "late %d\n", 2 ) );
+    outfile = NULL;
+
+    char *text = read_log( fp );
+    EXPECT_STREQ( "early 1\nlate 2\n", text );
+    free( text );
+    fclose( fp );
+}
+
+static void *log_many( void *object )
+{
+    for ( int i = 0; i < 2000; i ++ )
+        AIOUSB_LogRecord( "thread %ld line %d\n", (long)object, i );
+    return NULL;
+}
+
+TEST(AIOUSBLog, EveryMessageIsWrittenOrCountedAsDropped )
+{
+    FILE *fp = tmpfile();
+    pthread_t threads[3];
+    unsigned long long dropped = AIOUSB_LogDropped();
+    outfile = fp;
+    AIOUSB_LogStartAsync( 8 );
+    for ( long i = 0; i < 3; i ++ )
+        pthread_create( &threads[i], NULL, log_many, (void *)i );
+    for ( int i = 0; i < 3; i ++ )
+        pthread_join( threads[i], NULL );
+    AIOUSB_LogStopAsync();
+    outfile = NULL;
+    dropped = AIOUSB_LogDropped() - dropped;
+
+    char *text = read_log( fp );
+    unsigned long long lines = 0, last[3] = {0, 0, 0};
+    for ( char *line = strtok( text, "\n" ); line; line = strtok( NULL, "\n" ) ) {
+        long thread;
+        int n;
+        if ( sscanf( line, "thread %ld line %d", &thread, &n ) == 2 ) {
+            lines ++;
+            EXPECT_GE( (unsigned long long)n, last[thread] ) << "A thread's messages stay in order";
+            last[thread] = n;
+        }
+    }
+    EXPECT_EQ( 3 * 2000u, lines + dropped );
+    free( text );
+    fclose( fp );
+}
+
+int main(int argc, char *argv[] )
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+#endif
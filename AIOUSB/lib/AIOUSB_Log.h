@@ -37,10 +37,20 @@ namespace AIOUSB
 
 #undef AIOUSB_LOG
 
+#define AIO_LOG_UNLIKELY(x) __builtin_expect( !!(x), 0 )
+
+/**
+ * Once AIOUSB_LogStartAsync() has been called the message is only copied
+ * into the calling thread's ring, see AIOUSB_Log.c
+ **/
 #define AIOUSB_LOG(fmt, ... ) do {                                      \
+    if ( aiousb_log_async ) {                                           \
+        AIOUSB_LogRecord( fmt AIO_RESET_STR ,  ##__VA_ARGS__ );         \
+    } else {                                                            \
         pthread_mutex_lock( &message_lock );                            \
-    fprintf( (!outfile ? stdout : outfile ), fmt AIO_RESET_STR ,  ##__VA_ARGS__ ); \
-    pthread_mutex_unlock(&message_lock);                                \
+        fprintf( (!outfile ? stdout : outfile ), fmt AIO_RESET_STR ,  ##__VA_ARGS__ ); \
+        pthread_mutex_unlock(&message_lock);                            \
+    }                                                                   \
   } while ( 0 )
 
 
@@ -70,18 +80,18 @@ extern AIO_DEBUG_LEVEL AIOUSB_DEBUG_LEVEL;
  **/
 
 #define AIOUSB_TAP(x,...)  if( 1 ) { AIOUSB_LOG( ( x ? "ok -" : "not ok" ) __VA_ARGS__ ); }
-#define AIOUSB_DEVEL(...)  do { if ( AIOUSB_DEBUG_LEVEL & AIODEVEL_LEVEL ) { AIOUSB_LOG(AIO_DEVEL_STR __VA_ARGS__ ); } } while(0)
-#define AIOUSB_DEBUG(...)  do { if ( AIOUSB_DEBUG_LEVEL & AIODEBUG_LEVEL ) { AIOUSB_LOG(AIO_DEBUG_STR __VA_ARGS__ ); } } while(0)
-#define AIOUSB_WARN(...)   do { if ( AIOUSB_DEBUG_LEVEL & AIOWARN_LEVEL )  { AIOUSB_LOG(AIO_WARN_STR  __VA_ARGS__ ); } } while(0)
-#define AIOUSB_INFO(...)   do { if ( AIOUSB_DEBUG_LEVEL & AIOINFO_LEVEL )  { AIOUSB_LOG(AIO_INFO_STR  __VA_ARGS__ ); } } while(0)
-#define AIOUSB_ERROR(...)  do { if ( AIOUSB_DEBUG_LEVEL & AIOERROR_LEVEL ) { AIOUSB_LOG(AIO_ERROR_STR __VA_ARGS__ ); } } while(0)
-#define AIOUSB_FATAL(...)  do { if ( AIOUSB_DEBUG_LEVEL & AIOFATAL_LEVEL ) { AIOUSB_LOG(AIO_FATAL_STR __VA_ARGS__ ); } } while(0)
+#define AIOUSB_DEVEL(...)  do { if ( AIO_LOG_UNLIKELY( AIOUSB_DEBUG_LEVEL & AIODEVEL_LEVEL ) ) { AIOUSB_LOG(AIO_DEVEL_STR __VA_ARGS__ ); } } while(0)
+#define AIOUSB_DEBUG(...)  do { if ( AIO_LOG_UNLIKELY( AIOUSB_DEBUG_LEVEL & AIODEBUG_LEVEL ) ) { AIOUSB_LOG(AIO_DEBUG_STR __VA_ARGS__ ); } } while(0)
+#define AIOUSB_WARN(...)   do { if ( AIO_LOG_UNLIKELY( AIOUSB_DEBUG_LEVEL & AIOWARN_LEVEL ) )  { AIOUSB_LOG(AIO_WARN_STR  __VA_ARGS__ ); } } while(0)
+#define AIOUSB_INFO(...)   do { if ( AIO_LOG_UNLIKELY( AIOUSB_DEBUG_LEVEL & AIOINFO_LEVEL ) )  { AIOUSB_LOG(AIO_INFO_STR  __VA_ARGS__ ); } } while(0)
+#define AIOUSB_ERROR(...)  do { if ( AIO_LOG_UNLIKELY( AIOUSB_DEBUG_LEVEL & AIOERROR_LEVEL ) ) { AIOUSB_LOG(AIO_ERROR_STR __VA_ARGS__ ); } } while(0)
+#define AIOUSB_FATAL(...)  do { if ( AIO_LOG_UNLIKELY( AIOUSB_DEBUG_LEVEL & AIOFATAL_LEVEL ) ) { AIOUSB_LOG(AIO_FATAL_STR __VA_ARGS__ ); } } while(0)
 
 #else
 
 #define AIOUSB_DEVEL( ... ) if ( 0 ) { }
 #define AIOUSB_DEBUG( ... ) if ( 0 ) { }
-#define AIOUSB_WARN(...)    if ( 0 ) { AIOUSB_LOG("<Warn>\t"  __VA_ARGS__ ) }
+#define AIOUSB_WARN(...)    if ( 0 ) { AIOUSB_LOG("<Warn>\t"  __VA_ARGS__ ); }
 #define AIOUSB_INFO(...)    if ( 0 ) { AIOUSB_LOG("<Info>\t"  __VA_ARGS__ ); }
 #define AIOUSB_ERROR(...)  AIOUSB_LOG("<Error>\t" __VA_ARGS__ )
 #define AIOUSB_FATAL(...)  AIOUSB_LOG("<Fatal>\t" __VA_ARGS__ )
@@ -98,6 +108,20 @@ extern int LOG_LEVEL;
 extern pthread_t cont_thread;
 extern pthread_mutex_t message_lock;
 extern FILE *outfile;
+extern volatile int aiousb_log_async;
+
+#define AIOUSB_LOG_RECORD_SIZE      256
+#define AIOUSB_LOG_RING_RECORDS     1024
+
+/* BEGIN AIOUSB_API */
+
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogStartAsync( unsigned ring_records );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogStopAsync( void );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogFlush( void );
+PUBLIC_EXTERN unsigned long long AIOUSB_LogDropped( void );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogRecord( const char *fmt, ... ) __attribute__((format(printf,1,2)));
+
+/* END AIOUSB_API */
 
 #ifdef __aiousb_cplusplus
 }
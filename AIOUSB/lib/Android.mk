@@ -30,6 +30,7 @@ LOCAL_SRC_FILES :=  $(MYLOCAL_DIR)/ADCConfigBlock.c \
 		    $(MYLOCAL_DIR)/AIOConfiguration.c \
 		    $(MYLOCAL_DIR)/AIOContinuousBuffer.c \
 		    $(MYLOCAL_DIR)/AIOCountsConverter.c \
+		    $(MYLOCAL_DIR)/AIOConversionPlan.c \
 		    $(MYLOCAL_DIR)/AIODeviceInfo.c \
 		    $(MYLOCAL_DIR)/AIODeviceQuery.c \
 		    $(MYLOCAL_DIR)/AIODeviceTable.c \
@@ -37,6 +38,8 @@ LOCAL_SRC_FILES :=  $(MYLOCAL_DIR)/ADCConfigBlock.c \
 		    $(MYLOCAL_DIR)/AIOFifo.c \
 		    $(MYLOCAL_DIR)/AIOList.c \
 		    $(MYLOCAL_DIR)/AIOProductTypes.c \
+		    $(MYLOCAL_DIR)/AIORecorder.c \
+		    $(MYLOCAL_DIR)/AIOThreadPolicy.c \
 		    $(MYLOCAL_DIR)/AIOTuple.c \
 		    $(MYLOCAL_DIR)/AIOUSB_ADC.c \
 		    $(MYLOCAL_DIR)/AIOUSB_Core.c \
@@ -52,6 +55,11 @@ LOCAL_SRC_FILES :=  $(MYLOCAL_DIR)/ADCConfigBlock.c \
 		    $(MYLOCAL_DIR)/cJSON.c \
 		    $(MYLOCAL_DIR)/CStringArray.c \
 		    $(MYLOCAL_DIR)/DIOBuf.c \
+		    $(MYLOCAL_DIR)/USBCapture.c \
+		    $(MYLOCAL_DIR)/USBSimulator.c \
+		    $(MYLOCAL_DIR)/AIOHistogram.c \
+		    $(MYLOCAL_DIR)/AIODIOStream.c \
+		    $(MYLOCAL_DIR)/AIODIOWatch.c \
 		    $(MYLOCAL_DIR)/USBDevice.c \
 
 LOCAL_STATIC_LIBRARIES := usb-1.0
@@ -78,6 +86,7 @@ LOCAL_SRC_FILES :=  $(MYLOCAL_DIR)/ADCConfigBlock.c \
 		    $(MYLOCAL_DIR)/AIOConfiguration.c \
 		    $(MYLOCAL_DIR)/AIOContinuousBuffer.c \
 		    $(MYLOCAL_DIR)/AIOCountsConverter.c \
+		    $(MYLOCAL_DIR)/AIOConversionPlan.c \
 		    $(MYLOCAL_DIR)/AIODeviceInfo.c \
 		    $(MYLOCAL_DIR)/AIODeviceQuery.c \
 		    $(MYLOCAL_DIR)/AIODeviceTable.c \
@@ -85,6 +94,8 @@ LOCAL_SRC_FILES :=  $(MYLOCAL_DIR)/ADCConfigBlock.c \
 		    $(MYLOCAL_DIR)/AIOFifo.c \
 		    $(MYLOCAL_DIR)/AIOList.c \
 		    $(MYLOCAL_DIR)/AIOProductTypes.c \
+		    $(MYLOCAL_DIR)/AIORecorder.c \
+		    $(MYLOCAL_DIR)/AIOThreadPolicy.c \
 		    $(MYLOCAL_DIR)/AIOTuple.c \
 		    $(MYLOCAL_DIR)/AIOUSB_ADC.c \
 		    $(MYLOCAL_DIR)/AIOUSB_Core.c \
@@ -100,6 +111,11 @@ LOCAL_SRC_FILES :=  $(MYLOCAL_DIR)/ADCConfigBlock.c \
 		    $(MYLOCAL_DIR)/cJSON.c \
 		    $(MYLOCAL_DIR)/CStringArray.c \
 		    $(MYLOCAL_DIR)/DIOBuf.c \
+		    $(MYLOCAL_DIR)/USBCapture.c \
+		    $(MYLOCAL_DIR)/USBSimulator.c \
+		    $(MYLOCAL_DIR)/AIOHistogram.c \
+		    $(MYLOCAL_DIR)/AIODIOStream.c \
+		    $(MYLOCAL_DIR)/AIODIOWatch.c \
 		    $(MYLOCAL_DIR)/USBDevice.c \
 
 LOCAL_STATIC_LIBRARIES := usb-1.0
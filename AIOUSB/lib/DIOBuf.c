@@ -17,12 +17,51 @@
 namespace AIOUSB {
 #endif
 
+#define DIOBUF_WORD_BITS            64
+#define DIOBUF_NUM_WORDS(bits)      ( ( (bits) + DIOBUF_WORD_BITS - 1 ) / DIOBUF_WORD_BITS )
+
+/**
+ * Position pos counts from the left of the string form, index from the
+ * right. Each byte holds eight positions, the leftmost in its top bit.
+ */
+#define DIOBUF_POS(buf, index)      ( (buf)->size - 1 - (index) )
+#define DIOBUF_BYTE(buf, pos)       ( ((unsigned char *)(buf)->words)[ (pos) / BITS_PER_BYTE ] )
+#define DIOBUF_BIT(pos)             ( 0x80 >> ( (pos) % BITS_PER_BYTE ) )
+
 
 int _determine_strbuf_size( unsigned size )
 {
     return (((size / BITS_PER_BYTE)+1)*BITS_PER_BYTE) + strlen("0x") + 1;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Zeroes the bits past size so that word wide operations never see
+ *        them
+ */
+static void _clear_padding( DIOBuf *buf )
+{
+    unsigned char *bytes = (unsigned char *)buf->words;
+    unsigned used = DIOBUF_NUM_BYTES( buf->size );
+    if ( buf->size % BITS_PER_BYTE )
+        bytes[used - 1] &= (unsigned char)( 0xff00 >> ( buf->size % BITS_PER_BYTE ) );
+    memset( bytes + used, 0, buf->num_words * sizeof(uint64_t) - used );
+}
+
+/*----------------------------------------------------------------------------*/
+static char *_ensure_strbuf( DIOBuf *buf )
+{
+    int needed = _determine_strbuf_size( buf->size );
+    if ( !buf->strbuf || buf->strbuf_size < needed ) {
+        char *tmp = (char *)realloc( buf->strbuf, needed );
+        if ( !tmp )
+            return NULL;
+        buf->strbuf = tmp;
+        buf->strbuf_size = needed;
+    }
+    return buf->strbuf;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Constructor for creating a new DIOBuf object. The parameter represents
@@ -32,33 +71,18 @@ int _determine_strbuf_size( unsigned size )
  * @return DIOBuf * or Null if failure
  */
 DIOBuf *NewDIOBuf( unsigned size ) {
-    DIOBuf *tmp = (DIOBuf *)malloc( sizeof(DIOBuf) );
+    DIOBuf *tmp = (DIOBuf *)calloc( 1, sizeof(DIOBuf) );
     if( ! tmp ) 
         return tmp;
-    tmp->buffer = (DIOBufferType *)calloc(size, sizeof(DIOBufferType));
-    if ( !tmp->buffer ) {
+    tmp->num_words = ( size ? DIOBUF_NUM_WORDS( size ) : 1 );
+    tmp->words = (uint64_t *)calloc( tmp->num_words, sizeof(uint64_t) );
+    if ( !tmp->words ) {
         free( tmp );
         return NULL;
     }
-    tmp->strbuf_size = _determine_strbuf_size( size );
-    tmp->strbuf = (char *)malloc(sizeof(char) * tmp->strbuf_size );
-    if ( !tmp->strbuf ) {
-        free(tmp->buffer);
-        free(tmp);
-        return NULL;
-    }
     tmp->size = size;
     return tmp;
 }
-/*----------------------------------------------------------------------------*/
-void _copy_to_buf( DIOBuf *tmp, const char *ary, int size_array ) {
-    int tot_bit_size = tmp->size;
-    int i; 
-    for ( i = 0 ; i < tot_bit_size ; i ++ ) { 
-        int curindex = i / 8;
-        tmp->buffer[ i ] = (( ary[curindex] >> (( 8-1 ) - (i%8)) ) & 1 ? 1 : 0 );
-    }
-}
 
 /*----------------------------------------------------------------------------*/
 /**
@@ -72,12 +96,11 @@ void _copy_to_buf( DIOBuf *tmp, const char *ary, int size_array ) {
  *         memory allocation problems.
  */
 DIOBuf *NewDIOBufFromChar( const char *ary, int size_array ) {
-    int tot_bit_size = size_array*8;
-    DIOBuf *tmp = NewDIOBuf( tot_bit_size );
+    DIOBuf *tmp = NewDIOBuf( size_array * BITS_PER_BYTE );
     if( ! tmp ) 
       return tmp;
 
-    _copy_to_buf( tmp, ary , size_array );
+    memcpy( tmp->words, ary, size_array );
     return tmp;
 }
 
@@ -88,13 +111,13 @@ DIOBuf *NewDIOBufFromChar( const char *ary, int size_array ) {
  * @return DIOBuf if successful or NULL if there was an error.
  */
 DIOBuf *NewDIOBufFromBinStr( const char *ary ) {
-    int tot_bit_size = strlen(ary);
+    unsigned tot_bit_size = strlen(ary);
     DIOBuf *tmp = NewDIOBuf( tot_bit_size );
-    int i;
     if( ! tmp ) 
         return tmp;
-    for ( i = tot_bit_size - 1; i >= 0 ; i -- ) { 
-        DIOBufSetIndex( tmp, tot_bit_size - 1 - i  , (ary[i] == '0' ? 0 : 1 ) );
+    for ( unsigned pos = 0; pos < tot_bit_size; pos ++ ) { 
+        if ( ary[pos] != '0' )
+            DIOBUF_BYTE( tmp, pos ) |= DIOBUF_BIT( pos );
     }
     return tmp;
 }
@@ -112,7 +135,7 @@ DIOBuf *DIOBufReplaceString( DIOBuf *buf, char *ary, int size_array )
 { 
     if ( buf  )
         if( DIOBufResize( buf, size_array*8 ) )
-            _copy_to_buf( buf, ary, size_array );
+            memcpy( buf->words, ary, size_array );
     return buf;
 }
 
@@ -133,30 +156,30 @@ DIOBuf *DIOBufReplaceBinString( DIOBuf *buf, char *bitstr )
 void DeleteDIOBuf( DIOBuf *buf ) 
 {
     buf->size = 0;
-    free( buf->buffer );
+    free( buf->words );
     free( buf->strbuf );
     free( buf );
 }
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Changes the number of bits. The string form keeps its left end,
+ *        new positions on its right are 0.
+ * @return buf, or NULL if memory ran out and buf was left as it was
+ */
 DIOBuf *DIOBufResize( DIOBuf *buf , unsigned newsize ) 
 {
-    buf->buffer = (unsigned char *)realloc( buf->buffer, newsize*sizeof(unsigned char));
-    if ( !buf->buffer ) {
-        buf->size = 0;
-        buf->strbuf_size = _determine_strbuf_size( newsize );
-        buf->strbuf = (char *)realloc( buf->strbuf, buf->strbuf_size * sizeof(char) );
-        buf->strbuf[0] = '\0';
-        return NULL;
+    unsigned num_words = ( newsize ? DIOBUF_NUM_WORDS( newsize ) : 1 );
+    if ( num_words != buf->num_words ) {
+        uint64_t *words = (uint64_t *)realloc( buf->words, num_words * sizeof(uint64_t) );
+        if ( !words )
+            return NULL;
+        if ( num_words > buf->num_words )
+            memset( words + buf->num_words, 0, ( num_words - buf->num_words ) * sizeof(uint64_t) );
+        buf->words = words;
+        buf->num_words = num_words;
     }
-    if( newsize > buf->size )
-        memset( &buf->buffer[buf->size], 0, ( newsize - buf->size ));
-
-    buf->strbuf_size = _determine_strbuf_size( newsize );
-    buf->strbuf = (char *)realloc( buf->strbuf, buf->strbuf_size * sizeof(char));
-
-    if ( !buf->strbuf )
-        return NULL;
     buf->size = newsize;
+    _clear_padding( buf );
     return buf;
 }
 /*----------------------------------------------------------------------------*/
@@ -169,6 +192,18 @@ unsigned DIOBufByteSize( DIOBuf *buf ) {
   return buf->size / BITS_PER_BYTE;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The packed bits themselves, DIOBufByteSize() bytes rounded up,
+ *        in the same order as DIOBufToBinary() but without a copy. Writes
+ *        through it change buf; it stays valid until buf is resized or
+ *        deleted.
+ */
+unsigned char *DIOBufRawBytes( DIOBuf *buf ) {
+    AIO_ASSERT_RET( NULL, buf );
+    return (unsigned char *)buf->words;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Converts the DIOBuf buf into a string of 1's and 0's representing the 
@@ -178,11 +213,10 @@ unsigned DIOBufByteSize( DIOBuf *buf ) {
  *         errno is set.
  */
 char *DIOBufToString( DIOBuf *buf ) {
-    
-  unsigned i;
-  memset(buf->strbuf,0, buf->strbuf_size );
-  for( i = 0; i < buf->size ; i ++ )
-      buf->strbuf[i] = ( buf->buffer[i] == 0 ? '0' : '1' );
+  if ( !_ensure_strbuf( buf ) )
+      return NULL;
+  for( unsigned pos = 0; pos < buf->size ; pos ++ )
+      buf->strbuf[pos] = ( DIOBUF_BYTE( buf, pos ) & DIOBUF_BIT( pos ) ? '1' : '0' );
   buf->strbuf[buf->size] = '\0';
   return buf->strbuf;
 }
@@ -198,34 +232,29 @@ char *DIOBufToString( DIOBuf *buf ) {
  */
 char *DIOBufToHex( DIOBuf *buf ) {
     AIO_ASSERT_RET( NULL, buf );
+    static const char digits[] = "0123456789abcdef";
 
-    int size = DIOBufSize(buf) / BITS_PER_BYTE + ( DIOBufSize(buf) % BITS_PER_BYTE > 0 );
-    char *tmp = (char *)malloc( size );
-   
-    memset( buf->strbuf, 0, buf->strbuf_size );
-    memcpy( tmp, DIOBufToBinary( buf ), size );
-
-
-    strcpy(&buf->strbuf[0], "0x" );
-    int j = strlen(buf->strbuf);
-
-    for ( int i = 0 ; i <  size ; i ++ , j = strlen(buf->strbuf)) {
-        sprintf(&buf->strbuf[j], "%.2x", (unsigned char)tmp[i] );
+    if ( !_ensure_strbuf( buf ) )
+        return NULL;
+    unsigned char *bytes = DIOBufRawBytes( buf );
+    char *dest = buf->strbuf;
+    *dest++ = '0';
+    *dest++ = 'x';
+    for ( unsigned i = 0 ; i < DIOBUF_NUM_BYTES( buf->size ) ; i ++ ) {
+        *dest++ = digits[ bytes[i] >> 4 ];
+        *dest++ = digits[ bytes[i] & 0xf ];
     }
-    buf->strbuf[j] = 0;
-    free(tmp);
+    *dest = 0;
     return buf->strbuf;
 }
 
 /*----------------------------------------------------------------------------*/
 char *DIOBufToBinary( DIOBuf *buf ) {
     AIO_ASSERT_RET( NULL, buf );
-    int i, j;
+    if ( !_ensure_strbuf( buf ) )
+        return NULL;
     memset(buf->strbuf, 0, buf->strbuf_size );
-    for ( i = 0, j = 0 ; i < (int)DIOBufSize(buf) ; i ++ , j = ( (j+1) % 8 )) { 
-        buf->strbuf[i / BITS_PER_BYTE] |= buf->buffer[i] << ( 7 - (j % BITS_PER_BYTE) );
-    }
-    buf->strbuf[ ((i/ BITS_PER_BYTE)+1)*BITS_PER_BYTE ] = '\0';
+    memcpy(buf->strbuf, buf->words, DIOBUF_NUM_BYTES( buf->size ) );
     return buf->strbuf;
 }
 
@@ -241,6 +270,8 @@ char *DIOBufToBinary( DIOBuf *buf ) {
 char *DIOBufToInvertedBinary( DIOBuf *buf ) {
     int i;
     char *orig = DIOBufToBinary(buf);
+    if ( !orig )
+        return NULL;
     int size = DIOBufSize(buf);
     int size_to_alloc = ((size / BITS_PER_BYTE)+1);
     char *tmp  = (char *)malloc( size_to_alloc );
@@ -266,7 +297,11 @@ AIORET_TYPE DIOBufSetIndex( DIOBuf *buf, int index, unsigned value )
     AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_INDEX, index < (int)buf->size && index >= 0 );
     AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, value == 0 || value == 1 );
 
-    buf->buffer[buf->size - 1 - index] = ( value == AIOUSB_TRUE ? 1 : AIOUSB_FALSE );
+    unsigned pos = DIOBUF_POS( buf, index );
+    if ( value )
+        DIOBUF_BYTE( buf, pos ) |= DIOBUF_BIT( pos );
+    else
+        DIOBUF_BYTE( buf, pos ) &= ~DIOBUF_BIT( pos );
     return 0;
 }
 
@@ -280,7 +315,21 @@ AIORET_TYPE DIOBufSetIndex( DIOBuf *buf, int index, unsigned value )
 AIORET_TYPE DIOBufGetIndex( DIOBuf *buf, int index ) {
     AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_INDEX, index < (int)buf->size && index >= 0 );
   
-    return buf->buffer[buf->size - 1 - index ];
+    unsigned pos = DIOBUF_POS( buf, index );
+    return ( DIOBUF_BYTE( buf, pos ) & DIOBUF_BIT( pos ) ? 1 : 0 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Flips the bit at index
+ * @return The bit's new value, < 0 on failure
+ */
+AIORET_TYPE DIOBufToggleIndex( DIOBuf *buf, int index ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_INDEX, index < (int)buf->size && index >= 0 );
+
+    unsigned pos = DIOBUF_POS( buf, index );
+    DIOBUF_BYTE( buf, pos ) ^= DIOBUF_BIT( pos );
+    return ( DIOBUF_BYTE( buf, pos ) & DIOBUF_BIT( pos ) ? 1 : 0 );
 }
 
 /*----------------------------------------------------------------------------*/
@@ -288,6 +337,13 @@ AIORET_TYPE DIOBufGetByteAtIndex( DIOBuf *buf, unsigned index , char *value ) {
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     if ( index >= buf->size / BITS_PER_BYTE )   
         return -AIOUSB_ERROR_INVALID_INDEX;
+
+    /* Whole bytes line up with the packed ones, counted from the other end */
+    if ( buf->size % BITS_PER_BYTE == 0 ) {
+        *value = DIOBufRawBytes( buf )[ buf->size / BITS_PER_BYTE - 1 - index ];
+        return retval;
+    }
+
     *value = 0;
     int actindex = index * BITS_PER_BYTE;
     for ( int i = actindex ; i < actindex + BITS_PER_BYTE ; i ++ ) {
@@ -301,6 +357,12 @@ AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value ) {
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     if ( index >= buf->size / BITS_PER_BYTE )   
         return -AIOUSB_ERROR_INVALID_INDEX;
+
+    if ( buf->size % BITS_PER_BYTE == 0 ) {
+        DIOBufRawBytes( buf )[ buf->size / BITS_PER_BYTE - 1 - index ] = (unsigned char)value;
+        return retval;
+    }
+
     int actindex = index * BITS_PER_BYTE;
     for ( int i = actindex ; i < actindex + BITS_PER_BYTE ; i ++ ) {
         DIOBufSetIndex( buf, i,  (( (1 << i % BITS_PER_BYTE ) & value ) ? 1 : 0 ));
@@ -309,6 +371,125 @@ AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value ) {
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets every bit of buf to value, 0 or 1
+ */
+AIORET_TYPE DIOBufSetAll( DIOBuf *buf, unsigned value ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, value == 0 || value == 1 );
+    memset( buf->words, value ? 0xff : 0, buf->num_words * sizeof(uint64_t) );
+    _clear_padding( buf );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DIOBufToggleAll( DIOBuf *buf ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf );
+    for ( unsigned i = 0; i < buf->num_words; i ++ )
+        buf->words[i] = ~buf->words[i];
+    _clear_padding( buf );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf &= other, both must have the same size
+ */
+AIORET_TYPE DIOBufAnd( DIOBuf *buf, DIOBuf *other ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf && other );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->size == other->size );
+    for ( unsigned i = 0; i < buf->num_words; i ++ )
+        buf->words[i] &= other->words[i];
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf |= other, both must have the same size
+ */
+AIORET_TYPE DIOBufOr( DIOBuf *buf, DIOBuf *other ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf && other );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->size == other->size );
+    for ( unsigned i = 0; i < buf->num_words; i ++ )
+        buf->words[i] |= other->words[i];
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf ^= other, both must have the same size
+ */
+AIORET_TYPE DIOBufXor( DIOBuf *buf, DIOBuf *other ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf && other );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->size == other->size );
+    for ( unsigned i = 0; i < buf->num_words; i ++ )
+        buf->words[i] ^= other->words[i];
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the bits of value that are set in mask into buf, leaving
+ *        the others alone. All three must have the same size.
+ */
+AIORET_TYPE DIOBufSetMasked( DIOBuf *buf, DIOBuf *mask, DIOBuf *value ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf && mask && value );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->size == mask->size && buf->size == value->size );
+    for ( unsigned i = 0; i < buf->num_words; i ++ )
+        buf->words[i] = ( buf->words[i] & ~mask->words[i] ) | ( value->words[i] & mask->words[i] );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of bits that are 1
+ */
+AIORET_TYPE DIOBufPopCount( DIOBuf *buf ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf );
+    AIORET_TYPE count = 0;
+    for ( unsigned i = 0; i < buf->num_words; i ++ )
+        count += __builtin_popcountll( buf->words[i] );
+    return count;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Finds the indices at which buf and other differ
+ * @param buf
+ * @param other A DIOBuf of the same size
+ * @param indices Receives the first maxindices of them in increasing order,
+ *        may be NULL if maxindices is 0
+ * @param maxindices
+ * @return How many indices differ, which may be more than maxindices
+ */
+AIORET_TYPE DIOBufDiff( DIOBuf *buf, DIOBuf *other, unsigned *indices, unsigned maxindices ) {
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, buf && other );
+    AIO_ASSERT_RET( -AIOUSB_ERROR_INVALID_PARAMETER, indices || maxindices == 0 );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, buf->size == other->size );
+
+    AIORET_TYPE count = 0;
+    /* The highest positions are the lowest indices, so walk backwards */
+    for ( unsigned w = buf->num_words; w-- > 0; ) {
+        uint64_t changed = buf->words[w] ^ other->words[w];
+        if ( !changed )
+            continue;
+        unsigned char *bytes = (unsigned char *)&changed;
+        for ( unsigned j = sizeof(uint64_t); j-- > 0; ) {
+            unsigned bits = bytes[j];
+            while ( bits ) {
+                unsigned k = __builtin_ctz( bits );
+                unsigned pos = ( w * sizeof(uint64_t) + j ) * BITS_PER_BYTE + 7 - k;
+                if ( (unsigned)count < maxindices )
+                    indices[count] = DIOBUF_POS( buf, pos );
+                count ++;
+                bits &= bits - 1;
+            }
+        }
+    }
+    return count;
+}
+
 #ifdef __cplusplus 
 }
 #endif
@@ -495,6 +676,93 @@ TEST(DIOBuf, Toggle_interview ) {
     free(tmp);
 }
 
+TEST(DIOBuf, RawBytesAreTheBinaryForm ) {
+    DIOBuf *buf = NewDIOBufFromChar( "\x12\x34\x56\x78\x9a\xbc\xde\xf0\x11\x22\x33\x44", 12 );
+    EXPECT_EQ( 96u, DIOBufSize(buf) );
+    EXPECT_EQ( 0, memcmp( DIOBufRawBytes(buf), DIOBufToBinary(buf), 12 ) );
+    EXPECT_EQ( 0x12, DIOBufRawBytes(buf)[0] );
+
+    DIOBufRawBytes(buf)[11] = 0x45;
+    EXPECT_EQ( 1, DIOBufGetIndex( buf, 0 ) );
+    EXPECT_EQ( 0, DIOBufGetIndex( buf, 1 ) );
+    char val;
+    DIOBufGetByteAtIndex( buf, 0, &val );
+    EXPECT_EQ( 0x45, (unsigned char)val );
+
+    DIOBufResize( buf, 12 );
+    EXPECT_STREQ( "000100100011", DIOBufToString(buf) ) << "Resizing keeps the left of the string";
+    DIOBufResize( buf, 20 );
+    EXPECT_STREQ( "00010010001100000000", DIOBufToString(buf) );
+    DeleteDIOBuf( buf );
+}
+
+TEST(DIOBuf, WordOperations ) {
+    DIOBuf *buf = NewDIOBuf( 96 );
+    DIOBuf *mask = NewDIOBuf( 96 );
+    DIOBuf *value = NewDIOBuf( 96 );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufSetAll( buf, 1 ) );
+    EXPECT_EQ( 96, DIOBufPopCount( buf ) );
+    EXPECT_EQ( 0, DIOBufToggleIndex( buf, 95 ) );
+    EXPECT_EQ( 95, DIOBufPopCount( buf ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufToggleAll( buf ) );
+    EXPECT_EQ( 1, DIOBufPopCount( buf ) );
+    EXPECT_EQ( 1, DIOBufGetIndex( buf, 95 ) );
+
+    DIOBufSetIndex( mask, 3, 1 );
+    DIOBufSetIndex( mask, 70, 1 );
+    DIOBufSetIndex( mask, 95, 1 );
+    DIOBufSetIndex( value, 3, 1 );
+    DIOBufSetIndex( value, 4, 1 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufSetMasked( buf, mask, value ) );
+    EXPECT_EQ( 1, DIOBufPopCount( buf ) );
+    EXPECT_EQ( 1, DIOBufGetIndex( buf, 3 ) );
+    EXPECT_EQ( 0, DIOBufGetIndex( buf, 4 ) ) << "Outside the mask";
+    EXPECT_EQ( 0, DIOBufGetIndex( buf, 95 ) );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufOr( buf, mask ) );
+    EXPECT_EQ( 3, DIOBufPopCount( buf ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufAnd( buf, value ) );
+    EXPECT_EQ( 1, DIOBufPopCount( buf ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufXor( buf, value ) );
+    EXPECT_EQ( 1, DIOBufPopCount( buf ) );
+    EXPECT_EQ( 1, DIOBufGetIndex( buf, 4 ) );
+
+    DIOBuf *small = NewDIOBuf( 8 );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, DIOBufAnd( buf, small ) );
+    DeleteDIOBuf( small );
+
+    DeleteDIOBuf( buf );
+    DeleteDIOBuf( mask );
+    DeleteDIOBuf( value );
+}
+
+TEST(DIOBuf, DiffListsChangedIndices ) {
+    DIOBuf *before = NewDIOBufFromBinStr( "1010000000000000000000000000000000000000000000000000000000000000000000001" );
+    DIOBuf *after = NewDIOBufFromBinStr(  "0010000000000000000000000000000000000000000000000000000000000000000100000" );
+    unsigned indices[4];
+
+    ASSERT_EQ( 3, DIOBufDiff( before, after, indices, 4 ) );
+    EXPECT_EQ( 0u, indices[0] );
+    EXPECT_EQ( 5u, indices[1] );
+    EXPECT_EQ( 72u, indices[2] );
+    EXPECT_EQ( 3, DIOBufDiff( before, after, indices, 1 ) );
+    EXPECT_EQ( 0, DIOBufDiff( before, before, NULL, 0 ) );
+
+    DeleteDIOBuf( before );
+    DeleteDIOBuf( after );
+}
+
+TEST(DIOBuf, OddSizesKeepPaddingClear ) {
+    DIOBuf *buf = NewDIOBuf( 13 );
+    DIOBufSetAll( buf, 1 );
+    EXPECT_EQ( 13, DIOBufPopCount( buf ) );
+    EXPECT_STREQ( "0xfff8", DIOBufToHex( buf ) );
+    DIOBufToggleAll( buf );
+    EXPECT_EQ( 0, DIOBufPopCount( buf ) );
+    DeleteDIOBuf( buf );
+}
+
 
 int main( int argc , char *argv[] ) 
 {
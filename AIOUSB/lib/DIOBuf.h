@@ -32,21 +32,28 @@ namespace AIOUSB {
  * would be useful in case you are working with a network server that
  * would need to write an incoming byte stream to a digital buffer.
  *
- * @todo Provide Binary operators such as AND, OR, And Not between two
- * different DIOBuf's
+ * The bits are packed eight to a byte in 64 bit words. The bytes are
+ * in the order DIOBufToBinary() returns them, which is also the order
+ * DIO_ReadAllToDIOBuf() and DIO_ConfigureWithDIOBuf() move them to and
+ * from the board, so DIOBufRawBytes() can be handed to a transfer as it
+ * is. The string forms are only rendered when asked for.
  */
 
 typedef struct {
-    unsigned size;              /**< Size of the buffer */
-    unsigned char *buffer;      /**< Raw buffer data  */
-    char *strbuf;               /**< String representation in terms of 1's and 0's */
-    int strbuf_size;            /**< Strlen of the 1's and 0's version including some padding
-                                   room */
+    unsigned size;              /**< Bits in the buffer */
+    uint64_t *words;            /**< Packed bits, see DIOBufRawBytes() */
+    unsigned num_words;         /**< Words allocated, unused bits are kept 0 */
+    char *strbuf;               /**< String representation in terms of 1's and 0's, 
+                                   allocated the first time one is asked for */
+    int strbuf_size;            /**< Bytes allocated for strbuf */
 } DIOBuf;
 
 
 typedef unsigned char DIOBufferType ;
 
+/** Bytes DIOBufRawBytes() holds for a buffer of bits bits */
+#define DIOBUF_NUM_BYTES(bits)      ( ( (bits) + BITS_PER_BYTE - 1 ) / BITS_PER_BYTE )
+
 /* BEGIN AIOUSB_API */
 
 PUBLIC_EXTERN DIOBuf *NewDIOBuf ( unsigned size );
@@ -67,6 +74,17 @@ PUBLIC_EXTERN AIORET_TYPE DIOBufGetIndex( DIOBuf *buf, int index );
 PUBLIC_EXTERN AIORET_TYPE DIOBufGetByteAtIndex( DIOBuf *buf, unsigned index, char *value);
 PUBLIC_EXTERN AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value );
 
+PUBLIC_EXTERN unsigned char *DIOBufRawBytes( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufToggleIndex( DIOBuf *buf, int index );
+PUBLIC_EXTERN AIORET_TYPE DIOBufSetAll( DIOBuf *buf, unsigned value );
+PUBLIC_EXTERN AIORET_TYPE DIOBufToggleAll( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufAnd( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufOr( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufXor( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufSetMasked( DIOBuf *buf, DIOBuf *mask, DIOBuf *value );
+PUBLIC_EXTERN AIORET_TYPE DIOBufPopCount( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufDiff( DIOBuf *buf, DIOBuf *other, unsigned *indices, unsigned maxindices );
+
 /* END AIOUSB_API */
 
 #ifdef __aiousb_cplusplus
@@ -0,0 +1,626 @@
+/**
+ * @file   USBCapture.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Binary capture of USBDevice traffic and a USBDevice that replays it
+ *
+ * A capture wraps the usb_control_transfer and usb_bulk_transfer function
+ * pointers of a USBDevice and appends one USBCaptureRecord, followed by
+ * its payload, for every transfer that goes through them.
+ *
+ * A replay device is a USBDevice whose transfer functions answer from a
+ * capture file instead of the bus, so anything built on USBDevice, from
+ * DIO_Read8() to AIOContinuousBuf, runs against it unchanged. Control and
+ * bulk transfers keep separate places in the capture, since an acquisition
+ * thread and the thread driving it need not interleave their transfers the
+ * same way twice. Each transfer is answered by the next record of the same
+ * kind with the same request type and request ( or endpoint ), skipping
+ * any that the program being replayed did not ask for. When no record is
+ * left the transfer fails with LIBUSB_ERROR_NOT_FOUND, unless
+ * USB_REPLAY_LOOP was asked for.
+ */
+
+#include "USBCapture.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_Log.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/**
+ * @brief State of a replay device. The USBDevice comes first and the
+ * record index and payloads are part of the same allocation, so a replay
+ * device handed to the device table is released by DeleteUSBDevice() like
+ * any other.
+ */
+typedef struct usb_replay {
+    USBDevice usb;
+    pthread_mutex_t lock;
+    int flags;
+    size_t num_records;
+    size_t *offsets;                    /**< Of each record in data */
+    unsigned char *data;                /**< The capture file, header included */
+    size_t control_pos;                 /**< Next record to look at for a control transfer */
+    size_t bulk_pos;                    /**< Next record to look at for a bulk transfer */
+    uint64_t num_replayed;
+    uint64_t num_mismatches;
+} USBReplay;
+
+/*----------------------------------------------------------------------------*/
+static uint64_t _USBCaptureNanoseconds( const struct timespec *from, const struct timespec *to )
+{
+    return (uint64_t)( to->tv_sec - from->tv_sec ) * 1000000000ULL + to->tv_nsec - from->tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _USBCaptureWrite( USBCapture *cap, USBCaptureRecord *rec, const struct timespec *started, const unsigned char *data )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    rec->start_ns    = _USBCaptureNanoseconds( &cap->start, started );
+    rec->duration_ns = _USBCaptureNanoseconds( started, &now );
+
+    pthread_mutex_lock( &cap->lock );
+    if ( fwrite( rec, sizeof(*rec), 1, cap->file ) != 1 ||
+         ( rec->data_length && fwrite( data, rec->data_length, 1, cap->file ) != 1 ) ) {
+        AIOUSB_ERROR("Can't write USB capture record: %s\n", strerror(errno) );
+    } else {
+        cap->num_records ++;
+    }
+    pthread_mutex_unlock( &cap->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBCaptureControlTransfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                       uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    USBCapture *cap = (USBCapture *)usb->transport;
+    USBCaptureRecord rec;
+    struct timespec started;
+
+    clock_gettime( CLOCK_MONOTONIC, &started );
+    int result = cap->control_transfer( usb, request_type, bRequest, wValue, wIndex, data, wLength, timeout );
+
+    memset( &rec, 0, sizeof(rec) );
+    rec.kind         = USB_CAPTURE_CONTROL;
+    rec.request_type = request_type;
+    rec.bRequest     = bRequest;
+    rec.wValue       = wValue;
+    rec.wIndex       = wIndex;
+    rec.length       = wLength;
+    rec.result       = result;
+    if ( request_type & LIBUSB_ENDPOINT_IN )
+        rec.data_length = ( result > 0 ? MIN( result, (int)wLength ) : 0 );
+    else
+        rec.data_length = ( data ? wLength : 0 );
+
+    _USBCaptureWrite( cap, &rec, &started, data );
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBCaptureBulkTransfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                                    int *actual_length, unsigned int timeout )
+{
+    USBCapture *cap = (USBCapture *)usb->transport;
+    USBCaptureRecord rec;
+    struct timespec started;
+
+    clock_gettime( CLOCK_MONOTONIC, &started );
+    int result = cap->bulk_transfer( usb, endpoint, data, length, actual_length, timeout );
+
+    memset( &rec, 0, sizeof(rec) );
+    rec.kind          = USB_CAPTURE_BULK;
+    rec.request_type  = endpoint;
+    rec.length        = length;
+    rec.result        = result;
+    rec.actual_length = ( actual_length ? *actual_length : 0 );
+    rec.data_length   = ( rec.actual_length > 0 ? MIN( rec.actual_length, length ) : 0 );
+
+    _USBCaptureWrite( cap, &rec, &started, data );
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts recording every control and bulk transfer made through usb
+ * into fname, replacing anything already in the file
+ * @param fname Capture file to create
+ * @param usb Device whose transfers are recorded. It must not already be a
+ *        replay device or have a capture attached.
+ * @return The capture, or NULL on failure
+ */
+USBCapture *NewUSBCapture( const char *fname, USBDevice *usb )
+{
+    USBCaptureFileHeader header;
+    USBCapture *cap;
+
+    if ( !fname || !usb || usb->transport || !usb->usb_control_transfer || !usb->usb_bulk_transfer ) {
+        AIOUSB_ERROR("Can't capture this USBDevice\n");
+        return NULL;
+    }
+
+    cap = (USBCapture *)calloc( 1, sizeof(USBCapture) );
+    if ( !cap )
+        return NULL;
+
+    cap->file = fopen( fname, "wb" );
+    if ( !cap->file ) {
+        AIOUSB_ERROR("Can't create USB capture %s: %s\n", fname, strerror(errno) );
+        free( cap );
+        return NULL;
+    }
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, USB_CAPTURE_MAGIC, sizeof(USB_CAPTURE_MAGIC) );
+    header.version   = USB_CAPTURE_VERSION;
+    header.idVendor  = usb->deviceDesc.idVendor;
+    header.idProduct = usb->deviceDesc.idProduct;
+    if ( fwrite( &header, sizeof(header), 1, cap->file ) != 1 ) {
+        AIOUSB_ERROR("Can't write USB capture %s: %s\n", fname, strerror(errno) );
+        fclose( cap->file );
+        free( cap );
+        return NULL;
+    }
+
+    pthread_mutex_init( &cap->lock, NULL );
+    clock_gettime( CLOCK_MONOTONIC, &cap->start );
+
+    cap->usb                  = usb;
+    cap->control_transfer     = usb->usb_control_transfer;
+    cap->bulk_transfer        = usb->usb_bulk_transfer;
+    usb->transport            = cap;
+    usb->usb_control_transfer = _USBCaptureControlTransfer;
+    usb->usb_bulk_transfer    = _USBCaptureBulkTransfer;
+
+    return cap;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts back the device's own transfer functions and closes the
+ * capture file. No transfer may be in progress on the device.
+ */
+AIORET_TYPE DeleteUSBCapture( USBCapture *cap )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIO_ASSERT( cap );
+
+    cap->usb->usb_control_transfer = cap->control_transfer;
+    cap->usb->usb_bulk_transfer    = cap->bulk_transfer;
+    cap->usb->transport            = NULL;
+
+    if ( fclose( cap->file ) != 0 )
+        retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+    pthread_mutex_destroy( &cap->lock );
+    free( cap );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE USBCaptureGetNumberRecords( USBCapture *cap )
+{
+    AIO_ASSERT( cap );
+    pthread_mutex_lock( &cap->lock );
+    AIORET_TYPE retval = (AIORET_TYPE)cap->num_records;
+    pthread_mutex_unlock( &cap->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Finds the record that answers the next transfer and moves past it
+ * @return AIOUSB_TRUE if there was one
+ */
+static AIOUSB_BOOL _USBReplayNext( USBReplay *replay, size_t *pos, uint8_t kind, uint8_t request_type, uint8_t bRequest,
+                                   USBCaptureRecord *rec, const unsigned char **payload )
+{
+    size_t passes = ( replay->flags & USB_REPLAY_LOOP ? 2 : 1 );
+    size_t i = *pos;
+
+    for ( size_t pass = 0; pass < passes; pass ++ ) {
+        size_t end = ( pass == 0 ? replay->num_records : *pos );
+        for ( ; i < end; i ++ ) {
+            memcpy( rec, replay->data + replay->offsets[i], sizeof(*rec) );
+            if ( rec->kind == kind && rec->request_type == request_type &&
+                 ( kind != USB_CAPTURE_CONTROL || rec->bRequest == bRequest ) ) {
+                *payload = replay->data + replay->offsets[i] + sizeof(*rec);
+                *pos = i + 1;
+                replay->num_replayed ++;
+                return AIOUSB_TRUE;
+            }
+        }
+        i = 0;
+    }
+    return AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _USBReplayWait( USBReplay *replay, const USBCaptureRecord *rec )
+{
+    if ( !( replay->flags & USB_REPLAY_RECORDED_TIMING ) || !rec->duration_ns )
+        return;
+    struct timespec wait;
+    wait.tv_sec  = rec->duration_ns / 1000000000ULL;
+    wait.tv_nsec = rec->duration_ns % 1000000000ULL;
+    while ( nanosleep( &wait, &wait ) != 0 && errno == EINTR )
+        ;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBReplayControlTransfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                      uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    USBReplay *replay = (USBReplay *)usb->transport;
+    USBCaptureRecord rec;
+    const unsigned char *payload;
+
+    pthread_mutex_lock( &replay->lock );
+    if ( !_USBReplayNext( replay, &replay->control_pos, USB_CAPTURE_CONTROL, request_type, bRequest, &rec, &payload ) ) {
+        pthread_mutex_unlock( &replay->lock );
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    if ( request_type & LIBUSB_ENDPOINT_IN ) {
+        memcpy( data, payload, MIN( rec.data_length, (uint32_t)wLength ) );
+    } else if ( rec.wValue != wValue || rec.wIndex != wIndex || rec.length != wLength ||
+                ( rec.data_length && memcmp( data, payload, rec.data_length ) != 0 ) ) {
+        replay->num_mismatches ++;
+    }
+    pthread_mutex_unlock( &replay->lock );
+
+    _USBReplayWait( replay, &rec );
+    return rec.result;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBReplayBulkTransfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                                   int *actual_length, unsigned int timeout )
+{
+    USBReplay *replay = (USBReplay *)usb->transport;
+    USBCaptureRecord rec;
+    const unsigned char *payload;
+
+    pthread_mutex_lock( &replay->lock );
+    if ( !_USBReplayNext( replay, &replay->bulk_pos, USB_CAPTURE_BULK, endpoint, 0, &rec, &payload ) ) {
+        pthread_mutex_unlock( &replay->lock );
+        *actual_length = 0;
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    int moved = MIN( MAX( rec.actual_length, 0 ), length );
+    if ( endpoint & LIBUSB_ENDPOINT_IN ) {
+        memcpy( data, payload, MIN( (int)rec.data_length, moved ) );
+    } else if ( rec.length != length || memcmp( data, payload, MIN( (int)rec.data_length, moved ) ) != 0 ) {
+        replay->num_mismatches ++;
+    }
+    *actual_length = moved;
+    pthread_mutex_unlock( &replay->lock );
+
+    _USBReplayWait( replay, &rec );
+    return rec.result;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBReplayResetDevice( USBDevice *usb )
+{
+    USBDeviceInvalidateADCConfigCache( usb );
+    return LIBUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static USBReplay *_USBReplayFromDevice( USBDevice *usb )
+{
+    if ( !usb || usb->usb_control_transfer != _USBReplayControlTransfer )
+        return NULL;
+    return (USBReplay *)usb->transport;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes a USBDevice that answers its transfers from the capture in
+ * fname. Its deviceDesc carries the vendor and product of the captured
+ * device, so it can be put in the device table with
+ * AIODeviceTableAddDeviceToDeviceTableWithUSBDevice() and used through
+ * the normal API.
+ * @param fname Capture written by NewUSBCapture()
+ * @param flags USBReplayFlags
+ * @return The replay device, or NULL if the capture can't be read
+ */
+USBDevice *NewUSBReplayDevice( const char *fname, int flags )
+{
+    USBCaptureFileHeader header;
+    USBReplay *replay;
+    FILE *file;
+    long size;
+
+    AIO_ERROR_VALID_DATA( NULL, fname );
+
+    if ( !( file = fopen( fname, "rb" ) ) ) {
+        AIOUSB_ERROR("Can't open USB capture %s: %s\n", fname, strerror(errno) );
+        return NULL;
+    }
+    if ( fseek( file, 0, SEEK_END ) != 0 || ( size = ftell( file ) ) < (long)sizeof(header) ) {
+        AIOUSB_ERROR("%s is not a USB capture\n", fname );
+        fclose( file );
+        return NULL;
+    }
+    rewind( file );
+
+    /* No record is smaller than a USBCaptureRecord, which bounds the index */
+    size_t max_records = ( size - sizeof(header) ) / sizeof(USBCaptureRecord);
+    replay = (USBReplay *)calloc( 1, sizeof(USBReplay) + max_records * sizeof(size_t) + size );
+    if ( !replay ) {
+        fclose( file );
+        return NULL;
+    }
+    replay->offsets = (size_t *)( replay + 1 );
+    replay->data    = (unsigned char *)( replay->offsets + max_records );
+
+    if ( fread( replay->data, size, 1, file ) != 1 ) {
+        AIOUSB_ERROR("Can't read USB capture %s: %s\n", fname, strerror(errno) );
+        fclose( file );
+        free( replay );
+        return NULL;
+    }
+    fclose( file );
+
+    memcpy( &header, replay->data, sizeof(header) );
+    if ( memcmp( header.magic, USB_CAPTURE_MAGIC, sizeof(USB_CAPTURE_MAGIC) ) != 0 || header.version != USB_CAPTURE_VERSION ) {
+        AIOUSB_ERROR("%s is not a version %d USB capture\n", fname, USB_CAPTURE_VERSION );
+        free( replay );
+        return NULL;
+    }
+
+    for ( size_t offset = sizeof(header); offset + sizeof(USBCaptureRecord) <= (size_t)size; ) {
+        USBCaptureRecord rec;
+        memcpy( &rec, replay->data + offset, sizeof(rec) );
+        if ( offset + sizeof(rec) + rec.data_length > (size_t)size ) {
+            AIOUSB_WARN("USB capture %s ends part way through a record\n", fname );
+            break;
+        }
+        replay->offsets[replay->num_records ++] = offset;
+        offset += sizeof(rec) + rec.data_length;
+    }
+
+    pthread_mutex_init( &replay->lock, NULL );
+    replay->flags = flags;
+
+    USBDevice *usb            = &replay->usb;
+    usb->transport            = replay;
+    usb->deviceDesc.idVendor  = header.idVendor;
+    usb->deviceDesc.idProduct = header.idProduct;
+    usb->usb_control_transfer = _USBReplayControlTransfer;
+    usb->usb_bulk_transfer    = _USBReplayBulkTransfer;
+    usb->usb_request          = usb_request;
+    usb->usb_reset_device     = _USBReplayResetDevice;
+    usb->usb_put_config       = USBDevicePutADCConfigBlock;
+    usb->usb_get_config       = USBDeviceFetchADCConfigBlock;
+
+    return usb;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteUSBReplayDevice( USBDevice *usb )
+{
+    USBReplay *replay = _USBReplayFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, replay );
+
+    pthread_mutex_destroy( &replay->lock );
+    free( replay );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Goes back to the start of the capture and clears the counters
+ */
+AIORET_TYPE USBReplayRewind( USBDevice *usb )
+{
+    USBReplay *replay = _USBReplayFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, replay );
+
+    pthread_mutex_lock( &replay->lock );
+    replay->control_pos    = 0;
+    replay->bulk_pos       = 0;
+    replay->num_replayed   = 0;
+    replay->num_mismatches = 0;
+    pthread_mutex_unlock( &replay->lock );
+    USBDeviceInvalidateADCConfigCache( usb );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of transfers answered from the capture
+ */
+AIORET_TYPE USBReplayGetNumberReplayed( USBDevice *usb )
+{
+    USBReplay *replay = _USBReplayFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, replay );
+
+    pthread_mutex_lock( &replay->lock );
+    AIORET_TYPE retval = (AIORET_TYPE)replay->num_replayed;
+    pthread_mutex_unlock( &replay->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of OUT transfers whose setup or payload differed from the
+ * capture, i.e. where the program being replayed did not do what the
+ * captured one did
+ */
+AIORET_TYPE USBReplayGetNumberMismatches( USBDevice *usb )
+{
+    USBReplay *replay = _USBReplayFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, replay );
+
+    pthread_mutex_lock( &replay->lock );
+    AIORET_TYPE retval = (AIORET_TYPE)replay->num_mismatches;
+    pthread_mutex_unlock( &replay->lock );
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "AIODeviceTable.h"
+#include "AIOUSB_DIO.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace AIOUSB;
+
+static unsigned char fake_port[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+/* Stands in for a DIO board: reads return the port, writes land in it */
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                  uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    unsigned n = MIN( (unsigned)wLength, (unsigned)sizeof(fake_port) );
+    usleep( 2000 );
+    if ( request_type & LIBUSB_ENDPOINT_IN )
+        memcpy( data, fake_port, n );
+    else
+        memcpy( fake_port, data, n );
+    return wLength;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                               int *actual_length, unsigned int timeout )
+{
+    for ( int i = 0; i < length; i ++ )
+        data[i] = (unsigned char)( i * 3 + endpoint );
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+class USBCaptureTest : public ::testing::Test {
+ protected:
+    char fname[64];
+    virtual void SetUp() {
+        strcpy( fname, "/tmp/usbcapXXXXXX" );
+        int fd = mkstemp( fname );
+        ASSERT_GE( fd, 0 );
+        close( fd );
+    }
+    virtual void TearDown() {
+        unlink( fname );
+    }
+};
+
+TEST_F(USBCaptureTest, ReplaysWhatWasCaptured )
+{
+    USBDevice usb;
+    unsigned char in[4], bulk[64], replayed[64];
+    int actual;
+
+    memset( &usb, 0, sizeof(usb) );
+    usb.deviceDesc.idProduct = USB_DIO_32;
+    usb.usb_control_transfer = fake_control_transfer;
+    usb.usb_bulk_transfer    = fake_bulk_transfer;
+
+    USBCapture *cap = NewUSBCapture( fname, &usb );
+    ASSERT_TRUE( cap );
+    EXPECT_FALSE( NewUSBCapture( fname, &usb ) );
+
+    unsigned char out[4] = { 1, 2, 3, 4 };
+    EXPECT_EQ( 4, usb.usb_control_transfer( &usb, USB_WRITE_TO_DEVICE, AUR_DIO_WRITE, 0, 0, out, 4, 1000 ) );
+    EXPECT_EQ( 4, usb.usb_control_transfer( &usb, USB_READ_FROM_DEVICE, AUR_DIO_READ, 0, 0, in, 4, 1000 ) );
+    EXPECT_EQ( LIBUSB_SUCCESS, usb.usb_bulk_transfer( &usb, 0x86, bulk, sizeof(bulk), &actual, 1000 ) );
+    EXPECT_EQ( 3, USBCaptureGetNumberRecords( cap ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DeleteUSBCapture( cap ) );
+    EXPECT_EQ( (void*)fake_control_transfer, (void*)usb.usb_control_transfer );
+    EXPECT_FALSE( usb.transport );
+
+    USBDevice *replay = NewUSBReplayDevice( fname, USB_REPLAY_MAX_SPEED );
+    ASSERT_TRUE( replay );
+    EXPECT_EQ( USB_DIO_32, USBDeviceGetIdProduct( replay ) );
+
+    /* The bulk read comes back even though it is asked for first */
+    memset( replayed, 0, sizeof(replayed) );
+    EXPECT_EQ( LIBUSB_SUCCESS, replay->usb_bulk_transfer( replay, 0x86, replayed, sizeof(replayed), &actual, 1000 ) );
+    EXPECT_EQ( (int)sizeof(replayed), actual );
+    EXPECT_EQ( 0, memcmp( bulk, replayed, sizeof(bulk) ) );
+
+    unsigned char other[4] = { 9, 9, 9, 9 };
+    EXPECT_EQ( 4, replay->usb_control_transfer( replay, USB_WRITE_TO_DEVICE, AUR_DIO_WRITE, 0, 0, other, 4, 1000 ) );
+    EXPECT_EQ( 1, USBReplayGetNumberMismatches( replay ) );
+    memset( replayed, 0, sizeof(replayed) );
+    EXPECT_EQ( 4, replay->usb_control_transfer( replay, USB_READ_FROM_DEVICE, AUR_DIO_READ, 0, 0, replayed, 4, 1000 ) );
+    EXPECT_EQ( 0, memcmp( in, replayed, 4 ) );
+    EXPECT_EQ( 3, USBReplayGetNumberReplayed( replay ) );
+
+    /* Without USB_REPLAY_LOOP the capture runs dry */
+    EXPECT_EQ( LIBUSB_ERROR_NOT_FOUND, replay->usb_control_transfer( replay, USB_READ_FROM_DEVICE, AUR_DIO_READ, 0, 0, replayed, 4, 1000 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, USBReplayRewind( replay ) );
+    EXPECT_EQ( 4, replay->usb_control_transfer( replay, USB_READ_FROM_DEVICE, AUR_DIO_READ, 0, 0, replayed, 4, 1000 ) );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DeleteUSBReplayDevice( replay ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_USBDEVICE, DeleteUSBReplayDevice( &usb ) );
+}
+
+TEST_F(USBCaptureTest, ReplaysThroughTheDeviceTable )
+{
+    USBDevice usb;
+    int numDevices = 0;
+    unsigned long DeviceIndex = 0;
+    DIOBuf *captured = NewDIOBuf( 32 ), *replayed = NewDIOBuf( 32 );
+
+    memset( &usb, 0, sizeof(usb) );
+    usb.deviceDesc.idProduct = USB_DIO_32;
+    usb.usb_control_transfer = fake_control_transfer;
+    usb.usb_bulk_transfer    = fake_bulk_transfer;
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_32, &usb );
+    USBCapture *cap = NewUSBCapture( fname, &usb );
+    ASSERT_TRUE( cap );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_Write8( DeviceIndex, 1, 0xa5 ) );
+    EXPECT_GE( DIO_ReadAllToDIOBuf( DeviceIndex, captured ), 0 );
+    DeleteUSBCapture( cap );
+    deviceTable[0].usb_device = NULL;
+
+    USBDevice *replay = NewUSBReplayDevice( fname, USB_REPLAY_RECORDED_TIMING );
+    ASSERT_TRUE( replay );
+    AIODeviceTableInit();
+    numDevices = 0;
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USBDeviceGetIdProduct( replay ), replay );
+
+    struct timespec t0, t1;
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_Write8( DeviceIndex, 1, 0xa5 ) );
+    EXPECT_GE( DIO_ReadAllToDIOBuf( DeviceIndex, replayed ), 0 );
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+    EXPECT_STREQ( DIOBufToString( captured ), DIOBufToString( replayed ) );
+    EXPECT_EQ( 0, USBReplayGetNumberMismatches( replay ) );
+    /* Both transfers took at least 2ms when they were captured */
+    EXPECT_GE( _USBCaptureNanoseconds( &t0, &t1 ), 4000000ULL );
+
+    /* The device table owns the replay device from here on */
+    AIODeviceTableInit();
+    DeleteDIOBuf( captured );
+    DeleteDIOBuf( replayed );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  return RUN_ALL_TESTS();
+}
+
+#endif
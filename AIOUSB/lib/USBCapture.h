@@ -0,0 +1,102 @@
+/**
+ * @file   USBCapture.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Binary capture of USBDevice traffic and a USBDevice that replays it
+ *
+ */
+
+#ifndef _USB_CAPTURE_H
+#define _USB_CAPTURE_H
+
+#include "AIOTypes.h"
+#include "USBDevice.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define USB_CAPTURE_MAGIC               "AIOUSBC"
+#define USB_CAPTURE_VERSION             1
+
+/* BEGIN AIOUSB_API */
+
+typedef enum {
+    USB_CAPTURE_CONTROL = 1,
+    USB_CAPTURE_BULK    = 2
+} USBCaptureKind;
+
+typedef enum {
+    USB_REPLAY_MAX_SPEED       = 0,     /**< Answer every transfer as soon as it is made */
+    USB_REPLAY_RECORDED_TIMING = 1,     /**< Take as long over each transfer as the device did */
+    USB_REPLAY_LOOP            = 2      /**< Start over from the first record once the capture runs out */
+} USBReplayFlags;
+
+/**
+ * @brief Start of a capture file. Everything in the file is in host byte
+ * order.
+ */
+typedef struct usb_capture_file_header {
+    char magic[8];                      /**< USB_CAPTURE_MAGIC */
+    uint32_t version;
+    uint16_t idVendor;
+    uint16_t idProduct;                 /**< Product the capture was taken from */
+} USBCaptureFileHeader;
+
+/**
+ * @brief One transfer. data_length bytes of payload follow the record:
+ * what the device sent for IN transfers and what the host sent for OUT
+ * transfers.
+ */
+typedef struct usb_capture_record {
+    uint8_t kind;                       /**< USBCaptureKind */
+    uint8_t request_type;               /**< bmRequestType, or the endpoint of a bulk transfer */
+    uint8_t bRequest;
+    uint8_t reserved;
+    uint16_t wValue;
+    uint16_t wIndex;
+    int32_t length;                     /**< Bytes asked for */
+    int32_t result;                     /**< What the transfer returned */
+    int32_t actual_length;              /**< Bytes a bulk transfer moved */
+    uint32_t data_length;
+    uint64_t start_ns;                  /**< Since the capture was started */
+    uint64_t duration_ns;
+} USBCaptureRecord;
+
+/**
+ * @brief Writes every control and bulk transfer made through a USBDevice
+ * to a capture file. The device's transfer functions are wrapped for as
+ * long as the capture exists.
+ */
+typedef struct usb_capture {
+    FILE *file;
+    pthread_mutex_t lock;
+    struct timespec start;
+    USBDevice *usb;
+    int (*control_transfer)( USBDevice *usbdev, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout );
+    int (*bulk_transfer)( USBDevice *usbdev, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout );
+    uint64_t num_records;
+} USBCapture;
+
+PUBLIC_EXTERN USBCapture *NewUSBCapture( const char *fname, USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE DeleteUSBCapture( USBCapture *cap );
+PUBLIC_EXTERN AIORET_TYPE USBCaptureGetNumberRecords( USBCapture *cap );
+
+PUBLIC_EXTERN USBDevice *NewUSBReplayDevice( const char *fname, int flags );
+PUBLIC_EXTERN AIORET_TYPE DeleteUSBReplayDevice( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBReplayRewind( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBReplayGetNumberReplayed( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBReplayGetNumberMismatches( USBDevice *usb );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
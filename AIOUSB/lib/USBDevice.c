@@ -10,12 +10,19 @@
 #include "libusb.h"
 #include "AIODeviceTable.h"
 #include "AIOEither.h"
+#include "AIOUSB_Log.h"
 
 #ifdef __cplusplus
 #include <iostream>
 namespace AIOUSB {
 #endif
 
+libusb_device *(*USBDeviceRefLibusbDevice)( libusb_device *dev ) = libusb_ref_device;
+void (*USBDeviceUnrefLibusbDevice)( libusb_device *dev ) = libusb_unref_device;
+int (*USBDeviceOpenLibusbDevice)( libusb_device *dev, libusb_device_handle **handle ) = libusb_open;
+void (*USBDeviceCloseLibusbHandle)( libusb_device_handle *handle ) = libusb_close;
+int (*USBDeviceGetLibusbDescriptor)( libusb_device *dev, struct libusb_device_descriptor *desc ) = libusb_get_device_descriptor;
+
 /*----------------------------------------------------------------------------*/
 AIOEither InitializeUSBDevice( USBDevice *usb, LIBUSBArgs *args )
 {
@@ -36,13 +43,13 @@ AIOEither InitializeUSBDevice( USBDevice *usb, LIBUSBArgs *args )
     usb->deviceHandle          = args->handle;
     usb->deviceDesc            = *args->deviceDesc;
 
-    errcode = libusb_open(  usb->device, &usb->deviceHandle );
+    errcode = USBDeviceOpenLibusbDevice( usb->device, &usb->deviceHandle );
     if ( errcode < 0 ) {
         retcode = asprintf(&retval.errmsg,"ERROR: Failed on libusb_open, code: %d\n", errcode);
         goto error;
     }
 
-    if ((errcode = libusb_get_device_descriptor( usb->device, &devdesc)) < 0) {
+    if ((errcode = USBDeviceGetLibusbDescriptor( usb->device, &devdesc)) < 0) {
         retcode = asprintf(&retval.errmsg,"ERROR: Failed to get device descriptor, code: %d\n", errcode);
         goto error;
     }
@@ -134,7 +141,12 @@ AIOEither InitializeUSBDevice( USBDevice *usb, LIBUSBArgs *args )
     return retval;
  error:
     
-    libusb_close(usb->deviceHandle);
+    if ( confptr )
+        libusb_free_config_descriptor(confptr);
+    /* Cleared so that USBDeviceClose() does not close the handle again */
+    if ( usb->deviceHandle )
+        USBDeviceCloseLibusbHandle(usb->deviceHandle);
+    usb->deviceHandle = NULL;
     usb->device = NULL;
     if ( retcode < 0 ) { 
         retval.left = -AIOUSB_ERROR_INVALID_AIOEITHER_ALLOCATION;
@@ -169,15 +181,50 @@ int USBDeviceClose( USBDevice *usb )
 {
     AIO_ASSERT_USB(usb);
     
-    libusb_close(usb->deviceHandle);
+    if ( usb->deviceHandle )
+        USBDeviceCloseLibusbHandle(usb->deviceHandle);
     usb->deviceHandle = NULL;
 
-    libusb_unref_device( usb->device );
+    USBDeviceUnrefLibusbDevice( usb->device );
+
+    return AIOUSB_SUCCESS;
+}
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens and claims a device that AddAllACCESUSBDevices() only
+ * recorded. Does nothing if the device is already open.
+ * @param usb
+ * @return AIOUSB_SUCCESS or -AIOUSB_ERROR_USB_INIT
+ */
+AIORET_TYPE USBDeviceOpen( USBDevice *usb )
+{
+    AIO_ASSERT_USB( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_USBDEVICE_NOT_FOUND, usb->device );
+
+    if ( usb->deviceHandle )
+        return AIOUSB_SUCCESS;
+
+    libusb_device *device = usb->device;
+    struct libusb_device_descriptor deviceDesc = usb->deviceDesc;
+    LIBUSBArgs args = { device, NULL, &deviceDesc };
+    AIOEither usbretval = InitializeUSBDevice( usb, &args );
+    if ( AIOEitherHasError( &usbretval ) ) {
+        if ( usbretval.errmsg ) {
+            AIOUSB_ERROR( "%s", usbretval.errmsg );
+            free( usbretval.errmsg );
+        }
+        USBDeviceUnrefLibusbDevice( device );
+        return -AIOUSB_ERROR_USB_INIT;
+    }
     return AIOUSB_SUCCESS;
 }
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Records every ACCES device on the bus in devs. Only the
+ * descriptors are read; the devices are opened later by USBDeviceOpen().
+ */
 AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs , int *size )
 {
     AIORET_TYPE result = AIOUSB_ERROR_DEVICE_NOT_FOUND;
@@ -197,11 +244,10 @@ AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs
                     ) {
                     *size += 1;
                     *devs = (USBDevice*)realloc( *devs, (*size )*(sizeof(USBDevice)));
-                    memset(&(*devs)[*size-1],0,sizeof(USBDevice));
-                    LIBUSBArgs args = { libusb_ref_device(usb_device), NULL, &libusbDeviceDesc };
-                    AIOEither usbretval = InitializeUSBDevice( &( *devs)[*size-1] , &args );
-                    if ( AIOEitherHasError( &usbretval ) )
-                        return -AIOUSB_ERROR_USB_INIT;
+                    USBDevice *usb = &(*devs)[*size-1];
+                    memset( usb, 0, sizeof(USBDevice) );
+                    usb->device     = libusb_ref_device(usb_device);
+                    usb->deviceDesc = libusbDeviceDesc;
                     result = AIOUSB_SUCCESS;
                 }
             }
@@ -278,6 +324,11 @@ libusb_device_handle *get_usb_device( USBDevice *dev )
 }
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads the A/D config registers into configBlock. Once the
+ * registers have been read or written they are answered from the shadow
+ * copy kept on usb instead of going back to the device.
+ */
 int USBDeviceFetchADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock )
 {
     int result = AIOUSB_SUCCESS;
@@ -290,6 +341,11 @@ int USBDeviceFetchADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock )
     memcpy( &config, configBlock, sizeof( ADCConfigBlock ));
 
     if( configBlock->testing != AIOUSB_TRUE ) {
+        if ( usb->adc_config_shadow_size && usb->adc_config_shadow_size == config.size ) {
+            memcpy( config.registers, usb->adc_config_shadow, config.size );
+            return ADCConfigBlockCopy( configBlock, &config );
+        }
+
         int bytesTransferred = usb->usb_control_transfer( usb, 
                                                           USB_READ_FROM_DEVICE,
                                                           AUR_ADC_GET_CONFIG,
@@ -300,10 +356,13 @@ int USBDeviceFetchADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock )
                                                           config.timeout
                                                           );
         
-        if ( bytesTransferred != ( int ) config.size)
+        if ( bytesTransferred != ( int ) config.size) {
             result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
-        else
+        } else {
+            memcpy( usb->adc_config_shadow, config.registers, config.size );
+            usb->adc_config_shadow_size = config.size;
             result = ADCConfigBlockCopy( configBlock, &config );
+        }
     } else {
         result = configBlock->size;
     }
@@ -312,32 +371,161 @@ int USBDeviceFetchADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock )
 }
 
 /*----------------------------------------------------------------------------*/
-int USBDevicePutADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock )
+/**
+ * @brief Writes size A/D config registers unless the device is already
+ * known to hold exactly those values
+ * @return size on success ( whether or not a transfer was needed ), negative
+ *         error otherwise
+ */
+int USBDeviceWriteADCConfigRegisters( USBDevice *usb, unsigned char *registers, unsigned long size, unsigned timeout )
 {
-    int retval;
+    AIO_ASSERT_USB(usb);
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, registers && size <= sizeof(usb->adc_config_shadow) );
+
+    if ( usb->adc_config_shadow_size == size && memcmp( usb->adc_config_shadow, registers, size ) == 0 )
+        return (int)size;
+
+    int bytesTransferred = usb->usb_control_transfer( usb, 
+                                                      USB_WRITE_TO_DEVICE,
+                                                      AUR_ADC_SET_CONFIG,
+                                                      0,
+                                                      0,
+                                                      registers,
+                                                      size,
+                                                      timeout
+                                                      );
+    if ( bytesTransferred != (int)size ) {
+        usb->adc_config_shadow_size = 0;
+        return -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+    }
+
+    memcpy( usb->adc_config_shadow, registers, size );
+    usb->adc_config_shadow_size = size;
+    usb->adc_config_generation ++;
 
+    return bytesTransferred;
+}
+
+/*----------------------------------------------------------------------------*/
+int USBDevicePutADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock )
+{
     AIO_ASSERT_USB(usb);
     AIO_ASSERT_CONFIG( configBlock );
 
-    if( configBlock->testing == AIOUSB_TRUE ) {
-        retval = (int)configBlock->size;
-    } else {
-        int bytesTransferred = usb->usb_control_transfer( usb, 
-                                                          USB_WRITE_TO_DEVICE,
-                                                          AUR_ADC_SET_CONFIG,
-                                                          0,
-                                                          0,
-                                                          configBlock->registers,
-                                                          configBlock->size,
-                                                          configBlock->timeout
-                                                          );
-        if ( bytesTransferred != (int)configBlock->size ) {
-            retval = -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
-        } else {
-            retval = bytesTransferred;
-        }
-    }
-    return retval;
+    if( configBlock->testing == AIOUSB_TRUE )
+        return (int)configBlock->size;
+
+    return USBDeviceWriteADCConfigRegisters( usb, configBlock->registers, configBlock->size, configBlock->timeout );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Forgets the shadow copy of the A/D config registers so that the
+ * next fetch or write goes to the device. Needed after anything that may
+ * change the registers behind the library's back, such as a device reset.
+ */
+void USBDeviceInvalidateADCConfigCache( USBDevice *usb )
+{
+    if ( usb )
+        usb->adc_config_shadow_size = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of A/D config writes that have actually reached the device
+ */
+unsigned long USBDeviceGetADCConfigGeneration( USBDevice *usb )
+{
+    return usb ? usb->adc_config_generation : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _usb_count_failure( USBDevice *usb, int libusbResult )
+{
+    if ( libusbResult == LIBUSB_ERROR_TIMEOUT )
+        USB_DEVICE_COUNT( usb, timeouts, 1 );
+    else if ( libusbResult < 0 )
+        USB_DEVICE_COUNT( usb, errors, 1 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies the traffic counters of usb into stats
+ * @param usb
+ * @param stats
+ * @return AIOUSB_SUCCESS, or an error if either argument is missing
+ */
+AIORET_TYPE USBDeviceGetIOStats( USBDevice *usb, USBDeviceIOStats *stats )
+{
+    AIO_ASSERT_USB( usb );
+    AIO_ASSERT( stats );
+
+    stats->control_transfers = __sync_fetch_and_add( &usb->stats.control_transfers, 0 );
+    stats->control_bytes     = __sync_fetch_and_add( &usb->stats.control_bytes, 0 );
+    stats->bulk_transfers    = __sync_fetch_and_add( &usb->stats.bulk_transfers, 0 );
+    stats->bulk_bytes_in     = __sync_fetch_and_add( &usb->stats.bulk_bytes_in, 0 );
+    stats->bulk_bytes_out    = __sync_fetch_and_add( &usb->stats.bulk_bytes_out, 0 );
+    stats->requests          = __sync_fetch_and_add( &usb->stats.requests, 0 );
+    stats->timeouts          = __sync_fetch_and_add( &usb->stats.timeouts, 0 );
+    stats->errors            = __sync_fetch_and_add( &usb->stats.errors, 0 );
+    stats->retries           = __sync_fetch_and_add( &usb->stats.retries, 0 );
+    stats->overruns          = __sync_fetch_and_add( &usb->stats.overruns, 0 );
+    stats->resets            = __sync_fetch_and_add( &usb->stats.resets, 0 );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets every traffic counter of usb back to zero. Transfers that
+ * finish while this runs may be counted before or after the reset.
+ */
+AIORET_TYPE USBDeviceResetIOStats( USBDevice *usb )
+{
+    AIO_ASSERT_USB( usb );
+
+    __sync_fetch_and_and( &usb->stats.control_transfers, 0 );
+    __sync_fetch_and_and( &usb->stats.control_bytes, 0 );
+    __sync_fetch_and_and( &usb->stats.bulk_transfers, 0 );
+    __sync_fetch_and_and( &usb->stats.bulk_bytes_in, 0 );
+    __sync_fetch_and_and( &usb->stats.bulk_bytes_out, 0 );
+    __sync_fetch_and_and( &usb->stats.requests, 0 );
+    __sync_fetch_and_and( &usb->stats.timeouts, 0 );
+    __sync_fetch_and_and( &usb->stats.errors, 0 );
+    __sync_fetch_and_and( &usb->stats.retries, 0 );
+    __sync_fetch_and_and( &usb->stats.overruns, 0 );
+    __sync_fetch_and_and( &usb->stats.resets, 0 );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief JSON object holding every counter of stats
+ * @return Newly allocated string the caller frees, NULL if stats is missing
+ */
+char *USBDeviceIOStatsToJSON( const USBDeviceIOStats *stats )
+{
+    char tmpbuf[512];
+    AIO_ASSERT_RET( NULL, stats );
+
+    snprintf( tmpbuf, sizeof(tmpbuf),
+              "{\"control_transfers\":%llu,\"control_bytes\":%llu,\"bulk_transfers\":%llu,"
+              "\"bulk_bytes_in\":%llu,\"bulk_bytes_out\":%llu,\"requests\":%llu,\"timeouts\":%llu,"
+              "\"errors\":%llu,\"retries\":%llu,\"overruns\":%llu,\"resets\":%llu}",
+              (unsigned long long)stats->control_transfers,
+              (unsigned long long)stats->control_bytes,
+              (unsigned long long)stats->bulk_transfers,
+              (unsigned long long)stats->bulk_bytes_in,
+              (unsigned long long)stats->bulk_bytes_out,
+              (unsigned long long)stats->requests,
+              (unsigned long long)stats->timeouts,
+              (unsigned long long)stats->errors,
+              (unsigned long long)stats->retries,
+              (unsigned long long)stats->overruns,
+              (unsigned long long)stats->resets );
+
+    return strdup( tmpbuf );
 }
 
 #if defined(__cplusplus) && defined(mocktesting)
@@ -355,16 +543,21 @@ int usb_control_transfer(USBDevice *dev_handle,
     libusb_device_handle *handle = get_usb_device( dev_handle );
     AIO_ERROR_VALID_DATA(-AIOUSB_ERROR_INVALID_LIBUSB_DEVICE_HANDLE, handle );
 
-    return libusb_control_transfer( handle,
-                                    request_type,
-                                    bRequest,
-                                    wValue,
-                                    wIndex,
-                                    data,
-                                    wLength, 
-                                    timeout
-                                    );
-
+    int result = libusb_control_transfer( handle,
+                                          request_type,
+                                          bRequest,
+                                          wValue,
+                                          wIndex,
+                                          data,
+                                          wLength, 
+                                          timeout
+                                          );
+    USB_DEVICE_COUNT( dev_handle, control_transfers, 1 );
+    if ( result >= 0 )
+        USB_DEVICE_COUNT( dev_handle, control_bytes, result );
+    else
+        _usb_count_failure( dev_handle, result );
+    return result;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -394,8 +587,11 @@ int usb_bulk_transfer( USBDevice *usb,
     libusb_device_handle *handle = get_usb_device( usb );
     AIO_ERROR_VALID_DATA(-AIOUSB_ERROR_INVALID_LIBUSB_DEVICE_HANDLE, handle );
 
+    USB_DEVICE_COUNT( usb, bulk_transfers, 1 );
     while (length > 0) {
           int bytes;
+          if ( total > 0 )
+              USB_DEVICE_COUNT( usb, retries, 1 );
           libusbResult = libusb_bulk_transfer( handle , 
                                                endpoint, 
                                                data, 
@@ -403,6 +599,7 @@ int usb_bulk_transfer( USBDevice *usb,
                                                &bytes, 
                                                timeout
                                                );
+          _usb_count_failure( usb, libusbResult );
           if (libusbResult == LIBUSB_SUCCESS) {
               if(bytes > 0) {
                   total += bytes;
@@ -426,6 +623,10 @@ int usb_bulk_transfer( USBDevice *usb,
               break;
     }
     *actual_length = total;
+    if ( endpoint & LIBUSB_ENDPOINT_IN )
+        USB_DEVICE_COUNT( usb, bulk_bytes_in, total );
+    else
+        USB_DEVICE_COUNT( usb, bulk_bytes_out, total );
     return libusbResult;
 }
 
@@ -434,6 +635,8 @@ int usb_request(USBDevice *dev_handle,
                         uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
                         unsigned char *data, uint16_t wLength, unsigned int timeout)
 {
+    if ( dev_handle )
+        USB_DEVICE_COUNT( dev_handle, requests, 1 );
     return 1;
 }
 
@@ -442,7 +645,9 @@ int usb_reset_device( USBDevice *usb )
 {
     AIO_ASSERT_USB( usb );
 
+    USB_DEVICE_COUNT( usb, resets, 1 );
     int libusbResult = libusb_reset_device( usb->deviceHandle  );
+    USBDeviceInvalidateADCConfigCache( usb );
     return libusbResult;
 }
 
@@ -483,6 +688,53 @@ TEST(USBDevice,FailsCorrectly)
     ASSERT_DEATH( { InitializeUSBDevice(usb, args); } , "Assertion `args' failed" );
 }
 
+
+static int config_transfers = 0;
+static unsigned char fake_registers[AD_CONFIG_REGISTERS];
+
+static int counting_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                      uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    config_transfers ++;
+    if ( bRequest == AUR_ADC_GET_CONFIG )
+        memcpy( data, fake_registers, wLength );
+    else if ( bRequest == AUR_ADC_SET_CONFIG )
+        memcpy( fake_registers, data, wLength );
+    return wLength;
+}
+
+TEST(USBDevice,ConfigShadowSkipsRedundantTransfers)
+{
+    USBDevice usb;
+    ADCConfigBlock config;
+    memset( &usb, 0, sizeof(usb) );
+    memset( &config, 0, sizeof(config) );
+    usb.usb_control_transfer = counting_control_transfer;
+    config.size    = AD_CONFIG_REGISTERS;
+    config.timeout = 1000;
+    config_transfers = 0;
+    fake_registers[AD_CONFIG_OVERSAMPLE] = 7;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, USBDeviceFetchADCConfigBlock( &usb, &config ) );
+    EXPECT_EQ( 7, config.registers[AD_CONFIG_OVERSAMPLE] );
+    ASSERT_EQ( AIOUSB_SUCCESS, USBDeviceFetchADCConfigBlock( &usb, &config ) );
+    EXPECT_EQ( 1, config_transfers ) << "Second fetch is served from the shadow";
+
+    EXPECT_EQ( (int)config.size, USBDevicePutADCConfigBlock( &usb, &config ) );
+    EXPECT_EQ( 1, config_transfers ) << "Writing back what the device holds is free";
+    EXPECT_EQ( 0, USBDeviceGetADCConfigGeneration( &usb ) );
+
+    config.registers[AD_CONFIG_OVERSAMPLE] = 3;
+    EXPECT_EQ( (int)config.size, USBDevicePutADCConfigBlock( &usb, &config ) );
+    EXPECT_EQ( 2, config_transfers );
+    EXPECT_EQ( 1, USBDeviceGetADCConfigGeneration( &usb ) );
+    EXPECT_EQ( 3, fake_registers[AD_CONFIG_OVERSAMPLE] );
+
+    USBDeviceInvalidateADCConfigCache( &usb );
+    EXPECT_EQ( (int)config.size, USBDevicePutADCConfigBlock( &usb, &config ) );
+    EXPECT_EQ( 3, config_transfers );
+}
+
 int main(int argc, char *argv[] )
 {
   testing::InitGoogleTest(&argc, argv);
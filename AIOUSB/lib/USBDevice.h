@@ -20,6 +20,26 @@ namespace AIOUSB {
 #endif
 typedef struct USBDevice USBDevice;
 
+/**
+ * @brief Running totals of the traffic to one device. Every field is
+ * updated atomically, so they can be read while transfers are under way.
+ */
+typedef struct usb_device_io_stats {
+    uint64_t control_transfers;         /**< Control transfers handed to libusb */
+    uint64_t control_bytes;             /**< Bytes those control transfers moved */
+    uint64_t bulk_transfers;            /**< Bulk transfers, once per usb_bulk_transfer() call however many libusb calls it takes, or per async completion */
+    uint64_t bulk_bytes_in;
+    uint64_t bulk_bytes_out;
+    uint64_t requests;                  /**< usb_request() calls */
+    uint64_t timeouts;                  /**< Transfers that timed out, with or without data */
+    uint64_t errors;                    /**< Transfers that failed for any other reason */
+    uint64_t retries;                   /**< Transfers restarted after a partial timeout or a failed read */
+    uint64_t overruns;                  /**< Acquisitions stopped because the host fell behind */
+    uint64_t resets;                    /**< usb_reset_device() calls */
+} USBDeviceIOStats;
+
+#define USB_DEVICE_COUNT( usb, field, n )  __sync_fetch_and_add( &(usb)->stats.field, (uint64_t)(n) )
+
 struct USBDevice { 
     INTERNAL_METHOD( usb_control_transfer , int, USBDevice *usbdev, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout  );
     int (*usb_bulk_transfer)( USBDevice *dev_handle,
@@ -44,6 +64,14 @@ struct USBDevice {
     int conf;
     int origconf;
     int altset;
+
+    unsigned char adc_config_shadow[AD_MAX_CONFIG_REGISTERS + 1]; /**< A/D config registers last seen on the device */
+    unsigned long adc_config_shadow_size;                          /**< 0 == shadow not valid */
+    unsigned long adc_config_generation;                           /**< Bumped by every config write that reached the device */
+    void *transport;                                               /**< State of a capture or replay wrapped around this device, see USBCapture.h */
+    USBDeviceIOStats stats;                                        /**< See USBDeviceGetIOStats() */
+    struct USBDevice *retired;                                     /**< Next closed USBDevice waiting to be freed, see AIODeviceTableDeviceArrived() */
+    unsigned long retiredIndex;                                    /**< DeviceIndex of the board this one was replaced on */
 };
 
 typedef struct aiousb_libusb_args {
@@ -58,12 +86,19 @@ PUBLIC_EXTERN void DeleteUSBDevice( USBDevice *dev );
 PUBLIC_EXTERN USBDevice *CopyUSBDevice( USBDevice *usb );
 PUBLIC_EXTERN AIOEither InitializeUSBDevice( USBDevice *usb, LIBUSBArgs *args );
 PUBLIC_EXTERN AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs , int *size );
+PUBLIC_EXTERN AIORET_TYPE USBDeviceOpen( USBDevice *usb );
 PUBLIC_EXTERN void DeleteUSBDevices( USBDevice *devs);
 PUBLIC_EXTERN int USBDeviceClose( USBDevice *dev );
 
 PUBLIC_EXTERN int USBDeviceGetIdProduct( USBDevice *device );
 PUBLIC_EXTERN int USBDeviceFetchADCConfigBlock( USBDevice *device, ADCConfigBlock *config );
 PUBLIC_EXTERN int USBDevicePutADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock );
+PUBLIC_EXTERN int USBDeviceWriteADCConfigRegisters( USBDevice *usb, unsigned char *registers, unsigned long size, unsigned timeout );
+PUBLIC_EXTERN void USBDeviceInvalidateADCConfigCache( USBDevice *usb );
+PUBLIC_EXTERN unsigned long USBDeviceGetADCConfigGeneration( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBDeviceGetIOStats( USBDevice *usb, USBDeviceIOStats *stats );
+PUBLIC_EXTERN AIORET_TYPE USBDeviceResetIOStats( USBDevice *usb );
+PUBLIC_EXTERN char *USBDeviceIOStatsToJSON( const USBDeviceIOStats *stats );
 
 PUBLIC_EXTERN int usb_control_transfer(USBDevice *dev_handle,
                          uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
@@ -81,6 +116,15 @@ PUBLIC_EXTERN libusb_device_handle *get_usb_device( USBDevice *dev );
 PUBLIC_EXTERN libusb_device_handle *USBDeviceGetUSBDeviceHandle( USBDevice *usb );
 /* END AIOUSB_API */
 
+/* libusb's reference counting of the boards and the calls that open and
+ * close them, which the tests replace so they can hand the device table
+ * made up libusb_devices */
+extern libusb_device *(*USBDeviceRefLibusbDevice)( libusb_device *dev );
+extern void (*USBDeviceUnrefLibusbDevice)( libusb_device *dev );
+extern int (*USBDeviceOpenLibusbDevice)( libusb_device *dev, libusb_device_handle **handle );
+extern void (*USBDeviceCloseLibusbHandle)( libusb_device_handle *handle );
+extern int (*USBDeviceGetLibusbDescriptor)( libusb_device *dev, struct libusb_device_descriptor *desc );
+
 #ifdef __aiousb_cplusplus
 }
 #endif
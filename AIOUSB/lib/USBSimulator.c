@@ -0,0 +1,742 @@
+/**
+ * @file   USBSimulator.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  USBDevice that behaves like a USB-AI16-16 family board
+ *
+ * The simulator answers the control requests the library sends an analog
+ * input board and produces samples on endpoint 0x86, so continuous mode,
+ * BulkAcquire and the immediate ADC calls all run against it unchanged.
+ *
+ * - A/D config writes are kept and read back. The channel range,
+ *   oversample and trigger mode are taken from them when an acquisition
+ *   starts, and the gain codes whenever a sample is converted to counts.
+ * - Counters 1 and 2, loaded with CTR_8254ModeLoad() or
+ *   AIOContinuousBufLoadCounters(), divide the 10MHz root clock into the
+ *   scan clock. With AD_TRIGGER_TIMER set, scans become available at that
+ *   rate, measured against CLOCK_MONOTONIC, and a bulk read waits until
+ *   the samples it asked for would have been converted.
+ * - Each AUR_ADC_IMMEDIATE request is a software trigger.
+ *
+ * Products listed in the AIO_SIMULATED_PRODUCTS environment variable, by
+ * name or number and separated by commas, are added to the device table
+ * by AIOUSB_Init(). AIO_SIMULATED_WAVEFORM sets what every channel of
+ * those devices sees, in the form taken by USBSimulatorParseWaveform().
+ *
+ * @verbatim
+shell> AIO_SIMULATED_PRODUCTS=USB-AI16-16A AIO_SIMULATED_WAVEFORM=sine:50:4:5 ./continuous_mode
+ @endverbatim
+ */
+
+#include "USBSimulator.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_Log.h"
+#include "AIODeviceTable.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define USB_SIMULATOR_MAX_CHANNELS      128
+
+/**
+ * @brief The USBDevice comes first, so a simulated device handed to the
+ * device table is released by DeleteUSBDevice() like any other.
+ */
+typedef struct usb_simulator {
+    USBDevice usb;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;                 /**< Signalled by anything that may make samples available */
+    unsigned num_channels;
+    unsigned channels_per_gain;             /**< Channels sharing each gain code register */
+    unsigned char registers[AD_MAX_CONFIG_REGISTERS];
+    unsigned long divisor[3];               /**< 0 while a counter is not counting */
+    AIOSimWaveform waves[USB_SIMULATOR_MAX_CHANNELS];
+    uint32_t rng;
+
+    /* Latched when an acquisition starts */
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL stopped;
+    AIOUSB_BOOL timer;
+    struct timespec since;                  /**< Timer triggers are counted from here */
+    struct timespec stop_time;
+    double scan_clock;
+    unsigned start_channel;
+    unsigned scan_channels;
+    unsigned channels_per_trigger;
+    unsigned samples_per_channel;
+    uint64_t sample_limit;                  /**< 0 for no limit */
+    uint64_t triggers;                      /**< Software triggers, plus timer triggers before since */
+    uint64_t samples_sent;
+} USBSimulator;
+
+/*----------------------------------------------------------------------------*/
+static double _USBSimulatorSeconds( const struct timespec *from, const struct timespec *to )
+{
+    return ( to->tv_sec - from->tv_sec ) + ( to->tv_nsec - from->tv_nsec ) / 1e9;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _USBSimulatorAddSeconds( struct timespec *ts, double seconds )
+{
+    long sec = (long)seconds;
+    ts->tv_sec  += sec;
+    ts->tv_nsec += (long)( ( seconds - sec ) * 1e9 );
+    if ( ts->tv_nsec >= 1000000000L ) {
+        ts->tv_sec ++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static double _USBSimulatorGauss( USBSimulator *sim )
+{
+    double u[2];
+    for ( int i = 0; i < 2; i ++ ) {
+        sim->rng ^= sim->rng << 13;
+        sim->rng ^= sim->rng >> 17;
+        sim->rng ^= sim->rng << 5;
+        u[i] = ( sim->rng + 1.0 ) / 4294967297.0;
+    }
+    return sqrt( -2.0 * log( u[0] ) ) * cos( 2 * M_PI * u[1] );
+}
+
+/*----------------------------------------------------------------------------*/
+static unsigned short _USBSimulatorCounts( USBSimulator *sim, unsigned channel, double t )
+{
+    AIOSimWaveform *w = &sim->waves[channel % USB_SIMULATOR_MAX_CHANNELS];
+    double phase = w->frequency * t - floor( w->frequency * t );
+    double volts;
+
+    switch ( w->type ) {
+    case AIO_SIM_NOISE:
+        volts = w->offset + w->amplitude * _USBSimulatorGauss( sim );
+        break;
+    case AIO_SIM_STEP:
+        volts = w->offset + ( phase < 0.5 ? w->amplitude : -w->amplitude );
+        break;
+    case AIO_SIM_RAMP:
+        volts = w->offset - w->amplitude + 2 * w->amplitude * phase;
+        break;
+    default:
+        volts = w->offset + w->amplitude * sin( 2 * M_PI * phase );
+        break;
+    }
+    if ( w->noise )
+        volts += w->noise * _USBSimulatorGauss( sim );
+
+    unsigned gain = sim->registers[AD_CONFIG_GAIN_CODE + ( channel / sim->channels_per_gain ) % AD_NUM_GAIN_CODE_REGISTERS];
+    struct ADRange *range = &adRanges[gain & AD_GAIN_CODE_MASK];
+    double counts = round( AI_16_MAX_COUNTS * ( volts - range->minVolts ) / range->range );
+
+    return (unsigned short)( counts < 0 ? 0 : counts > AI_16_MAX_COUNTS ? AI_16_MAX_COUNTS : counts );
+}
+
+/*----------------------------------------------------------------------------*/
+static double _USBSimulatorClock( USBSimulator *sim )
+{
+    if ( !sim->divisor[1] || !sim->divisor[2] )
+        return 0;
+    return (double)USB_SIMULATOR_ROOT_CLOCK / ( (double)sim->divisor[1] * sim->divisor[2] );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Samples converted since the acquisition started, sent or not
+ */
+static uint64_t _USBSimulatorProduced( USBSimulator *sim, const struct timespec *now )
+{
+    if ( !sim->started )
+        return 0;
+
+    uint64_t triggers = sim->triggers;
+    if ( sim->timer && sim->scan_clock > 0 ) {
+        double elapsed = _USBSimulatorSeconds( &sim->since, sim->stopped ? &sim->stop_time : now );
+        if ( elapsed > 0 )
+            triggers += (uint64_t)( elapsed * sim->scan_clock );
+    }
+
+    uint64_t produced = triggers * sim->channels_per_trigger * sim->samples_per_channel;
+    if ( sim->sample_limit && produced > sim->sample_limit )
+        produced = sim->sample_limit;
+    return produced;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Folds the timer triggers so far into sim->triggers, so that the
+ * scan clock can change without moving samples already converted
+ */
+static void _USBSimulatorRebase( USBSimulator *sim, const struct timespec *now )
+{
+    if ( sim->started && !sim->stopped && sim->timer && sim->scan_clock > 0 ) {
+        double elapsed = _USBSimulatorSeconds( &sim->since, now );
+        if ( elapsed > 0 )
+            sim->triggers += (uint64_t)( elapsed * sim->scan_clock );
+    }
+    sim->since = *now;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _USBSimulatorStart( USBSimulator *sim, uint64_t sample_limit )
+{
+    unsigned char *reg = sim->registers;
+    unsigned start = reg[AD_CONFIG_START_END] & 0x0f, end = reg[AD_CONFIG_START_END] >> 4;
+
+    if ( sim->num_channels > 16 ) {
+        start |= ( reg[AD_CONFIG_MUX_START_END] & 0x0f ) << 4;
+        end   |= ( reg[AD_CONFIG_MUX_START_END] & 0xf0 );
+    }
+    if ( end < start )
+        end = start;
+
+    clock_gettime( CLOCK_MONOTONIC, &sim->since );
+    sim->started              = AIOUSB_TRUE;
+    sim->stopped              = AIOUSB_FALSE;
+    sim->timer                = ( reg[AD_CONFIG_TRIG_COUNT] & AD_TRIGGER_TIMER ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    sim->scan_clock           = _USBSimulatorClock( sim );
+    sim->start_channel        = start;
+    sim->scan_channels        = end - start + 1;
+    sim->channels_per_trigger = ( reg[AD_CONFIG_TRIG_COUNT] & AD_TRIGGER_SCAN ) ? sim->scan_channels : 1;
+    sim->samples_per_channel  = reg[AD_CONFIG_OVERSAMPLE] + 1;
+    sim->sample_limit         = sample_limit;
+    sim->triggers             = 0;
+    sim->samples_sent         = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _USBSimulatorFill( USBSimulator *sim, unsigned short *counts, uint64_t num_samples, const struct timespec *now )
+{
+    double wall = _USBSimulatorSeconds( &sim->since, now );
+
+    for ( uint64_t i = 0; i < num_samples; i ++ ) {
+        uint64_t conversion = ( sim->samples_sent + i ) / sim->samples_per_channel;
+        uint64_t trigger = conversion / sim->channels_per_trigger;
+        unsigned channel = sim->start_channel + conversion % sim->scan_channels;
+        double t = ( sim->timer && sim->scan_clock > 0 ? trigger / sim->scan_clock : wall );
+        counts[i] = _USBSimulatorCounts( sim, channel, t );
+    }
+    sim->samples_sent += num_samples;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBSimulatorControlTransfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                         uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    USBSimulator *sim = (USBSimulator *)usb->transport;
+    AIOUSB_BOOL in = ( request_type & LIBUSB_ENDPOINT_IN ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+    unsigned counter = wValue >> 14;
+    struct timespec now;
+    int retval = wLength;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    pthread_mutex_lock( &sim->lock );
+
+    switch ( bRequest ) {
+    case AUR_ADC_SET_CONFIG:
+    case AUR_ADC_GET_CONFIG:
+        retval = MIN( wLength, (uint16_t)AD_MAX_CONFIG_REGISTERS );
+        if ( in )
+            memcpy( data, sim->registers, retval );
+        else
+            memcpy( sim->registers, data, retval );
+        break;
+
+    case AUR_CTR_MODE:
+    case AUR_CTR_LOAD:
+    case AUR_CTR_MODELOAD:
+        /* Writing a mode stops a counter until it is loaded again */
+        if ( counter < 3 ) {
+            _USBSimulatorRebase( sim, &now );
+            sim->divisor[counter] = ( bRequest == AUR_CTR_MODE ? 0 : ( wIndex ? wIndex : 0x10000 ) );
+            if ( sim->started && !sim->stopped )
+                sim->scan_clock = _USBSimulatorClock( sim );
+        }
+        break;
+
+    case AUR_START_ACQUIRING_BLOCK:
+        if ( in ) {
+            memset( data, 0, wLength );
+        } else if ( wLength && data[0] == 0x02 ) {
+            if ( sim->started && !sim->stopped ) {
+                sim->stopped   = AIOUSB_TRUE;
+                sim->stop_time = now;
+            }
+        } else {
+            _USBSimulatorStart( sim, ( (uint64_t)wValue << 16 ) | wIndex );
+        }
+        break;
+
+    case AUR_ADC_IMMEDIATE:
+        if ( in ) {
+            retval = ( wLength / sizeof(unsigned short) ) * sizeof(unsigned short);
+            for ( unsigned i = 0; i < wLength / sizeof(unsigned short); i ++ ) {
+                unsigned short counts = _USBSimulatorCounts( sim, wIndex + i, _USBSimulatorSeconds( &sim->since, &now ) );
+                memcpy( data + i * sizeof(counts), &counts, sizeof(counts) );
+            }
+        } else if ( sim->started && !sim->stopped ) {
+            sim->triggers ++;
+        }
+        break;
+
+    case AUR_PROBE_CALFEATURE:
+        if ( in && wLength )
+            data[0] = AUR_LOAD_BULK_CALIBRATION_BLOCK;
+        break;
+
+    case AUR_GEN_CLEAR_FIFO:
+    case AUR_GEN_CLEAR_FIFO_NEXT:
+    case AUR_GEN_CLEAR_FIFO_WAIT:
+    case AUR_GEN_ABORT_AND_CLEAR:
+        sim->samples_sent = _USBSimulatorProduced( sim, &now );
+        break;
+
+    default:
+        if ( in )
+            memset( data, 0, wLength );
+        break;
+    }
+
+    pthread_cond_broadcast( &sim->changed );
+    pthread_mutex_unlock( &sim->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bulk reads on 0x86 return once all the samples asked for have
+ * been converted, the acquisition reaches its sample limit or stops, or
+ * the timeout passes. Bulk writes, such as calibration tables, are
+ * accepted and dropped.
+ */
+static int _USBSimulatorBulkTransfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                                      int *actual_length, unsigned int timeout )
+{
+    USBSimulator *sim = (USBSimulator *)usb->transport;
+    uint64_t want = length / sizeof(unsigned short), available = 0;
+    struct timespec now, deadline;
+
+    *actual_length = 0;
+    if ( !( endpoint & LIBUSB_ENDPOINT_IN ) ) {
+        *actual_length = length;
+        return LIBUSB_SUCCESS;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    deadline = now;
+    _USBSimulatorAddSeconds( &deadline, timeout / 1000.0 );
+
+    pthread_mutex_lock( &sim->lock );
+    for ( ;; ) {
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        uint64_t produced = _USBSimulatorProduced( sim, &now );
+        available = produced - sim->samples_sent;
+        if ( available >= want || sim->stopped ||
+             ( sim->started && sim->sample_limit && produced == sim->sample_limit ) )
+            break;
+        if ( timeout && _USBSimulatorSeconds( &deadline, &now ) >= 0 )
+            break;
+
+        struct timespec until = deadline;
+        if ( sim->started && sim->timer && sim->scan_clock > 0 ) {
+            /* When the last sample asked for will have been converted */
+            uint64_t per_trigger = (uint64_t)sim->channels_per_trigger * sim->samples_per_channel;
+            uint64_t needed = ( sim->samples_sent + want + per_trigger - 1 ) / per_trigger;
+            until = sim->since;
+            if ( needed > sim->triggers )
+                _USBSimulatorAddSeconds( &until, ( needed - sim->triggers ) / sim->scan_clock );
+            if ( timeout && _USBSimulatorSeconds( &deadline, &until ) > 0 )
+                until = deadline;
+        } else if ( !timeout ) {
+            pthread_cond_wait( &sim->changed, &sim->lock );
+            continue;
+        }
+        pthread_cond_timedwait( &sim->changed, &sim->lock, &until );
+    }
+
+    available = MIN( available, want );
+    _USBSimulatorFill( sim, (unsigned short *)data, available, &now );
+    pthread_mutex_unlock( &sim->lock );
+
+    *actual_length = (int)( available * sizeof(unsigned short) );
+    return ( available ? LIBUSB_SUCCESS : LIBUSB_ERROR_TIMEOUT );
+}
+
+/*----------------------------------------------------------------------------*/
+static int _USBSimulatorResetDevice( USBDevice *usb )
+{
+    USBDeviceInvalidateADCConfigCache( usb );
+    return LIBUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static USBSimulator *_USBSimulatorFromDevice( USBDevice *usb )
+{
+    if ( !usb || usb->usb_control_transfer != _USBSimulatorControlTransfer )
+        return NULL;
+    return (USBSimulator *)usb->transport;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIOUSB_BOOL _USBSimulatorSupports( unsigned long productID )
+{
+    return ( ( productID >= USB_AI16_16A && productID <= USB_AI12_128E ) ||
+             ( productID >= USB_AIO16_16A && productID <= USB_AIO12_128E ) ) ? AIOUSB_TRUE : AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes a USBDevice that simulates a board of the analog input
+ * family. Every channel starts out with its own sine wave.
+ * @param productID One of USB_AI16_16A ... USB_AI12_128E or
+ *        USB_AIO16_16A ... USB_AIO12_128E
+ * @return The device, or NULL if productID is not an analog input board
+ */
+USBDevice *NewUSBSimulatorDevice( unsigned long productID )
+{
+    AIO_ERROR_VALID_DATA( NULL, _USBSimulatorSupports( productID ) );
+    USBSimulator *sim = (USBSimulator *)calloc( 1, sizeof(USBSimulator) );
+    AIO_ERROR_VALID_DATA( NULL, sim );
+
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &sim->changed, &attr );
+    pthread_condattr_destroy( &attr );
+    pthread_mutex_init( &sim->lock, NULL );
+
+    /* The channel count is part of the product name, as in USB-AI16-64MA */
+    const char *name = ProductIDToName( (unsigned)productID );
+    if ( !name || sscanf( name, "%*[^-]-%*[^-]-%u", &sim->num_channels ) != 1 || !sim->num_channels ||
+         sim->num_channels > USB_SIMULATOR_MAX_CHANNELS )
+        sim->num_channels = USB_SIMULATOR_NUM_CHANNELS;
+    sim->channels_per_gain = MAX( 1u, sim->num_channels / AD_NUM_GAIN_CODE_REGISTERS );
+
+    sim->registers[AD_CONFIG_TRIG_COUNT] = AD_TRIGGER_SCAN | AD_TRIGGER_TIMER;
+    sim->registers[AD_CONFIG_START_END]  = ( MIN( sim->num_channels, 16u ) - 1 ) << 4;
+    sim->rng = 0x2545f491u ^ (uint32_t)productID;
+    for ( unsigned i = 0; i < USB_SIMULATOR_MAX_CHANNELS; i ++ ) {
+        sim->waves[i].type      = AIO_SIM_SINE;
+        sim->waves[i].frequency = 10.0 * ( i + 1 );
+        sim->waves[i].amplitude = 2.0;
+        sim->waves[i].offset    = 2.5;
+    }
+
+    USBDevice *usb              = &sim->usb;
+    usb->transport              = sim;
+    usb->deviceDesc.idVendor    = ACCES_VENDOR_ID;
+    usb->deviceDesc.idProduct   = (uint16_t)productID;
+    usb->usb_control_transfer   = _USBSimulatorControlTransfer;
+    usb->usb_bulk_transfer      = _USBSimulatorBulkTransfer;
+    usb->usb_request            = usb_request;
+    usb->usb_reset_device       = _USBSimulatorResetDevice;
+    usb->usb_put_config         = USBDevicePutADCConfigBlock;
+    usb->usb_get_config         = USBDeviceFetchADCConfigBlock;
+
+    return usb;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE DeleteUSBSimulatorDevice( USBDevice *usb )
+{
+    USBSimulator *sim = _USBSimulatorFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, sim );
+
+    pthread_cond_destroy( &sim->changed );
+    pthread_mutex_destroy( &sim->lock );
+    free( sim );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets what a channel sees
+ * @param usb Simulated device
+ * @param channel Channel to set, or -1 for all of them
+ * @param wave Waveform in volts
+ */
+AIORET_TYPE USBSimulatorSetWaveform( USBDevice *usb, int channel, const AIOSimWaveform *wave )
+{
+    USBSimulator *sim = _USBSimulatorFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, sim );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, wave && channel >= -1 && channel < (int)sim->num_channels );
+
+    pthread_mutex_lock( &sim->lock );
+    for ( unsigned i = 0; i < sim->num_channels; i ++ ) {
+        if ( channel < 0 || (unsigned)channel == i )
+            sim->waves[i] = *wave;
+    }
+    pthread_mutex_unlock( &sim->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads a waveform written as type[:frequency[:amplitude[:offset[:noise]]]],
+ * where type is sine, noise, step or ramp, e.g. "sine:60:1.5:2.5". Fields
+ * that are left out keep the values already in wave.
+ */
+AIORET_TYPE USBSimulatorParseWaveform( const char *str, AIOSimWaveform *wave )
+{
+    static const char *types[] = { "sine", "noise", "step", "ramp" };
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, str && wave );
+
+    size_t len = strcspn( str, ":" );
+    unsigned i;
+    for ( i = 0; i < sizeof(types) / sizeof(types[0]); i ++ ) {
+        if ( strlen( types[i] ) == len && strncmp( str, types[i], len ) == 0 )
+            break;
+    }
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, i < sizeof(types) / sizeof(types[0]) );
+
+    AIOSimWaveform tmp = *wave;
+    tmp.type = (AIOSimWaveformType)i;
+    double *fields[] = { &tmp.frequency, &tmp.amplitude, &tmp.offset, &tmp.noise };
+    const char *pos = str + len;
+    for ( unsigned f = 0; *pos == ':' && f < sizeof(fields) / sizeof(fields[0]); f ++ ) {
+        char *end;
+        *fields[f] = strtod( pos + 1, &end );
+        AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, end != pos + 1 );
+        pos = end;
+    }
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_PARAMETER, *pos == '\0' );
+
+    *wave = tmp;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Scan clock that counters 1 and 2 currently divide out of the root
+ * clock, rounded to Hz, 0 if they are not both loaded
+ */
+AIORET_TYPE USBSimulatorGetScanClock( USBDevice *usb )
+{
+    USBSimulator *sim = _USBSimulatorFromDevice( usb );
+    AIO_ERROR_VALID_DATA( -AIOUSB_ERROR_INVALID_USBDEVICE, sim );
+
+    pthread_mutex_lock( &sim->lock );
+    AIORET_TYPE retval = (AIORET_TYPE)round( _USBSimulatorClock( sim ) );
+    pthread_mutex_unlock( &sim->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Appends a simulated device to devs for every product listed in
+ * AIO_SIMULATED_PRODUCTS, the way AddAllACCESUSBDevices() appends the
+ * boards found on the bus
+ * @return Number of devices added
+ */
+AIORET_TYPE USBSimulatorAddDevices( USBDevice **devs, int *size )
+{
+    AIO_ASSERT( devs && size );
+    const char *products = getenv("AIO_SIMULATED_PRODUCTS");
+    const char *waveform = getenv("AIO_SIMULATED_WAVEFORM");
+    AIOSimWaveform wave;
+    AIORET_TYPE added = 0;
+    char *copy, *token, *pos;
+
+    if ( !products || !*products )
+        return 0;
+
+    memset( &wave, 0, sizeof(wave) );
+    if ( waveform && USBSimulatorParseWaveform( waveform, &wave ) != AIOUSB_SUCCESS ) {
+        AIOUSB_WARN("Ignoring AIO_SIMULATED_WAVEFORM=%s\n", waveform );
+        waveform = NULL;
+    }
+
+    copy = strdup( products );
+    for ( token = strtok_r( copy, ",", &pos ); token && *size < MAX_USB_DEVICES; token = strtok_r( NULL, ",", &pos ) ) {
+        char *end;
+        unsigned long productID = strtoul( token, &end, 0 );
+        if ( *end != '\0' ) {
+            AIORET_TYPE id = ProductNameToID( token );
+            productID = ( id > 0 ? (unsigned long)id : 0 );
+        }
+
+        USBDevice *usb = NewUSBSimulatorDevice( productID );
+        if ( !usb ) {
+            AIOUSB_WARN("Can't simulate product '%s'\n", token );
+            continue;
+        }
+        if ( waveform )
+            USBSimulatorSetWaveform( usb, -1, &wave );
+
+        /* The table keeps a copy of the USBDevice; its transport still
+         * points at the simulator, which lives as long as the program */
+        *size += 1;
+        *devs = (USBDevice *)realloc( *devs, (*size) * sizeof(USBDevice) );
+        memcpy( &(*devs)[*size - 1], usb, sizeof(USBDevice) );
+        added ++;
+    }
+    free( copy );
+
+    return added;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_CTR.h"
+#include <stdlib.h>
+
+using namespace AIOUSB;
+
+static void load_counters( USBDevice *usb, unsigned a, unsigned b )
+{
+    usb->usb_control_transfer( usb, USB_WRITE_TO_DEVICE, AUR_CTR_MODELOAD, 0x7400, a, NULL, 0, 1000 );
+    usb->usb_control_transfer( usb, USB_WRITE_TO_DEVICE, AUR_CTR_MODELOAD, 0xb600, b, NULL, 0, 1000 );
+}
+
+TEST(USBSimulator, ParsesWaveforms )
+{
+    AIOSimWaveform wave;
+    memset( &wave, 0, sizeof(wave) );
+    wave.amplitude = 3;
+
+    EXPECT_EQ( AIOUSB_SUCCESS, USBSimulatorParseWaveform( "step:50", &wave ) );
+    EXPECT_EQ( AIO_SIM_STEP, wave.type );
+    EXPECT_DOUBLE_EQ( 50, wave.frequency );
+    EXPECT_DOUBLE_EQ( 3, wave.amplitude );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, USBSimulatorParseWaveform( "noise:0:0.5:2.5:0.01", &wave ) );
+    EXPECT_EQ( AIO_SIM_NOISE, wave.type );
+    EXPECT_DOUBLE_EQ( 2.5, wave.offset );
+    EXPECT_DOUBLE_EQ( 0.01, wave.noise );
+
+    EXPECT_LT( USBSimulatorParseWaveform( "square", &wave ), 0 );
+    EXPECT_LT( USBSimulatorParseWaveform( "sine:x", &wave ), 0 );
+    EXPECT_EQ( AIO_SIM_NOISE, wave.type );
+}
+
+TEST(USBSimulator, HonoursConfigAndPacesScansByTheCounters )
+{
+    USBDevice *usb = NewUSBSimulatorDevice( USB_AI16_16A );
+    ASSERT_TRUE( usb );
+    EXPECT_FALSE( NewUSBSimulatorDevice( USB_DIO_32 ) );
+
+    /* Each channel holds its own level, 0.5V apart */
+    for ( int ch = 0; ch < 16; ch ++ ) {
+        AIOSimWaveform wave = { AIO_SIM_STEP, 0, 0.5 * ch, 0, 0 };
+        EXPECT_EQ( AIOUSB_SUCCESS, USBSimulatorSetWaveform( usb, ch, &wave ) );
+    }
+
+    /* Channels 2-5, one oversample, channel 3 at +-10V */
+    unsigned char registers[AD_CONFIG_REGISTERS];
+    memset( registers, AD_GAIN_CODE_0_5V, sizeof(registers) );
+    registers[3]                    = AD_GAIN_CODE_10V;
+    registers[AD_CONFIG_CAL_MODE]   = 0;
+    registers[AD_CONFIG_TRIG_COUNT] = AD_TRIGGER_SCAN | AD_TRIGGER_TIMER;
+    registers[AD_CONFIG_START_END]  = 0x52;
+    registers[AD_CONFIG_OVERSAMPLE] = 1;
+    EXPECT_EQ( AD_CONFIG_REGISTERS, usb->usb_control_transfer( usb, USB_WRITE_TO_DEVICE, AUR_ADC_SET_CONFIG, 0, 0, registers, sizeof(registers), 1000 ) );
+
+    /* 10MHz / ( 10 * 100 ) = 10kHz scans */
+    load_counters( usb, 10, 100 );
+    EXPECT_EQ( 10000, USBSimulatorGetScanClock( usb ) );
+
+    unsigned char start[] = { 0x07, 0, 0, 1 };
+    usb->usb_control_transfer( usb, USB_WRITE_TO_DEVICE, AUR_START_ACQUIRING_BLOCK, 0, 0, start, sizeof(start), 1000 );
+
+    unsigned num_scans = 2000;
+    unsigned short *counts = (unsigned short *)malloc( num_scans * 8 * sizeof(unsigned short) );
+    struct timespec t0, t1;
+    int actual;
+    clock_gettime( CLOCK_MONOTONIC, &t0 );
+    EXPECT_EQ( LIBUSB_SUCCESS, usb->usb_bulk_transfer( usb, 0x86, (unsigned char *)counts, num_scans * 8 * sizeof(unsigned short), &actual, 5000 ) );
+    clock_gettime( CLOCK_MONOTONIC, &t1 );
+    EXPECT_EQ( (int)( num_scans * 8 * sizeof(unsigned short) ), actual );
+    EXPECT_GE( _USBSimulatorSeconds( &t0, &t1 ), 0.18 ) << "2000 scans at 10kHz take 0.2s";
+    EXPECT_LT( _USBSimulatorSeconds( &t0, &t1 ), 1.0 );
+
+    /* ch2 1.0V on 0-5V, ch3 1.5V on +-10V, ch4 2.0V and ch5 2.5V on 0-5V */
+    unsigned short expected[] = { 13107, 13107, 37683, 37683, 26214, 26214, 32768, 32768 };
+    for ( unsigned scan = 0; scan < num_scans; scan += 397 )
+        EXPECT_EQ( 0, memcmp( expected, &counts[scan * 8], sizeof(expected) ) ) << "scan " << scan;
+
+    /* Stopping hands back what is left and then times out */
+    unsigned char stop[] = { 0x02, 0, 0x02, 0 };
+    usb->usb_control_transfer( usb, USB_WRITE_TO_DEVICE, AUR_START_ACQUIRING_BLOCK, 0, 0, stop, sizeof(stop), 1000 );
+    usb->usb_bulk_transfer( usb, 0x86, (unsigned char *)counts, num_scans * 8 * sizeof(unsigned short), &actual, 100 );
+    EXPECT_EQ( LIBUSB_ERROR_TIMEOUT, usb->usb_bulk_transfer( usb, 0x86, (unsigned char *)counts, 512, &actual, 100 ) );
+    EXPECT_EQ( 0, actual );
+
+    free( counts );
+    EXPECT_EQ( AIOUSB_SUCCESS, DeleteUSBSimulatorDevice( usb ) );
+}
+
+TEST(USBSimulator, ServesImmediateScansThroughTheLibrary )
+{
+    int numDevices = 0;
+    double volts[16];
+    USBDevice *usb = NewUSBSimulatorDevice( USB_AI16_16A );
+    for ( int ch = 0; ch < 16; ch ++ ) {
+        AIOSimWaveform wave = { AIO_SIM_STEP, 0, 0.25 * ch, 0, 0 };
+        USBSimulatorSetWaveform( usb, ch, &wave );
+    }
+
+    AIODeviceTableInit();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16A, usb );
+
+    ADCConfigBlock *config = AIOUSBDeviceGetADCConfigBlock( AIODeviceTableGetDeviceAtIndex( 0, NULL ) );
+    ADCConfigBlockSetAllGainCodeAndDiffMode( config, AD_GAIN_CODE_0_5V, AIOUSB_FALSE );
+    ADCConfigBlockSetScanRange( config, 0, 15 );
+    ADCConfigBlockSetOversample( config, 3 );
+    ADC_SetConfig( 0, config->registers, &config->size );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_GetScanV( 0, volts ) );
+    for ( int ch = 0; ch < 16; ch ++ )
+        EXPECT_NEAR( 0.25 * ch, volts[ch], 0.001 ) << "channel " << ch;
+
+    /* The device table owns the simulator from here on */
+    AIODeviceTableInit();
+}
+
+TEST(USBSimulator, AddsTheProductsNamedInTheEnvironment )
+{
+    USBDevice *devs = NULL;
+    int size = 0;
+
+    setenv( "AIO_SIMULATED_PRODUCTS", "USB-AI16-16A,0x8140,USB-DIO-32,USB-AI16-64MA", 1 );
+    setenv( "AIO_SIMULATED_WAVEFORM", "ramp:5", 1 );
+    EXPECT_EQ( 3, USBSimulatorAddDevices( &devs, &size ) );
+    unsetenv( "AIO_SIMULATED_PRODUCTS" );
+    unsetenv( "AIO_SIMULATED_WAVEFORM" );
+
+    ASSERT_EQ( 3, size );
+    EXPECT_EQ( USB_AI16_16A, USBDeviceGetIdProduct( &devs[0] ) );
+    EXPECT_EQ( USB_AIO16_16A, USBDeviceGetIdProduct( &devs[1] ) );
+    EXPECT_EQ( 64u, _USBSimulatorFromDevice( &devs[2] )->num_channels );
+    EXPECT_EQ( AIO_SIM_RAMP, _USBSimulatorFromDevice( &devs[2] )->waves[63].type );
+    EXPECT_DOUBLE_EQ( 5, _USBSimulatorFromDevice( &devs[2] )->waves[63].frequency );
+
+    for ( int i = 0; i < size; i ++ )
+        DeleteUSBSimulatorDevice( (USBDevice *)devs[i].transport );
+    free( devs );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file   USBSimulator.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  USBDevice that behaves like a USB-AI16-16 family board
+ *
+ */
+
+#ifndef _USB_SIMULATOR_H
+#define _USB_SIMULATOR_H
+
+#include "AIOTypes.h"
+#include "USBDevice.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define USB_SIMULATOR_NUM_CHANNELS      16
+#define USB_SIMULATOR_ROOT_CLOCK        10000000
+
+/* BEGIN AIOUSB_API */
+
+typedef enum {
+    AIO_SIM_SINE  = 0,
+    AIO_SIM_NOISE = 1,                  /**< Gaussian noise with a deviation of amplitude */
+    AIO_SIM_STEP  = 2,                  /**< Square wave between offset + amplitude and offset - amplitude */
+    AIO_SIM_RAMP  = 3                   /**< Sawtooth from offset - amplitude to offset + amplitude */
+} AIOSimWaveformType;
+
+/**
+ * @brief What a simulated channel sees, in volts. noise is the deviation
+ * of gaussian noise added on top of every waveform.
+ */
+typedef struct aio_sim_waveform {
+    AIOSimWaveformType type;
+    double frequency;
+    double amplitude;
+    double offset;
+    double noise;
+} AIOSimWaveform;
+
+PUBLIC_EXTERN USBDevice *NewUSBSimulatorDevice( unsigned long productID );
+PUBLIC_EXTERN AIORET_TYPE DeleteUSBSimulatorDevice( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorSetWaveform( USBDevice *usb, int channel, const AIOSimWaveform *wave );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorParseWaveform( const char *str, AIOSimWaveform *wave );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorGetScanClock( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorAddDevices( USBDevice **devs, int *size );
+
+/* END AIOUSB_API */
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -46,6 +46,16 @@ PUBLIC_EXTERN AIORET_TYPE DIOBufSetIndex( DIOBuf *buf, int index, unsigned value
 PUBLIC_EXTERN AIORET_TYPE DIOBufGetIndex( DIOBuf *buf, int index );
 PUBLIC_EXTERN AIORET_TYPE DIOBufGetByteAtIndex( DIOBuf *buf, unsigned index, char *value);
 PUBLIC_EXTERN AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value );
+PUBLIC_EXTERN unsigned char *DIOBufRawBytes( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufToggleIndex( DIOBuf *buf, int index );
+PUBLIC_EXTERN AIORET_TYPE DIOBufSetAll( DIOBuf *buf, unsigned value );
+PUBLIC_EXTERN AIORET_TYPE DIOBufToggleAll( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufAnd( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufOr( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufXor( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufSetMasked( DIOBuf *buf, DIOBuf *mask, DIOBuf *value );
+PUBLIC_EXTERN AIORET_TYPE DIOBufPopCount( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufDiff( DIOBuf *buf, DIOBuf *other, unsigned *indices, unsigned maxindices );
 
 
 /* #include "AIOUSB_DIO.h" */
@@ -56,9 +66,16 @@ PUBLIC_EXTERN unsigned long DIO_Configure( unsigned long DeviceIndex, unsigned c
 PUBLIC_EXTERN unsigned long DIO_ConfigureEx( unsigned long DeviceIndex, void *pOutMask, void *pData, void *pTristateMask ); 
 PUBLIC_EXTERN unsigned long DIO_ConfigurationQuery( unsigned long DeviceIndex, void *pOutMask, void *pTristateMask ); 
 PUBLIC_EXTERN unsigned long DIO_WriteAll( unsigned long DeviceIndex, void *pData ); 
+PUBLIC_EXTERN AIORESULT DIO_WriteAllFromDIOBuf( unsigned long DeviceIndex, DIOBuf *buf );
 PUBLIC_EXTERN unsigned long DIO_Write8( unsigned long DeviceIndex, unsigned long ByteIndex, unsigned char Data ); 
 
 PUBLIC_EXTERN unsigned long DIO_Write1( unsigned long DeviceIndex, unsigned long BitIndex, unsigned char bData ); 
+PUBLIC_EXTERN AIORESULT DIO_WriteMask( unsigned long DeviceIndex, void *pMask, void *pData );
+PUBLIC_EXTERN AIORESULT DIO_BeginTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_CommitTransaction( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_FlushWrites( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORESULT DIO_SetWriteCoalescing( unsigned long DeviceIndex, unsigned long WindowUs );
+PUBLIC_EXTERN void AIOUSBDeviceStopDIOCoalescing( AIOUSBDevice *device );
 
 
 PUBLIC_EXTERN AIORET_TYPE DIO_ReadAllToDIOBuf( unsigned long DeviceIndex, DIOBuf *buf );
@@ -132,6 +149,64 @@ PUBLIC_EXTERN AIORESULT GenericVendorWrite( unsigned long DeviceIndex, unsigned
 PUBLIC_EXTERN AIORESULT AIOUSB_Validate_Device( unsigned long DeviceIndex );
 
 
+/* #include "AIOUSB_Log.h" */
+
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogStartAsync( unsigned ring_records );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogStopAsync( void );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogFlush( void );
+PUBLIC_EXTERN unsigned long long AIOUSB_LogDropped( void );
+PUBLIC_EXTERN AIORET_TYPE AIOUSB_LogRecord( const char *fmt, ... ) __attribute__((format(printf,1,2)));
+
+/* #include "AIOThreadPolicy.h" */
+
+typedef enum {
+    AIO_THREAD_SCHED_INHERIT = 0,       /**< Leave the thread with the creator's scheduling */
+    AIO_THREAD_SCHED_OTHER,
+    AIO_THREAD_SCHED_FIFO,
+    AIO_THREAD_SCHED_RR
+} AIOThreadSchedClass;
+
+/**
+ * @brief What a thread found when it applied an AIOThreadPolicy to itself.
+ * The sched and CPU fields are read back from the thread afterwards, so they
+ * show what the thread really runs with rather than what was asked for.
+ */
+typedef struct aio_thread_policy_report {
+    int applied;                        /**< Non zero once a thread has applied the policy */
+    int sched_policy;                   /**< SCHED_* the thread runs with */
+    int sched_priority;                 /**< Priority the thread runs with */
+    int sched_error;                    /**< errno from changing the scheduler, 0 if it worked or wasn't asked for */
+    int num_cpus;                       /**< CPUs the thread may run on */
+    int affinity_error;                 /**< errno from changing the affinity */
+    int mlock_error;                    /**< errno from mlockall() */
+    size_t stack_prefaulted;            /**< Bytes of stack touched */
+} AIOThreadPolicyReport;
+
+/**
+ * @brief How an acquisition worker thread should be run. The thread applies
+ * the policy to itself when it starts and records the outcome in report.
+ */
+typedef struct aio_thread_policy {
+    AIOThreadSchedClass sched_class;
+    int priority;                       /**< < 0 picks the highest priority of sched_class */
+    int num_cpus;                       /**< CPUs set in cpus, 0 leaves the affinity alone */
+    unsigned char cpus[AIO_THREAD_POLICY_MAX_CPUS/8];
+    AIOUSB_BOOL lock_memory;            /**< mlockall( MCL_CURRENT | MCL_FUTURE ) */
+    size_t prefault_stack;              /**< Bytes of stack to touch before any work is done */
+    AIOThreadPolicyReport report;
+} AIOThreadPolicy;
+
+PUBLIC_EXTERN AIOThreadPolicy *NewAIOThreadPolicy( void );
+PUBLIC_EXTERN AIOThreadPolicy *NewAIOThreadPolicyCopy( const AIOThreadPolicy *policy );
+PUBLIC_EXTERN void DeleteAIOThreadPolicy( AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicySetScheduler( AIOThreadPolicy *policy, AIOThreadSchedClass sched_class, int priority );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyAddCPU( AIOThreadPolicy *policy, unsigned cpu );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyClearCPUs( AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicySetLockMemory( AIOThreadPolicy *policy, AIOUSB_BOOL lock_memory );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicySetStackPrefault( AIOThreadPolicy *policy, size_t bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyApply( AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOThreadPolicyGetReport( const AIOThreadPolicy *policy, AIOThreadPolicyReport *report );
+
 /* #include "AIOContinuousBuffer.h" */
 
 /*-----------------------------  Constructors  ------------------------------*/
@@ -158,6 +233,10 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetCallback(AIOContinuousBuf *buf , vo
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetStreamingBlockSize( AIOContinuousBuf *buf, unsigned sblksize);
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetStreamingBlockSize( AIOContinuousBuf *buf );
 
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetAsyncTransfers( AIOContinuousBuf *buf, unsigned depth, unsigned transfer_size );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetAsyncDepth( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetAsyncTransferSize( AIOContinuousBuf *buf );
+
 PUBLIC_EXTERN ADCConfigBlock *AIOContinuousBufGetADCConfigBlock( AIOContinuousBuf *buf );
 
 
@@ -207,6 +286,11 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetNumberScans( AIOContinuousBuf *buf
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufNumberWriteSamplesRemaining( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufNumberSamplesAvailable( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufWaitForSamples( AIOContinuousBuf *buf, unsigned long num_samples, int timeout_ms );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetWakeupFd( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetWakeupThreshold( AIOContinuousBuf *buf, unsigned long num_samples );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetWakeupThreshold( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufClearWakeup( AIOContinuousBuf *buf );
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetNumberSamplesPerScan( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetTotalSamplesExpected(  AIOContinuousBuf *buf );
@@ -215,6 +299,9 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReset( AIOContinuousBuf *buf );
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPushN(AIOContinuousBuf *buf ,void  *frombuf, unsigned int N );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPopN(AIOContinuousBuf *buf , void *tobuf, unsigned int N );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPeek( AIOContinuousBuf *buf, AIOFifoRegion *region );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufConsume( AIOContinuousBuf *buf, unsigned size );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadActiveScans( AIOContinuousBuf *buf, void *tobuf, unsigned tobufsize );
 
 
 /*-----------------------------  Deprecated / Refactored   -------------------------------*/
@@ -254,6 +341,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufUnlock( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCallbackStart( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCallbackStartCallbackWithAcquisitionFunction( AIOContinuousBuf *buf, AIOCmd *cmd, AIORET_TYPE (*callback)( AIOContinuousBuf *buf) );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufStopAcquisition( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetThreadPolicy( AIOContinuousBuf *buf, const AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetThreadPolicyReport( AIOContinuousBuf *buf, AIOThreadPolicyReport *report );
 
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufInitiateCallbackAcquisition( AIOContinuousBuf *buf );
@@ -265,6 +354,7 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetWritePosition( AIOContinuousBuf *bu
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetRemainingSize( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetStatus( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetExitCode( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufDeviceRemoved( unsigned long DeviceIndex );
 PUBLIC_EXTERN THREAD_STATUS AIOContinuousBufGetRunStatus( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPending( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetScansRead( AIOContinuousBuf *buf );
@@ -296,6 +386,89 @@ char *AIOContinuousBufToJSON( AIOContinuousBuf *buf );
 AIOContinuousBuf *NewAIOContinuousBufFromJSON( const char *json_string );
 
 
+/* #include "AIORecorder.h" */
+
+/**
+ * @brief Start of every segment file. The ADCConfigBlock JSON follows the
+ * header, and the scan records start at header_size, which is a multiple
+ * of AIO_RECORDING_HEADER_ALIGN. A scan record holds
+ * num_channels * ( num_oversamples + 1 ) raw counts in acquisition order.
+ */
+typedef struct aio_recording_header {
+    char magic[8];                      /**< AIO_RECORDING_MAGIC */
+    uint32_t version;
+    uint32_t header_size;               /**< Bytes before the first scan record */
+    uint32_t num_channels;
+    uint32_t num_oversamples;
+    uint32_t record_size;               /**< Bytes per scan record */
+    uint32_t segment_index;
+    uint32_t start_channel;             /**< Channel of the first count in a record */
+    uint32_t mux_channels;              /**< ADCMUXChannels of the device that recorded */
+    uint32_t channels_per_group;        /**< ADCChannelsPerGroup of the device that recorded */
+    uint32_t config_length;             /**< Bytes of ADCConfigBlock JSON, 0 if none */
+    uint64_t clock_hz;
+    uint64_t first_scan;                /**< Scan number of the first record in this segment */
+    uint64_t num_scans;                 /**< Records in this segment, updated as they are written */
+} AIORecordingHeader;
+
+/**
+ * @brief Writes scan records into preallocated, memory mapped segment files
+ * named <prefix>.NNNN.aiorec, starting a new segment whenever the current
+ * one is full.
+ */
+typedef struct aio_recorder {
+    char prefix[AIO_RECORDING_MAX_PATH];
+    size_t segment_size;                /**< Bytes preallocated per segment */
+    AIORecordingHeader header;          /**< Template for each new segment */
+    char *config_json;
+    int fd;                             /**< Current segment, -1 when none is open */
+    unsigned char *map;
+    size_t map_size;
+    size_t write_offset;
+    unsigned num_segments;
+    uint64_t num_scans;                 /**< Records written over all segments */
+} AIORecorder;
+
+typedef struct aio_recording_segment {
+    int fd;
+    unsigned char *map;
+    size_t map_size;
+    const AIORecordingHeader *header;
+    const unsigned short *counts;
+} AIORecordingSegment;
+
+/**
+ * @brief Read side of a recording. The segments are mapped read only and
+ * counts are handed out as pointers into the mappings.
+ */
+typedef struct aio_recording {
+    unsigned num_segments;
+    AIORecordingSegment *segments;
+    uint64_t num_scans;
+    ADCConfigBlock *config;             /**< Parsed from the first segment, NULL if none was recorded */
+    AIOConversionPlan *plan;
+} AIORecording;
+
+PUBLIC_EXTERN AIORecorder *NewAIORecorder( const char *prefix, unsigned num_channels, unsigned num_oversamples, unsigned long clock_hz, ADCConfigBlock *config, size_t segment_size );
+PUBLIC_EXTERN AIORecorder *NewAIORecorderForContinuousBuf( AIOContinuousBuf *buf, const char *prefix, size_t segment_size );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIORecorder( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderWriteScans( AIORecorder *rec, const unsigned short *counts, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderDrain( AIORecorder *rec, AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderRecord( AIORecorder *rec, AIOContinuousBuf *buf, unsigned long min_scans, int timeout_ms );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderGetNumberScans( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderGetNumberSegments( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderClose( AIORecorder *rec );
+
+PUBLIC_EXTERN AIORecording *NewAIORecording( const char *prefix );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIORecording( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetNumberScans( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetNumberChannels( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetOversample( AIORecording *recording );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetClock( AIORecording *recording );
+PUBLIC_EXTERN const unsigned short *AIORecordingGetCounts( AIORecording *recording, uint64_t first_scan, unsigned *num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIORecordingGetVolts( AIORecording *recording, uint64_t first_scan, unsigned num_scans, double *volts );
+
+
 /* #include "AIOUSB_CTR.h" */
 
 PUBLIC_EXTERN AIORET_TYPE CTR_CalculateCountersForClock( int hz , int *diva, int *divb );
@@ -422,6 +595,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskNumberSignals( AIOChannelMask *mask );
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskGetSize( AIOChannelMask *mask );
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskIndices( AIOChannelMask *mask , int *pos);
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskNextIndex( AIOChannelMask *mask , int *pos );
+PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskNextActive( AIOChannelMask *mask, int channel );
+PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskActiveIndices( AIOChannelMask *mask, int *indices, unsigned maxindices );
 
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskSetMaskFromInt( AIOChannelMask *mask, unsigned field );
 PUBLIC_EXTERN AIORET_TYPE AIOChannelMaskSetMaskAtIndex( AIOChannelMask *mask, char field, unsigned index  );
@@ -492,6 +667,20 @@ typedef struct {
     double max;
 } AIOGainRange;
 
+/**
+ * @brief Selects the loop used to turn whole scans of counts into volts.
+ * AIO_CC_KERNEL_AUTO picks the widest instruction set the running CPU
+ * supports, AIO_CC_KERNEL_PER_SAMPLE keeps the original one sample at a
+ * time conversion.
+ */
+typedef enum {
+    AIO_CC_KERNEL_AUTO = 0,
+    AIO_CC_KERNEL_PER_SAMPLE,
+    AIO_CC_KERNEL_SCALAR,
+    AIO_CC_KERNEL_SSE2,
+    AIO_CC_KERNEL_AVX2
+} AIOCountsConverterKernel;
+
 typedef struct aio_counts_converter {
     unsigned num_oversamples;
     unsigned num_channels;
@@ -508,6 +697,11 @@ typedef struct aio_counts_converter {
     AIORET_TYPE (*Convert)( struct aio_counts_converter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
     AIORET_TYPE (*ConvertFifo)( struct aio_counts_converter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
     AIOUSB_BOOL discardFirstSample;
+    AIOCountsConverterKernel kernel;
+    double *scale;                /**< (max-min)/65536 per channel, tiled to tile entries */
+    double *offset;               /**< min per channel, tiled to tile entries */
+    unsigned tile;                /**< Multiple of num_channels used as the vector row length */
+    AIOGainRange *tabled_ranges;  /**< gain_ranges the scale/offset tables were built from */
 } AIOCountsConverter;
 
 
@@ -524,10 +718,51 @@ PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertNScans( AIOCountsConverter *c
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertAllAvailableScans( AIOCountsConverter *cc );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvert( AIOCountsConverter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertScans( AIOCountsConverter *cc, double *tobuf, const uint16_t *frombuf, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterSetKernel( AIOCountsConverter *cc, AIOCountsConverterKernel kernel );
+PUBLIC_EXTERN AIOCountsConverterKernel AIOCountsConverterGetKernel( AIOCountsConverter *cc );
+PUBLIC_EXTERN const char *AIOCountsConverterKernelName( AIOCountsConverterKernel kernel );
 
 PUBLIC_EXTERN AIOGainRange* NewAIOGainRangeFromADCConfigBlock( ADCConfigBlock *adc );
 PUBLIC_EXTERN void  DeleteAIOGainRange( AIOGainRange* );
 
+/* #include "AIOConversionPlan.h" */
+
+/**
+ * @brief The gain setting of every channel turned into a multiplier and an
+ * offset ( volts = counts * scale + offset ), plus an optional 65536 entry
+ * table per gain code in use. A plan remembers the gain registers it was
+ * compiled from, so that a change to the config block is noticed no matter
+ * which setter made it.
+ */
+typedef struct aio_conversion_plan {
+    unsigned num_channels;                                      /**< Channels covered, ADCMUXChannels */
+    unsigned long channels_per_group;
+    unsigned char gain_registers[AD_NUM_GAIN_CODE_REGISTERS];   /**< Registers the plan was compiled from */
+    int built;
+    int use_lut;
+    unsigned char gain_code[AD_MAX_CHANNELS];
+    double scale[AD_MAX_CHANNELS];                              /**< Volts per count */
+    double offset[AD_MAX_CHANNELS];                             /**< Volts at zero counts */
+    AIOGainRange ranges[AD_MAX_CHANNELS];                       /**< Same ranges in AIOCountsConverter form */
+    double *lut[AD_NUM_GAIN_CODES];                             /**< Optional counts to volts tables */
+} AIOConversionPlan;
+
+PUBLIC_EXTERN AIOConversionPlan *NewAIOConversionPlan( void );
+PUBLIC_EXTERN void DeleteAIOConversionPlan( AIOConversionPlan *plan );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanBuild( AIOConversionPlan *plan, const ADCConfigBlock *config );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanIsCurrent( const AIOConversionPlan *plan, const ADCConfigBlock *config );
+PUBLIC_EXTERN void AIOConversionPlanInvalidate( AIOConversionPlan *plan );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanSetLUT( AIOConversionPlan *plan, AIOUSB_BOOL use_lut );
+PUBLIC_EXTERN AIORET_TYPE AIOConversionPlanCountsToVolts( const AIOConversionPlan *plan, unsigned startChannel, unsigned numChannels, const unsigned short *counts, double *volts );
+PUBLIC_EXTERN AIOGainRange *NewAIOGainRangeFromAIOConversionPlan( const AIOConversionPlan *plan );
+
+PUBLIC_EXTERN AIOConversionPlan *AIOUSBDeviceGetConversionPlan( AIOUSBDevice *dev, AIORET_TYPE *result );
+PUBLIC_EXTERN void AIOUSBDeviceReleaseConversionPlan( AIOUSBDevice *dev, AIOConversionPlan *plan );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetConversionLUT( AIOUSBDevice *dev, AIOUSB_BOOL use_lut );
+PUBLIC_EXTERN void AIOUSBDeviceInvalidateConversionPlan( AIOUSBDevice *dev );
+PUBLIC_EXTERN void AIOUSBDeviceFreeConversionPlan( AIOUSBDevice *dev );
+
 /* #include "AIODeviceInfo.h" */
 
 PUBLIC_EXTERN AIODeviceInfo *NewAIODeviceInfo();
@@ -551,14 +786,34 @@ PUBLIC_EXTERN char * AIODeviceQueryGetName( AIODeviceQuery *devq );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetNumDIOBytes( AIODeviceQuery *devq );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetNumCounters( AIODeviceQuery *devq );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetIndex( AIODeviceQuery *devq );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryGetIOStats( AIODeviceQuery *devq, USBDeviceIOStats *stats );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceQueryResetIOStats( AIODeviceQuery *devq );
 
 
 
 /* #include "AIODeviceTable.h" */
 
+typedef enum {
+    AIO_DEVICE_ARRIVED = 1,
+    AIO_DEVICE_LEFT    = 2
+} AIODeviceEvent;
+
+/**
+ * @brief Told about boards coming and going once AIODeviceTableStartHotplug() is running
+ */
+typedef void (*AIODeviceEventCallback)( unsigned long DeviceIndex, AIODeviceEvent event, void *user_data );
+
 PUBLIC_EXTERN AIORESULT AIODeviceTableAddDeviceToDeviceTable( int *numAccesDevices, unsigned long productID ) ;
 PUBLIC_EXTERN AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevices, unsigned long productID , USBDevice *usb_dev );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceTablePopulateTable(void);
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableWarmUp( const unsigned long *DeviceIndices, unsigned num_devices, unsigned num_threads );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableStartHotplug( AIODeviceEventCallback callback, void *user_data, unsigned poll_interval_ms );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableStopHotplug( void );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableDeviceArrived( libusb_device *usb_device );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableDeviceLeft( libusb_device *usb_device );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableLockRead( void );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableLockWrite( void );
+PUBLIC_EXTERN AIORET_TYPE AIODeviceTableUnlock( void );
 PUBLIC_EXTERN AIORET_TYPE AIODeviceTablePopulateTableTest(unsigned long *products, int length );
 PUBLIC_EXTERN AIORESULT AIODeviceTableClearDevices( void );
 PUBLIC_EXTERN AIORESULT ClearDevices( void );
@@ -611,6 +866,12 @@ PUBLIC_EXTERN AIORET_TYPE AIOFifoGetSizeNumElements( void *tmpfifo );
 PUBLIC_EXTERN AIORET_TYPE AIOFifoResize( AIOFifo *fifo, size_t newsize );
 PUBLIC_EXTERN AIORET_TYPE AIOFifoReadPosition( void *nfifo );
 PUBLIC_EXTERN AIORET_TYPE AIOFifoWritePosition( void *nfifo );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoSetSPSC( void *nfifo, AIOUSB_BOOL spsc );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoIsSPSC( void *nfifo );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoWriteReserve( void *nfifo, unsigned maxsize, AIOFifoRegion *region );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoWriteCommit( void *nfifo, unsigned size );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoReadPeek( void *nfifo, unsigned maxsize, AIOFifoRegion *region );
+PUBLIC_EXTERN AIORET_TYPE AIOFifoReadConsume( void *nfifo, unsigned size );
 
 /* #include "AIOEither.h" */
 
@@ -634,6 +895,9 @@ PUBLIC_EXTERN AIORET_TYPE AIOEitherToAIORetType( AIOEither either );
 PUBLIC_EXTERN AIORET_TYPE ADC_GetScanV( unsigned long DeviceIndex, double *voltages );
 PUBLIC_EXTERN AIORESULT ADC_RangeAll( unsigned long DeviceIndex, unsigned char *pGainCodes, unsigned long bSingleEnded );
 PUBLIC_EXTERN AIORET_TYPE ADC_GetChannelV( unsigned long DeviceIndex, unsigned long ChannelIndex, double *singlevoltage );
+PUBLIC_EXTERN AIORET_TYPE ADC_SetScanProfileResident( unsigned long DeviceIndex, AIOUSB_BOOL resident );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetScanProfileResident( unsigned long DeviceIndex );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetScansBatch( unsigned long DeviceIndex, unsigned num_scans, unsigned short *counts, double *volts, struct timespec *timestamps );
 
     
 PUBLIC_EXTERN AIORET_TYPE ADC_GetScan( unsigned long DeviceIndex, unsigned short *pBuf );
@@ -651,6 +915,8 @@ PUBLIC_EXTERN AIORESULT ADC_QueryCal( unsigned long DeviceIndex );
 PUBLIC_EXTERN AIOUSB_BOOL ADC_CanCalibrate( unsigned long ProductID );
 PUBLIC_EXTERN AIORESULT ADC_Initialize( unsigned long DeviceIndex, unsigned char *pConfigBuf, unsigned long *ConfigBufSize,     const char *CalFileName );
 PUBLIC_EXTERN AIORESULT ADC_BulkAcquire( unsigned long DeviceIndex, unsigned long BufSize, void *pBuf );
+PUBLIC_EXTERN AIORET_TYPE ADC_SetBulkAcquireThreadPolicy( unsigned long DeviceIndex, const AIOThreadPolicy *policy );
+PUBLIC_EXTERN AIORET_TYPE ADC_GetBulkAcquireThreadPolicyReport( unsigned long DeviceIndex, AIOThreadPolicyReport *report );
 PUBLIC_EXTERN AIORESULT ADC_BulkPoll( unsigned long DeviceIndex, unsigned long *BytesLeft     );
 
 /* FastScan Functions */
@@ -702,6 +968,14 @@ PUBLIC_EXTERN unsigned char AIOUSB_GetRegister( ADConfigBlock *cb, unsigned int
 
 /* #include "AIOUSB_DAC.h" */
 
+typedef struct dac_stream_requests {
+    unsigned long (*set_clock)( AIOUSBDevice *device, USBDevice *usb, unsigned long divisor );
+    unsigned long (*start)( AIOUSBDevice *device, USBDevice *usb );
+    unsigned long (*stop)( AIOUSBDevice *device, USBDevice *usb, AIOUSB_BOOL reset );
+} DACStreamRequests;
+
+PUBLIC_EXTERN unsigned long DACOutputSetStreamRequests( const DACStreamRequests *requests );
+
 PUBLIC_EXTERN unsigned long DACDirect(unsigned long DeviceIndex,unsigned short Channel,unsigned short Value );
 PUBLIC_EXTERN unsigned long DACMultiDirect(unsigned long DeviceIndex,unsigned short *pDACData,unsigned long DACDataCount );
 PUBLIC_EXTERN unsigned long DACSetBoardRange(unsigned long DeviceIndex,unsigned long RangeCode );
@@ -728,6 +1002,10 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceInitializeWithProductID( AIOUSBDevice *dev
 PUBLIC_EXTERN USBDevice *AIOUSBDeviceGetUSBHandle( AIOUSBDevice *dev );
 PUBLIC_EXTERN USBDevice *AIOUSBDeviceGetUSBHandleFromDeviceIndex( unsigned long DeviceIndex, AIOUSBDevice **dev, AIORESULT *res );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetUSBHandle( AIOUSBDevice *dev, USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceOpen( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceInitLock( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceLock( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *dev );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetADCConfigBlock( AIOUSBDevice *dev, ADCConfigBlock *conf );
 PUBLIC_EXTERN ADCConfigBlock * AIOUSBDeviceGetADCConfigBlock( AIOUSBDevice *dev );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceCopyADCConfigBlock( AIOUSBDevice *dev, ADCConfigBlock *newone );
@@ -740,6 +1018,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetDiscardFirstSample( AIOUSBDevice *devic
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceSetTimeout( AIOUSBDevice *device, unsigned timeout );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetTimeout( AIOUSBDevice *device );
 PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceWriteADCConfig( AIOUSBDevice *device, ADCConfigBlock *config );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetIOStats( AIOUSBDevice *device, USBDeviceIOStats *stats );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceResetIOStats( AIOUSBDevice *device );
 
 /* #include "AIOUSB_Properties.h" */
 
@@ -784,12 +1064,19 @@ PUBLIC_EXTERN void DeleteUSBDevice( USBDevice *dev );
 PUBLIC_EXTERN USBDevice *CopyUSBDevice( USBDevice *usb );
 PUBLIC_EXTERN AIOEither InitializeUSBDevice( USBDevice *usb, LIBUSBArgs *args );
 PUBLIC_EXTERN AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs , int *size );
+PUBLIC_EXTERN AIORET_TYPE USBDeviceOpen( USBDevice *usb );
 PUBLIC_EXTERN void DeleteUSBDevices( USBDevice *devs);
 PUBLIC_EXTERN int USBDeviceClose( USBDevice *dev );
 
 PUBLIC_EXTERN int USBDeviceGetIdProduct( USBDevice *device );
 PUBLIC_EXTERN int USBDeviceFetchADCConfigBlock( USBDevice *device, ADCConfigBlock *config );
 PUBLIC_EXTERN int USBDevicePutADCConfigBlock( USBDevice *usb, ADCConfigBlock *configBlock );
+PUBLIC_EXTERN int USBDeviceWriteADCConfigRegisters( USBDevice *usb, unsigned char *registers, unsigned long size, unsigned timeout );
+PUBLIC_EXTERN void USBDeviceInvalidateADCConfigCache( USBDevice *usb );
+PUBLIC_EXTERN unsigned long USBDeviceGetADCConfigGeneration( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBDeviceGetIOStats( USBDevice *usb, USBDeviceIOStats *stats );
+PUBLIC_EXTERN AIORET_TYPE USBDeviceResetIOStats( USBDevice *usb );
+PUBLIC_EXTERN char *USBDeviceIOStatsToJSON( const USBDeviceIOStats *stats );
 
 PUBLIC_EXTERN int usb_control_transfer(USBDevice *dev_handle,
                          uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
@@ -806,6 +1093,264 @@ PUBLIC_EXTERN int usb_reset_device( USBDevice *usb );
 PUBLIC_EXTERN libusb_device_handle *get_usb_device( USBDevice *dev );
 PUBLIC_EXTERN libusb_device_handle *USBDeviceGetUSBDeviceHandle( USBDevice *usb );
 
+/* #include "USBCapture.h" */
+
+
+typedef enum {
+    USB_CAPTURE_CONTROL = 1,
+    USB_CAPTURE_BULK    = 2
+} USBCaptureKind;
+
+typedef enum {
+    USB_REPLAY_MAX_SPEED       = 0,     /**< Answer every transfer as soon as it is made */
+    USB_REPLAY_RECORDED_TIMING = 1,     /**< Take as long over each transfer as the device did */
+    USB_REPLAY_LOOP            = 2      /**< Start over from the first record once the capture runs out */
+} USBReplayFlags;
+
+/**
+ * @brief Start of a capture file. Everything in the file is in host byte
+ * order.
+ */
+typedef struct usb_capture_file_header {
+    char magic[8];                      /**< USB_CAPTURE_MAGIC */
+    uint32_t version;
+    uint16_t idVendor;
+    uint16_t idProduct;                 /**< Product the capture was taken from */
+} USBCaptureFileHeader;
+
+/**
+ * @brief One transfer. data_length bytes of payload follow the record:
+ * what the device sent for IN transfers and what the host sent for OUT
+ * transfers.
+ */
+typedef struct usb_capture_record {
+    uint8_t kind;                       /**< USBCaptureKind */
+    uint8_t request_type;               /**< bmRequestType, or the endpoint of a bulk transfer */
+    uint8_t bRequest;
+    uint8_t reserved;
+    uint16_t wValue;
+    uint16_t wIndex;
+    int32_t length;                     /**< Bytes asked for */
+    int32_t result;                     /**< What the transfer returned */
+    int32_t actual_length;              /**< Bytes a bulk transfer moved */
+    uint32_t data_length;
+    uint64_t start_ns;                  /**< Since the capture was started */
+    uint64_t duration_ns;
+} USBCaptureRecord;
+
+/**
+ * @brief Writes every control and bulk transfer made through a USBDevice
+ * to a capture file. The device's transfer functions are wrapped for as
+ * long as the capture exists.
+ */
+typedef struct usb_capture {
+    FILE *file;
+    pthread_mutex_t lock;
+    struct timespec start;
+    USBDevice *usb;
+    int (*control_transfer)( USBDevice *usbdev, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout );
+    int (*bulk_transfer)( USBDevice *usbdev, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout );
+    uint64_t num_records;
+} USBCapture;
+
+PUBLIC_EXTERN USBCapture *NewUSBCapture( const char *fname, USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE DeleteUSBCapture( USBCapture *cap );
+PUBLIC_EXTERN AIORET_TYPE USBCaptureGetNumberRecords( USBCapture *cap );
+
+PUBLIC_EXTERN USBDevice *NewUSBReplayDevice( const char *fname, int flags );
+PUBLIC_EXTERN AIORET_TYPE DeleteUSBReplayDevice( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBReplayRewind( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBReplayGetNumberReplayed( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBReplayGetNumberMismatches( USBDevice *usb );
+
+/* #include "USBSimulator.h" */
+
+typedef enum {
+    AIO_SIM_SINE  = 0,
+    AIO_SIM_NOISE = 1,                  /**< Gaussian noise with a deviation of amplitude */
+    AIO_SIM_STEP  = 2,                  /**< Square wave between offset + amplitude and offset - amplitude */
+    AIO_SIM_RAMP  = 3                   /**< Sawtooth from offset - amplitude to offset + amplitude */
+} AIOSimWaveformType;
+
+/**
+ * @brief What a simulated channel sees, in volts. noise is the deviation
+ * of gaussian noise added on top of every waveform.
+ */
+typedef struct aio_sim_waveform {
+    AIOSimWaveformType type;
+    double frequency;
+    double amplitude;
+    double offset;
+    double noise;
+} AIOSimWaveform;
+
+PUBLIC_EXTERN USBDevice *NewUSBSimulatorDevice( unsigned long productID );
+PUBLIC_EXTERN AIORET_TYPE DeleteUSBSimulatorDevice( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorSetWaveform( USBDevice *usb, int channel, const AIOSimWaveform *wave );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorParseWaveform( const char *str, AIOSimWaveform *wave );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorGetScanClock( USBDevice *usb );
+PUBLIC_EXTERN AIORET_TYPE USBSimulatorAddDevices( USBDevice **devs, int *size );
+
+/* #include "AIOHistogram.h" */
+
+/**
+ * @brief Counts of 64 bit values in buckets that are exact below 16 and
+ * then split every power of two into 16, so any value is placed to
+ * within 1/16th of itself. Recording is lock free and may run while
+ * another thread takes a snapshot; a snapshot can then be a record or
+ * two out of step between count and buckets.
+ */
+typedef struct aio_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[AIO_HISTOGRAM_NUM_BUCKETS];
+} AIOHistogram;
+
+typedef enum {
+    AIO_TRANSFER_BULK_ACQUIRE = 0,      /**< ADC_BulkAcquire() worker */
+    AIO_TRANSFER_CONTINUOUS,            /**< AIOContinuousBuf workers */
+    AIO_TRANSFER_DIO_STREAM,            /**< DIO_StreamFrame() */
+    AIO_TRANSFER_NUM_PATHS
+} AIOTransferPath;
+
+/**
+ * @brief What the bulk transfers of one path looked like
+ */
+typedef struct aio_transfer_histograms {
+    AIOHistogram latency_ns;            /**< Time spent in each bulk transfer */
+    AIOHistogram bytes;                 /**< Bytes each transfer moved */
+    AIOHistogram gap_ns;                /**< From the end of one transfer to the start of the next */
+    AIOHistogram fifo_fill;             /**< Bytes waiting in the fifo when a transfer completed */
+} AIOTransferHistograms;
+
+PUBLIC_EXTERN void AIOHistogramReset( AIOHistogram *hist );
+PUBLIC_EXTERN void AIOHistogramRecord( AIOHistogram *hist, uint64_t value );
+PUBLIC_EXTERN unsigned AIOHistogramBucketIndex( uint64_t value );
+PUBLIC_EXTERN uint64_t AIOHistogramBucketLowerBound( unsigned index );
+PUBLIC_EXTERN uint64_t AIOHistogramPercentile( const AIOHistogram *hist, double percentile );
+PUBLIC_EXTERN double AIOHistogramMean( const AIOHistogram *hist );
+PUBLIC_EXTERN char *AIOHistogramToJSON( const AIOHistogram *hist );
+
+PUBLIC_EXTERN uint64_t AIOTransferTimestamp( void );
+PUBLIC_EXTERN void AIOTransferHistogramsRecord( AIOTransferHistograms *hists, uint64_t start_ns, uint64_t end_ns, long bytes, long fifo_fill, uint64_t *last_end_ns );
+PUBLIC_EXTERN char *AIOTransferHistogramsToJSON( const AIOTransferHistograms *hists );
+
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceEnableTransferHistograms( AIOUSBDevice *dev, AIOUSB_BOOL enable );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceTransferHistogramsEnabled( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceResetTransferHistograms( AIOUSBDevice *dev );
+PUBLIC_EXTERN AIORET_TYPE AIOUSBDeviceGetTransferHistograms( AIOUSBDevice *dev, AIOTransferPath path, AIOTransferHistograms *snapshot );
+PUBLIC_EXTERN char *AIOUSBDeviceTransferHistogramsToJSON( AIOUSBDevice *dev );
+PUBLIC_EXTERN void AIOUSBDeviceFreeTransferHistograms( AIOUSBDevice *dev );
+
+/* #include "AIODIOStream.h" */
+
+/**
+ * @brief AIODIOStream is the DIO counterpart of AIOContinuousBuf. Where
+ * DIO_StreamFrame() moves one frame with one blocking bulk transfer at a
+ * time, a stream keeps several bulk transfers queued on the device from a
+ * background thread so the bus stays busy, and hands points to and from the
+ * application through a fifo.
+ *
+ * - Create it with NewAIODIOStream() for reading or writing
+ * - Optionally pick the number of transfers in flight and their size with
+ *   AIODIOStreamSetTransfers()
+ * - Set the clocks with DIO_StreamSetClocks() and call AIODIOStreamStart()
+ * - Consume points with AIODIOStreamRead() or produce them with
+ *   AIODIOStreamWrite() while the stream runs
+ * - AIODIOStreamStop() ends it, optionally letting a write stream drain
+ */
+typedef struct aio_dio_stream {
+    unsigned long DeviceIndex;
+    AIOUSB_BOOL is_read;
+    AIOFifoCounts *fifo;                /**< Points waiting for the application (read) or the device (write) */
+    unsigned depth;                     /**< Bulk transfers kept in flight, 0 moves one transfer at a time */
+    unsigned transfer_size;             /**< Bytes per bulk transfer, a multiple of 512 */
+    unsigned timeout;                   /**< Milliseconds one bulk transfer may take */
+    pthread_t worker;
+    volatile THREAD_STATUS status;      /**< NOT_STARTED, RUNNING, TERMINATED or TERMINATED_OVERRUN */
+    volatile AIOUSB_BOOL draining;      /**< Write streams: send what is left in the fifo, then stop */
+    AIOUSB_BOOL opened;                 /**< Start opened the device for streaming, so Stop closes it */
+    AIORET_TYPE exitcode;
+    volatile uint64_t bytes_transferred;
+    volatile uint64_t underruns;        /**< Times a write stream had nothing to send */
+} AIODIOStream;
+
+PUBLIC_EXTERN AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIOUSB_BOOL is_read, unsigned points );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOStream( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamSetTransfers( AIODIOStream *stream, unsigned depth, unsigned transfer_size );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamSetTimeout( AIODIOStream *stream, unsigned timeout );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamStart( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamStop( AIODIOStream *stream, AIOUSB_BOOL drain );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *points, unsigned maxpoints );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, unsigned short *points, unsigned npoints );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamPointsAvailable( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetStatus( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetExitCode( AIODIOStream *stream );
+
+/* #include "AIODIOWatch.h" */
+
+/**
+ * @brief One input that changed between two polls
+ */
+typedef struct aio_dio_edge {
+    uint64_t timestamp_ns;              /**< CLOCK_MONOTONIC, the middle of the poll that saw it */
+    unsigned bit;
+    AIOUSB_BOOL rising;
+} AIODIOEdge;
+
+/**
+ * @brief AIODIOWatch reads the inputs of a device with DIO_ReadAll() at a
+ * fixed rate from one thread, so any number of threads can follow them
+ * without each paying for a control transfer.
+ *
+ * - AIODIOWatchReadAll() returns the latest image without touching USB
+ * - Every change between two polls becomes an AIODIOEdge in a ring of the
+ *   last capacity edges. Each AIODIOWatchSubscribe() gets its own cursor
+ *   into it; the poller never waits for subscribers, so one that falls
+ *   more than capacity edges behind loses the oldest and is told how many.
+ */
+typedef struct aio_dio_watch {
+    unsigned long DeviceIndex;
+    volatile unsigned period_us;
+    unsigned nbytes;                    /**< DIOBytes of the device */
+    pthread_t worker;
+    volatile THREAD_STATUS status;      /**< NOT_STARTED, RUNNING or TERMINATED */
+    AIORET_TYPE exitcode;
+    unsigned char *image;               /**< Latest inputs, consistent when image_seq is even */
+    unsigned char *scratch;             /**< What the poll in progress read */
+    uint64_t image_ns;
+    volatile uint64_t image_seq;        /**< Odd while the worker rewrites image, 0 before the first poll */
+    AIODIOEdge *edges;
+    unsigned capacity;                  /**< Size of edges, a power of two */
+    volatile uint64_t head;             /**< Edges published so far */
+    volatile uint64_t polls;
+    volatile uint64_t late_polls;       /**< Polls started more than a period after the one before */
+} AIODIOWatch;
+
+/**
+ * @brief A consumer's place in the edges of an AIODIOWatch
+ */
+typedef struct aio_dio_watch_subscriber {
+    AIODIOWatch *watch;
+    uint64_t next;                      /**< Edge to hand out next */
+    uint64_t lost;                      /**< Edges overwritten before they were handed out */
+} AIODIOWatchSubscriber;
+
+PUBLIC_EXTERN AIODIOWatch *NewAIODIOWatch( unsigned long DeviceIndex, unsigned period_us, unsigned capacity );
+PUBLIC_EXTERN AIORET_TYPE DeleteAIODIOWatch( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchSetPeriod( AIODIOWatch *watch, unsigned period_us );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchStart( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchStop( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchGetStatus( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchGetExitCode( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchReadAll( AIODIOWatch *watch, void *buf, uint64_t *timestamp_ns );
+PUBLIC_EXTERN AIODIOWatchSubscriber *AIODIOWatchSubscribe( AIODIOWatch *watch );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchUnsubscribe( AIODIOWatchSubscriber *sub );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchNextEdges( AIODIOWatchSubscriber *sub, AIODIOEdge *edges, unsigned maxedges );
+PUBLIC_EXTERN AIORET_TYPE AIODIOWatchGetLost( AIODIOWatchSubscriber *sub );
+
 /* #include "AIOCommandLine.h" */
 
 PUBLIC_EXTERN AIOCommandLineOptions *NewDefaultAIOCommandLineOptions();
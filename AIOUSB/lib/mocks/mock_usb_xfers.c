@@ -77,6 +77,7 @@ AIORET_TYPE AddAllACCESUSBDevices( libusb_device **deviceList , USBDevice **devs
                     *size += 1;
                     *devs = (USBDevice*)realloc( *devs, (*size )*(sizeof(USBDevice)));
                     USBDevice *usb = &(*devs)[*size-1];
+                    memset( usb, 0, sizeof(USBDevice) );
                     usb->debug = AIOUSB_FALSE;
                     usb->usb_control_transfer  = mock_usb_control_transfer;
                     usb->usb_bulk_transfer     = mock_usb_bulk_transfer;
@@ -1,4 +1,5 @@
 #include "AIOCommandLine.h"
+#include "AIOConversionPlan.h"
 #include "gtest/gtest.h"
 
 
@@ -31,6 +32,100 @@ TEST(ADCFunctions, CanDetermineCalibration )
 }
 
 
+static unsigned char fake_config[AD_MAX_CONFIG_REGISTERS];
+static unsigned block_samples, fake_triggers, fake_channels, fake_samples_per_channel;
+
+static int fake_adc_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                      uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    switch ( bRequest ) {
+    case AUR_ADC_GET_CONFIG:
+        memcpy( data, fake_config, wLength );
+        break;
+    case AUR_ADC_SET_CONFIG:
+        memcpy( fake_config, data, wLength );
+        break;
+    case AUR_START_ACQUIRING_BLOCK:
+        block_samples = ( wValue << 16 ) | wIndex;
+        break;
+    case AUR_ADC_IMMEDIATE:
+        fake_triggers ++;
+        break;
+    default:
+        memset( data, 0, wLength );
+    }
+    return wLength;
+}
+
+/**
+ * Sample k of channel c in scan s reads 1000*(s+1) + 10*c, except the
+ * primary sample, which is off by 500 so that averaging it in would show
+ */
+static int fake_adc_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length,
+                                   int *actual_length, unsigned int timeout )
+{
+    unsigned short *samples = (unsigned short *)data;
+    unsigned per_scan = fake_channels * fake_samples_per_channel;
+    for ( int i = 0; i < length / 2; i ++ ) {
+        unsigned scan = i / per_scan, channel = ( i % per_scan ) / fake_samples_per_channel;
+        samples[i] = 1000 * ( scan + 1 ) + 10 * channel + ( i % fake_samples_per_channel == 0 ? 500 : 0 );
+    }
+    *actual_length = length;
+    return LIBUSB_SUCCESS;
+}
+
+TEST(ADCFunctions, GetScansBatchUsesOneBlock )
+{
+    USBDevice usb;
+    AIORESULT result;
+    int numDevices = 0;
+    unsigned short counts[64*4];
+    double volts[64*4];
+    struct timespec stamps[64];
+
+    memset( &usb, 0, sizeof(usb) );
+    usb.usb_control_transfer = fake_adc_control_transfer;
+    usb.usb_bulk_transfer    = fake_adc_bulk_transfer;
+    AIODeviceTableInit();
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_AI16_16E, &usb ) );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ASSERT_TRUE( dev );
+
+    ADCConfigBlockSetScanRange( &dev->cachedConfigBlock, 2, 5 );
+    ADCConfigBlockSetOversample( &dev->cachedConfigBlock, 3 );
+    memcpy( fake_config, dev->cachedConfigBlock.registers, dev->cachedConfigBlock.size );
+    dev->discardFirstSample = AIOUSB_TRUE;
+    fake_channels = 4;
+    fake_samples_per_channel = 1 + 3 + 1;
+    fake_triggers = 0;
+
+    /* 1024 samples of buffer hold 51 scans of 20 samples */
+    AIORET_TYPE retval = ADC_GetScansBatch( 0, 64, counts, volts, stamps );
+    ASSERT_EQ( 51, retval );
+    EXPECT_EQ( 51u, fake_triggers );
+    EXPECT_EQ( 51u * 20, block_samples );
+
+    AIOConversionPlan *plan = AIOUSBDeviceGetConversionPlan( dev, &retval );
+    ASSERT_TRUE( plan );
+    for ( int scan = 0; scan < 51; scan ++ ) {
+        double expected[4];
+        AIOConversionPlanCountsToVolts( plan, 2, 4, &counts[scan*4], expected );
+        for ( int ch = 0; ch < 4; ch ++ ) {
+            EXPECT_EQ( 1000 * ( scan + 1 ) + 10 * ch, counts[scan*4+ch] ) << "scan=" << scan << " ch=" << ch;
+            EXPECT_EQ( expected[ch], volts[scan*4+ch] );
+        }
+        if ( scan > 0 )
+            EXPECT_LE( stamps[scan-1].tv_sec * 1000000000LL + stamps[scan-1].tv_nsec,
+                       stamps[scan].tv_sec * 1000000000LL + stamps[scan].tv_nsec );
+    }
+    AIOUSBDeviceReleaseConversionPlan( dev, plan );
+
+    EXPECT_EQ( 3, ADCConfigBlockGetOversample( &dev->cachedConfigBlock ) ) << "User's config is put back";
+    EXPECT_EQ( 3, fake_config[AD_CONFIG_OVERSAMPLE] );
+
+    ClearAIODeviceTable( numDevices );
+}
+
 #include <unistd.h>
 #include <stdio.h>
 
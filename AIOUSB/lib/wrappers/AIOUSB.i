@@ -683,17 +683,16 @@ AIORET_TYPE DIO_StreamFrameTmp( unsigned long DeviceIndex, unsigned long FramePo
 #ifdef __cplusplus
    %extend DIOBuf {
      bool operator==( DIOBuf *b ) {
-       int equiv = 1;
        if ( b->size != $self->size )
          return 0;
-       for ( unsigned i = 0; i < b->size; i ++ )
-           equiv &= ( $self->buffer[i] == b->buffer[i] );
-       
-       return equiv == 1;
+       /* Bits past size are kept 0, so the packed bytes compare as they are */
+       return memcmp( DIOBufRawBytes( $self ), DIOBufRawBytes( b ), DIOBUF_NUM_BYTES( $self->size ) ) == 0;
      }
      
      bool operator!=( DIOBuf *b ) {
-    return !($self == b);
+       if ( b->size != $self->size )
+         return 1;
+       return memcmp( DIOBufRawBytes( $self ), DIOBufRawBytes( b ), DIOBUF_NUM_BYTES( $self->size ) ) != 0;
      }
    }
 #endif
@@ -0,0 +1,122 @@
+/**
+ * @file   counts_converter_benchmark.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Measures AIOCountsConverter throughput for each conversion kernel
+ *
+ * No hardware is needed. For a range of channel and oversample counts
+ * a block of synthetic counts is pushed through AIOCountsConverterConvertFifo
+ * the same way the continuous acquisition worker does it, once with the
+ * original per sample loop and once with every vector kernel the CPU
+ * supports. The output is one line per run:
+ *
+ * @verbatim
+shell> ./counts_converter_benchmark [total_counts]
+channels,oversamples,kernel,msamples_per_sec,speedup
+ @endverbatim
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <aiousb.h>
+#include "AIOCountsConverter.h"
+#include "AIOFifo.h"
+
+#define BLOCK_COUNTS ( 64 * 1024 )
+
+static double now_seconds( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @return counts converted per second, or a negative value on error
+ */
+static double run_once( AIOCountsConverterKernel kernel, unsigned num_channels, unsigned num_oversamples,
+                        unsigned total_counts, unsigned short *counts, double *volts )
+{
+    AIOGainRange ranges[16];
+    AIOFifoCounts *infifo = NewAIOFifoCounts( BLOCK_COUNTS + 1 );
+    AIOFifoVolts *outfifo = NewAIOFifoVolts( BLOCK_COUNTS + 1 );
+    AIOCountsConverter *cc;
+    double start, elapsed;
+    unsigned done = 0;
+
+    for ( int i = 0; i < 16; i ++ ) {
+        ranges[i].min = -10.0;
+        ranges[i].max = 10.0;
+    }
+    cc = NewAIOCountsConverter( num_channels, ranges, num_oversamples, sizeof(unsigned short) );
+    if ( !cc || !infifo || !outfifo || AIOCountsConverterSetKernel( cc, kernel ) != AIOUSB_SUCCESS )
+        return -1;
+
+    start = now_seconds();
+    while ( done < total_counts ) {
+        unsigned n = ( total_counts - done < BLOCK_COUNTS ? total_counts - done : BLOCK_COUNTS );
+        AIORET_TYPE nvolts;
+        infifo->PushN( infifo, counts, n );
+        nvolts = cc->ConvertFifo( cc, outfifo, infifo, n );
+        if ( nvolts < 0 )
+            return -1;
+        outfifo->PopN( outfifo, volts, (unsigned)nvolts );
+        done += n;
+    }
+    elapsed = now_seconds() - start;
+
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+
+    return total_counts / elapsed;
+}
+
+int main( int argc, char *argv[] )
+{
+    static const unsigned channels[]    = { 1, 2, 4, 8, 16 };
+    static const unsigned oversamples[] = { 0, 1, 3, 7, 15, 63, 255 };
+    static const AIOCountsConverterKernel kernels[] = { AIO_CC_KERNEL_PER_SAMPLE,
+                                                        AIO_CC_KERNEL_SCALAR,
+                                                        AIO_CC_KERNEL_SSE2,
+                                                        AIO_CC_KERNEL_AVX2 };
+    unsigned total_counts = ( argc > 1 ? (unsigned)strtoul( argv[1], NULL, 0 ) : 16*1024*1024 );
+    unsigned short *counts = (unsigned short *)malloc( BLOCK_COUNTS * sizeof(unsigned short) );
+    double *volts = (double *)malloc( BLOCK_COUNTS * sizeof(double) );
+    AIOCountsConverter *probe = NewAIOCountsConverter( 1, NULL, 0, sizeof(unsigned short) );
+
+    if ( !counts || !volts || !probe ) {
+        fprintf(stderr,"Unable to allocate benchmark buffers\n");
+        exit(1);
+    }
+    for ( unsigned i = 0; i < BLOCK_COUNTS; i ++ )
+        counts[i] = (unsigned short)( i * 2654435761u >> 16 );
+
+    printf("channels,oversamples,kernel,msamples_per_sec,speedup\n");
+    for ( size_t c = 0; c < sizeof(channels)/sizeof(channels[0]); c ++ ) {
+        for ( size_t o = 0; o < sizeof(oversamples)/sizeof(oversamples[0]); o ++ ) {
+            double baseline = 0;
+            for ( size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k ++ ) {
+                double rate;
+                if ( AIOCountsConverterSetKernel( probe, kernels[k] ) != AIOUSB_SUCCESS )
+                    continue;
+                rate = run_once( kernels[k], channels[c], oversamples[o], total_counts, counts, volts );
+                if ( rate < 0 ) {
+                    fprintf(stderr,"Conversion failed for kernel %s\n", AIOCountsConverterKernelName( kernels[k] ));
+                    exit(1);
+                }
+                if ( kernels[k] == AIO_CC_KERNEL_PER_SAMPLE )
+                    baseline = rate;
+                printf("%u,%u,%s,%.2f,%.2f\n", channels[c], oversamples[o],
+                       AIOCountsConverterKernelName( kernels[k] ), rate / 1e6, rate / baseline );
+            }
+        }
+    }
+
+    DeleteAIOCountsConverter( probe );
+    free(counts);
+    free(volts);
+    return 0;
+}
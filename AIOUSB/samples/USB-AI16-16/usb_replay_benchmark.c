@@ -0,0 +1,130 @@
+/**
+ * @file   usb_replay_benchmark.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Records a continuous acquisition from a board and replays it without one
+ *
+ * "record" runs a continuous acquisition of all 16 channels on the first
+ * analog input board and captures its USB traffic with NewUSBCapture().
+ * "replay" runs the same acquisition against NewUSBReplayDevice() instead,
+ * so the library, from AIOContinuousBuf down to usb_bulk_transfer, can be
+ * benchmarked on machines with no hardware. With "timed" each transfer
+ * takes as long as it did on the board, otherwise the capture is replayed
+ * as fast as the library can take it. The output is one line per run:
+ *
+ * @verbatim
+shell> ./usb_replay_benchmark record capture.aiocap [num_scans] [clock_hz]
+shell> ./usb_replay_benchmark replay capture.aiocap [num_scans] [clock_hz] [timed]
+mode,scans,seconds,scans_per_sec,replayed,mismatches
+ @endverbatim
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <aiousb.h>
+#include "AIOContinuousBuffer.h"
+#include "USBCapture.h"
+
+#define NUM_CHANNELS 16
+
+static double now_seconds( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @return scans read, or a negative error
+ */
+static long acquire( unsigned long DeviceIndex, unsigned num_scans, unsigned clock_hz )
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( DeviceIndex, num_scans, NUM_CHANNELS );
+    unsigned short *counts = (unsigned short *)malloc( num_scans * NUM_CHANNELS * sizeof(unsigned short) );
+    long read = 0;
+
+    if ( !buf || !counts )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    AIOContinuousBufInitConfiguration( buf );
+    AIOContinuousBufSetOversample( buf, 0 );
+    AIOContinuousBufSetStartAndEndChannel( buf, 0, NUM_CHANNELS - 1 );
+    AIOContinuousBufSetAllGainCodeAndDiffMode( buf, AD_GAIN_CODE_0_10V, AIOUSB_FALSE );
+    AIOContinuousBufSaveConfig( buf );
+    AIOContinuousBufSetClock( buf, clock_hz );
+    AIOContinuousBufInitiateCallbackAcquisition( buf );
+
+    while ( read < (long)num_scans ) {
+        AIORET_TYPE available = AIOContinuousBufCountScansAvailable( buf );
+        if ( available <= 0 ) {
+            if ( AIOContinuousBufGetRunStatus( buf ) != RUNNING )
+                break;
+            AIOContinuousBufWaitForSamples( buf, NUM_CHANNELS, 100 );
+            continue;
+        }
+        AIORET_TYPE scans = AIOContinuousBufReadIntegerScanCounts( buf, counts, num_scans * NUM_CHANNELS,
+                                                                   MIN( available, num_scans - read ) * NUM_CHANNELS );
+        if ( scans < 0 ) {
+            read = scans;
+            break;
+        }
+        read += scans;
+    }
+
+    AIOContinuousBufEnd( buf );
+    DeleteAIOContinuousBuf( buf );
+    free( counts );
+    return read;
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned num_scans = ( argc > 3 ? atoi( argv[3] ) : 100000 );
+    unsigned clock_hz = ( argc > 4 ? atoi( argv[4] ) : 100000 );
+    USBCapture *cap = NULL;
+    USBDevice *usb;
+    AIORESULT result = AIOUSB_SUCCESS;
+    double start, elapsed;
+    long scans;
+
+    if ( argc < 3 || ( strcmp( argv[1], "record" ) && strcmp( argv[1], "replay" ) ) ) {
+        fprintf(stderr,"Usage: %s record|replay capture_file [num_scans] [clock_hz] [timed]\n", argv[0] );
+        return 1;
+    }
+
+    AIOUSB_Init();
+    if ( strcmp( argv[1], "record" ) == 0 ) {
+        if ( !( usb = AIODeviceTableGetUSBDeviceAtIndex( 0, &result ) ) ) {
+            fprintf(stderr,"No board to record from: %d\n", (int)result );
+            return 1;
+        }
+        if ( !( cap = NewUSBCapture( argv[2], usb ) ) )
+            return 1;
+    } else {
+        int numDevices = 0;
+        usb = NewUSBReplayDevice( argv[2], ( argc > 5 && strcmp( argv[5], "timed" ) == 0 ?
+                                             USB_REPLAY_RECORDED_TIMING : USB_REPLAY_MAX_SPEED ) );
+        if ( !usb )
+            return 1;
+        AIODeviceTableInit();
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USBDeviceGetIdProduct( usb ), usb );
+    }
+
+    start = now_seconds();
+    scans = acquire( 0, num_scans, clock_hz );
+    elapsed = now_seconds() - start;
+
+    printf("mode,scans,seconds,scans_per_sec,replayed,mismatches\n");
+    printf("%s,%ld,%.3f,%.0f,%ld,%ld\n", argv[1], scans, elapsed, scans / elapsed,
+           ( cap ? (long)USBCaptureGetNumberRecords( cap ) : (long)USBReplayGetNumberReplayed( usb ) ),
+           ( cap ? 0L : (long)USBReplayGetNumberMismatches( usb ) ) );
+
+    if ( cap )
+        DeleteUSBCapture( cap );
+    AIOUSB_Exit();
+
+    return ( scans < 0 ? 1 : 0 );
+}
@@ -0,0 +1,136 @@
+/**
+ * @file   device_lock_benchmark.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Measures how immediate DIO calls scale with threads, one device per thread
+ *
+ * No hardware is needed. Each thread drives its own mock USB-DIO-32 whose
+ * control transfers sleep for a fixed time instead of going to the bus, and
+ * calls DIO_Write1() on it as fast as it can. Every thread count is run
+ * twice: once with each call wrapped in AIOUSB_Lock(), which is how the
+ * library serialized every device before it had per device locks, and once
+ * with the per device locks alone. The output is one line per run:
+ *
+ * @verbatim
+shell> ./device_lock_benchmark [max_threads] [transfer_ns] [seconds]
+locking,threads,calls_per_sec,speedup
+ @endverbatim
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <aiousb.h>
+#include "AIODeviceTable.h"
+#include "USBDevice.h"
+
+static long transfer_ns = 50000;
+static volatile int running;
+
+typedef struct {
+    unsigned long DeviceIndex;
+    int global;
+    unsigned long calls;
+} Worker;
+
+static double now_seconds( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Stands in for the time a control transfer spends on the bus */
+static int mock_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue,
+                                  uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    struct timespec wait = { transfer_ns / 1000000000L, transfer_ns % 1000000000L };
+    nanosleep( &wait, NULL );
+    return wLength;
+}
+
+static void *worker( void *object )
+{
+    Worker *w = (Worker *)object;
+    unsigned long calls = 0;
+
+    while ( running ) {
+        if ( w->global )
+            AIOUSB_Lock();
+        DIO_Write1( w->DeviceIndex, calls % 32, calls & 1 );
+        if ( w->global )
+            AIOUSB_UnLock();
+        calls ++;
+    }
+    w->calls = calls;
+    return NULL;
+}
+
+static double run_once( int num_threads, int global, double seconds )
+{
+    pthread_t threads[ MAX_USB_DEVICES ];
+    Worker workers[ MAX_USB_DEVICES ];
+    unsigned long calls = 0;
+    double start, elapsed;
+
+    running = 1;
+    start = now_seconds();
+    for ( int i = 0; i < num_threads; i ++ ) {
+        workers[i].DeviceIndex = i;
+        workers[i].global = global;
+        workers[i].calls = 0;
+        pthread_create( &threads[i], NULL, worker, &workers[i] );
+    }
+    while ( now_seconds() - start < seconds )
+        usleep( 1000 );
+    running = 0;
+    for ( int i = 0; i < num_threads; i ++ ) {
+        pthread_join( threads[i], NULL );
+        calls += workers[i].calls;
+    }
+    elapsed = now_seconds() - start;
+
+    return calls / elapsed;
+}
+
+int main( int argc, char *argv[] )
+{
+    int max_threads = ( argc > 1 ? atoi( argv[1] ) : 8 );
+    double seconds = ( argc > 3 ? atof( argv[3] ) : 0.5 );
+    USBDevice usb[ MAX_USB_DEVICES ];
+    int numDevices = 0;
+
+    if ( argc > 2 )
+        transfer_ns = atol( argv[2] );
+    if ( max_threads < 1 || max_threads > MAX_USB_DEVICES ) {
+        fprintf(stderr,"max_threads must be between 1 and %d\n", MAX_USB_DEVICES );
+        return 1;
+    }
+
+    AIODeviceTableInit();
+    memset( usb, 0, sizeof(usb) );
+    for ( int i = 0; i < max_threads; i ++ ) {
+        usb[i].usb_control_transfer = mock_control_transfer;
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numDevices, USB_DIO_32, &usb[i] );
+    }
+
+    printf("locking,threads,calls_per_sec,speedup\n");
+    for ( int global = 1; global >= 0; global -- ) {
+        double single = 0;
+        for ( int num_threads = 1; num_threads <= max_threads; num_threads *= 2 ) {
+            double rate = run_once( num_threads, global, seconds );
+            if ( num_threads == 1 )
+                single = rate;
+            printf("%s,%d,%.0f,%.2f\n", ( global ? "global" : "per_device" ), num_threads, rate, rate / single );
+        }
+    }
+
+    for ( int i = 0; i < numDevices; i ++ )
+        deviceTable[i].usb_device = NULL;
+
+    return 0;
+}